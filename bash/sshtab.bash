@@ -32,7 +32,7 @@ __sshtab_restore_guard() {
 
 __sshtab_is_subcommand() {
   case "$1" in
-    record|list|pick|pick-command|alias|delete|exec|add)
+    record|list|pick|pick-command|alias|delete|prune|search|export|import|warm|probe|fanout|prefetch|init|exec|add)
       return 0
       ;;
     *)
@@ -41,9 +41,9 @@ __sshtab_is_subcommand() {
   esac
 }
 
+# $1 is the `complete -p ssh` output that sshtab is about to replace.
 __sshtab_detect_prev_completion() {
-  local spec
-  spec=$(complete -p ssh 2>/dev/null) || return
+  local spec=$1
   if [[ $spec =~ -F[[:space:]]+([_a-zA-Z0-9]+) ]]; then
     SSHTAB_PREV_COMPLETION_FUNC="${BASH_REMATCH[1]}"
   fi
@@ -60,12 +60,77 @@ __sshtab_call_prev_completion() {
 SSHTAB_REAL_SSH=""
 SSHTAB_SSH_PROXY_ENABLED=0
 SSHTAB_PREHOOK_ENABLED=1
+# debug: a DEBUG trap inspects every simple command. history: the prompt hook
+# reads the newest history entry once per command line. auto: debug unless a
+# DEBUG trap is already installed, then history.
+SSHTAB_CAPTURE_MODE=${SSHTAB_CAPTURE_MODE:-auto}
+SSHTAB_CAPTURE_ACTIVE=""
 SSHTAB_COMPLETION_MODE=${SSHTAB_COMPLETION_MODE:-fallback}
 SSHTAB_LIMIT=${SSHTAB_LIMIT:-50}
+# 1: every record/add also rebuilds the picker snapshots in the background.
+SSHTAB_PREFETCH=${SSHTAB_PREFETCH:-0}
+SSHTAB_BUILTIN_ENABLED=0
+
+# Optional loadable builtin (make builtin): record/add/pick run in-process.
+# A script from `sshtab init bash` sets __sshtab_init_builtin_so, possibly to
+# nothing when no builtin was found.
+if [[ -n ${__sshtab_init_builtin_so+x} ]]; then
+  SSHTAB_BUILTIN_SO=${SSHTAB_BUILTIN_SO:-${__sshtab_init_builtin_so}}
+else
+  SSHTAB_BUILTIN_SO=${SSHTAB_BUILTIN_SO:-${BASH_SOURCE[0]%/*}/sshtab.so}
+fi
+if [[ -f ${SSHTAB_BUILTIN_SO} ]] && enable -f "${SSHTAB_BUILTIN_SO}" sshtab_builtin 2>/dev/null; then
+  SSHTAB_BUILTIN_ENABLED=1
+fi
+
+__sshtab_call() {
+  if [[ ${SSHTAB_BUILTIN_ENABLED} -eq 1 ]]; then
+    sshtab_builtin "$@"
+  else
+    command sshtab "$@"
+  fi
+}
+
+# Sets __sshtab_prefetch_args to the record/add options that request a
+# background snapshot rebuild, or to nothing.
+__sshtab_prefetch_opts() {
+  __sshtab_prefetch_args=()
+  if [[ ${SSHTAB_PREFETCH} -eq 1 ]]; then
+    __sshtab_prefetch_args=(--prefetch "${SSHTAB_LIMIT}")
+  fi
+}
+
+# __sshtab_capture VAR args... stores the command's stdout in VAR.
+__sshtab_capture() {
+  local __sshtab_var=$1
+  shift
+  local prev_guard=${SSHTAB_GUARD:-}
+  SSHTAB_GUARD=1
+  local rc
+  if [[ ${SSHTAB_BUILTIN_ENABLED} -eq 1 ]]; then
+    sshtab_builtin -v "$__sshtab_var" "$@"
+    rc=$?
+  else
+    local __sshtab_out
+    __sshtab_out=$(command sshtab "$@")
+    rc=$?
+    printf -v "$__sshtab_var" '%s' "$__sshtab_out"
+  fi
+  __sshtab_restore_guard "$prev_guard"
+  return $rc
+}
 
-SSHTAB_REAL_SSH=$(type -P ssh 2>/dev/null)
+# `sshtab init bash` bakes the resolved path in; it is only trusted while
+# it still points at an executable.
+if [[ -n ${__sshtab_init_ssh:-} && -x ${__sshtab_init_ssh} ]]; then
+  SSHTAB_REAL_SSH=${__sshtab_init_ssh}
+else
+  SSHTAB_REAL_SSH=$(type -P ssh 2>/dev/null)
+fi
 if [[ -n ${SSHTAB_REAL_SSH} ]]; then
   SSHTAB_SSH_PROXY_ENABLED=1
+  # sshtab exec/warm/fanout run this binary directly instead of searching PATH.
+  export SSHTAB_SSH="${SSHTAB_REAL_SSH}"
 else
   SSHTAB_SSH_PROXY_ENABLED=0
   __sshtab_warn_once SSHTAB_WARNED_SSH_PATH "sshtab: cannot resolve real ssh path; proxy disabled"
@@ -73,8 +138,32 @@ fi
 
 if [[ ${SSHTAB_SSH_PROXY_ENABLED} -eq 1 ]]; then
   ssh() {
+    __sshtab_ssh_ran=1
     local prev_guard=${SSHTAB_GUARD:-}
     SSHTAB_GUARD=1
+    if [[ ${SSHTAB_TIMING:-0} -eq 1 ]]; then
+      # sshtab waits for ssh and records it with timing, so the post hook
+      # must not record the same command again.
+      local raw="${SSHTAB_PENDING_RAW:-}"
+      unset SSHTAB_PENDING_RAW
+      if [[ -z $raw && ${SSHTAB_CAPTURE_ACTIVE} == history ]] && __sshtab_history_take &&
+        [[ $__sshtab_hist_line =~ ^ssh([[:space:]]|$) ]]; then
+        raw="$__sshtab_hist_line"
+      fi
+      local timed_args=(exec --timed)
+      if [[ -n $raw ]]; then
+        timed_args+=(--raw "$raw")
+      fi
+      if [[ $# -eq 1 && "$1" == *" "* ]]; then
+        timed_args+=("$1")
+      else
+        timed_args+=(-- "$@")
+      fi
+      command sshtab "${timed_args[@]}"
+      local rc=$?
+      __sshtab_restore_guard "$prev_guard"
+      return $rc
+    fi
     if [[ $# -eq 1 && "$1" == *" "* ]]; then
       sshtab exec "$1"
       local rc=$?
@@ -118,12 +207,109 @@ sshtab() {
   local rc=$?
   if [[ $rc -eq 0 ]]; then
     SSHTAB_GUARD=1
-    command sshtab add "$@" >/dev/null 2>&1
+    __sshtab_prefetch_opts
+    __sshtab_call add "${__sshtab_prefetch_args[@]}" "$@" >/dev/null 2>&1
     __sshtab_restore_guard "$prev_guard"
   fi
   return $rc
 }
 
+# History capture: PS0 stores HISTCMD once a line has been read and the prompt
+# hook stores it before each prompt, so a difference means bash saved a new
+# history entry for the line that just ran.
+__sshtab_ps0_mark=""
+__sshtab_ps0_hist=""
+__sshtab_prompt_hist=""
+__sshtab_ssh_ran=""
+SSHTAB_HIST_FILE=""
+
+# Sets __sshtab_hist_line to the newest history entry. history writes to a
+# file rather than a command substitution so no subshell is forked.
+__sshtab_read_history() {
+  __sshtab_hist_line=""
+  local HISTTIMEFORMAT=""
+  builtin history 1 >"${SSHTAB_HIST_FILE}" 2>/dev/null || return 1
+  IFS= read -r -d '' __sshtab_hist_line <"${SSHTAB_HIST_FILE}"
+  : >"${SSHTAB_HIST_FILE}"
+  # Drop the "%5d" entry number and the two separator columns.
+  __sshtab_hist_line=${__sshtab_hist_line#"${__sshtab_hist_line%%[![:space:]]*}"}
+  __sshtab_hist_line=${__sshtab_hist_line#"${__sshtab_hist_line%%[!0-9]*}"}
+  __sshtab_hist_line=${__sshtab_hist_line:2}
+  __sshtab_hist_line=${__sshtab_hist_line%$'\n'}
+  return 0
+}
+
+# Succeeds at most once per command line that bash added to history, leaving
+# its text in __sshtab_hist_line.
+__sshtab_history_take() {
+  local ran=${__sshtab_ps0_hist}
+  __sshtab_ps0_hist=""
+  [[ -n $ran && $ran != "${__sshtab_prompt_hist}" ]] || return 1
+  __sshtab_read_history
+}
+
+__sshtab_history_hook() {
+  # Only lines that called the ssh wrapper or follow a pick-command
+  # completion need their text, so most prompts never touch the history.
+  local wanted=${__sshtab_ssh_ran}${SSHTAB_CAPTURE_NEXT:-}
+  __sshtab_ssh_ran=""
+  if [[ -z $wanted ]]; then
+    __sshtab_ps0_hist=""
+    return
+  fi
+  __sshtab_history_take || return
+  [[ -z ${SSHTAB_GUARD:-} ]] || return
+
+  local cmd="$__sshtab_hist_line"
+  if [[ -n ${SSHTAB_CAPTURE_NEXT:-} ]]; then
+    unset SSHTAB_CAPTURE_NEXT
+    SSHTAB_PENDING_COMMAND="$cmd"
+  fi
+  if [[ $cmd =~ ^ssh([[:space:]]|$) ]]; then
+    SSHTAB_PENDING_RAW="$cmd"
+  fi
+}
+
+__sshtab_enable_history_capture() {
+  shopt -qo history || return 1
+  if [[ -z ${SSHTAB_HIST_FILE} ]]; then
+    SSHTAB_HIST_FILE=$(umask 077 && mktemp "${XDG_RUNTIME_DIR:-${TMPDIR:-/tmp}}/sshtab-hist.XXXXXX" 2>/dev/null) || return 1
+  fi
+  if [[ ${PS0:-} != *__sshtab_ps0_mark* ]]; then
+    PS0="${PS0:-}"'${__sshtab_ps0_mark:((__sshtab_ps0_hist=HISTCMD)):0}'
+  fi
+  __sshtab_ps0_hist=""
+  __sshtab_prompt_hist=$HISTCMD
+  SSHTAB_CAPTURE_ACTIVE=history
+  return 0
+}
+
+# existing is the `trap -p DEBUG` output seen at the top level.
+__sshtab_setup_capture() {
+  local existing=$1
+  if [[ $existing == *__sshtab_pre_hook* ]]; then
+    trap - DEBUG
+    existing=""
+  fi
+  if [[ ${SSHTAB_CAPTURE_MODE} == history || ( ${SSHTAB_CAPTURE_MODE} != debug && -n $existing ) ]]; then
+    if __sshtab_enable_history_capture; then
+      SSHTAB_PREHOOK_ENABLED=1
+    else
+      SSHTAB_CAPTURE_ACTIVE=off
+      SSHTAB_PREHOOK_ENABLED=0
+      __sshtab_warn_once SSHTAB_WARNED_PREHOOK_DISABLED "sshtab: shell history is off; recording skipped"
+    fi
+  elif [[ -n $existing ]]; then
+    SSHTAB_CAPTURE_ACTIVE=off
+    SSHTAB_PREHOOK_ENABLED=0
+    __sshtab_warn_once SSHTAB_WARNED_PREHOOK_DISABLED "sshtab: DEBUG trap already set; pre-hook disabled"
+  else
+    SSHTAB_CAPTURE_ACTIVE=debug
+    SSHTAB_PREHOOK_ENABLED=1
+    trap '__sshtab_pre_hook' DEBUG
+  fi
+}
+
 __sshtab_pre_hook() {
   [[ $- == *i* ]] || return
   [[ ${SSHTAB_PREHOOK_ENABLED:-1} -eq 1 ]] || return
@@ -142,6 +328,11 @@ __sshtab_pre_hook() {
 __sshtab_post_hook() {
   local ec=$?
 
+  if [[ ${SSHTAB_CAPTURE_ACTIVE} == history ]]; then
+    __sshtab_history_hook
+    __sshtab_prompt_hist=$HISTCMD
+  fi
+
   if [[ ${SSHTAB_PREHOOK_ENABLED:-1} -eq 0 ]]; then
     unset SSHTAB_CAPTURE_NEXT
     unset SSHTAB_PENDING_COMMAND
@@ -161,7 +352,8 @@ __sshtab_post_hook() {
   if [[ -n $raw ]]; then
     local prev_guard=${SSHTAB_GUARD:-}
     SSHTAB_GUARD=1
-    sshtab record --exit-code "$ec" --raw "$raw" >/dev/null 2>&1
+    __sshtab_prefetch_opts
+    __sshtab_call record --exit-code "$ec" --raw "$raw" "${__sshtab_prefetch_args[@]}" >/dev/null 2>&1
     __sshtab_restore_guard "$prev_guard"
     return
   fi
@@ -169,7 +361,8 @@ __sshtab_post_hook() {
   if [[ -n $pending_command && ! $pending_command =~ ^ssh([[:space:]]|$) ]]; then
     local prev_guard=${SSHTAB_GUARD:-}
     SSHTAB_GUARD=1
-    sshtab add "$pending_command" >/dev/null 2>&1
+    __sshtab_prefetch_opts
+    __sshtab_call add "${__sshtab_prefetch_args[@]}" "$pending_command" >/dev/null 2>&1
     __sshtab_restore_guard "$prev_guard"
   fi
 }
@@ -185,7 +378,7 @@ __sshtab_complete() {
   fi
 
   local args
-  args=$(sshtab pick --limit "${SSHTAB_LIMIT}" 2>/dev/null) || {
+  __sshtab_capture args pick --limit "${SSHTAB_LIMIT}" 2>/dev/null || {
     COMPREPLY=()
     if [[ ${SSHTAB_COMPLETION_MODE} == "fallback" ]]; then
       __sshtab_call_prev_completion
@@ -217,7 +410,7 @@ __sshtab_complete_command() {
   fi
 
   local command
-  command=$(sshtab pick-command --limit "${SSHTAB_LIMIT}" 2>/dev/null) || {
+  __sshtab_capture command pick-command --limit "${SSHTAB_LIMIT}" 2>/dev/null || {
     COMPREPLY=()
     return 0
   }
@@ -249,52 +442,46 @@ __sshtab_complete_command() {
 }
 
 if [[ $- == *i* ]]; then
-  if [[ -n $(trap -p DEBUG) ]]; then
-    SSHTAB_PREHOOK_ENABLED=0
-    __sshtab_warn_once SSHTAB_WARNED_PREHOOK_DISABLED "sshtab: DEBUG trap already set; pre-hook disabled"
-  else
-    SSHTAB_PREHOOK_ENABLED=1
-    trap '__sshtab_pre_hook' DEBUG
-  fi
-
-  if [[ $(declare -p PROMPT_COMMAND 2>/dev/null) == declare\ -a* ]]; then
-    _sshtab_has=0
+  # Sourced files and functions do not see an existing DEBUG trap, so the
+  # capture mode is chosen from PROMPT_COMMAND at the top level, once, before
+  # the first command line is read.
+  SSHTAB_CAPTURE_ACTIVE=pending
+  __sshtab_trap_probe='[[ ${SSHTAB_CAPTURE_ACTIVE} != pending ]] || __sshtab_setup_capture "$(trap -p DEBUG)"'
+
+  if [[ -n ${PROMPT_COMMAND+x} && ${PROMPT_COMMAND@a} == *a* ]]; then
+    _sshtab_pcs=()
     for _pc in "${PROMPT_COMMAND[@]}"; do
-      if [[ $_pc == "__sshtab_post_hook" ]]; then
-        _sshtab_has=1
-        break
+      if [[ $_pc != "__sshtab_post_hook" && $_pc != "${__sshtab_trap_probe}" ]]; then
+        _sshtab_pcs+=("$_pc")
       fi
     done
-    if [[ $_sshtab_has -eq 0 ]]; then
-      PROMPT_COMMAND=(__sshtab_post_hook "${PROMPT_COMMAND[@]}")
-    fi
-    unset _pc _sshtab_has
+    PROMPT_COMMAND=(__sshtab_post_hook "${__sshtab_trap_probe}" "${_sshtab_pcs[@]}")
+    unset _pc _sshtab_pcs
   else
-    if [[ ${PROMPT_COMMAND:-} != __sshtab_post_hook* ]]; then
-      _pc="${PROMPT_COMMAND:-}"
-      _pc=${_pc//__sshtab_post_hook; /}
-      _pc=${_pc//__sshtab_post_hook;/}
-      _pc=${_pc//__sshtab_post_hook /}
-      _pc=${_pc//__sshtab_post_hook/}
-      if [[ -n $_pc ]]; then
-        PROMPT_COMMAND="__sshtab_post_hook;${_pc}"
-      else
-        PROMPT_COMMAND="__sshtab_post_hook"
-      fi
-      unset _pc
+    _pc="${PROMPT_COMMAND:-}"
+    _pc=${_pc//"${__sshtab_trap_probe};"/}
+    _pc=${_pc//"${__sshtab_trap_probe}"/}
+    _pc=${_pc//__sshtab_post_hook; /}
+    _pc=${_pc//__sshtab_post_hook;/}
+    _pc=${_pc//__sshtab_post_hook /}
+    _pc=${_pc//__sshtab_post_hook/}
+    if [[ -n $_pc ]]; then
+      PROMPT_COMMAND="__sshtab_post_hook;${__sshtab_trap_probe};${_pc}"
+    else
+      PROMPT_COMMAND="__sshtab_post_hook;${__sshtab_trap_probe}"
     fi
+    unset _pc
   fi
 
-  __sshtab_spec=$(complete -p ssh 2>/dev/null)
-  if [[ ${__sshtab_spec} != *"__sshtab_complete"* ]]; then
-    __sshtab_detect_prev_completion
-    complete -F __sshtab_complete ssh
-  fi
-  unset __sshtab_spec
-
-  __sshtab_cmd_spec=$(complete -p sshtab 2>/dev/null)
-  if [[ ${__sshtab_cmd_spec} != *"__sshtab_complete_command"* ]]; then
-    complete -F __sshtab_complete_command sshtab
+  # The spec text is only captured when one exists, so a shell without an
+  # eagerly loaded ssh completion forks nothing here.
+  if complete -p ssh &>/dev/null; then
+    __sshtab_spec=$(complete -p ssh 2>/dev/null)
+    if [[ ${__sshtab_spec} != *"__sshtab_complete"* ]]; then
+      __sshtab_detect_prev_completion "${__sshtab_spec}"
+    fi
+    unset __sshtab_spec
   fi
-  unset __sshtab_cmd_spec
+  complete -F __sshtab_complete ssh
+  complete -F __sshtab_complete_command sshtab
 fi
@@ -0,0 +1,103 @@
+#!/usr/bin/env bash
+# Measures what the sshtab recording hooks add to every command an
+# interactive shell runs. A `bash -i` reads a generated script line by line,
+# so PROMPT_COMMAND and PS0 fire once per line exactly as they do at a real
+# prompt, for three setups: no snippet, the DEBUG trap capture mode and the
+# history capture mode. Reported per command line (three simple commands
+# each) and per simple command inside one loop line, best of --repeat runs.
+set -euo pipefail
+
+SCRIPT_DIR=$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)
+REPO_DIR=$(cd "${SCRIPT_DIR}/.." && pwd)
+SNIPPET=${SSHTAB_SNIPPET:-"${REPO_DIR}/bash/sshtab.bash"}
+
+LINES_N=2000
+LOOP_N=20000
+REPEAT=3
+MODES="none debug history"
+
+usage() {
+  echo "Usage: $0 [--lines N] [--loop N] [--repeat N] [--modes \"none debug history\"]" >&2
+}
+
+while [[ $# -gt 0 ]]; do
+  case "$1" in
+    --lines)
+      LINES_N=${2:?}
+      shift 2
+      ;;
+    --loop)
+      LOOP_N=${2:?}
+      shift 2
+      ;;
+    --repeat)
+      REPEAT=${2:?}
+      shift 2
+      ;;
+    --modes)
+      MODES=${2:?}
+      shift 2
+      ;;
+    *)
+      usage
+      exit 2
+      ;;
+  esac
+done
+
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "${WORK_DIR}"' EXIT
+
+# Emits the script the interactive shell reads from stdin.
+gen_input() {
+  local mode=$1
+  if [[ $mode != none ]]; then
+    printf 'SSHTAB_CAPTURE_MODE=%s\nsource %q\n' "$mode" "$SNIPPET"
+  fi
+  # The first prompt after sourcing settles the capture mode.
+  echo ':'
+  echo 'echo "active=${SSHTAB_CAPTURE_ACTIVE:-none}"'
+  echo '__b_t0=${EPOCHREALTIME/./}'
+  local i
+  for ((i = 0; i < LINES_N; i++)); do
+    echo ': one | : two; : three'
+  done
+  echo '__b_t1=${EPOCHREALTIME/./}'
+  echo "for ((__b_i = 0; __b_i < ${LOOP_N}; __b_i++)); do :; done"
+  echo '__b_t2=${EPOCHREALTIME/./}'
+  echo 'echo "lines_us=$((__b_t1 - __b_t0)) loop_us=$((__b_t2 - __b_t1))"'
+}
+
+printf '%-8s %-8s %14s %14s %16s\n' mode active "us/line" "us/simple cmd" "vs none us/line"
+base_line=""
+for mode in ${MODES}; do
+  gen_input "$mode" >"${WORK_DIR}/input"
+  lines_us=""
+  loop_us=""
+  for ((r = 0; r < REPEAT; r++)); do
+    out=$(env -i PATH="${PATH}" HOME="${WORK_DIR}" TERM=dumb \
+      XDG_DATA_HOME="${WORK_DIR}/data" HISTFILE=/dev/null PS1='' \
+      SSHTAB_BUILTIN_SO=/nonexistent \
+      bash --norc --noprofile -i <"${WORK_DIR}/input" 2>/dev/null)
+    active=$(sed -n 's/^active=//p' <<<"$out")
+    run_lines=$(sed -n 's/^lines_us=\([0-9]*\).*/\1/p' <<<"$out")
+    run_loop=$(sed -n 's/.*loop_us=\([0-9]*\).*/\1/p' <<<"$out")
+    if [[ -z $run_lines || -z $run_loop ]]; then
+      echo "bench_hooks: mode ${mode} produced no timings" >&2
+      exit 1
+    fi
+    if [[ -z $lines_us || $run_lines -lt $lines_us ]]; then
+      lines_us=$run_lines
+    fi
+    if [[ -z $loop_us || $run_loop -lt $loop_us ]]; then
+      loop_us=$run_loop
+    fi
+  done
+  per_line=$(awk -v t="$lines_us" -v n="$LINES_N" 'BEGIN { printf "%.2f", t / n }')
+  per_cmd=$(awk -v t="$loop_us" -v n="$LOOP_N" 'BEGIN { printf "%.3f", t / n }')
+  if [[ -z $base_line ]]; then
+    base_line=$per_line
+  fi
+  delta=$(awk -v a="$per_line" -v b="$base_line" 'BEGIN { printf "%+.2f", a - b }')
+  printf '%-8s %-8s %14s %14s %16s\n' "$mode" "$active" "$per_line" "$per_cmd" "$delta"
+done
@@ -0,0 +1,390 @@
+// Drives `sshtab pick` under a pseudo-terminal with a scripted key sequence
+// and reports time to first paint, keypress-to-frame latency, bytes per
+// frame and write syscalls per keypress for several list sizes and
+// terminal dimensions. Optional --max-* limits turn it into a regression
+// gate: the exit status is nonzero when any scenario exceeds them.
+
+#include "util.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <poll.h>
+#include <sstream>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Scenario {
+  size_t items = 0;
+  unsigned short rows = 0;
+  unsigned short cols = 0;
+};
+
+struct Frame {
+  size_t bytes = 0;
+  Clock::time_point last;
+};
+
+struct Result {
+  Scenario scenario;
+  double first_paint_ms = 0;
+  size_t first_paint_bytes = 0;
+  size_t keys = 0;
+  size_t frame_bytes_total = 0;
+  size_t frame_bytes_max = 0;
+  long long writes_total = 0;
+  std::vector<double> latencies_us;
+};
+
+struct Options {
+  std::string bin = "./sshtab";
+  std::vector<size_t> sizes = {10, 100, 1000};
+  std::vector<std::pair<unsigned short, unsigned short>> dims = {{24, 80}, {60, 200}};
+  int idle_ms = 30;
+  size_t max_frame_bytes = 0;
+  double max_latency_ms = 0;
+  double max_first_paint_ms = 0;
+};
+
+const int kFrameTimeoutMs = 2000;
+
+bool ParseList(const std::string& s, std::vector<size_t>* out) {
+  out->clear();
+  std::stringstream in(s);
+  std::string part;
+  while (std::getline(in, part, ',')) {
+    char* end = nullptr;
+    unsigned long long v = std::strtoull(part.c_str(), &end, 10);
+    if (part.empty() || *end != '\0' || v == 0) {
+      return false;
+    }
+    out->push_back(static_cast<size_t>(v));
+  }
+  return !out->empty();
+}
+
+bool ParseDims(const std::string& s, std::vector<std::pair<unsigned short, unsigned short>>* out) {
+  out->clear();
+  std::stringstream in(s);
+  std::string part;
+  while (std::getline(in, part, ',')) {
+    unsigned cols = 0;
+    unsigned rows = 0;
+    char x = 0;
+    std::istringstream dim(part);
+    if (!(dim >> cols >> x >> rows) || x != 'x' || cols == 0 || rows == 0 || cols > 1000 ||
+        rows > 1000) {
+      return false;
+    }
+    out->emplace_back(static_cast<unsigned short>(rows), static_cast<unsigned short>(cols));
+  }
+  return !out->empty();
+}
+
+std::string MakeTempDir() {
+  std::string templ = "/tmp/sshtab_benchXXXXXX";
+  std::vector<char> buf(templ.begin(), templ.end());
+  buf.push_back('\0');
+  char* dir = mkdtemp(buf.data());
+  return dir ? std::string(dir) : std::string();
+}
+
+bool WriteHistory(const std::string& data_home, size_t items) {
+  std::string dir = data_home + "/sshtab";
+  std::string err;
+  if (!EnsureDir(dir, &err)) {
+    std::cerr << "bench: " << err << "\n";
+    return false;
+  }
+  std::ofstream out(dir + "/events.log", std::ios::trunc);
+  std::time_t now = std::time(nullptr);
+  for (size_t i = 0; i < items; ++i) {
+    std::string command = "ssh user" + std::to_string(i % 7) + "@host-" + std::to_string(i) +
+                          ".example.internal";
+    if (i % 3 == 0) {
+      command += " -p " + std::to_string(2200 + i % 100);
+    }
+    if (i % 5 == 0) {
+      command += " -J bastion" + std::to_string(i % 4) + ".example.internal";
+    }
+    for (size_t k = 0; k <= i % 4; ++k) {
+      out << static_cast<long long>(now - static_cast<std::time_t>(i * 3600 + k)) << "\t0\ts\t"
+          << Base64Encode(command) << "\n";
+    }
+  }
+  return static_cast<bool>(out);
+}
+
+void RemoveTree(const std::string& data_home) {
+  std::string dir = data_home + "/sshtab";
+  unlink((dir + "/events.log").c_str());
+  unlink((dir + "/aliases.log").c_str());
+  rmdir(dir.c_str());
+  rmdir(data_home.c_str());
+}
+
+bool Spawn(const Options& opt, const Scenario& sc, const std::string& data_home, pid_t* pid, int* master) {
+  int fd = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+  if (fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0) {
+    std::cerr << "bench: pty setup failed: " << std::strerror(errno) << "\n";
+    return false;
+  }
+  struct winsize ws{};
+  ws.ws_row = sc.rows;
+  ws.ws_col = sc.cols;
+  ioctl(fd, TIOCSWINSZ, &ws);
+  std::string slave = ptsname(fd);
+  std::string limit = std::to_string(sc.items);
+
+  pid_t child = fork();
+  if (child < 0) {
+    close(fd);
+    return false;
+  }
+  if (child == 0) {
+    setsid();
+    int sfd = open(slave.c_str(), O_RDWR);
+    if (sfd < 0) {
+      _exit(127);
+    }
+    ioctl(sfd, TIOCSCTTY, 0);
+    dup2(sfd, 0);
+    dup2(sfd, 1);
+    dup2(sfd, 2);
+    if (sfd > 2) {
+      close(sfd);
+    }
+    setenv("XDG_DATA_HOME", data_home.c_str(), 1);
+    execl(opt.bin.c_str(), opt.bin.c_str(), "pick", "--limit", limit.c_str(),
+          static_cast<char*>(nullptr));
+    _exit(127);
+  }
+  *pid = child;
+  *master = fd;
+  return true;
+}
+
+// Collects output until the terminal has been quiet for idle_ms.
+Frame ReadFrame(int fd, int idle_ms) {
+  Frame frame;
+  Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(kFrameTimeoutMs);
+  char buf[65536];
+  while (Clock::now() < deadline) {
+    struct pollfd pfd{fd, POLLIN, 0};
+    int timeout = frame.bytes == 0 ? kFrameTimeoutMs : idle_ms;
+    int rc = poll(&pfd, 1, timeout);
+    if (rc < 0 && errno == EINTR) {
+      continue;
+    }
+    if (rc <= 0) {
+      break;
+    }
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n <= 0) {
+      break;
+    }
+    frame.bytes += static_cast<size_t>(n);
+    frame.last = Clock::now();
+  }
+  return frame;
+}
+
+long long WriteSyscalls(pid_t pid) {
+  std::ifstream in("/proc/" + std::to_string(pid) + "/io");
+  std::string key;
+  long long value = 0;
+  while (in >> key >> value) {
+    if (key == "syscw:") {
+      return value;
+    }
+  }
+  return -1;
+}
+
+std::vector<std::string> KeyScript(size_t items) {
+  std::vector<std::string> keys;
+  size_t moves = std::min<size_t>(items + 2, 40);
+  for (size_t i = 0; i < moves; ++i) {
+    keys.push_back("\x1b[B");
+  }
+  for (size_t i = 0; i < moves; ++i) {
+    keys.push_back("\x1b[A");
+  }
+  keys.push_back("S");
+  keys.push_back("S");
+  for (int i = 0; i < 5; ++i) {
+    keys.push_back("o");
+  }
+  return keys;
+}
+
+double Percentile(std::vector<double> v, double p) {
+  if (v.empty()) {
+    return 0;
+  }
+  std::sort(v.begin(), v.end());
+  size_t idx = static_cast<size_t>(p * static_cast<double>(v.size() - 1) + 0.5);
+  return v[idx];
+}
+
+bool RunScenario(const Options& opt, const Scenario& sc, Result* result) {
+  result->scenario = sc;
+  std::string data_home = MakeTempDir();
+  if (data_home.empty() || !WriteHistory(data_home, sc.items)) {
+    return false;
+  }
+
+  pid_t pid = -1;
+  int master = -1;
+  Clock::time_point start = Clock::now();
+  if (!Spawn(opt, sc, data_home, &pid, &master)) {
+    RemoveTree(data_home);
+    return false;
+  }
+  ScopedFd master_guard(master);
+
+  Frame first = ReadFrame(master, opt.idle_ms);
+  bool ok = first.bytes > 0;
+  if (ok) {
+    result->first_paint_bytes = first.bytes;
+    result->first_paint_ms =
+        std::chrono::duration<double, std::milli>(first.last - start).count();
+    for (const std::string& key : KeyScript(sc.items)) {
+      long long before = WriteSyscalls(pid);
+      Clock::time_point sent = Clock::now();
+      if (write(master, key.data(), key.size()) != static_cast<ssize_t>(key.size())) {
+        ok = false;
+        break;
+      }
+      Frame frame = ReadFrame(master, opt.idle_ms);
+      long long after = WriteSyscalls(pid);
+      ++result->keys;
+      result->frame_bytes_total += frame.bytes;
+      result->frame_bytes_max = std::max(result->frame_bytes_max, frame.bytes);
+      if (before >= 0 && after >= before) {
+        result->writes_total += after - before;
+      }
+      if (frame.bytes > 0) {
+        result->latencies_us.push_back(
+            std::chrono::duration<double, std::micro>(frame.last - sent).count());
+      }
+    }
+  }
+
+  const char ctrl_c = 0x03;
+  if (write(master, &ctrl_c, 1) != 1) {
+    kill(pid, SIGTERM);
+  }
+  ReadFrame(master, opt.idle_ms);
+  int status = 0;
+  waitpid(pid, &status, 0);
+  RemoveTree(data_home);
+  if (!ok) {
+    std::cerr << "bench: picker produced no frame for " << sc.items << " items\n";
+  }
+  return ok;
+}
+
+void PrintUsage() {
+  std::cerr << "Usage: sshtab_bench_tui [--bin <path>] [--sizes N,N,...] [--dims CxR,...]\n"
+            << "                        [--idle-ms <ms>] [--max-frame-bytes <N>]\n"
+            << "                        [--max-latency-ms <ms>] [--max-first-paint-ms <ms>]\n";
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options opt;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "--bin" && has_value) {
+      opt.bin = argv[++i];
+    } else if (arg == "--sizes" && has_value) {
+      if (!ParseList(argv[++i], &opt.sizes)) {
+        std::cerr << "Invalid --sizes value\n";
+        return 1;
+      }
+    } else if (arg == "--dims" && has_value) {
+      if (!ParseDims(argv[++i], &opt.dims)) {
+        std::cerr << "Invalid --dims value\n";
+        return 1;
+      }
+    } else if (arg == "--idle-ms" && has_value) {
+      opt.idle_ms = std::atoi(argv[++i]);
+    } else if (arg == "--max-frame-bytes" && has_value) {
+      opt.max_frame_bytes = static_cast<size_t>(std::strtoull(argv[++i], nullptr, 10));
+    } else if (arg == "--max-latency-ms" && has_value) {
+      opt.max_latency_ms = std::atof(argv[++i]);
+    } else if (arg == "--max-first-paint-ms" && has_value) {
+      opt.max_first_paint_ms = std::atof(argv[++i]);
+    } else {
+      PrintUsage();
+      return 1;
+    }
+  }
+  if (access(opt.bin.c_str(), X_OK) != 0) {
+    std::cerr << "bench: sshtab binary not found at " << opt.bin << "\n";
+    return 1;
+  }
+
+  std::printf("%7s %9s %11s %11s %10s %10s %12s %12s\n", "items", "term", "paint_ms",
+              "paint_B", "B/frame", "max_B", "writes/key", "p50/p99_us");
+  bool failed = false;
+  for (size_t items : opt.sizes) {
+    for (const auto& dim : opt.dims) {
+      Scenario sc;
+      sc.items = items;
+      sc.rows = dim.first;
+      sc.cols = dim.second;
+      Result r;
+      if (!RunScenario(opt, sc, &r)) {
+        failed = true;
+        continue;
+      }
+      double keys = r.keys > 0 ? static_cast<double>(r.keys) : 1.0;
+      double p50 = Percentile(r.latencies_us, 0.5);
+      double p99 = Percentile(r.latencies_us, 0.99);
+      std::string term = std::to_string(sc.cols) + "x" + std::to_string(sc.rows);
+      std::string lat = std::to_string(static_cast<long long>(p50)) + "/" +
+                        std::to_string(static_cast<long long>(p99));
+      std::printf("%7zu %9s %11.2f %11zu %10.0f %10zu %12.2f %12s\n", items, term.c_str(),
+                  r.first_paint_ms, r.first_paint_bytes,
+                  static_cast<double>(r.frame_bytes_total) / keys, r.frame_bytes_max,
+                  static_cast<double>(r.writes_total) / keys, lat.c_str());
+
+      if (opt.max_frame_bytes > 0 && r.frame_bytes_max > opt.max_frame_bytes) {
+        std::cerr << "bench: " << items << " items " << term << ": frame of " << r.frame_bytes_max
+                  << " bytes exceeds " << opt.max_frame_bytes << "\n";
+        failed = true;
+      }
+      if (opt.max_latency_ms > 0 && p99 / 1000.0 > opt.max_latency_ms) {
+        std::cerr << "bench: " << items << " items " << term << ": p99 latency " << p99 / 1000.0
+                  << " ms exceeds " << opt.max_latency_ms << " ms\n";
+        failed = true;
+      }
+      if (opt.max_first_paint_ms > 0 && r.first_paint_ms > opt.max_first_paint_ms) {
+        std::cerr << "bench: " << items << " items " << term << ": first paint "
+                  << r.first_paint_ms << " ms exceeds " << opt.max_first_paint_ms << " ms\n";
+        failed = true;
+      }
+    }
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,127 @@
+// Bash loadable builtin: `enable -f sshtab.so sshtab_builtin`.
+//
+// Runs the commands that never exec another program (record, add, list,
+// pick, pick-command) inside the shell, so the prompt hook and Tab completion
+// do not pay for a fork and exec of the sshtab binary. They fork only to
+// rebuild the picker snapshots in the background (record/add --prefetch, or
+// pick with a stale snapshot); that child is a copy of the shell and always
+// ends in _exit, never returning here. With -v VAR the command's stdout is
+// stored in VAR (trailing newlines stripped, as with $(...)).
+
+#include "cli.h"
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// The subset of bash's loadable builtin ABI used here (builtins.h, command.h
+// and variables.h); these layouts have been stable since bash 4, so the
+// build does not need the bash development headers.
+extern "C" {
+struct word_desc {
+  char* word;
+  int flags;
+};
+struct word_list {
+  struct word_list* next;
+  struct word_desc* word;
+};
+typedef int sh_builtin_func_t(struct word_list*);
+struct builtin {
+  const char* name;
+  sh_builtin_func_t* function;
+  int flags;
+  const char* const* long_doc;
+  const char* short_doc;
+  char* handle;
+};
+struct variable;
+struct variable* bind_variable(const char* name, char* value, int flags);
+}
+
+namespace {
+
+const int kBuiltinEnabled = 0x01;
+const int kExecutionFailure = 1;
+const int kExUsage = 258;
+
+// Commands that are safe to run in the shell: none of them execs, and the
+// only fork is SpawnPrefetch's.
+bool RunsInProcess(const std::string& cmd) {
+  return cmd == "record" || cmd == "add" || cmd == "list" || cmd == "pick" || cmd == "pick-command";
+}
+
+int SshtabBuiltin(struct word_list* list) {
+  std::vector<std::string> args;
+  for (struct word_list* w = list; w; w = w->next) {
+    args.emplace_back(w->word->word);
+  }
+  std::string var;
+  size_t first = 0;
+  if (first < args.size() && args[first] == "-v") {
+    if (first + 1 >= args.size() || args[first + 1].empty()) {
+      std::cerr << "sshtab_builtin: -v requires a variable name\n";
+      return kExUsage;
+    }
+    var = args[first + 1];
+    first += 2;
+  }
+  if (first >= args.size() || !RunsInProcess(args[first])) {
+    std::cerr << "sshtab_builtin: usage: sshtab_builtin [-v var] record|add|list|pick|pick-command [args...]\n";
+    return kExUsage;
+  }
+
+  std::vector<std::string> argv_storage;
+  argv_storage.emplace_back("sshtab");
+  argv_storage.insert(argv_storage.end(), args.begin() + static_cast<std::ptrdiff_t>(first), args.end());
+  std::vector<char*> argv_exec;
+  for (auto& arg : argv_storage) {
+    argv_exec.push_back(arg.data());
+  }
+  argv_exec.push_back(nullptr);
+
+  std::ostringstream captured;
+  std::streambuf* saved = nullptr;
+  if (!var.empty()) {
+    saved = std::cout.rdbuf(captured.rdbuf());
+  }
+  int rc = kExecutionFailure;
+  try {
+    rc = RunCli(static_cast<int>(argv_storage.size()), argv_exec.data());
+  } catch (const std::exception& e) {
+    std::cerr << "sshtab_builtin: " << e.what() << "\n";
+  }
+  std::cout.flush();
+  if (saved) {
+    std::cout.rdbuf(saved);
+    std::string out = captured.str();
+    while (!out.empty() && out.back() == '\n') {
+      out.pop_back();
+    }
+    bind_variable(var.c_str(), out.data(), 0);
+  }
+  return rc;
+}
+
+const char* const kLongDoc[] = {
+    "Run an sshtab command inside the shell.",
+    "",
+    "Supports record, add, list, pick and pick-command with the same",
+    "arguments as the sshtab binary. With -v VAR, output is stored in VAR",
+    "instead of being printed.",
+    nullptr,
+};
+
+}  // namespace
+
+extern "C" {
+struct builtin sshtab_builtin_struct = {
+    "sshtab_builtin",
+    SshtabBuiltin,
+    kBuiltinEnabled,
+    kLongDoc,
+    "sshtab_builtin [-v var] record|add|list|pick|pick-command [args...]",
+    nullptr,
+};
+}
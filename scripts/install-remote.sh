@@ -78,6 +78,16 @@ SNIPPET_URL="https://raw.githubusercontent.com/${REPO_OWNER}/${REPO_NAME}/main/b
 curl -fsSL "${SNIPPET_URL}" -o "${SNIPPET_PATH}"
 chmod 0644 "${SNIPPET_PATH}"
 
+# Startup-optimized copy of the snippet with ssh and the builtin resolved
+# now instead of in every new shell. Older binaries without `init` skip it.
+INIT_DEST="${SNIPPET_DIR}/init.bash"
+if "${BIN_DIR}/sshtab" init bash --snippet "${SNIPPET_PATH}" > "${INIT_DEST}.tmp" 2>/dev/null; then
+  mv "${INIT_DEST}.tmp" "${INIT_DEST}"
+  chmod 0644 "${INIT_DEST}"
+else
+  rm -f "${INIT_DEST}.tmp" "${INIT_DEST}"
+fi
+
 BASHRC="${HOME}/.bashrc"
 MARK_BEGIN="# >>> sshtab begin >>>"
 MARK_END="# <<< sshtab end <<<"
@@ -86,13 +96,22 @@ if [[ ! -f "${BASHRC}" ]]; then
   touch "${BASHRC}"
 fi
 
-if ! grep -q "^${MARK_BEGIN}$" "${BASHRC}"; then
-  {
-    echo "${MARK_BEGIN}"
-    echo "[ -f \"${SNIPPET_PATH}\" ] && source \"${SNIPPET_PATH}\""
-    echo "${MARK_END}"
-  } >> "${BASHRC}"
+# Rewrite the block on every install so older installs pick up init.bash.
+if grep -q "^${MARK_BEGIN}$" "${BASHRC}"; then
+  tmp=$(mktemp)
+  awk -v begin="${MARK_BEGIN}" -v end="${MARK_END}" '
+    $0 == begin {flag=1; next}
+    $0 == end {flag=0; next}
+    !flag {print}
+  ' "${BASHRC}" > "${tmp}"
+  cat "${tmp}" > "${BASHRC}"
+  rm -f "${tmp}"
 fi
+{
+  echo "${MARK_BEGIN}"
+  echo "if [ -f \"${INIT_DEST}\" ]; then source \"${INIT_DEST}\"; elif [ -f \"${SNIPPET_PATH}\" ]; then source \"${SNIPPET_PATH}\"; fi"
+  echo "${MARK_END}"
+} >> "${BASHRC}"
 
 case ":${PATH}:" in
   *":${BIN_DIR}:"*)
@@ -29,6 +29,23 @@ SNIPPET_DEST="${DATA_DIR}/sshtab.bash"
 cp "${SNIPPET_SRC}" "${SNIPPET_DEST}"
 chmod 0644 "${SNIPPET_DEST}"
 
+# Optional bash loadable builtin, present only after `make builtin`.
+BUILTIN_SRC=${SSHTAB_BUILTIN_SO:-"${REPO_DIR}/sshtab.so"}
+if [[ -f "${BUILTIN_SRC}" ]]; then
+  cp "${BUILTIN_SRC}" "${DATA_DIR}/sshtab.so"
+  chmod 0755 "${DATA_DIR}/sshtab.so"
+fi
+
+# Startup-optimized copy of the snippet with ssh and the builtin resolved
+# now instead of in every new shell. Older binaries without `init` skip it.
+INIT_DEST="${DATA_DIR}/init.bash"
+if "${BIN_DIR}/sshtab" init bash --snippet "${SNIPPET_DEST}" > "${INIT_DEST}.tmp" 2>/dev/null; then
+  mv "${INIT_DEST}.tmp" "${INIT_DEST}"
+  chmod 0644 "${INIT_DEST}"
+else
+  rm -f "${INIT_DEST}.tmp" "${INIT_DEST}"
+fi
+
 BASHRC="${HOME}/.bashrc"
 MARK_BEGIN="# >>> sshtab begin >>>"
 MARK_END="# <<< sshtab end <<<"
@@ -37,13 +54,22 @@ if [[ ! -f "${BASHRC}" ]]; then
   touch "${BASHRC}"
 fi
 
-if ! grep -q "^${MARK_BEGIN}$" "${BASHRC}"; then
-  {
-    echo "${MARK_BEGIN}"
-    echo "[ -f \"${SNIPPET_DEST}\" ] && source \"${SNIPPET_DEST}\""
-    echo "${MARK_END}"
-  } >> "${BASHRC}"
+# Rewrite the block on every install so older installs pick up init.bash.
+if grep -q "^${MARK_BEGIN}$" "${BASHRC}"; then
+  tmp=$(mktemp)
+  awk -v begin="${MARK_BEGIN}" -v end="${MARK_END}" '
+    $0 == begin {flag=1; next}
+    $0 == end {flag=0; next}
+    !flag {print}
+  ' "${BASHRC}" > "${tmp}"
+  cat "${tmp}" > "${BASHRC}"
+  rm -f "${tmp}"
 fi
+{
+  echo "${MARK_BEGIN}"
+  echo "if [ -f \"${INIT_DEST}\" ]; then source \"${INIT_DEST}\"; elif [ -f \"${SNIPPET_DEST}\" ]; then source \"${SNIPPET_DEST}\"; fi"
+  echo "${MARK_END}"
+} >> "${BASHRC}"
 
 case ":${PATH}:" in
   *":${BIN_DIR}:"*)
@@ -27,6 +27,7 @@ fi
 
 rm -f "${BIN_DEST}"
 rm -f "${SNIPPET_DEST}"
+rm -f "${DATA_DIR}/init.bash"
 
 if [[ ${PURGE} -eq 1 ]]; then
   rm -rf "${DATA_DIR}"
@@ -30,6 +30,8 @@ fi
 
 rm -f "${BIN_DEST}"
 rm -f "${SNIPPET_DEST}"
+rm -f "${DATA_DIR}/init.bash"
+rm -f "${DATA_DIR}/sshtab.so"
 
 if [[ ${PURGE} -eq 1 ]]; then
   rm -rf "${DATA_DIR}"
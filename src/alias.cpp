@@ -1,5 +1,6 @@
 #include "alias.h"
 
+#include "normalize.h"
 #include "util.h"
 
 #include <algorithm>
@@ -15,7 +16,13 @@
 
 namespace
 {
-  void ParseAliasContent(const std::string &content, std::unordered_map<std::string, std::string> *aliases)
+  // Maps a stored key to the key lookups use, so every spelling of one ssh
+  // target shares an alias. Older files keyed by the raw spelling are
+  // rewritten in this form on the next alias change.
+  using AliasKeyFn = std::string (*)(const std::string &);
+
+  void ParseAliasContent(const std::string &content, AliasKeyFn key_fn,
+                         AliasMap *aliases)
   {
     if (!aliases)
     {
@@ -47,6 +54,7 @@ namespace
       {
         continue;
       }
+      key = key_fn(key);
       if (key.empty())
       {
         continue;
@@ -62,7 +70,7 @@ namespace
     }
   }
 
-  bool WriteAliases(int fd, const std::unordered_map<std::string, std::string> &aliases, std::string *err)
+  bool WriteAliases(int fd, const AliasMap &aliases, std::string *err)
   {
     std::vector<std::pair<std::string, std::string>> items;
     items.reserve(aliases.size());
@@ -91,7 +99,8 @@ namespace
 }
 
 bool LoadAliasesFromPath(const std::string &path,
-                         std::unordered_map<std::string, std::string> *aliases,
+                         AliasKeyFn key_fn,
+                         AliasMap *aliases,
                          std::string *err)
 {
   if (!aliases)
@@ -140,15 +149,17 @@ bool LoadAliasesFromPath(const std::string &path,
     return false;
   }
 
-  ParseAliasContent(content, aliases);
+  ParseAliasContent(content, key_fn, aliases);
   return true;
 }
 
 bool SetAliasForKeyAtPath(const std::string &path,
-                          const std::string &key,
+                          AliasKeyFn key_fn,
+                          const std::string &raw_key,
                           const std::string &alias,
                           std::string *err)
 {
+  std::string key = key_fn(raw_key);
   if (key.empty())
   {
     if (err)
@@ -198,13 +209,13 @@ bool SetAliasForKeyAtPath(const std::string &path,
     return false;
   }
 
-  std::unordered_map<std::string, std::string> aliases;
+  AliasMap aliases;
   std::string content;
   if (!ReadAllFromFd(fd, &content, err))
   {
     return false;
   }
-  ParseAliasContent(content, &aliases);
+  ParseAliasContent(content, key_fn, &aliases);
 
   if (alias.empty())
   {
@@ -268,7 +279,7 @@ bool SetAliasForKeyAtPath(const std::string &path,
 } // namespace
 
 
-bool LoadAliases(std::unordered_map<std::string, std::string> *aliases, std::string *err)
+bool LoadAliases(AliasMap *aliases, std::string *err)
 {
   std::string path_err;
   std::string path = GetAliasPath(&path_err);
@@ -280,10 +291,29 @@ bool LoadAliases(std::unordered_map<std::string, std::string> *aliases, std::str
     }
     return false;
   }
-  return LoadAliasesFromPath(path, aliases, err);
+  if (!LoadAliasesFromPath(path, SshTargetKey, aliases, err))
+  {
+    return false;
+  }
+  // Aliases shared beside team history layers fill in targets without a
+  // personal alias; an earlier layer wins over a later one. A layer
+  // without aliases, or one that cannot be read, adds none.
+  for (const auto &layer : GetHistoryLayerPaths())
+  {
+    AliasMap shared;
+    std::string shared_err;
+    if (LoadAliasesFromPath(GetLayerAliasPath(layer), SshTargetKey, &shared, &shared_err))
+    {
+      for (auto &kv : shared)
+      {
+        aliases->emplace(kv.first, std::move(kv.second));
+      }
+    }
+  }
+  return true;
 }
 
-bool LoadCommandAliases(std::unordered_map<std::string, std::string> *aliases, std::string *err)
+bool LoadCommandAliases(AliasMap *aliases, std::string *err)
 {
   std::string path_err;
   std::string path = GetCommandAliasPath(&path_err);
@@ -295,7 +325,7 @@ bool LoadCommandAliases(std::unordered_map<std::string, std::string> *aliases, s
     }
     return false;
   }
-  return LoadAliasesFromPath(path, aliases, err);
+  return LoadAliasesFromPath(path, SshCommandKey, aliases, err);
 }
 
 bool SetAliasForArgs(const std::string &args, const std::string &alias, std::string *err)
@@ -310,7 +340,7 @@ bool SetAliasForArgs(const std::string &args, const std::string &alias, std::str
     }
     return false;
   }
-  return SetAliasForKeyAtPath(path, args, alias, err);
+  return SetAliasForKeyAtPath(path, SshTargetKey, args, alias, err);
 }
 
 bool SetAliasForCommand(const std::string &command, const std::string &alias, std::string *err)
@@ -325,5 +355,5 @@ bool SetAliasForCommand(const std::string &command, const std::string &alias, st
     }
     return false;
   }
-  return SetAliasForKeyAtPath(path, command, alias, err);
+  return SetAliasForKeyAtPath(path, SshCommandKey, command, alias, err);
 }
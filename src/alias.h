@@ -1,9 +1,15 @@
 #pragma once
 
+#include "hash.h"
+
 #include <string>
 #include <unordered_map>
 
-bool LoadAliases(std::unordered_map<std::string, std::string>* aliases, std::string* err);
-bool LoadCommandAliases(std::unordered_map<std::string, std::string>* aliases, std::string* err);
+using AliasMap = std::unordered_map<std::string, std::string, StringHash>;
+
+// Maps are keyed by SshTargetKey (ssh aliases) or SshCommandKey (command
+// aliases); look them up with the same key.
+bool LoadAliases(AliasMap* aliases, std::string* err);
+bool LoadCommandAliases(AliasMap* aliases, std::string* err);
 bool SetAliasForArgs(const std::string& args, const std::string& alias, std::string* err);
 bool SetAliasForCommand(const std::string& command, const std::string& alias, std::string* err);
@@ -0,0 +1,242 @@
+#include "archive.h"
+
+#include "lz.h"
+#include "util.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <limits>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+// An archive, with fields as described at PutU32 in util.h:
+//   magic[8] block...
+//   index: n_blocks x { offset:u64 size:u32 raw_size:u32 first_ts:i64 last_ts:i64 }
+//   footer: n_blocks:u32 index_offset:u64 magic[8]
+// Each block holds whole lines and decompresses on its own; the index is
+// read from the end so a reader can skip blocks outside its time range.
+const char kMagic[8] = {'S', 'S', 'H', 'T', 'A', 'R', 'C', '1'};
+const std::size_t kBlockBytes = 64 << 10;
+const std::size_t kIndexEntryBytes = 8 + 4 + 4 + 8 + 8;
+const std::size_t kFooterBytes = 4 + 8 + sizeof(kMagic);
+const std::uint32_t kMaxBlocks = 1u << 24;
+
+struct Block {
+  std::uint64_t offset = 0;
+  std::uint32_t size = 0;
+  std::uint32_t raw_size = 0;
+  std::int64_t first_ts = 0;
+  std::int64_t last_ts = 0;
+};
+
+// The leading decimal timestamp of a record, if it has one.
+bool LeadingTs(std::string_view line, std::int64_t* ts) {
+  std::int64_t v = 0;
+  std::size_t i = 0;
+  while (i < line.size() && line[i] >= '0' && line[i] <= '9' && i < 18) {
+    v = v * 10 + (line[i] - '0');
+    ++i;
+  }
+  if (i == 0 || (i < line.size() && line[i] != '\t')) {
+    return false;
+  }
+  *ts = v;
+  return true;
+}
+
+bool ReadAt(int fd, std::uint64_t offset, std::size_t size, std::string* out, std::string* err) {
+  out->resize(size);
+  std::size_t done = 0;
+  while (done < size) {
+    ssize_t n = pread(fd, &(*out)[done], size - done, static_cast<off_t>(offset + done));
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (err) {
+        *err = std::string("read archive failed: ") + std::strerror(errno);
+      }
+      return false;
+    }
+    if (n == 0) {
+      if (err) {
+        *err = "read archive failed: unexpected end of file";
+      }
+      return false;
+    }
+    done += static_cast<std::size_t>(n);
+  }
+  return true;
+}
+
+// Opens path and reads its block index.
+bool OpenArchive(const std::string& path, ScopedFd* fd, std::vector<Block>* blocks, std::string* err) {
+  fd->reset(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+  if (fd->get() < 0) {
+    if (err) {
+      *err = std::string("open archive failed: ") + std::strerror(errno);
+    }
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd->get(), &st) != 0) {
+    if (err) {
+      *err = std::string("stat archive failed: ") + std::strerror(errno);
+    }
+    return false;
+  }
+  const std::uint64_t file_size = static_cast<std::uint64_t>(st.st_size);
+  auto corrupt = [&]() {
+    if (err) {
+      *err = "corrupt archive: " + path;
+    }
+    return false;
+  };
+  if (file_size < sizeof(kMagic) + kFooterBytes) {
+    return corrupt();
+  }
+  std::string footer;
+  if (!ReadAt(fd->get(), file_size - kFooterBytes, kFooterBytes, &footer, err)) {
+    return false;
+  }
+  BinaryReader footer_reader(footer.data(), footer.size());
+  std::uint32_t n = 0;
+  std::uint64_t index_offset = 0;
+  char magic[sizeof(kMagic)];
+  if (!footer_reader.U32(&n) || !footer_reader.U64(&index_offset) || !footer_reader.Raw(magic, sizeof(magic)) ||
+      std::memcmp(magic, kMagic, sizeof(kMagic)) != 0) {
+    return corrupt();
+  }
+  if (n > kMaxBlocks || index_offset < sizeof(kMagic) ||
+      index_offset + std::uint64_t(n) * kIndexEntryBytes != file_size - kFooterBytes) {
+    return corrupt();
+  }
+  std::string index;
+  if (!ReadAt(fd->get(), index_offset, n * kIndexEntryBytes, &index, err)) {
+    return false;
+  }
+  blocks->resize(n);
+  BinaryReader reader(index.data(), index.size());
+  for (auto& block : *blocks) {
+    if (!reader.U64(&block.offset) || !reader.U32(&block.size) || !reader.U32(&block.raw_size) ||
+        !reader.I64(&block.first_ts) || !reader.I64(&block.last_ts) || block.offset < sizeof(kMagic) ||
+        block.offset + block.size > index_offset) {
+      return corrupt();
+    }
+  }
+  return true;
+}
+
+bool ReadBlock(int fd, const Block& block, std::string* buf, std::string* out, std::string* err) {
+  return ReadAt(fd, block.offset, block.size, buf, err) && LzDecompress(*buf, block.raw_size, out, err);
+}
+
+}  // namespace
+
+bool WriteArchive(const std::string& path, std::string_view content, std::string* err) {
+  std::string out(kMagic, sizeof(kMagic));
+  std::vector<Block> blocks;
+  std::size_t pos = 0;
+  while (pos < content.size()) {
+    // Cut after the last newline within kBlockBytes, or after the first
+    // newline when a single line is longer than that.
+    std::size_t end = content.size();
+    if (end - pos > kBlockBytes) {
+      std::size_t nl = content.rfind('\n', pos + kBlockBytes - 1);
+      if (nl == std::string_view::npos || nl < pos) {
+        nl = content.find('\n', pos + kBlockBytes);
+      }
+      end = nl == std::string_view::npos ? content.size() : nl + 1;
+    }
+    std::string_view raw = content.substr(pos, end - pos);
+    Block block;
+    block.first_ts = std::numeric_limits<std::int64_t>::max();
+    block.last_ts = std::numeric_limits<std::int64_t>::min();
+    std::size_t line_start = 0;
+    while (line_start < raw.size()) {
+      std::size_t nl = raw.find('\n', line_start);
+      std::size_t line_end = nl == std::string_view::npos ? raw.size() : nl;
+      std::int64_t ts = 0;
+      if (LeadingTs(raw.substr(line_start, line_end - line_start), &ts)) {
+        block.first_ts = std::min(block.first_ts, ts);
+        block.last_ts = std::max(block.last_ts, ts);
+      }
+      line_start = line_end + 1;
+    }
+    if (block.first_ts > block.last_ts) {
+      // No timestamps to go by: every range reads the block.
+      block.first_ts = std::numeric_limits<std::int64_t>::min();
+      block.last_ts = std::numeric_limits<std::int64_t>::max();
+    }
+    std::string compressed = LzCompress(raw);
+    block.offset = out.size();
+    block.size = static_cast<std::uint32_t>(compressed.size());
+    block.raw_size = static_cast<std::uint32_t>(raw.size());
+    out.append(compressed);
+    blocks.push_back(block);
+    pos = end;
+  }
+  const std::uint64_t index_offset = out.size();
+  for (const auto& block : blocks) {
+    PutU64(&out, block.offset);
+    PutU32(&out, block.size);
+    PutU32(&out, block.raw_size);
+    PutI64(&out, block.first_ts);
+    PutI64(&out, block.last_ts);
+  }
+  PutU32(&out, static_cast<std::uint32_t>(blocks.size()));
+  PutU64(&out, index_offset);
+  out.append(kMagic, sizeof(kMagic));
+  return WriteFileAtomically(path, out, err);
+}
+
+bool ReadArchive(const std::string& path, std::string* content, std::string* err) {
+  ScopedFd fd;
+  std::vector<Block> blocks;
+  if (!OpenArchive(path, &fd, &blocks, err)) {
+    return false;
+  }
+  content->clear();
+  std::string buf;
+  for (const auto& block : blocks) {
+    if (!ReadBlock(fd.get(), block, &buf, content, err)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool StreamArchiveLines(const std::string& path, std::int64_t from_ts, std::int64_t to_ts,
+                        const std::function<void(std::string_view)>& fn, std::string* err) {
+  ScopedFd fd;
+  std::vector<Block> blocks;
+  if (!OpenArchive(path, &fd, &blocks, err)) {
+    return false;
+  }
+  std::string buf;
+  std::string raw;
+  for (const auto& block : blocks) {
+    if (block.last_ts < from_ts || block.first_ts > to_ts) {
+      continue;
+    }
+    raw.clear();
+    if (!ReadBlock(fd.get(), block, &buf, &raw, err)) {
+      return false;
+    }
+    std::size_t start = 0;
+    while (start < raw.size()) {
+      std::size_t nl = raw.find('\n', start);
+      std::size_t end = nl == std::string::npos ? raw.size() : nl;
+      if (end > start) {
+        fn(std::string_view(raw).substr(start, end - start));
+      }
+      start = end + 1;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+
+// Compressed archives of frozen event logs. The log is cut into blocks of
+// whole lines, each compressed on its own with LzCompress, and a block index
+// at the end records every block's place and timestamp range, so a reader
+// decompresses only the blocks a time range needs.
+
+// Writes content, a run of event records, to path as an archive. The file is
+// replaced atomically.
+bool WriteArchive(const std::string& path, std::string_view content, std::string* err);
+
+// Decompresses the whole archive at path into content.
+bool ReadArchive(const std::string& path, std::string* content, std::string* err);
+
+// Calls fn with every line of the blocks whose timestamps overlap
+// [from_ts, to_ts]. Lines of those blocks outside the range are passed too;
+// the caller filters them.
+bool StreamArchiveLines(const std::string& path, std::int64_t from_ts, std::int64_t to_ts,
+                        const std::function<void(std::string_view)>& fn, std::string* err);
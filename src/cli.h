@@ -0,0 +1,6 @@
+#pragma once
+
+// Runs one sshtab command line (argv[0] is the program name) and returns its
+// exit status. main() forwards here; the bash loadable builtin calls it
+// in-process for the commands that neither fork nor exec.
+int RunCli(int argc, char** argv);
@@ -0,0 +1,230 @@
+#include "control.h"
+
+#include "hash.h"
+#include "normalize.h"
+#include "ssh_exec.h"
+#include "tokenize.h"
+#include "util.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+// Runs ssh with the given arguments, stdio on /dev/null. Returns the child
+// pid or -1.
+pid_t SpawnSsh(const std::string& binary, const std::vector<std::string>& args) {
+  std::vector<std::string> argv_storage;
+  argv_storage.reserve(args.size() + 1);
+  argv_storage.emplace_back("ssh");
+  argv_storage.insert(argv_storage.end(), args.begin(), args.end());
+  std::vector<char*> argv_exec;
+  argv_exec.reserve(argv_storage.size() + 1);
+  for (auto& arg : argv_storage) {
+    argv_exec.push_back(arg.data());
+  }
+  argv_exec.push_back(nullptr);
+
+  pid_t pid = fork();
+  if (pid != 0) {
+    return pid;
+  }
+  RedirectStdioToNull();
+  ExecSshBinary(binary, argv_exec.data());
+  _exit(127);
+}
+
+struct WarmJob {
+  std::string control_path;
+  std::vector<std::string> tokens;
+};
+
+}  // namespace
+
+std::string GetControlDir(std::string* err) {
+  std::string dir = GetDataDir(err);
+  if (dir.empty()) {
+    return std::string();
+  }
+  return dir + "/cm";
+}
+
+namespace {
+
+std::string ControlPathForKey(const std::string& key, std::string* err) {
+  std::string dir = GetControlDir(err);
+  if (dir.empty()) {
+    return std::string();
+  }
+  char name[17];
+  std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(HashBytes(key)));
+  std::string path = dir + "/" + name;
+  if (path.size() >= sizeof(sockaddr_un::sun_path)) {
+    if (err) {
+      *err = "control path too long";
+    }
+    return std::string();
+  }
+  return path;
+}
+
+}  // namespace
+
+std::string ControlPathForArgs(const std::string& args, std::string* err) {
+  return ControlPathForKey(SshTargetKey(args), err);
+}
+
+std::string ControlPathForTokens(const std::vector<std::string>& tokens, std::string* err) {
+  SshTarget target;
+  std::string parse_err;
+  if (!ParseSshArgs(tokens, &target, &parse_err)) {
+    std::string joined;
+    for (const auto& token : tokens) {
+      joined += joined.empty() ? token : " " + token;
+    }
+    return ControlPathForKey(CollapseSpaces(joined), err);
+  }
+  return ControlPathForKey(CanonicalSshArgs(target), err);
+}
+
+bool HasControlSocket(const std::string& path) {
+  struct stat st;
+  return !path.empty() && stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode);
+}
+
+bool WarmControlMasters(const std::vector<std::string>& targets,
+                        const WarmOptions& options,
+                        WarmStats* stats,
+                        std::string* err) {
+  WarmStats result;
+  std::string dir = GetControlDir(err);
+  if (dir.empty() || !EnsureDir(dir, err)) {
+    return false;
+  }
+
+  std::vector<WarmJob> jobs;
+  jobs.reserve(targets.size());
+  ArgTokens parsed;
+  for (const auto& args : targets) {
+    WarmJob job;
+    std::string tok_err;
+    if (!TokenizeArgsInto(args, true, &parsed, &tok_err) || parsed.empty()) {
+      ++result.failed;
+      continue;
+    }
+    job.tokens = parsed.ToStrings();
+    job.control_path = ControlPathForArgs(args, &tok_err);
+    if (job.control_path.empty()) {
+      ++result.failed;
+      continue;
+    }
+    jobs.push_back(job);
+  }
+
+  // Each job checks for a live master first and only starts a new one when
+  // the check fails. At most options.jobs ssh processes run at once.
+  const size_t limit = options.jobs > 0 ? options.jobs : 1;
+  const std::string binary = ResolveSshBinary();
+  struct Running {
+    pid_t pid;
+    ScopedFd pidfd;
+    size_t job;
+    bool checking;
+  };
+  std::vector<Running> running;
+  size_t next = 0;
+  auto start = [&](size_t idx, bool checking) -> bool {
+    const WarmJob& job = jobs[idx];
+    std::vector<std::string> args;
+    args.push_back("-o");
+    args.push_back("ControlPath=" + job.control_path);
+    if (checking) {
+      args.push_back("-O");
+      args.push_back("check");
+    } else {
+      args.push_back("-o");
+      args.push_back("ControlMaster=yes");
+      args.push_back("-o");
+      args.push_back("ControlPersist=" + options.persist);
+      args.push_back("-o");
+      args.push_back("BatchMode=yes");
+      args.push_back("-f");
+      args.push_back("-N");
+    }
+    args.insert(args.end(), job.tokens.begin(), job.tokens.end());
+    pid_t pid = SpawnSsh(binary, args);
+    if (pid < 0) {
+      return false;
+    }
+    running.push_back(Running{pid, ScopedFd(OpenPidFd(pid)), idx, checking});
+    return true;
+  };
+
+  std::vector<struct pollfd> fds;
+  while (next < jobs.size() || !running.empty()) {
+    while (next < jobs.size() && running.size() < limit) {
+      size_t idx = next++;
+      if (!start(idx, HasControlSocket(jobs[idx].control_path))) {
+        ++result.failed;
+      }
+    }
+    if (running.empty()) {
+      continue;
+    }
+    // Sleep until one of our children exits. Only our own children are
+    // reaped, so callers that have other child processes are unaffected.
+    // Without pidfds the oldest child is waited for instead.
+    size_t exited = 0;
+    fds.clear();
+    for (const auto& child : running) {
+      fds.push_back(pollfd{child.pidfd.get(), POLLIN, 0});
+    }
+    bool have_pidfds = std::all_of(fds.begin(), fds.end(), [](const pollfd& fd) { return fd.fd >= 0; });
+    if (have_pidfds) {
+      int ready = poll(fds.data(), fds.size(), -1);
+      if (ready < 0 && errno == EINTR) {
+        continue;
+      }
+      while (ready > 0 && exited + 1 < fds.size() && fds[exited].revents == 0) {
+        ++exited;
+      }
+    }
+    int status = 0;
+    pid_t pid;
+    do {
+      pid = waitpid(running[exited].pid, &status, 0);
+    } while (pid < 0 && errno == EINTR);
+    bool ok = pid > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    bool checking = running[exited].checking;
+    size_t job = running[exited].job;
+    running.erase(running.begin() + static_cast<std::ptrdiff_t>(exited));
+    if (checking) {
+      if (ok) {
+        ++result.alive;
+      } else {
+        unlink(jobs[job].control_path.c_str());
+        if (!start(job, false)) {
+          ++result.failed;
+        }
+      }
+    } else if (ok) {
+      ++result.started;
+    } else {
+      ++result.failed;
+    }
+  }
+
+  if (stats) {
+    *stats = result;
+  }
+  return true;
+}
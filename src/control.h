@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+struct WarmOptions {
+  std::size_t jobs = 4;
+  std::string persist = "10m";
+};
+
+struct WarmStats {
+  std::size_t started = 0;
+  std::size_t alive = 0;
+  std::size_t failed = 0;
+};
+
+std::string GetControlDir(std::string* err);
+// The socket a warmed master for these ssh args listens on. Args are keyed
+// by their canonical spelling (SshTargetKey), so the string and argv forms
+// of one target share a master.
+std::string ControlPathForArgs(const std::string& args, std::string* err);
+std::string ControlPathForTokens(const std::vector<std::string>& tokens, std::string* err);
+bool HasControlSocket(const std::string& path);
+bool WarmControlMasters(const std::vector<std::string>& targets,
+                        const WarmOptions& options,
+                        WarmStats* stats,
+                        std::string* err);
@@ -0,0 +1,563 @@
+#include "entry_ids.h"
+
+#include "hash.h"
+#include "normalize.h"
+#include "util.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <string_view>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+
+// ids.log holds one line per change, oldest first:
+//   id \t base64(command key)   assigns id, or revives it once retired
+//   id \t -                     retires id
+// ids.idx indexes it, with fields as described at PutU32 in util.h:
+//   magic[8] log_size:u64 n_ids:u64 capacity:u64
+//   capacity x { hash:u64 id_plus_one:u64 }
+//   n_ids x { entry:u64 }
+// log_size is how much of ids.log the index covers; any other size means a
+// writer stopped between the two files, and the index is rebuilt from the
+// log. The slots map the HashBytes of a key to its ID by linear probing,
+// with capacity a power of two at least twice the number of IDs. An entry
+// is one past the offset of the line that assigned the ID, or 0 for an ID
+// never assigned, with kRetired set while the ID is retired.
+const char kMagic[8] = {'S', 'S', 'H', 'T', 'I', 'D', 'X', '1'};
+const std::uint64_t kHeaderSize = 32;
+const std::uint64_t kSlotSize = 16;
+const std::uint64_t kMinCapacity = 64;
+const std::uint64_t kRetired = 1ull << 63;
+const std::int64_t kMaxId = std::int64_t(1) << 32;
+
+struct IdPaths {
+  std::string log;
+  std::string index;
+};
+
+bool GetIdPaths(IdPaths* paths, std::string* err) {
+  std::string dir = GetDataDir(err);
+  if (dir.empty()) {
+    return false;
+  }
+  paths->log = dir + "/ids.log";
+  paths->index = dir + "/ids.idx";
+  return true;
+}
+
+std::string NotFound(std::int64_t id) {
+  return "id " + std::to_string(id) + " not found";
+}
+
+// The state of one ID after replaying the log.
+struct IdState {
+  std::uint64_t entry = 0;
+  std::string key;
+};
+
+bool ReadLog(int fd, std::string* content, std::string* err) {
+  if (lseek(fd, 0, SEEK_SET) < 0) {
+    if (err) {
+      *err = std::string("lseek failed: ") + std::strerror(errno);
+    }
+    return false;
+  }
+  return ReadAllFromFd(fd, content, err);
+}
+
+void ParseIdLog(std::string_view content, std::vector<IdState>* ids) {
+  ForEachLine(content, [&](std::string_view line) {
+    std::size_t tab = line.find('\t');
+    std::int64_t id = 0;
+    if (tab == std::string_view::npos || !ParseInt64(line.substr(0, tab), &id) || id < 0 || id >= kMaxId) {
+      return;
+    }
+    if (static_cast<std::size_t>(id) >= ids->size()) {
+      ids->resize(static_cast<std::size_t>(id) + 1);
+    }
+    IdState& state = (*ids)[static_cast<std::size_t>(id)];
+    std::string_view field = line.substr(tab + 1);
+    if (field == "-") {
+      if (state.entry != 0) {
+        state.entry |= kRetired;
+      }
+      return;
+    }
+    if (state.entry == 0) {
+      std::string decode_err;
+      if (!Base64Decode(std::string(field), &state.key, &decode_err) || state.key.empty()) {
+        state.key.clear();
+        return;
+      }
+      state.entry = static_cast<std::uint64_t>(line.data() - content.data()) + 1;
+    }
+    state.entry &= ~kRetired;
+  });
+}
+
+std::string BuildIndex(const std::vector<IdState>& ids, std::uint64_t log_size) {
+  std::uint64_t capacity = kMinCapacity;
+  while (capacity < ids.size() * 4) {
+    capacity *= 2;
+  }
+  std::vector<std::uint64_t> slots(capacity * 2, 0);
+  for (std::size_t id = 0; id < ids.size(); ++id) {
+    if (ids[id].entry == 0) {
+      continue;
+    }
+    std::uint64_t hash = HashBytes(ids[id].key);
+    std::uint64_t slot = hash & (capacity - 1);
+    while (slots[slot * 2 + 1] != 0) {
+      slot = (slot + 1) & (capacity - 1);
+    }
+    slots[slot * 2] = hash;
+    slots[slot * 2 + 1] = id + 1;
+  }
+  std::string out(kMagic, sizeof(kMagic));
+  PutU64(&out, log_size);
+  PutU64(&out, ids.size());
+  PutU64(&out, capacity);
+  for (std::uint64_t v : slots) {
+    PutU64(&out, v);
+  }
+  for (const auto& state : ids) {
+    PutU64(&out, state.entry);
+  }
+  return out;
+}
+
+std::string IdLine(std::uint64_t id, const std::string& key) {
+  return std::to_string(id) + '\t' + (key.empty() ? std::string("-") : Base64Encode(key)) + '\n';
+}
+
+// An open index, read and written in place, or held in memory when a
+// reader found it stale and may not rewrite it.
+class IdIndex {
+ public:
+  // Opens the index at path if it covers log_size bytes of the log.
+  bool Open(const std::string& path, std::uint64_t log_size, bool writable) {
+    fd_.reset(open(path.c_str(), (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC));
+    image_.clear();
+    return fd_.get() >= 0 && LoadHeader(log_size);
+  }
+
+  // Rebuilds the index from the log open on log_fd, saving it when
+  // writable.
+  bool Rebuild(int log_fd, const std::string& path, bool writable, std::string* err) {
+    std::string content;
+    if (!ReadLog(log_fd, &content, err)) {
+      return false;
+    }
+    std::vector<IdState> ids;
+    ParseIdLog(content, &ids);
+    std::string image = BuildIndex(ids, content.size());
+    if (writable) {
+      return WriteFileAtomically(path, image, err) && Open(path, content.size(), true);
+    }
+    fd_.reset(-1);
+    image_ = std::move(image);
+    return LoadHeader(content.size());
+  }
+
+  std::uint64_t log_size() const { return log_size_; }
+  std::uint64_t n_ids() const { return n_ids_; }
+  std::uint64_t capacity() const { return capacity_; }
+
+  bool Entry(std::uint64_t id, std::uint64_t* entry) const {
+    return id < n_ids_ && Read(EntryOffset(id), entry);
+  }
+
+  // Looks key up, reading candidate keys back from the log on log_fd.
+  // Leaves *slot on the key's slot, or on the free slot where it belongs
+  // with *id at -1.
+  bool Find(int log_fd, const std::string& key, std::uint64_t* slot, std::int64_t* id) const {
+    const std::uint64_t hash = HashBytes(key);
+    for (std::uint64_t i = hash & (capacity_ - 1), probes = 0; probes < capacity_;
+         i = (i + 1) & (capacity_ - 1), ++probes) {
+      std::uint64_t slot_hash = 0;
+      std::uint64_t id_plus_one = 0;
+      if (!Read(kHeaderSize + i * kSlotSize, &slot_hash) || !Read(kHeaderSize + i * kSlotSize + 8, &id_plus_one)) {
+        return false;
+      }
+      *slot = i;
+      *id = -1;
+      if (id_plus_one == 0) {
+        return true;
+      }
+      std::uint64_t entry = 0;
+      std::string candidate;
+      if (slot_hash == hash && Entry(id_plus_one - 1, &entry) && ReadKey(log_fd, entry, &candidate) &&
+          candidate == key) {
+        *id = static_cast<std::int64_t>(id_plus_one - 1);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool PutSlot(std::uint64_t slot, const std::string& key, std::uint64_t id, std::string* err) {
+    std::string data;
+    PutU64(&data, HashBytes(key));
+    PutU64(&data, id + 1);
+    return Write(kHeaderSize + slot * kSlotSize, data, err);
+  }
+
+  bool PutEntry(std::uint64_t id, std::uint64_t entry, std::string* err) {
+    std::string data;
+    PutU64(&data, entry);
+    n_ids_ = std::max(n_ids_, id + 1);
+    return Write(EntryOffset(id), data, err);
+  }
+
+  // Commits the entries and slots written so far; the index stays stale
+  // until this lands.
+  bool PutHeader(std::uint64_t log_size, std::string* err) {
+    std::string data;
+    PutU64(&data, log_size);
+    PutU64(&data, n_ids_);
+    log_size_ = log_size;
+    return Write(sizeof(kMagic), data, err);
+  }
+
+  // Reads the key of the line an entry points at.
+  static bool ReadKey(int log_fd, std::uint64_t entry, std::string* key) {
+    entry &= ~kRetired;
+    if (entry == 0) {
+      return false;
+    }
+    std::string line;
+    char buf[256];
+    for (off_t at = static_cast<off_t>(entry - 1);;) {
+      ssize_t n = pread(log_fd, buf, sizeof(buf), at);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        break;
+      }
+      const char* nl = static_cast<const char*>(std::memchr(buf, '\n', static_cast<std::size_t>(n)));
+      line.append(buf, nl ? static_cast<std::size_t>(nl - buf) : static_cast<std::size_t>(n));
+      if (nl) {
+        break;
+      }
+      at += n;
+    }
+    std::size_t tab = line.find('\t');
+    std::string decode_err;
+    return tab != std::string::npos && Base64Decode(line.substr(tab + 1), key, &decode_err);
+  }
+
+ private:
+  std::uint64_t EntryOffset(std::uint64_t id) const { return kHeaderSize + capacity_ * kSlotSize + id * 8; }
+
+  bool LoadHeader(std::uint64_t log_size) {
+    char header[kHeaderSize];
+    if (!ReadRaw(0, header, sizeof(header))) {
+      return false;
+    }
+    BinaryReader reader(header, sizeof(header));
+    char magic[sizeof(kMagic)];
+    if (!reader.Raw(magic, sizeof(magic)) || std::memcmp(magic, kMagic, sizeof(kMagic)) != 0 ||
+        !reader.U64(&log_size_) || !reader.U64(&n_ids_) || !reader.U64(&capacity_)) {
+      return false;
+    }
+    return log_size_ == log_size && capacity_ >= kMinCapacity && (capacity_ & (capacity_ - 1)) == 0 &&
+           n_ids_ <= static_cast<std::uint64_t>(kMaxId);
+  }
+
+  bool ReadRaw(std::uint64_t offset, void* out, std::size_t n) const {
+    if (fd_.get() < 0) {
+      if (offset > image_.size() || image_.size() - offset < n) {
+        return false;
+      }
+      std::memcpy(out, image_.data() + offset, n);
+      return true;
+    }
+    ssize_t got = pread(fd_.get(), out, n, static_cast<off_t>(offset));
+    return got == static_cast<ssize_t>(n);
+  }
+
+  bool Read(std::uint64_t offset, std::uint64_t* v) const { return ReadRaw(offset, v, sizeof(*v)); }
+
+  bool Write(std::uint64_t offset, const std::string& data, std::string* err) {
+    if (pwrite(fd_.get(), data.data(), data.size(), static_cast<off_t>(offset)) !=
+        static_cast<ssize_t>(data.size())) {
+      if (err) {
+        *err = std::string("write failed: ") + std::strerror(errno);
+      }
+      return false;
+    }
+    return true;
+  }
+
+  ScopedFd fd_;
+  std::string image_;
+  std::uint64_t log_size_ = 0;
+  std::uint64_t n_ids_ = 0;
+  std::uint64_t capacity_ = 0;
+};
+
+std::uint64_t FileSize(int fd) {
+  struct stat st;
+  return fstat(fd, &st) == 0 ? static_cast<std::uint64_t>(st.st_size) : 0;
+}
+
+// Opens the log locked for writing, with its index ready for updates.
+bool OpenForUpdate(const IdPaths& paths, ScopedFd* fd, FlockGuard* lock, IdIndex* index, std::string* err) {
+  if (!EnsureDir(DirnameFromPath(paths.log), err)) {
+    return false;
+  }
+  fd->reset(open(paths.log.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600));
+  if (fd->get() < 0) {
+    if (err) {
+      *err = std::string("open failed: ") + std::strerror(errno);
+    }
+    return false;
+  }
+  lock->reset(fd->get());
+  if (!lock->LockExclusive(err)) {
+    return false;
+  }
+  return index->Open(paths.index, FileSize(fd->get()), true) || index->Rebuild(fd->get(), paths.index, true, err);
+}
+
+// Opens the log share-locked for reading; *missing is set when no ID has
+// been assigned yet.
+bool OpenForRead(const IdPaths& paths,
+                 ScopedFd* fd,
+                 FlockGuard* lock,
+                 IdIndex* index,
+                 bool* missing,
+                 std::string* err) {
+  *missing = false;
+  fd->reset(open(paths.log.c_str(), O_RDONLY | O_CLOEXEC));
+  if (fd->get() < 0) {
+    if (errno == ENOENT) {
+      *missing = true;
+      return true;
+    }
+    if (err) {
+      *err = std::string("open failed: ") + std::strerror(errno);
+    }
+    return false;
+  }
+  lock->reset(fd->get());
+  if (!lock->LockShared(err)) {
+    return false;
+  }
+  return index->Open(paths.index, FileSize(fd->get()), false) || index->Rebuild(fd->get(), paths.index, false, err);
+}
+
+}  // namespace
+
+bool AssignEntryIds(const std::vector<std::string>& commands,
+                    std::vector<std::int64_t>* ids,
+                    std::string* err) {
+  if (!ids) {
+    if (err) {
+      *err = "ids pointer is null";
+    }
+    return false;
+  }
+  ids->assign(commands.size(), -1);
+  IdPaths paths;
+  if (!GetIdPaths(&paths, err)) {
+    return false;
+  }
+  ScopedFd fd;
+  FlockGuard lock;
+  IdIndex index;
+  if (!OpenForUpdate(paths, &fd, &lock, &index, err)) {
+    return false;
+  }
+  std::uint64_t log_size = index.log_size();
+  for (std::size_t c = 0; c < commands.size(); ++c) {
+    std::string key = SshCommandKey(commands[c]);
+    std::uint64_t slot = 0;
+    std::int64_t id = -1;
+    if (!index.Find(fd.get(), key, &slot, &id)) {
+      if (err) {
+        *err = "ids.idx is unreadable";
+      }
+      return false;
+    }
+    if (id >= 0) {
+      std::uint64_t entry = 0;
+      if (index.Entry(static_cast<std::uint64_t>(id), &entry) && (entry & kRetired) != 0) {
+        std::string line = IdLine(static_cast<std::uint64_t>(id), key);
+        if (!WriteAllToFd(fd.get(), line, err) ||
+            !index.PutEntry(static_cast<std::uint64_t>(id), entry & ~kRetired, err)) {
+          return false;
+        }
+        log_size += line.size();
+      }
+      (*ids)[c] = id;
+      continue;
+    }
+    if ((index.n_ids() + 1) * 2 > index.capacity()) {
+      // Growing rehashes everything once, so assignments stay O(1) on
+      // average.
+      if (!index.Rebuild(fd.get(), paths.index, true, err) || !index.Find(fd.get(), key, &slot, &id)) {
+        return false;
+      }
+    }
+    const std::uint64_t new_id = index.n_ids();
+    std::string line = IdLine(new_id, key);
+    if (!WriteAllToFd(fd.get(), line, err) || !index.PutSlot(slot, key, new_id, err) ||
+        !index.PutEntry(new_id, log_size + 1, err)) {
+      return false;
+    }
+    log_size += line.size();
+    (*ids)[c] = static_cast<std::int64_t>(new_id);
+  }
+  return log_size == index.log_size() || index.PutHeader(log_size, err);
+}
+
+bool FindEntryIds(const std::vector<std::string>& commands,
+                  std::vector<std::int64_t>* ids,
+                  std::string* err) {
+  if (!ids) {
+    if (err) {
+      *err = "ids pointer is null";
+    }
+    return false;
+  }
+  ids->assign(commands.size(), -1);
+  IdPaths paths;
+  if (!GetIdPaths(&paths, err)) {
+    return false;
+  }
+  ScopedFd fd;
+  FlockGuard lock;
+  IdIndex index;
+  bool missing = false;
+  if (!OpenForRead(paths, &fd, &lock, &index, &missing, err)) {
+    return false;
+  }
+  if (missing) {
+    return true;
+  }
+  for (std::size_t c = 0; c < commands.size(); ++c) {
+    std::uint64_t slot = 0;
+    std::int64_t id = -1;
+    std::uint64_t entry = 0;
+    if (index.Find(fd.get(), SshCommandKey(commands[c]), &slot, &id) && id >= 0 &&
+        index.Entry(static_cast<std::uint64_t>(id), &entry) && (entry & kRetired) == 0) {
+      (*ids)[c] = id;
+    }
+  }
+  return true;
+}
+
+bool LookupEntryId(std::int64_t id, std::string* command, std::string* err) {
+  if (!command) {
+    if (err) {
+      *err = "command pointer is null";
+    }
+    return false;
+  }
+  IdPaths paths;
+  if (!GetIdPaths(&paths, err)) {
+    return false;
+  }
+  ScopedFd fd;
+  FlockGuard lock;
+  IdIndex index;
+  bool missing = false;
+  if (!OpenForRead(paths, &fd, &lock, &index, &missing, err)) {
+    return false;
+  }
+  std::uint64_t entry = 0;
+  if (missing || id < 0 || !index.Entry(static_cast<std::uint64_t>(id), &entry) || entry == 0) {
+    if (err) {
+      *err = NotFound(id);
+    }
+    return false;
+  }
+  if ((entry & kRetired) != 0) {
+    if (err) {
+      *err = "id " + std::to_string(id) + " has been deleted";
+    }
+    return false;
+  }
+  if (!IdIndex::ReadKey(fd.get(), entry, command)) {
+    if (err) {
+      *err = "ids.log is unreadable";
+    }
+    return false;
+  }
+  return true;
+}
+
+bool ReconcileEntryIds(const std::vector<std::string>& live, std::string* err) {
+  IdPaths paths;
+  if (!GetIdPaths(&paths, err) || !EnsureDir(DirnameFromPath(paths.log), err)) {
+    return false;
+  }
+  ScopedFd fd(open(paths.log.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600));
+  if (fd.get() < 0) {
+    if (err) {
+      *err = std::string("open failed: ") + std::strerror(errno);
+    }
+    return false;
+  }
+  FlockGuard lock(fd.get());
+  if (!lock.LockExclusive(err)) {
+    return false;
+  }
+  std::string content;
+  if (!ReadLog(fd.get(), &content, err)) {
+    return false;
+  }
+  std::vector<IdState> ids;
+  ParseIdLog(content, &ids);
+  std::unordered_map<std::string, std::size_t> by_key;
+  for (std::size_t id = 0; id < ids.size(); ++id) {
+    if (ids[id].entry != 0) {
+      by_key.emplace(ids[id].key, id);
+    }
+  }
+
+  std::string appended;
+  std::unordered_set<std::string> live_keys;
+  for (const auto& command : live) {
+    std::string key = SshCommandKey(command);
+    if (!live_keys.insert(key).second) {
+      continue;
+    }
+    auto it = by_key.find(key);
+    if (it == by_key.end()) {
+      IdState state;
+      state.entry = content.size() + appended.size() + 1;
+      state.key = key;
+      appended += IdLine(ids.size(), key);
+      by_key.emplace(std::move(key), ids.size());
+      ids.push_back(std::move(state));
+    } else if ((ids[it->second].entry & kRetired) != 0) {
+      appended += IdLine(it->second, key);
+      ids[it->second].entry &= ~kRetired;
+    }
+  }
+  for (std::size_t id = 0; id < ids.size(); ++id) {
+    if (ids[id].entry != 0 && (ids[id].entry & kRetired) == 0 && live_keys.count(ids[id].key) == 0) {
+      appended += IdLine(id, std::string());
+      ids[id].entry |= kRetired;
+    }
+  }
+  if (!appended.empty() && !WriteAllToFd(fd.get(), appended, err)) {
+    return false;
+  }
+  return WriteFileAtomically(paths.index, BuildIndex(ids, content.size() + appended.size()), err);
+}
+
+bool HaveEntryIdIndex() {
+  IdPaths paths;
+  std::string err;
+  return GetIdPaths(&paths, &err) && access(paths.index.c_str(), F_OK) == 0;
+}
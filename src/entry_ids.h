@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Stable IDs for ssh history entries, kept in <data>/ids.log and indexed by
+// <data>/ids.idx. An ID names the SshCommandKey of an entry rather than its
+// position, so it survives new records, re-sorting and other shells. IDs
+// are assigned as entries are recorded, start at 0 and are never reused;
+// the ID of an entry that is deleted or pruned is retired and resolves
+// again only once the same target is recorded again.
+
+// Returns the ID of every command in ids, assigning new IDs and reviving
+// retired ones as needed.
+bool AssignEntryIds(const std::vector<std::string>& commands,
+                    std::vector<std::int64_t>* ids,
+                    std::string* err);
+
+// Returns the ID of every command in ids without writing anything; commands
+// without a live ID get -1.
+bool FindEntryIds(const std::vector<std::string>& commands,
+                  std::vector<std::int64_t>* ids,
+                  std::string* err);
+
+// Resolves id to the canonical command it was assigned to, reading one
+// index entry and one log line. Fails when the ID was never assigned or
+// has been retired.
+bool LookupEntryId(std::int64_t id, std::string* command, std::string* err);
+
+// Brings the IDs in line with live, the command of every ssh entry most
+// recent first: entries without an ID get one in that order, retired ones
+// come back, and the IDs of targets missing from live are retired.
+bool ReconcileEntryIds(const std::vector<std::string>& live, std::string* err);
+
+// True once the IDs have been reconciled with the history, so that every
+// recorded entry has one.
+bool HaveEntryIdIndex();
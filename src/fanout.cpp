@@ -0,0 +1,294 @@
+#include "fanout.h"
+
+#include "control.h"
+#include "ssh_exec.h"
+#include "tokenize.h"
+#include "util.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+struct Stream {
+  ScopedFd fd;
+  std::string pending;
+};
+
+struct Worker {
+  pid_t pid = -1;
+  // Readable once the child exits; -1 without pidfd support.
+  ScopedFd pidfd;
+  std::size_t job = 0;
+  Stream out;
+  Stream err;
+};
+
+// How long a worker without a pidfd waits between exit checks.
+const int kExitPollMs = 50;
+
+// Writes every complete line in stream.pending to fd behind prefix. At EOF a
+// trailing partial line is flushed with a newline added.
+bool FlushLines(Stream* stream, const std::string& prefix, int fd, bool eof, std::string* err) {
+  std::string out;
+  std::size_t start = 0;
+  while (true) {
+    std::size_t nl = stream->pending.find('\n', start);
+    if (nl == std::string::npos) {
+      break;
+    }
+    out += prefix;
+    out.append(stream->pending, start, nl - start + 1);
+    start = nl + 1;
+  }
+  stream->pending.erase(0, start);
+  if (eof && !stream->pending.empty()) {
+    out += prefix + stream->pending + '\n';
+    stream->pending.clear();
+  }
+  return out.empty() || WriteAllToFd(fd, out, err);
+}
+
+// Drains a non-blocking pipe. Returns false once the writer side is closed.
+bool DrainStream(Stream* stream) {
+  char buf[65536];
+  while (true) {
+    ssize_t n = read(stream->fd.get(), buf, sizeof(buf));
+    if (n > 0) {
+      stream->pending.append(buf, static_cast<std::size_t>(n));
+      continue;
+    }
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return true;
+    }
+    return false;
+  }
+}
+
+pid_t SpawnWorker(const std::string& binary, std::vector<std::string>& argv_storage, Worker* worker) {
+  int out_pipe[2];
+  int err_pipe[2];
+  if (pipe2(out_pipe, O_CLOEXEC) != 0) {
+    return -1;
+  }
+  if (pipe2(err_pipe, O_CLOEXEC) != 0) {
+    close(out_pipe[0]);
+    close(out_pipe[1]);
+    return -1;
+  }
+  std::vector<char*> argv_exec;
+  argv_exec.reserve(argv_storage.size() + 1);
+  for (auto& arg : argv_storage) {
+    argv_exec.push_back(arg.data());
+  }
+  argv_exec.push_back(nullptr);
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    int null_fd = open("/dev/null", O_RDONLY);
+    if (null_fd > 0) {
+      dup2(null_fd, 0);
+      close(null_fd);
+    }
+    dup2(out_pipe[1], 1);
+    dup2(err_pipe[1], 2);
+    ExecSshBinary(binary, argv_exec.data());
+    _exit(127);
+  }
+  close(out_pipe[1]);
+  close(err_pipe[1]);
+  if (pid < 0) {
+    close(out_pipe[0]);
+    close(err_pipe[0]);
+    return -1;
+  }
+  fcntl(out_pipe[0], F_SETFL, fcntl(out_pipe[0], F_GETFL) | O_NONBLOCK);
+  fcntl(err_pipe[0], F_SETFL, fcntl(err_pipe[0], F_GETFL) | O_NONBLOCK);
+  worker->out.fd.reset(out_pipe[0]);
+  worker->err.fd.reset(err_pipe[0]);
+  worker->pid = pid;
+  worker->pidfd.reset(OpenPidFd(pid));
+  return pid;
+}
+
+}  // namespace
+
+bool RunFanout(const std::vector<FanoutTarget>& targets,
+               const std::string& command,
+               const FanoutOptions& options,
+               int out_fd,
+               int err_fd,
+               std::vector<int>* exit_codes,
+               std::string* err) {
+  if (!exit_codes) {
+    if (err) {
+      *err = "exit codes pointer is null";
+    }
+    return false;
+  }
+  exit_codes->assign(targets.size(), 255);
+
+  std::size_t label_width = 0;
+  for (const auto& target : targets) {
+    label_width = std::max(label_width, DisplayWidth(target.label));
+  }
+  std::vector<std::string> prefixes;
+  prefixes.reserve(targets.size());
+  for (const auto& target : targets) {
+    std::string prefix = target.label;
+    prefix.append(label_width - DisplayWidth(target.label), ' ');
+    prefix += " | ";
+    prefixes.push_back(prefix);
+  }
+
+  const std::size_t limit = options.jobs > 0 ? options.jobs : 1;
+  const std::string binary = ResolveSshBinary();
+  std::vector<Worker> running;
+  running.reserve(limit);
+  std::size_t next = 0;
+  ArgTokens tokens;
+
+  while (next < targets.size() || !running.empty()) {
+    while (next < targets.size() && running.size() < limit) {
+      std::size_t job = next++;
+      const std::string& args = targets[job].args;
+      std::string tok_err;
+      if (!TokenizeArgsInto(args, true, &tokens, &tok_err) || tokens.empty()) {
+        WriteAllToFd(err_fd, prefixes[job] + "sshtab: invalid ssh args\n", nullptr);
+        continue;
+      }
+      std::vector<std::string> argv_storage;
+      argv_storage.emplace_back("ssh");
+      std::string control_path = ControlPathForArgs(args, &tok_err);
+      if (HasControlSocket(control_path)) {
+        argv_storage.emplace_back("-o");
+        argv_storage.push_back("ControlPath=" + control_path);
+      }
+      // No terminal is attached, so prompts would only stall a worker.
+      argv_storage.emplace_back("-o");
+      argv_storage.emplace_back("BatchMode=yes");
+      for (std::size_t t = 0; t < tokens.size(); ++t) {
+        argv_storage.emplace_back(tokens[t]);
+      }
+      argv_storage.push_back(command);
+
+      running.emplace_back();
+      Worker& worker = running.back();
+      worker.job = job;
+      if (SpawnWorker(binary, argv_storage, &worker) < 0) {
+        WriteAllToFd(err_fd, prefixes[job] + "sshtab: spawn failed: " + std::strerror(errno) + "\n",
+                     nullptr);
+        running.pop_back();
+      }
+    }
+    if (running.empty()) {
+      continue;
+    }
+
+    // Workers are reaped when they exit, not when their pipes close: a
+    // background process the remote command left behind may hold stdout
+    // open indefinitely.
+    std::vector<struct pollfd> fds;
+    // Worker index and what the fd is: 0 stdout, 1 stderr, 2 exit.
+    std::vector<std::pair<std::size_t, int>> owners;
+    bool missing_pidfd = false;
+    for (std::size_t i = 0; i < running.size(); ++i) {
+      if (running[i].out.fd.get() >= 0) {
+        fds.push_back(pollfd{running[i].out.fd.get(), POLLIN, 0});
+        owners.emplace_back(i, 0);
+      }
+      if (running[i].err.fd.get() >= 0) {
+        fds.push_back(pollfd{running[i].err.fd.get(), POLLIN, 0});
+        owners.emplace_back(i, 1);
+      }
+      if (running[i].pidfd.get() >= 0) {
+        fds.push_back(pollfd{running[i].pidfd.get(), POLLIN, 0});
+        owners.emplace_back(i, 2);
+      } else {
+        missing_pidfd = true;
+      }
+    }
+    if (poll(fds.data(), fds.size(), missing_pidfd ? kExitPollMs : -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (err) {
+        *err = std::string("poll failed: ") + std::strerror(errno);
+      }
+      return false;
+    }
+
+    auto fail = [&]() {
+      for (auto& w : running) {
+        kill(w.pid, SIGTERM);
+        waitpid(w.pid, nullptr, 0);
+      }
+      return false;
+    };
+    std::vector<bool> exited(running.size(), false);
+    for (std::size_t f = 0; f < fds.size(); ++f) {
+      if (fds[f].revents == 0) {
+        continue;
+      }
+      Worker& worker = running[owners[f].first];
+      if (owners[f].second == 2) {
+        exited[owners[f].first] = true;
+        continue;
+      }
+      bool is_err = owners[f].second == 1;
+      Stream* stream = is_err ? &worker.err : &worker.out;
+      bool open = DrainStream(stream);
+      if (!FlushLines(stream, prefixes[worker.job], is_err ? err_fd : out_fd, !open, err)) {
+        return fail();
+      }
+      if (!open) {
+        stream->fd.reset();
+      }
+    }
+
+    for (std::size_t i = running.size(); i-- > 0;) {
+      Worker& worker = running[i];
+      int status = 0;
+      pid_t rc = 0;
+      if (exited[i] || worker.pidfd.get() < 0) {
+        do {
+          rc = waitpid(worker.pid, &status, worker.pidfd.get() < 0 ? WNOHANG : 0);
+        } while (rc < 0 && errno == EINTR);
+      }
+      if (rc == 0) {
+        continue;
+      }
+      // Whatever the child wrote before exiting is still in the pipes;
+      // output from descendants that outlive it is dropped.
+      for (int which = 0; which < 2; ++which) {
+        Stream* stream = which == 1 ? &worker.err : &worker.out;
+        if (stream->fd.get() < 0) {
+          continue;
+        }
+        DrainStream(stream);
+        if (!FlushLines(stream, prefixes[worker.job], which == 1 ? err_fd : out_fd, true, err)) {
+          return fail();
+        }
+        stream->fd.reset();
+      }
+      int code = 255;
+      if (rc > 0 && WIFEXITED(status)) {
+        code = WEXITSTATUS(status);
+      } else if (rc > 0 && WIFSIGNALED(status)) {
+        code = 128 + WTERMSIG(status);
+      }
+      (*exit_codes)[worker.job] = code;
+      running.erase(running.begin() + static_cast<std::ptrdiff_t>(i));
+    }
+  }
+  return true;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+struct FanoutTarget {
+  std::string args;
+  std::string label;
+};
+
+struct FanoutOptions {
+  std::size_t jobs = 8;
+};
+
+// Runs `ssh <args> <command>` for every target with at most options.jobs
+// children at once. Output is forwarded line by line to out_fd/err_fd with
+// a "label | " prefix. exit_codes is aligned with targets; 255 marks a target
+// whose args could not be tokenized or whose ssh could not be started.
+bool RunFanout(const std::vector<FanoutTarget>& targets,
+               const std::string& command,
+               const FanoutOptions& options,
+               int out_fd,
+               int err_fd,
+               std::vector<int>* exit_codes,
+               std::string* err);
@@ -0,0 +1,84 @@
+#include "hash.h"
+
+#include <cstring>
+
+namespace {
+
+// wyhash (final version 4) with its default secret and seed 0.
+const std::uint64_t kSecret[4] = {0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull,
+                                  0x4d5a2da51de1aa47ull};
+
+__extension__ typedef unsigned __int128 Uint128;
+
+inline void Mum(std::uint64_t* a, std::uint64_t* b) {
+  Uint128 r = static_cast<Uint128>(*a) * *b;
+  *a = static_cast<std::uint64_t>(r);
+  *b = static_cast<std::uint64_t>(r >> 64);
+}
+
+inline std::uint64_t Mix(std::uint64_t a, std::uint64_t b) {
+  Mum(&a, &b);
+  return a ^ b;
+}
+
+inline std::uint64_t Read8(const unsigned char* p) {
+  std::uint64_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline std::uint64_t Read4(const unsigned char* p) {
+  std::uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline std::uint64_t Read3(const unsigned char* p, std::size_t k) {
+  return (static_cast<std::uint64_t>(p[0]) << 16) | (static_cast<std::uint64_t>(p[k >> 1]) << 8) | p[k - 1];
+}
+
+}  // namespace
+
+std::uint64_t HashBytes(std::string_view bytes) {
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(bytes.data());
+  const std::size_t len = bytes.size();
+  std::uint64_t seed = Mix(kSecret[0], kSecret[1]);
+  std::uint64_t a;
+  std::uint64_t b;
+  if (len <= 16) {
+    if (len >= 4) {
+      a = (Read4(p) << 32) | Read4(p + ((len >> 3) << 2));
+      b = (Read4(p + len - 4) << 32) | Read4(p + len - 4 - ((len >> 3) << 2));
+    } else if (len > 0) {
+      a = Read3(p, len);
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    std::size_t i = len;
+    if (i > 48) {
+      std::uint64_t see1 = seed;
+      std::uint64_t see2 = seed;
+      do {
+        seed = Mix(Read8(p) ^ kSecret[1], Read8(p + 8) ^ seed);
+        see1 = Mix(Read8(p + 16) ^ kSecret[2], Read8(p + 24) ^ see1);
+        see2 = Mix(Read8(p + 32) ^ kSecret[3], Read8(p + 40) ^ see2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= see1 ^ see2;
+    }
+    while (i > 16) {
+      seed = Mix(Read8(p) ^ kSecret[1], Read8(p + 8) ^ seed);
+      i -= 16;
+      p += 16;
+    }
+    a = Read8(p + i - 16);
+    b = Read8(p + i - 8);
+  }
+  a ^= kSecret[1];
+  b ^= seed;
+  Mum(&a, &b);
+  return Mix(a ^ kSecret[0] ^ len, b ^ kSecret[1]);
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// 64-bit wyhash of bytes. The seed is fixed, so the value is stable across
+// runs and can name files (control sockets, layer indexes). Not for
+// untrusted adversarial input.
+std::uint64_t HashBytes(std::string_view bytes);
+
+// Hasher for std containers keyed by strings.
+struct StringHash {
+  std::size_t operator()(std::string_view s) const { return static_cast<std::size_t>(HashBytes(s)); }
+};
+
+// Open-addressing table from a 64-bit key hash to a position in a
+// caller-owned vector of entries. Keys live only in the entries; the table
+// compares full keys (through the caller's equal) only when hashes match.
+class FlatHashIndex {
+ public:
+  static constexpr std::uint32_t kNone = UINT32_MAX;
+
+  explicit FlatHashIndex(std::size_t expected = 0) { Reserve(expected); }
+
+  void Reserve(std::size_t expected) {
+    std::size_t want = 16;
+    while (want * 3 / 4 < expected) {
+      want *= 2;
+    }
+    if (want > slots_.size()) {
+      Rehash(want);
+    }
+  }
+
+  std::size_t size() const { return size_; }
+
+  // Returns the position of the entry with this hash for which
+  // equal(position) holds, or kNone.
+  template <typename Equal>
+  std::uint32_t Find(std::uint64_t hash, Equal equal) const {
+    if (slots_.empty()) {
+      return kNone;
+    }
+    const std::size_t mask = slots_.size() - 1;
+    for (std::size_t i = static_cast<std::size_t>(hash) & mask;; i = (i + 1) & mask) {
+      const Slot& slot = slots_[i];
+      if (slot.position == kNone) {
+        return kNone;
+      }
+      if (slot.hash == hash && equal(slot.position)) {
+        return slot.position;
+      }
+    }
+  }
+
+  // Like Find, but records position for hash when no entry matches and
+  // returns it; *inserted tells which happened.
+  template <typename Equal>
+  std::uint32_t FindOrInsert(std::uint64_t hash, std::uint32_t position, Equal equal, bool* inserted) {
+    if ((size_ + 1) * 4 > slots_.size() * 3) {
+      Rehash(slots_.empty() ? 16 : slots_.size() * 2);
+    }
+    const std::size_t mask = slots_.size() - 1;
+    for (std::size_t i = static_cast<std::size_t>(hash) & mask;; i = (i + 1) & mask) {
+      Slot& slot = slots_[i];
+      if (slot.position == kNone) {
+        slot.hash = hash;
+        slot.position = position;
+        ++size_;
+        *inserted = true;
+        return position;
+      }
+      if (slot.hash == hash && equal(slot.position)) {
+        *inserted = false;
+        return slot.position;
+      }
+    }
+  }
+
+ private:
+  struct Slot {
+    std::uint64_t hash = 0;
+    std::uint32_t position = kNone;
+  };
+
+  void Rehash(std::size_t capacity) {
+    std::vector<Slot> old;
+    old.swap(slots_);
+    slots_.assign(capacity, Slot());
+    const std::size_t mask = capacity - 1;
+    for (const Slot& slot : old) {
+      if (slot.position == kNone) {
+        continue;
+      }
+      std::size_t i = static_cast<std::size_t>(slot.hash) & mask;
+      while (slots_[i].position != kNone) {
+        i = (i + 1) & mask;
+      }
+      slots_[i] = slot;
+    }
+  }
+
+  std::vector<Slot> slots_;
+  std::size_t size_ = 0;
+};
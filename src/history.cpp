@@ -1,5 +1,13 @@
 #include "history.h"
 
+#include "archive.h"
+#include "entry_ids.h"
+#include "hash.h"
+#include "layers.h"
+#include "normalize.h"
+#include "segments.h"
+#include "sync.h"
+#include "topk.h"
 #include "util.h"
 
 #include <algorithm>
@@ -7,275 +15,637 @@
 #include <cstring>
 #include <ctime>
 #include <fcntl.h>
+#include <functional>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <sys/file.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 namespace {
 
-bool ParseInt64(const std::string& s, std::int64_t* out) {
-  if (!out) {
+// Record types in the event log. An ssh event shows in both views; a plain
+// command (sshtab add, sshtab <command>) only in the command view.
+const char kTypeSsh = 's';
+const char kTypeCommand = 'c';
+const char kSshTypes[] = {kTypeSsh, '\0'};
+const char kAllTypes[] = {kTypeSsh, kTypeCommand, '\0'};
+
+// One event log line:
+//   ts \t exit_code \t type \t base64(command) [\t first_byte_ms \t duration_ms]
+struct RecordView {
+  std::string_view ts;
+  std::string_view code;
+  char type = 0;
+  std::string_view b64;
+  // The optional timing fields, empty when absent.
+  std::string_view rest;
+};
+
+bool SplitRecord(std::string_view line, RecordView* out) {
+  size_t t1 = line.find('\t');
+  if (t1 == std::string_view::npos) {
     return false;
   }
-  try {
-    size_t idx = 0;
-    long long v = std::stoll(s, &idx, 10);
-    if (idx != s.size()) {
-      return false;
-    }
-    *out = static_cast<std::int64_t>(v);
-    return true;
-  } catch (...) {
+  size_t t2 = line.find('\t', t1 + 1);
+  if (t2 == std::string_view::npos || t2 + 2 >= line.size() || line[t2 + 2] != '\t') {
     return false;
   }
+  out->ts = line.substr(0, t1);
+  out->code = line.substr(t1 + 1, t2 - t1 - 1);
+  out->type = line[t2 + 1];
+  size_t b64_start = t2 + 3;
+  size_t t4 = line.find('\t', b64_start);
+  out->b64 = line.substr(b64_start, t4 == std::string_view::npos ? std::string_view::npos : t4 - b64_start);
+  out->rest = t4 == std::string_view::npos ? std::string_view() : line.substr(t4 + 1);
+  return true;
 }
 
-bool ParseInt(const std::string& s, int* out) {
-  if (!out) {
-    return false;
+bool HasType(const char* types, char type) {
+  return type != '\0' && std::strchr(types, type) != nullptr;
+}
+
+// Opens the event log. Without O_CREAT in flags a missing log yields -1
+// with errno ENOENT.
+int OpenEventLog(const std::string& path, int flags, std::string* err) {
+  if ((flags & O_CREAT) && !EnsureDir(DirnameFromPath(path), err)) {
+    return -1;
+  }
+  int fd = open(path.c_str(), flags | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    int open_errno = errno;
+    if (err) {
+      *err = std::string("open failed: ") + std::strerror(open_errno);
+    }
+    errno = open_errno;
+  }
+  return fd;
+}
+
+std::string EventLogPathOrError(std::string* err) {
+  std::string path_err;
+  std::string path = GetEventLogPath(&path_err);
+  if (path.empty() && err) {
+    *err = path_err;
   }
-  try {
-    size_t idx = 0;
-    int v = std::stoi(s, &idx, 10);
-    if (idx != s.size()) {
+  return path;
+}
+
+// Opens and locks the hot log. A roll renames it into segments/, so a lock
+// taken on a file that is no longer at path is dropped and the open retried.
+// Without O_CREAT in flags a missing log yields false with errno ENOENT.
+bool LockEventLog(const std::string& path,
+                  int flags,
+                  bool exclusive,
+                  ScopedFd* fd,
+                  FlockGuard* lock,
+                  std::string* err) {
+  for (;;) {
+    lock->reset(-1);
+    int raw = OpenEventLog(path, flags, err);
+    if (raw < 0) {
+      return false;
+    }
+    fd->reset(raw);
+    lock->reset(raw);
+    if (!(exclusive ? lock->LockExclusive(err) : lock->LockShared(err))) {
+      return false;
+    }
+    struct stat held;
+    struct stat current;
+    if (fstat(raw, &held) != 0) {
+      if (err) {
+        *err = std::string("fstat failed: ") + std::strerror(errno);
+      }
+      return false;
+    }
+    if (stat(path.c_str(), &current) == 0) {
+      if (held.st_dev == current.st_dev && held.st_ino == current.st_ino) {
+        return true;
+      }
+    } else if (errno != ENOENT) {
+      if (err) {
+        *err = std::string("stat failed: ") + std::strerror(errno);
+      }
       return false;
     }
-    *out = v;
-    return true;
-  } catch (...) {
-    return false;
   }
 }
 
-bool AppendHistoryToPath(const std::string& path,
-                         const std::string& command,
-                         int exit_code,
-                         std::string* err) {
-  if (path.empty()) {
+// A history.log or commands.log of an older version, held exclusively
+// locked from the read until it has been emptied, so a writer of that
+// version waits and its record lands in the next fold.
+struct LegacyLog {
+  std::string path;
+  ScopedFd fd;
+  FlockGuard lock;
+  std::string content;
+};
+
+bool HasLegacyRecords(const std::string& path) {
+  struct stat st;
+  return !path.empty() && stat(path.c_str(), &st) == 0 && st.st_size > 0;
+}
+
+bool LockLegacyLog(LegacyLog* log, std::string* err) {
+  log->fd.reset(open(log->path.c_str(), O_RDWR | O_CLOEXEC));
+  if (log->fd.get() < 0) {
+    if (errno == ENOENT) {
+      return true;
+    }
     if (err) {
-      *err = "history path is empty";
+      *err = std::string("open failed: ") + std::strerror(errno);
     }
     return false;
   }
+  log->lock.reset(log->fd.get());
+  return log->lock.LockExclusive(err) && ReadAllFromFd(log->fd.get(), &log->content, err);
+}
 
-  std::string dir = DirnameFromPath(path);
-  if (dir.empty()) {
+// Keeps the folded records in <path>.migrated and empties the log where it
+// is. Renaming it instead would strand the record of a writer already
+// waiting for the lock in the renamed file.
+bool EmptyLegacyLog(LegacyLog* log, std::string* err) {
+  if (log->content.empty()) {
+    return true;
+  }
+  ScopedFd backup(open((log->path + ".migrated").c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600));
+  if (backup.get() < 0) {
     if (err) {
-      *err = "history directory is empty";
+      *err = std::string("open failed: ") + std::strerror(errno);
     }
     return false;
   }
-  if (!EnsureDir(dir, err)) {
+  if (!WriteAllToFd(backup.get(), log->content, err)) {
     return false;
   }
-
-  int fd = open(path.c_str(), O_CREAT | O_WRONLY | O_APPEND | O_CLOEXEC, 0600);
-  if (fd < 0) {
+  if (ftruncate(log->fd.get(), 0) != 0) {
     if (err) {
-      *err = std::string("open failed: ") + std::strerror(errno);
+      *err = std::string("ftruncate failed: ") + std::strerror(errno);
     }
     return false;
   }
+  return true;
+}
 
-  ScopedFd fd_guard(fd);
-  FlockGuard lock(fd);
-  if (!lock.LockExclusive(err)) {
+// Appends the records older versions wrote to history.log and commands.log
+// to the event log at path, whenever either holds any: before the first
+// use of events.log, and again whenever a shell still running an older
+// version writes to them. The two share one record layout without the
+// type field, and every ssh event was written to both. Records of
+// history.log become ssh events; a commands.log record is a plain command
+// unless it duplicates a history.log record with the same time, exit code
+// and command.
+bool FoldLegacyLogs(const std::string& path, std::string* err) {
+  LegacyLog ssh_log;
+  LegacyLog command_log;
+  ssh_log.path = GetHistoryPath(err);
+  command_log.path = GetCommandHistoryPath(err);
+  if (ssh_log.path.empty() || command_log.path.empty()) {
+    return false;
+  }
+  if (!HasLegacyRecords(ssh_log.path) && !HasLegacyRecords(command_log.path)) {
+    return true;
+  }
+  // history.log is locked first, and both before the event log.
+  if (!LockLegacyLog(&ssh_log, err) || !LockLegacyLog(&command_log, err)) {
     return false;
   }
+  if (ssh_log.content.empty() && command_log.content.empty()) {
+    return true;
+  }
 
-  std::time_t now = std::time(nullptr);
-  std::string encoded = Base64Encode(command);
-  std::ostringstream oss;
-  oss << static_cast<long long>(now) << '\t' << exit_code << '\t' << encoded << '\n';
-  std::string line = oss.str();
-  return WriteAllToFd(fd, line, err);
+  struct Line {
+    std::int64_t ts = 0;
+    std::string text;
+  };
+  std::vector<Line> out;
+  std::unordered_map<std::string_view, int, StringHash> ssh_events;
+  // Splits "ts \t code \t b64 [\t rest]" after the code field.
+  auto add = [&out](std::string_view line, char type) {
+    size_t t1 = line.find('\t');
+    size_t t2 = t1 == std::string_view::npos ? t1 : line.find('\t', t1 + 1);
+    Line converted;
+    if (t2 == std::string_view::npos || !ParseInt64(line.substr(0, t1), &converted.ts)) {
+      return;
+    }
+    converted.text.reserve(line.size() + 3);
+    converted.text.append(line.substr(0, t2 + 1));
+    converted.text.push_back(type);
+    converted.text.push_back('\t');
+    converted.text.append(line.substr(t2 + 1));
+    converted.text.push_back('\n');
+    out.push_back(std::move(converted));
+  };
+  // The first three fields identify an event in either file.
+  auto event_of = [](std::string_view line) {
+    size_t t1 = line.find('\t');
+    size_t t2 = t1 == std::string_view::npos ? t1 : line.find('\t', t1 + 1);
+    size_t t3 = t2 == std::string_view::npos ? t2 : line.find('\t', t2 + 1);
+    return line.substr(0, t3);
+  };
+  ForEachLine(ssh_log.content, [&](std::string_view line) {
+    ++ssh_events[event_of(line)];
+    add(line, kTypeSsh);
+  });
+  ForEachLine(command_log.content, [&](std::string_view line) {
+    auto it = ssh_events.find(event_of(line));
+    if (it != ssh_events.end() && it->second > 0) {
+      --it->second;
+      return;
+    }
+    add(line, kTypeCommand);
+  });
+  std::stable_sort(out.begin(), out.end(), [](const Line& a, const Line& b) { return a.ts < b.ts; });
+
+  std::string data;
+  for (const auto& line : out) {
+    data += line.text;
+  }
+  ScopedFd fd;
+  FlockGuard lock;
+  if (!LockEventLog(path, O_CREAT | O_WRONLY | O_APPEND, true, &fd, &lock, err) ||
+      !WriteAllToFd(fd.get(), data, err)) {
+    return false;
+  }
+  return EmptyLegacyLog(&ssh_log, err) && EmptyLegacyLog(&command_log, err);
 }
 
-std::vector<HistoryEntry> LoadRecentUniqueFromPath(const std::string& path,
-                                                   std::size_t limit,
-                                                   std::string* err) {
-  std::vector<HistoryEntry> result;
-  if (path.empty()) {
-    if (err) {
-      *err = "history path is empty";
+// LockEventLog, after folding in any records of older versions. A lock
+// the caller still holds through lock is dropped first.
+bool OpenLockedEventLog(const std::string& path,
+                        int flags,
+                        bool exclusive,
+                        ScopedFd* fd,
+                        FlockGuard* lock,
+                        std::string* err) {
+  lock->reset(-1);
+  return FoldLegacyLogs(path, err) && LockEventLog(path, flags, exclusive, fd, lock, err);
+}
+
+std::string SegmentDirOrError(std::string* err) {
+  std::string path_err;
+  std::string dir = GetSegmentDir(&path_err);
+  if (dir.empty() && err) {
+    *err = path_err;
+  }
+  return dir;
+}
+
+// Feeds every complete or trailing line of the file at fd to fn through a
+// fixed buffer, so memory does not grow with the file.
+bool StreamLines(int fd, const std::function<void(std::string_view)>& fn, std::string* err) {
+  std::string pending;
+  char buf[64 * 1024];
+  for (;;) {
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (err) {
+        *err = std::string("read failed: ") + std::strerror(errno);
+      }
+      return false;
     }
-    return result;
+    if (n == 0) {
+      break;
+    }
+    std::string_view chunk(buf, static_cast<size_t>(n));
+    size_t pos = 0;
+    for (size_t nl = chunk.find('\n'); nl != std::string_view::npos; nl = chunk.find('\n', pos)) {
+      if (pending.empty()) {
+        fn(chunk.substr(pos, nl - pos));
+      } else {
+        pending.append(chunk.substr(pos, nl - pos));
+        fn(pending);
+        pending.clear();
+      }
+      pos = nl + 1;
+    }
+    pending.append(chunk.substr(pos));
   }
+  if (!pending.empty()) {
+    fn(pending);
+  }
+  return true;
+}
 
+bool ReadFile(const std::string& path, std::string* content, std::string* err) {
   int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
   if (fd < 0) {
-    if (errno == ENOENT) {
-      return result;
-    }
     if (err) {
       *err = std::string("open failed: ") + std::strerror(errno);
     }
-    return result;
+    return false;
   }
-
   ScopedFd fd_guard(fd);
-  FlockGuard lock(fd);
-  if (!lock.LockShared(err)) {
-    return result;
-  }
+  return ReadAllFromFd(fd, content, err);
+}
 
-  std::string content;
-  if (!ReadAllFromFd(fd, &content, err)) {
-    return result;
+// Reads the records of a frozen segment, from its archive once compressed.
+bool ReadSegmentLog(const SegmentFile& segment, std::string* content, std::string* err) {
+  if (segment.compressed) {
+    return ReadArchive(segment.archive_path, content, err);
   }
+  return ReadFile(segment.log_path, content, err);
+}
 
-  std::unordered_map<std::string, HistoryEntry> seen;
-  std::istringstream in(content);
-  std::string line;
-  while (std::getline(in, line)) {
-    if (line.empty()) {
-      continue;
-    }
-    size_t t1 = line.find('\t');
-    if (t1 == std::string::npos) {
-      continue;
-    }
-    size_t t2 = line.find('\t', t1 + 1);
-    if (t2 == std::string::npos) {
-      continue;
+// Feeds fn the records of a frozen segment that may fall in
+// [from_ts, to_ts]; an archive decompresses only the blocks that overlap.
+bool StreamSegmentLines(const SegmentFile& segment,
+                        std::int64_t from_ts,
+                        std::int64_t to_ts,
+                        const std::function<void(std::string_view)>& fn,
+                        std::string* err) {
+  if (segment.compressed) {
+    return StreamArchiveLines(segment.archive_path, from_ts, to_ts, fn, err);
+  }
+  int fd = open(segment.log_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    if (err) {
+      *err = std::string("open failed: ") + std::strerror(errno);
     }
-    std::string ts_str = line.substr(0, t1);
-    std::string code_str = line.substr(t1 + 1, t2 - t1 - 1);
-    std::string b64 = line.substr(t2 + 1);
+    return false;
+  }
+  ScopedFd fd_guard(fd);
+  return StreamLines(fd, fn, err);
+}
 
-    std::int64_t ts = 0;
-    int exit_code = 0;
-    if (!ParseInt64(ts_str, &ts)) {
-      continue;
+void RemoveSegmentFiles(const SegmentFile& segment) {
+  unlink(segment.summary_path.c_str());
+  unlink(segment.archive_path.c_str());
+  unlink(segment.log_path.c_str());
+}
+
+// Successful records of one (type, command) pair, keyed on the still-encoded
+// command field: records are written with canonical base64, so equal
+// commands have equal fields and each distinct command is decoded once
+// instead of once per line.
+struct Seen {
+  std::string_view b64;
+  char type = 0;
+  std::int64_t last_used = 0;
+  std::int64_t count = 0;
+  // First-byte latencies as (ms, weight). A frozen segment contributes its
+  // median weighted by its number of samples.
+  std::vector<std::pair<std::int64_t, std::int64_t>> samples;
+};
+
+class SeenTable {
+ public:
+  Seen& Touch(char type, std::string_view b64) {
+    bool inserted = false;
+    std::uint32_t at = index_.FindOrInsert(
+        HashBytes(b64) ^ static_cast<std::uint64_t>(type), static_cast<std::uint32_t>(seen_.size()),
+        [&](std::uint32_t i) { return seen_[i].type == type && seen_[i].b64 == b64; }, &inserted);
+    if (inserted) {
+      seen_.emplace_back();
+      seen_.back().b64 = b64;
+      seen_.back().type = type;
     }
-    if (!ParseInt(code_str, &exit_code)) {
-      continue;
+    return seen_[at];
+  }
+
+  std::vector<Seen>& entries() { return seen_; }
+
+ private:
+  std::vector<Seen> seen_;
+  FlatHashIndex index_;
+};
+
+// Adds the successful records of the given types in content to table, whose
+// views then point into content.
+void AggregateRecords(std::string_view content, const char* types, SeenTable* table) {
+  ForEachLine(content, [&](std::string_view line) {
+    RecordView record;
+    if (line.empty() || !SplitRecord(line, &record) || !HasType(types, record.type)) {
+      return;
     }
-    if (exit_code != 0) {
-      continue;
+    std::int64_t ts = 0;
+    std::int64_t exit_code = 0;
+    if (!ParseInt64(record.ts, &ts) || !ParseInt64(record.code, &exit_code) || exit_code != 0) {
+      return;
     }
+    Seen& entry = table->Touch(record.type, record.b64);
+    entry.count += 1;
+    entry.last_used = std::max(entry.last_used, ts);
 
-    std::string decoded;
-    std::string decode_err;
-    if (!Base64Decode(b64, &decoded, &decode_err)) {
-      continue;
+    // Fields after the command are optional: first-byte and duration ms.
+    if (!record.rest.empty()) {
+      size_t tab = record.rest.find('\t');
+      std::int64_t first_byte_ms = -1;
+      if (ParseInt64(record.rest.substr(0, tab), &first_byte_ms) && first_byte_ms >= 0) {
+        entry.samples.emplace_back(first_byte_ms, 1);
+      }
     }
+  });
+}
 
-    auto it = seen.find(decoded);
-    if (it == seen.end()) {
-      HistoryEntry entry;
-      entry.command = decoded;
-      entry.last_used = ts;
-      entry.count = 1;
-      seen.emplace(decoded, entry);
-    } else {
-      it->second.count += 1;
-      if (ts > it->second.last_used) {
-        it->second.last_used = ts;
-      }
+// Weighted median of samples, or -1 without any; *weight receives the total.
+std::int64_t MedianSample(std::vector<std::pair<std::int64_t, std::int64_t>>* samples, std::int64_t* weight) {
+  std::sort(samples->begin(), samples->end());
+  std::int64_t total = 0;
+  for (const auto& sample : *samples) {
+    total += sample.second;
+  }
+  *weight = total;
+  std::int64_t seen = 0;
+  for (const auto& sample : *samples) {
+    seen += sample.second;
+    if (seen > total / 2) {
+      return sample.first;
     }
   }
+  return -1;
+}
 
-  result.reserve(seen.size());
-  for (const auto& kv : seen) {
-    result.push_back(kv.second);
-  }
+// One summary line per (type, command) of a frozen segment:
+//   type \t base64(command) \t count \t last_used \t connect_samples \t connect_ms
+// Only successful records are summarized; failures stay in the segment for
+// prune --failed.
+struct SummaryView {
+  char type = 0;
+  std::string_view b64;
+  std::int64_t count = 0;
+  std::int64_t last_used = 0;
+  std::int64_t connect_samples = 0;
+  std::int64_t connect_ms = -1;
+};
 
-  std::sort(result.begin(), result.end(), [](const HistoryEntry& a, const HistoryEntry& b) {
-    if (a.last_used != b.last_used) {
-      return a.last_used > b.last_used;
-    }
-    if (a.count != b.count) {
-      return a.count > b.count;
+bool SplitSummary(std::string_view line, SummaryView* out) {
+  if (line.size() < 3 || line[1] != '\t') {
+    return false;
+  }
+  std::string_view fields[5];
+  std::string_view rest = line.substr(2);
+  for (int i = 0; i < 5; ++i) {
+    size_t tab = rest.find('\t');
+    if ((tab == std::string_view::npos) != (i == 4)) {
+      return false;
     }
-    return a.command < b.command;
-  });
+    fields[i] = rest.substr(0, tab);
+    rest = tab == std::string_view::npos ? std::string_view() : rest.substr(tab + 1);
+  }
+  out->type = line[0];
+  out->b64 = fields[0];
+  return !out->b64.empty() && ParseInt64(fields[1], &out->count) && ParseInt64(fields[2], &out->last_used) &&
+         ParseInt64(fields[3], &out->connect_samples) && ParseInt64(fields[4], &out->connect_ms);
+}
 
-  if (limit > 0 && result.size() > limit) {
-    result.resize(limit);
+std::string FormatSummary(std::vector<Seen>* entries) {
+  std::ostringstream oss;
+  for (auto& s : *entries) {
+    std::int64_t samples = 0;
+    std::int64_t median = MedianSample(&s.samples, &samples);
+    oss << s.type << '\t' << s.b64 << '\t' << s.count << '\t' << s.last_used << '\t' << samples << '\t' << median
+        << '\n';
   }
+  return oss.str();
+}
 
-  return result;
+std::string BuildSummary(std::string_view content) {
+  SeenTable table;
+  AggregateRecords(content, kAllTypes, &table);
+  return FormatSummary(&table.entries());
 }
 
-}  // namespace
+void AggregateSummaryLine(std::string_view line, const char* types, SeenTable* table) {
+  SummaryView summary;
+  if (!SplitSummary(line, &summary) || !HasType(types, summary.type)) {
+    return;
+  }
+  Seen& entry = table->Touch(summary.type, summary.b64);
+  entry.count += summary.count;
+  entry.last_used = std::max(entry.last_used, summary.last_used);
+  if (summary.connect_samples > 0 && summary.connect_ms >= 0) {
+    entry.samples.emplace_back(summary.connect_ms, summary.connect_samples);
+  }
+}
 
-bool AppendHistory(const std::string& command, int exit_code, std::string* err) {
-  std::string path_err;
-  std::string path = GetHistoryPath(&path_err);
-  if (path.empty()) {
-    if (err) {
-      *err = path_err;
+void AggregateSummary(std::string_view content, const char* types, SeenTable* table) {
+  ForEachLine(content, [&](std::string_view line) { AggregateSummaryLine(line, types, table); });
+}
+
+// Adds every origin's aggregates in remote.sum content to table.
+void AggregateRemote(std::string_view content, const char* types, SeenTable* table) {
+  ForEachLine(content, [&](std::string_view line) {
+    std::string_view origin;
+    std::string_view summary;
+    if (SplitRemoteLine(line, &origin, &summary)) {
+      AggregateSummaryLine(summary, types, table);
     }
-    return false;
-  }
-  return AppendHistoryToPath(path, command, exit_code, err);
+  });
 }
 
-bool AppendCommandHistory(const std::string& command, int exit_code, std::string* err) {
-  std::string path_err;
-  std::string path = GetCommandHistoryPath(&path_err);
+// Reads remote.sum; without imports there is none and content is empty.
+bool ReadRemoteHistory(std::string* content, std::string* err) {
+  content->clear();
+  std::string path = GetRemoteHistoryPath(err);
   if (path.empty()) {
+    return false;
+  }
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    if (errno == ENOENT) {
+      return true;
+    }
     if (err) {
-      *err = path_err;
+      *err = std::string("open failed: ") + std::strerror(errno);
     }
     return false;
   }
-  return AppendHistoryToPath(path, command, exit_code, err);
+  ScopedFd fd_guard(fd);
+  return ReadAllFromFd(fd, content, err);
 }
 
-std::vector<HistoryEntry> LoadRecentUnique(std::size_t limit, std::string* err) {
-  std::string path_err;
-  std::string path = GetHistoryPath(&path_err);
-  if (path.empty()) {
+// Reads the summary of segment, or summarizes the segment itself when a
+// crash between rolling and summarizing left none.
+bool ReadSegmentSummary(const SegmentFile& segment, std::string* summary, std::string* err) {
+  int fd = open(segment.summary_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd >= 0) {
+    ScopedFd fd_guard(fd);
+    return ReadAllFromFd(fd, summary, err);
+  }
+  if (errno != ENOENT) {
     if (err) {
-      *err = path_err;
+      *err = std::string("open failed: ") + std::strerror(errno);
     }
-    return std::vector<HistoryEntry>();
+    return false;
   }
-  return LoadRecentUniqueFromPath(path, limit, err);
+  std::string content;
+  if (!ReadSegmentLog(segment, &content, err)) {
+    return false;
+  }
+  *summary = BuildSummary(content);
+  return true;
 }
 
-std::vector<HistoryEntry> LoadRecentUniqueCommands(std::size_t limit, std::string* err) {
-  std::string path_err;
-  std::string path = GetCommandHistoryPath(&path_err);
-  if (path.empty()) {
-    if (err) {
-      *err = path_err;
-    }
-    return std::vector<HistoryEntry>();
+// Opens and share-locks segments.lock and lists the frozen segments.
+bool ListSegmentsShared(ScopedFd* lock_fd,
+                        FlockGuard* lock,
+                        std::vector<SegmentFile>* segments,
+                        std::string* err) {
+  std::string dir = SegmentDirOrError(err);
+  if (dir.empty()) {
+    return false;
+  }
+  lock_fd->reset(OpenSegmentLock(err));
+  if (lock_fd->get() < 0) {
+    return false;
   }
-  return LoadRecentUniqueFromPath(path, limit, err);
+  lock->reset(lock_fd->get());
+  return lock->LockShared(err) && ListSegments(dir, segments, err);
 }
 
-bool DeleteHistoryCommand(const std::string& command, int* removed, std::string* err) {
-  if (removed) {
-    *removed = 0;
-  }
+// Hot logs roll once they reach this size, or when they hold a record from
+// a calendar month before the one being appended to.
+const off_t kSegmentMaxBytes = 4 << 20;
 
-  std::string path_err;
-  std::string path = GetHistoryPath(&path_err);
-  if (path.empty()) {
-    if (err) {
-      *err = path_err;
-    }
+bool ShouldRoll(int fd, std::time_t now) {
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
     return false;
   }
-
-  int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
-  if (fd < 0) {
-    if (err) {
-      *err = std::string("open failed: ") + std::strerror(errno);
-    }
+  if (st.st_size >= kSegmentMaxBytes) {
+    return true;
+  }
+  char head[32];
+  ssize_t n = pread(fd, head, sizeof(head), 0);
+  if (n <= 0) {
     return false;
   }
+  std::string_view first(head, static_cast<size_t>(n));
+  std::int64_t first_ts = 0;
+  if (!ParseInt64(first.substr(0, first.find('\t')), &first_ts)) {
+    return false;
+  }
+  std::time_t first_time = static_cast<std::time_t>(first_ts);
+  struct tm first_tm;
+  struct tm now_tm;
+  if (!localtime_r(&first_time, &first_tm) || !localtime_r(&now, &now_tm)) {
+    return false;
+  }
+  return first_tm.tm_year != now_tm.tm_year || first_tm.tm_mon != now_tm.tm_mon;
+}
 
-  ScopedFd fd_guard(fd);
-  FlockGuard lock(fd);
+// Freezes the hot log at path, which fd holds exclusively locked: it moves
+// into segments/, gets a summary, and is compressed into an archive. The
+// caller reopens path afterwards.
+bool RollHotLog(const std::string& path, int fd, std::string* err) {
+  std::string dir = SegmentDirOrError(err);
+  if (dir.empty() || !EnsureDir(dir, err)) {
+    return false;
+  }
+  ScopedFd lock_fd(OpenSegmentLock(err));
+  if (lock_fd.get() < 0) {
+    return false;
+  }
+  FlockGuard lock(lock_fd.get());
   if (!lock.LockExclusive(err)) {
     return false;
   }
@@ -284,199 +654,1094 @@ bool DeleteHistoryCommand(const std::string& command, int* removed, std::string*
   if (!ReadAllFromFd(fd, &content, err)) {
     return false;
   }
-
-  std::string dir = DirnameFromPath(path);
-  std::string tmp_path;
-  ScopedFd tmp_guard;
-  {
-    std::string tmpl = dir + "/history.log.tmp.XXXXXX";
-    std::vector<char> tmp_buf(tmpl.begin(), tmpl.end());
-    tmp_buf.push_back('\0');
-    int tmp_fd = mkstemp(tmp_buf.data());
-    if (tmp_fd < 0) {
-      if (err) {
-        *err = std::string("mkstemp failed: ") + std::strerror(errno);
-      }
-      return false;
+  std::int64_t first_ts = INT64_MAX;
+  std::int64_t last_ts = INT64_MIN;
+  ForEachLine(content, [&](std::string_view line) {
+    RecordView record;
+    std::int64_t ts = 0;
+    if (SplitRecord(line, &record) && ParseInt64(record.ts, &ts)) {
+      first_ts = std::min(first_ts, ts);
+      last_ts = std::max(last_ts, ts);
     }
-    tmp_path = tmp_buf.data();
-    tmp_guard.reset(tmp_fd);
+  });
+  if (first_ts > last_ts) {
+    first_ts = last_ts = static_cast<std::int64_t>(std::time(nullptr));
   }
 
-  int removed_count = 0;
-  std::istringstream in(content);
-  std::string line;
-  while (std::getline(in, line)) {
-    bool drop = false;
-    size_t t1 = line.find('\t');
-    size_t t2 = t1 == std::string::npos ? std::string::npos : line.find('\t', t1 + 1);
-    if (t1 != std::string::npos && t2 != std::string::npos) {
-      std::string b64 = line.substr(t2 + 1);
-      std::string decoded;
-      std::string decode_err;
-      if (Base64Decode(b64, &decoded, &decode_err) && decoded == command) {
-        drop = true;
-        ++removed_count;
+  // Segments a crash left without a summary or uncompressed are finished
+  // now.
+  std::vector<SegmentFile> segments;
+  if (ListSegments(dir, &segments, nullptr)) {
+    for (const auto& segment : segments) {
+      struct stat st;
+      std::string summary;
+      if (stat(segment.summary_path.c_str(), &st) != 0 && ReadSegmentSummary(segment, &summary, nullptr)) {
+        WriteFileAtomically(segment.summary_path, summary, nullptr);
       }
-    }
-
-    if (!drop) {
-      std::string out_line = line + "\n";
-      if (!WriteAllToFd(tmp_guard.get(), out_line, err)) {
-        unlink(tmp_path.c_str());
-        return false;
+      std::string log;
+      if (!segment.compressed && ReadFile(segment.log_path, &log, nullptr) &&
+          WriteArchive(segment.archive_path, log, nullptr)) {
+        unlink(segment.log_path.c_str());
+      } else if (segment.stale_log) {
+        unlink(segment.log_path.c_str());
       }
     }
   }
 
-  if (removed_count == 0) {
+  SegmentFile segment = NewSegmentFile(dir, first_ts, last_ts);
+  if (rename(path.c_str(), segment.log_path.c_str()) != 0) {
     if (err) {
-      *err = "entry not found";
+      *err = std::string("rename failed: ") + std::strerror(errno);
     }
-    unlink(tmp_path.c_str());
     return false;
   }
-
-  if (fsync(tmp_guard.get()) != 0) {
-    if (err) {
-      *err = std::string("fsync failed: ") + std::strerror(errno);
-    }
-    unlink(tmp_path.c_str());
-    return false;
+  // The segment is already frozen; without its summary it is only slower
+  // to load until the next roll writes one.
+  WriteFileAtomically(segment.summary_path, BuildSummary(content), nullptr);
+  // Likewise an uncompressed segment is only larger.
+  if (WriteArchive(segment.archive_path, content, nullptr)) {
+    unlink(segment.log_path.c_str());
   }
+  return FsyncDir(DirnameFromPath(path), err) && FsyncDir(dir, err);
+}
 
-  if (rename(tmp_path.c_str(), path.c_str()) != 0) {
-    if (err) {
-      *err = std::string("rename failed: ") + std::strerror(errno);
-    }
-    unlink(tmp_path.c_str());
+// Appends one record per command with a single write under one lock, so a
+// batch lands contiguously even with concurrent writers.
+bool AppendEvents(char type,
+                  const std::vector<std::string>& commands,
+                  int exit_code,
+                  const ConnectTiming* timing,
+                  std::string* err) {
+  std::string path = EventLogPathOrError(err);
+  if (path.empty()) {
     return false;
   }
+  if (commands.empty()) {
+    return true;
+  }
 
-  if (!FsyncDir(dir, err)) {
+  const int flags = O_CREAT | O_RDWR | O_APPEND;
+  ScopedFd fd;
+  FlockGuard lock;
+  if (!OpenLockedEventLog(path, flags, true, &fd, &lock, err)) {
     return false;
   }
 
-  if (removed) {
-    *removed = removed_count;
+  std::time_t now = std::time(nullptr);
+  if (ShouldRoll(fd.get(), now)) {
+    // A failed roll is retried by the next append; the records still land
+    // in the hot log.
+    std::string roll_err;
+    if (RollHotLog(path, fd.get(), &roll_err) && !OpenLockedEventLog(path, flags, true, &fd, &lock, err)) {
+      return false;
+    }
   }
-  return true;
-}
 
-bool DeleteCommandHistory(const std::string& command, int* removed, std::string* err) {
-  if (removed) {
-    *removed = 0;
+  std::ostringstream oss;
+  for (const auto& command : commands) {
+    oss << static_cast<long long>(now) << '\t' << exit_code << '\t' << type << '\t' << Base64Encode(command);
+    if (timing) {
+      oss << '\t' << static_cast<long long>(timing->first_byte_ms) << '\t'
+          << static_cast<long long>(timing->duration_ms);
+    }
+    oss << '\n';
+  }
+  if (!WriteAllToFd(fd.get(), oss.str(), err)) {
+    return false;
+  }
+  lock.Unlock();
+  // New ssh entries get their IDs as they are recorded; history from before
+  // IDs existed gets them first, most recent first.
+  if (type != kTypeSsh || exit_code != 0) {
+    return true;
+  }
+  if (!HaveEntryIdIndex() && !SyncEntryIds(err)) {
+    return false;
   }
+  std::vector<std::int64_t> ids;
+  return AssignEntryIds(commands, &ids, err);
+}
 
-  std::string path_err;
-  std::string path = GetCommandHistoryPath(&path_err);
+// Folds the records of one spelling into a view's entry for its target;
+// the entry shows the most recently used spelling.
+struct ViewEntry {
+  bool present = false;
+  HistoryEntry entry;
+  std::vector<std::pair<std::int64_t, std::int64_t>> samples;
+};
+
+void FoldSpelling(const std::string& command, const Seen& seen, ViewEntry* view) {
+  HistoryEntry& entry = view->entry;
+  const int count = static_cast<int>(seen.count);
+  if (!view->present) {
+    view->present = true;
+    entry.command = command;
+    entry.last_used = seen.last_used;
+    entry.count = count;
+  } else {
+    if (seen.last_used > entry.last_used ||
+        (seen.last_used == entry.last_used &&
+         (count > entry.count || (count == entry.count && command < entry.command)))) {
+      entry.command = command;
+    }
+    entry.count += count;
+    entry.last_used = std::max(entry.last_used, seen.last_used);
+  }
+  view->samples.insert(view->samples.end(), seen.samples.begin(), seen.samples.end());
+}
+
+void SortEntries(std::vector<HistoryEntry>* entries) {
+  std::sort(entries->begin(), entries->end(), [](const HistoryEntry& a, const HistoryEntry& b) {
+    if (a.last_used != b.last_used) {
+      return a.last_used > b.last_used;
+    }
+    if (a.count != b.count) {
+      return a.count > b.count;
+    }
+    return a.command < b.command;
+  });
+}
+
+std::vector<HistoryEntry> FinishView(std::vector<ViewEntry>* views, std::size_t limit) {
+  std::vector<HistoryEntry> result;
+  for (auto& view : *views) {
+    if (!view.present) {
+      continue;
+    }
+    std::int64_t samples = 0;
+    std::int64_t median = MedianSample(&view.samples, &samples);
+    if (samples > 0) {
+      view.entry.connect_ms = median;
+      view.entry.connect_samples = static_cast<int>(samples);
+    }
+    result.push_back(std::move(view.entry));
+  }
+
+  SortEntries(&result);
+  if (limit > 0 && result.size() > limit) {
+    result.resize(limit);
+  }
+  return result;
+}
+
+// What a SeenTable filled by AggregateHistory points into.
+struct AggregateSources {
+  std::string hot;
+  std::vector<std::string> summaries;
+  std::string remote;
+};
+
+// Adds this machine's successful records of the given types to table, from
+// the hot log and the segment summaries, and with_remote those imported
+// from other machines.
+bool AggregateHistory(const char* types,
+                      bool with_remote,
+                      AggregateSources* sources,
+                      SeenTable* table,
+                      std::string* err) {
+  std::string path = EventLogPathOrError(err);
   if (path.empty()) {
+    return false;
+  }
+
+  // The hot log stays share-locked while the summaries are read, so a roll
+  // cannot move records between the two halfway through.
+  ScopedFd fd;
+  FlockGuard lock;
+  if (OpenLockedEventLog(path, O_RDONLY, false, &fd, &lock, err)) {
+    if (!ReadAllFromFd(fd.get(), &sources->hot, err)) {
+      return false;
+    }
+  } else if (errno == ENOENT) {
     if (err) {
-      *err = path_err;
+      err->clear();
     }
+  } else {
     return false;
   }
+  AggregateRecords(sources->hot, types, table);
 
-  int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
-  if (fd < 0) {
-    if (errno == ENOENT) {
+  ScopedFd segment_lock_fd;
+  FlockGuard segment_lock;
+  std::vector<SegmentFile> segments;
+  if (!ListSegmentsShared(&segment_lock_fd, &segment_lock, &segments, err)) {
+    return false;
+  }
+  sources->summaries.resize(segments.size());
+  for (size_t i = 0; i < segments.size(); ++i) {
+    if (!ReadSegmentSummary(segments[i], &sources->summaries[i], err)) {
+      return false;
+    }
+    AggregateSummary(sources->summaries[i], types, table);
+  }
+  if (with_remote) {
+    if (!ReadRemoteHistory(&sources->remote, err)) {
+      return false;
+    }
+    AggregateRemote(sources->remote, types, table);
+  }
+  return true;
+}
+
+// The target keys of every entry of each view, before limits apply.
+struct ViewKeys {
+  std::unordered_set<std::string> ssh;
+  std::unordered_set<std::string> commands;
+};
+
+void BuildViews(SeenTable* table,
+                std::size_t limit,
+                bool want_ssh,
+                bool want_commands,
+                HistoryViews* out,
+                ViewKeys* keys) {
+  // Spellings of the same ssh target ("-p 22 h" and "h -p22") become one
+  // entry per view. Keys are computed once per distinct command, not per
+  // line.
+  struct Group {
+    std::string key;
+    ViewEntry ssh;
+    ViewEntry all;
+  };
+  std::vector<Seen>& seen = table->entries();
+  std::vector<Group> groups;
+  FlatHashIndex group_index(seen.size());
+  groups.reserve(seen.size());
+  for (const auto& s : seen) {
+    std::string decoded;
+    std::string decode_err;
+    if (!Base64Decode(std::string(s.b64), &decoded, &decode_err)) {
+      continue;
+    }
+    std::string key = SshCommandKey(decoded);
+    bool inserted = false;
+    std::uint32_t at = group_index.FindOrInsert(
+        HashBytes(key), static_cast<std::uint32_t>(groups.size()),
+        [&](std::uint32_t i) { return groups[i].key == key; }, &inserted);
+    if (inserted) {
+      groups.emplace_back();
+      groups.back().key = std::move(key);
+    }
+    Group& g = groups[at];
+    if (want_ssh && s.type == kTypeSsh) {
+      FoldSpelling(decoded, s, &g.ssh);
+    }
+    if (want_commands) {
+      FoldSpelling(decoded, s, &g.all);
+    }
+  }
+
+  std::vector<ViewEntry> ssh_views;
+  std::vector<ViewEntry> command_views;
+  ssh_views.reserve(want_ssh ? groups.size() : 0);
+  command_views.reserve(want_commands ? groups.size() : 0);
+  for (auto& g : groups) {
+    if (keys && g.ssh.present) {
+      keys->ssh.insert(g.key);
+    }
+    if (keys && g.all.present) {
+      keys->commands.insert(g.key);
+    }
+    if (want_ssh) {
+      ssh_views.push_back(std::move(g.ssh));
+    }
+    if (want_commands) {
+      command_views.push_back(std::move(g.all));
+    }
+  }
+  out->ssh = FinishView(&ssh_views, limit);
+  out->commands = FinishView(&command_views, limit);
+}
+
+bool LoadViews(std::size_t limit, bool want_ssh, bool want_commands, HistoryViews* out, std::string* err) {
+  out->ssh.clear();
+  out->commands.clear();
+  const char* types = want_commands ? kAllTypes : kSshTypes;
+  AggregateSources sources;
+  SeenTable table;
+  if (!AggregateHistory(types, true, &sources, &table, err)) {
+    return false;
+  }
+  // Team layers fill in below the personal entries; without any, the
+  // target keys are not collected.
+  std::vector<std::string> layers = GetHistoryLayerPaths();
+  ViewKeys keys;
+  BuildViews(&table, limit, want_ssh, want_commands, out, layers.empty() ? nullptr : &keys);
+  if (!layers.empty()) {
+    if (want_ssh) {
+      out->ssh = MergeHistoryLayers(layers, std::move(out->ssh), keys.ssh, true, limit);
+    }
+    if (want_commands) {
+      out->commands = MergeHistoryLayers(layers, std::move(out->commands), keys.commands, false, limit);
+    }
+  }
+  return true;
+}
+
+// Counters kept per requested entry by the approximate loaders. With m
+// counters over n records a count is overstated by at most n / m.
+const std::size_t kApproxCountersPerEntry = 16;
+const std::size_t kApproxMinCounters = 256;
+
+std::vector<HistoryEntry> LoadFrequent(std::size_t k, const char* types, std::string* err) {
+  std::vector<HistoryEntry> result;
+  if (k == 0) {
+    HistoryViews views;
+    bool ssh_only = !HasType(types, kTypeCommand);
+    LoadViews(0, ssh_only, !ssh_only, &views, err);
+    return std::move(ssh_only ? views.ssh : views.commands);
+  }
+  std::string path = EventLogPathOrError(err);
+  if (path.empty()) {
+    return result;
+  }
+
+  // Logs and summaries are streamed through a fixed buffer rather than read
+  // whole, so memory depends on k and the longest line, not on the history.
+  SpaceSaving sketch(std::max(k * kApproxCountersPerEntry, kApproxMinCounters));
+  // The type byte and the encoded command sit next to each other in both
+  // line formats, so together they key a counter without a copy.
+  auto take_record = [&](std::string_view line) {
+    RecordView record;
+    if (line.empty() || !SplitRecord(line, &record) || !HasType(types, record.type)) {
+      return;
+    }
+    std::int64_t ts = 0;
+    std::int64_t exit_code = 0;
+    if (!ParseInt64(record.ts, &ts) || !ParseInt64(record.code, &exit_code) || exit_code != 0) {
+      return;
+    }
+    std::string_view key(record.b64.data() - 2, record.b64.size() + 2);
+    SpaceSaving::Counter& counter = sketch.Add(key, ts);
+    if (!record.rest.empty() && ts >= counter.last_used) {
+      size_t tab = record.rest.find('\t');
+      std::int64_t first_byte_ms = -1;
+      if (ParseInt64(record.rest.substr(0, tab), &first_byte_ms) && first_byte_ms >= 0) {
+        counter.sample = first_byte_ms;
+      }
+    }
+  };
+  auto take_summary = [&](std::string_view line) {
+    SummaryView summary;
+    if (!SplitSummary(line, &summary) || !HasType(types, summary.type)) {
+      return;
+    }
+    std::string_view key(line.data(), summary.b64.size() + 2);
+    SpaceSaving::Counter& counter = sketch.Add(key, summary.last_used, summary.count);
+    if (summary.connect_ms >= 0 && summary.last_used >= counter.last_used) {
+      counter.sample = summary.connect_ms;
+    }
+  };
+
+  ScopedFd fd;
+  FlockGuard lock;
+  if (OpenLockedEventLog(path, O_RDONLY, false, &fd, &lock, err)) {
+    if (!StreamLines(fd.get(), take_record, err)) {
+      return result;
+    }
+  } else if (errno == ENOENT) {
+    if (err) {
+      err->clear();
+    }
+  } else {
+    return result;
+  }
+
+  ScopedFd segment_lock_fd;
+  FlockGuard segment_lock;
+  std::vector<SegmentFile> segments;
+  if (!ListSegmentsShared(&segment_lock_fd, &segment_lock, &segments, err)) {
+    return result;
+  }
+  for (const auto& segment : segments) {
+    int summary_fd = open(segment.summary_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (summary_fd < 0 && errno == ENOENT) {
+      if (!StreamSegmentLines(segment, INT64_MIN, INT64_MAX, take_record, err)) {
+        return result;
+      }
+      continue;
+    }
+    if (summary_fd < 0) {
       if (err) {
-        *err = "entry not found";
+        *err = std::string("open failed: ") + std::strerror(errno);
+      }
+      return result;
+    }
+    ScopedFd summary_guard(summary_fd);
+    if (!StreamLines(summary_fd, take_summary, err)) {
+      return result;
+    }
+  }
+  std::string remote_path = GetRemoteHistoryPath(err);
+  ScopedFd remote_fd(remote_path.empty() ? -1 : open(remote_path.c_str(), O_RDONLY | O_CLOEXEC));
+  if (remote_fd.get() >= 0) {
+    auto take_remote = [&](std::string_view line) {
+      std::string_view origin;
+      std::string_view summary;
+      if (SplitRemoteLine(line, &origin, &summary)) {
+        take_summary(summary);
       }
+    };
+    if (!StreamLines(remote_fd.get(), take_remote, err)) {
+      return result;
+    }
+  }
+
+  // Spellings of one ssh target are merged as in the exact views; their
+  // counts and error bounds add up.
+  struct Group {
+    HistoryEntry entry;
+    std::int64_t sample_ts = -1;
+  };
+  std::vector<Group> groups;
+  std::unordered_map<std::string, size_t, StringHash> group_index;
+  for (const auto& counter : sketch.Top(0)) {
+    std::string command;
+    std::string decode_err;
+    if (!Base64Decode(counter.key.substr(2), &command, &decode_err)) {
+      continue;
+    }
+    auto inserted = group_index.emplace(SshCommandKey(command), groups.size());
+    if (inserted.second) {
+      groups.emplace_back();
+      groups.back().entry.command = command;
+    }
+    Group& g = groups[inserted.first->second];
+    HistoryEntry& entry = g.entry;
+    if (!inserted.second &&
+        (counter.last_used > entry.last_used || (counter.last_used == entry.last_used && command < entry.command))) {
+      entry.command = command;
+    }
+    entry.count += static_cast<int>(counter.count);
+    entry.count_error += static_cast<int>(counter.error);
+    entry.last_used = std::max(entry.last_used, counter.last_used);
+    if (counter.sample >= 0 && counter.last_used > g.sample_ts) {
+      g.sample_ts = counter.last_used;
+      entry.connect_ms = counter.sample;
+      entry.connect_samples = 1;
+    }
+  }
+
+  // Team layers join as in the exact views: a target counted above keeps
+  // its personal entry, and between layers the first entry for a target
+  // wins. Layer counts are exact; only the highest are kept as candidates,
+  // so memory stays bounded by k here too.
+  std::vector<std::string> layers = GetHistoryLayerPaths();
+  if (!layers.empty()) {
+    LayerCandidates candidates(sketch.capacity());
+    ForEachLayerEntry(layers, !HasType(types, kTypeCommand), [&](const HistoryEntry& entry, const std::string& key) {
+      if (group_index.count(key) == 0) {
+        candidates.Add(key, entry);
+      }
+    });
+    for (auto& entry : candidates.Take()) {
+      groups.emplace_back();
+      groups.back().entry = std::move(entry);
+    }
+  }
+
+  result.reserve(groups.size());
+  for (auto& g : groups) {
+    result.push_back(std::move(g.entry));
+  }
+  // Entries are chosen by count but listed like the exact views.
+  if (result.size() > k) {
+    std::partial_sort(result.begin(), result.begin() + static_cast<std::ptrdiff_t>(k), result.end(),
+                      [](const HistoryEntry& a, const HistoryEntry& b) {
+                        if (a.count != b.count) {
+                          return a.count > b.count;
+                        }
+                        return a.last_used > b.last_used;
+                      });
+    result.resize(k);
+  }
+  SortEntries(&result);
+  return result;
+}
+
+struct RewriteStats {
+  std::size_t lines = 0;
+  std::size_t bytes = 0;
+};
+
+using DropRecordFn = std::function<bool(const RecordView& record)>;
+
+// Returns content without the records drop selects, counting them.
+std::string FilterRecords(std::string_view content, const DropRecordFn& drop, RewriteStats* stats) {
+  std::string out;
+  out.reserve(content.size());
+  ForEachLine(content, [&](std::string_view line) {
+    RecordView record;
+    if (SplitRecord(line, &record) && drop(record)) {
+      ++stats->lines;
+      stats->bytes += line.size() + 1;
+      return;
+    }
+    out.append(line.data(), line.size());
+    out.push_back('\n');
+  });
+  return out;
+}
+
+// Exclusive hold on the hot log and on segments.lock, taken for any change
+// to records already written. The hot log may not exist.
+struct HistoryLock {
+  std::string hot_path;
+  ScopedFd hot_fd;
+  FlockGuard hot_lock;
+  ScopedFd segment_fd;
+  FlockGuard segment_lock;
+  std::vector<SegmentFile> segments;
+};
+
+bool LockHistory(HistoryLock* lock, std::string* err) {
+  lock->hot_path = EventLogPathOrError(err);
+  std::string dir = SegmentDirOrError(err);
+  if (lock->hot_path.empty() || dir.empty()) {
+    return false;
+  }
+  if (!OpenLockedEventLog(lock->hot_path, O_RDWR, true, &lock->hot_fd, &lock->hot_lock, err)) {
+    if (errno != ENOENT) {
       return false;
     }
+    lock->hot_fd.reset();
     if (err) {
-      *err = std::string("open failed: ") + std::strerror(errno);
+      err->clear();
     }
+  }
+  lock->segment_fd.reset(OpenSegmentLock(err));
+  if (lock->segment_fd.get() < 0) {
     return false;
   }
+  lock->segment_lock.reset(lock->segment_fd.get());
+  return lock->segment_lock.LockExclusive(err) && ListSegments(dir, &lock->segments, err);
+}
 
-  ScopedFd fd_guard(fd);
-  FlockGuard lock(fd);
-  if (!lock.LockExclusive(err)) {
+// Rewrites the hot log without the records drop selects. Nothing is
+// written when none is dropped or in dry-run mode.
+bool RewriteHot(HistoryLock* lock, const DropRecordFn& drop, bool dry_run, RewriteStats* stats, std::string* err) {
+  if (lock->hot_fd.get() < 0) {
+    return true;
+  }
+  std::string content;
+  if (!ReadAllFromFd(lock->hot_fd.get(), &content, err)) {
     return false;
   }
+  RewriteStats local;
+  std::string out = FilterRecords(content, drop, &local);
+  stats->lines += local.lines;
+  stats->bytes += local.bytes;
+  if (local.lines == 0 || dry_run) {
+    return true;
+  }
+  // Writers waiting on the old file's lock notice the rename and reopen.
+  return WriteFileAtomically(lock->hot_path, out, err);
+}
 
+// Rewrites a frozen segment and its summary without the records drop
+// selects; a segment left empty is removed.
+bool RewriteSegment(const SegmentFile& segment,
+                    const DropRecordFn& drop,
+                    bool dry_run,
+                    RewriteStats* stats,
+                    std::string* err) {
   std::string content;
-  if (!ReadAllFromFd(fd, &content, err)) {
+  if (!ReadSegmentLog(segment, &content, err)) {
+    return false;
+  }
+  RewriteStats local;
+  std::string out = FilterRecords(content, drop, &local);
+  stats->lines += local.lines;
+  stats->bytes += local.bytes;
+  if (local.lines == 0 || dry_run) {
+    return true;
+  }
+  if (out.empty()) {
+    RemoveSegmentFiles(segment);
+    return FsyncDir(DirnameFromPath(segment.log_path), err);
+  }
+  if (!WriteArchive(segment.archive_path, out, err) ||
+      !WriteFileAtomically(segment.summary_path, BuildSummary(out), err)) {
     return false;
   }
+  if (!segment.compressed || segment.stale_log) {
+    unlink(segment.log_path.c_str());
+    return FsyncDir(DirnameFromPath(segment.log_path), err);
+  }
+  return true;
+}
 
-  std::string dir = DirnameFromPath(path);
-  std::string tmp_path;
-  ScopedFd tmp_guard;
-  {
-    std::string tmpl = dir + "/commands.log.tmp.XXXXXX";
-    std::vector<char> tmp_buf(tmpl.begin(), tmpl.end());
-    tmp_buf.push_back('\0');
-    int tmp_fd = mkstemp(tmp_buf.data());
-    if (tmp_fd < 0) {
-      if (err) {
-        *err = std::string("mkstemp failed: ") + std::strerror(errno);
-      }
+// Whether a segment's summary lists a successful record that match selects.
+bool SummaryMentions(const SegmentFile& segment,
+                     const std::function<bool(const SummaryView&)>& match,
+                     std::string* err,
+                     bool* mentions) {
+  std::string summary;
+  if (!ReadSegmentSummary(segment, &summary, err)) {
+    return false;
+  }
+  *mentions = false;
+  ForEachLine(summary, [&](std::string_view line) {
+    SummaryView view;
+    if (!*mentions && SplitSummary(line, &view) && match(view)) {
+      *mentions = true;
+    }
+  });
+  return true;
+}
+
+// Drops the records of the given types whose command has the same target
+// key as one of commands, from the hot log and every frozen segment.
+// Removes the remote.sum aggregates match selects, counting the records
+// they stand for. Called with the history lock held: remote.lock always
+// comes after it.
+bool DropRemote(const std::function<bool(char type, std::string_view b64)>& match,
+                RewriteStats* stats,
+                std::string* err) {
+  std::string path = GetRemoteHistoryPath(err);
+  if (path.empty()) {
+    return false;
+  }
+  ScopedFd lock_fd(OpenRemoteLock(err));
+  if (lock_fd.get() < 0) {
+    return false;
+  }
+  FlockGuard lock(lock_fd.get());
+  std::string remote;
+  if (!lock.LockExclusive(err) || !ReadRemoteHistory(&remote, err)) {
+    return false;
+  }
+  std::string kept;
+  kept.reserve(remote.size());
+  std::size_t dropped = 0;
+  ForEachLine(remote, [&](std::string_view line) {
+    std::string_view origin;
+    std::string_view summary;
+    SummaryView view;
+    if (SplitRemoteLine(line, &origin, &summary) && SplitSummary(summary, &view) && match(view.type, view.b64)) {
+      stats->lines += static_cast<std::size_t>(view.count);
+      stats->bytes += line.size() + 1;
+      ++dropped;
+      return;
+    }
+    kept.append(line).push_back('\n');
+  });
+  return dropped == 0 || WriteFileAtomically(path, kept, err);
+}
+
+bool DeleteEvents(const std::unordered_set<std::string>& commands,
+                  const char* types,
+                  int* removed,
+                  std::string* err) {
+  if (removed) {
+    *removed = 0;
+  }
+  // Every spelling of the same ssh target goes. Each distinct encoded field
+  // is decoded and keyed once and later lines reuse the verdict.
+  std::unordered_set<std::string> keys;
+  keys.reserve(commands.size());
+  for (const auto& command : commands) {
+    keys.insert(SshCommandKey(command));
+  }
+  std::unordered_map<std::string, bool, StringHash> verdicts;
+  auto matches = [&](char type, std::string_view b64) {
+    if (!HasType(types, type)) {
+      return false;
+    }
+    std::string field(b64);
+    auto it = verdicts.find(field);
+    if (it == verdicts.end()) {
+      std::string command;
+      std::string decode_err;
+      bool match = Base64Decode(field, &command, &decode_err) && keys.count(SshCommandKey(command)) > 0;
+      it = verdicts.emplace(std::move(field), match).first;
+    }
+    return it->second;
+  };
+  DropRecordFn drop = [&](const RecordView& record) { return matches(record.type, record.b64); };
+
+  HistoryLock lock;
+  if (!LockHistory(&lock, err)) {
+    return false;
+  }
+  RewriteStats stats;
+  if (!RewriteHot(&lock, drop, false, &stats, err)) {
+    return false;
+  }
+  for (const auto& segment : lock.segments) {
+    bool mentions = false;
+    if (!SummaryMentions(segment, [&](const SummaryView& view) { return matches(view.type, view.b64); }, err,
+                         &mentions)) {
+      return false;
+    }
+    if (mentions && !RewriteSegment(segment, drop, false, &stats, err)) {
+      return false;
+    }
+  }
+  // Imported aggregates go too, until an import of an export that still
+  // holds them brings them back.
+  if (!DropRemote(matches, &stats, err)) {
+    return false;
+  }
+  if (stats.lines == 0) {
+    if (err) {
+      *err = "entry not found";
+    }
+    return false;
+  }
+  if (removed) {
+    *removed = static_cast<int>(stats.lines);
+  }
+  return true;
+}
+
+bool PruneEvents(const PruneOptions& options, const char* types, PruneStats* stats, std::string* err) {
+  HistoryLock lock;
+  if (!LockHistory(&lock, err)) {
+    return false;
+  }
+  RewriteStats rewrite;
+  std::size_t dropped_segments = 0;
+
+  // Retention drops whole frozen segments without reading their records
+  // beyond a line count.
+  std::vector<SegmentFile> kept;
+  for (const auto& segment : lock.segments) {
+    if (options.drop_segments_before <= 0 || segment.last_ts >= options.drop_segments_before) {
+      kept.push_back(segment);
+      continue;
+    }
+    std::string content;
+    if (!ReadSegmentLog(segment, &content, err)) {
+      return false;
+    }
+    ++dropped_segments;
+    rewrite.lines += static_cast<std::size_t>(std::count(content.begin(), content.end(), '\n'));
+    rewrite.bytes += content.size();
+    if (!options.dry_run) {
+      RemoveSegmentFiles(segment);
+    }
+  }
+  if (dropped_segments > 0 && !options.dry_run) {
+    if (!FsyncDir(DirnameFromPath(lock.segments[0].log_path), err)) {
       return false;
     }
-    tmp_path = tmp_buf.data();
-    tmp_guard.reset(tmp_fd);
   }
 
-  int removed_count = 0;
-  std::istringstream in(content);
-  std::string line;
-  while (std::getline(in, line)) {
-    bool drop = false;
-    size_t t1 = line.find('\t');
-    size_t t2 = t1 == std::string::npos ? std::string::npos : line.find('\t', t1 + 1);
-    if (t1 != std::string::npos && t2 != std::string::npos) {
-      std::string b64 = line.substr(t2 + 1);
-      std::string decoded;
+  const bool filter_commands = options.older_than > 0 || options.min_count > 0 || options.match;
+  std::unordered_set<std::string> pruned;
+  std::size_t pruned_commands = 0;
+  std::string hot;
+  std::vector<std::string> summaries(kept.size());
+  if (filter_commands) {
+    // Age and count are judged over every spelling of the same ssh target
+    // and over the whole history, frozen segments included, so a target used
+    // often under two spellings or in earlier months is not pruned as rare.
+    if (lock.hot_fd.get() >= 0 && !ReadAllFromFd(lock.hot_fd.get(), &hot, err)) {
+      return false;
+    }
+    SeenTable table;
+    AggregateRecords(hot, types, &table);
+    for (size_t i = 0; i < kept.size(); ++i) {
+      if (!ReadSegmentSummary(kept[i], &summaries[i], err)) {
+        return false;
+      }
+      AggregateSummary(summaries[i], types, &table);
+    }
+    // Commands whose records all failed have no usage but can still match.
+    ForEachLine(hot, [&](std::string_view line) {
+      RecordView record;
+      if (SplitRecord(line, &record) && HasType(types, record.type)) {
+        table.Touch(record.type, record.b64);
+      }
+    });
+
+    struct Group {
+      std::int64_t last_used = 0;
+      std::int64_t count = 0;
+      std::vector<std::pair<std::string, std::string_view>> variants;
+    };
+    std::unordered_map<std::string, Group, StringHash> groups;
+    for (const auto& s : table.entries()) {
+      std::string command;
       std::string decode_err;
-      if (Base64Decode(b64, &decoded, &decode_err) && decoded == command) {
-        drop = true;
-        ++removed_count;
+      if (!Base64Decode(std::string(s.b64), &command, &decode_err)) {
+        continue;
+      }
+      Group& g = groups[SshCommandKey(command)];
+      g.last_used = std::max(g.last_used, s.last_used);
+      g.count += s.count;
+      g.variants.emplace_back(std::move(command), s.b64);
+    }
+    for (const auto& kv : groups) {
+      const Group& g = kv.second;
+      if (options.older_than > 0 && g.last_used >= options.older_than) {
+        continue;
+      }
+      if (options.min_count > 0 && g.count >= options.min_count) {
+        continue;
+      }
+      bool any = false;
+      for (const auto& variant : g.variants) {
+        if (options.match && !options.match(variant.first)) {
+          continue;
+        }
+        any = true;
+        pruned.insert(std::string(variant.second));
+      }
+      if (any) {
+        ++pruned_commands;
       }
     }
+  }
 
-    if (!drop) {
-      std::string out_line = line + "\n";
-      if (!WriteAllToFd(tmp_guard.get(), out_line, err)) {
-        unlink(tmp_path.c_str());
+  auto is_pruned = [&](std::string_view b64) { return !pruned.empty() && pruned.count(std::string(b64)) > 0; };
+  DropRecordFn drop = [&](const RecordView& record) {
+    if (!HasType(types, record.type)) {
+      return false;
+    }
+    std::int64_t exit_code = 0;
+    if (options.drop_failed && !(ParseInt64(record.code, &exit_code) && exit_code == 0)) {
+      return true;
+    }
+    return is_pruned(record.b64);
+  };
+  if (options.drop_failed || !pruned.empty()) {
+    if (!RewriteHot(&lock, drop, options.dry_run, &rewrite, err)) {
+      return false;
+    }
+    for (const auto& segment : kept) {
+      // Failed records are not summarized, so --failed reads every segment.
+      bool mentions = options.drop_failed;
+      if (!mentions &&
+          !SummaryMentions(segment,
+                           [&](const SummaryView& view) { return HasType(types, view.type) && is_pruned(view.b64); },
+                           err, &mentions)) {
+        return false;
+      }
+      if (mentions && !RewriteSegment(segment, drop, options.dry_run, &rewrite, err)) {
         return false;
       }
     }
   }
 
-  if (removed_count == 0) {
-    if (err) {
-      *err = "entry not found";
-    }
-    unlink(tmp_path.c_str());
+  if (stats) {
+    stats->lines = rewrite.lines;
+    stats->bytes = rewrite.bytes;
+    stats->commands = pruned_commands;
+    stats->segments = dropped_segments;
+  }
+  return true;
+}
+
+// Follows a delete or prune once its locks are released: exports start a
+// new generation so importers drop what was removed (see sync.h), and the
+// IDs of removed entries are retired. The generation is bumped only after
+// the records are gone.
+bool FinishRemoval(std::string* err) {
+  return BumpOriginGeneration(err) && SyncEntryIds(err);
+}
+
+bool ParseEvent(std::string_view line, HistoryEvent* event) {
+  RecordView record;
+  std::int64_t exit_code = 0;
+  if (!SplitRecord(line, &record) || !ParseInt64(record.ts, &event->ts) ||
+      !ParseInt64(record.code, &exit_code)) {
     return false;
   }
+  std::string decode_err;
+  if (!Base64Decode(std::string(record.b64), &event->command, &decode_err)) {
+    return false;
+  }
+  event->exit_code = static_cast<int>(exit_code);
+  event->ssh = record.type == kTypeSsh;
+  event->timing = ConnectTiming();
+  if (!record.rest.empty()) {
+    size_t tab = record.rest.find('\t');
+    ParseInt64(record.rest.substr(0, tab), &event->timing.first_byte_ms);
+    if (tab != std::string_view::npos) {
+      ParseInt64(record.rest.substr(tab + 1), &event->timing.duration_ms);
+    }
+  }
+  return true;
+}
+
+}  // namespace
 
-  if (fsync(tmp_guard.get()) != 0) {
+double FrecencyScore(int count, std::int64_t last_used, std::int64_t now) {
+  std::int64_t age = now - last_used;
+  if (age < 0) {
+    age = 0;
+  }
+  double weight = 0.25;
+  if (age < 3600) {
+    weight = 4.0;
+  } else if (age < 86400) {
+    weight = 2.0;
+  } else if (age < 604800) {
+    weight = 1.0;
+  } else if (age < 2592000) {
+    weight = 0.5;
+  }
+  return static_cast<double>(count) * weight;
+}
+
+bool AppendHistory(const std::string& command, int exit_code, std::string* err) {
+  return AppendEvents(kTypeSsh, {command}, exit_code, nullptr, err);
+}
+
+bool AppendCommandHistory(const std::string& command, int exit_code, std::string* err) {
+  return AppendEvents(kTypeCommand, {command}, exit_code, nullptr, err);
+}
+
+bool AppendTimedHistory(const std::string& command,
+                        int exit_code,
+                        const ConnectTiming& timing,
+                        std::string* err) {
+  return AppendEvents(kTypeSsh, {command}, exit_code, &timing, err);
+}
+
+bool AppendHistoryBatch(const std::vector<std::string>& commands,
+                        int exit_code,
+                        std::string* err) {
+  return AppendEvents(kTypeSsh, commands, exit_code, nullptr, err);
+}
+
+bool LoadHistoryViews(std::size_t limit, HistoryViews* out, std::string* err) {
+  if (!out) {
     if (err) {
-      *err = std::string("fsync failed: ") + std::strerror(errno);
+      *err = "views pointer is null";
     }
-    unlink(tmp_path.c_str());
     return false;
   }
+  return LoadViews(limit, true, true, out, err);
+}
+
+std::vector<HistoryEntry> LoadRecentUnique(std::size_t limit, std::string* err) {
+  HistoryViews views;
+  LoadViews(limit, true, false, &views, err);
+  return std::move(views.ssh);
+}
+
+std::vector<HistoryEntry> LoadRecentUniqueCommands(std::size_t limit, std::string* err) {
+  HistoryViews views;
+  LoadViews(limit, false, true, &views, err);
+  return std::move(views.commands);
+}
 
-  if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+std::vector<HistoryEntry> LoadFrequentUnique(std::size_t k, std::string* err) {
+  return LoadFrequent(k, kSshTypes, err);
+}
+
+std::vector<HistoryEntry> LoadFrequentUniqueCommands(std::size_t k, std::string* err) {
+  return LoadFrequent(k, kAllTypes, err);
+}
+
+bool DeleteHistoryCommand(const std::string& command, int* removed, std::string* err) {
+  return DeleteHistoryCommands(std::unordered_set<std::string>{command}, removed, err);
+}
+
+bool DeleteCommandHistory(const std::string& command, int* removed, std::string* err) {
+  return DeleteCommandHistoryCommands(std::unordered_set<std::string>{command}, removed, err);
+}
+
+bool DeleteHistoryCommands(const std::unordered_set<std::string>& commands,
+                           int* removed,
+                           std::string* err) {
+  return DeleteEvents(commands, kSshTypes, removed, err) && FinishRemoval(err);
+}
+
+bool DeleteCommandHistoryCommands(const std::unordered_set<std::string>& commands,
+                                  int* removed,
+                                  std::string* err) {
+  return DeleteEvents(commands, kAllTypes, removed, err) && FinishRemoval(err);
+}
+
+bool PruneHistory(const PruneOptions& options, PruneStats* stats, std::string* err) {
+  return PruneEvents(options, kSshTypes, stats, err) && (options.dry_run || FinishRemoval(err));
+}
+
+bool PruneCommandHistory(const PruneOptions& options, PruneStats* stats, std::string* err) {
+  return PruneEvents(options, kAllTypes, stats, err) && (options.dry_run || FinishRemoval(err));
+}
+
+bool SyncEntryIds(std::string* err) {
+  // Layers are left out: their entries were never recorded here.
+  AggregateSources sources;
+  SeenTable table;
+  if (!AggregateHistory(kSshTypes, true, &sources, &table, err)) {
+    return false;
+  }
+  HistoryViews views;
+  BuildViews(&table, 0, true, false, &views, nullptr);
+  std::vector<std::string> live;
+  live.reserve(views.ssh.size());
+  for (const auto& entry : views.ssh) {
+    live.push_back(entry.command);
+  }
+  return ReconcileEntryIds(live, err);
+}
+
+bool ScanHistory(std::int64_t since, const std::function<void(const HistoryEvent&)>& fn, std::string* err) {
+  std::string path = EventLogPathOrError(err);
+  if (path.empty()) {
+    return false;
+  }
+  // Locks are taken hot log first, as everywhere else; the hot log is read
+  // last so events come out oldest first.
+  ScopedFd fd;
+  FlockGuard lock;
+  bool have_hot = OpenLockedEventLog(path, O_RDONLY, false, &fd, &lock, err);
+  if (!have_hot) {
+    if (errno != ENOENT) {
+      return false;
+    }
     if (err) {
-      *err = std::string("rename failed: ") + std::strerror(errno);
+      err->clear();
     }
-    unlink(tmp_path.c_str());
-    return false;
   }
 
-  if (!FsyncDir(dir, err)) {
+  HistoryEvent event;
+  auto take = [&](std::string_view line) {
+    if (ParseEvent(line, &event) && event.ts >= since) {
+      fn(event);
+    }
+  };
+  ScopedFd segment_lock_fd;
+  FlockGuard segment_lock;
+  std::vector<SegmentFile> segments;
+  if (!ListSegmentsShared(&segment_lock_fd, &segment_lock, &segments, err)) {
     return false;
   }
+  for (const auto& segment : segments) {
+    if (segment.last_ts >= since && !StreamSegmentLines(segment, since, INT64_MAX, take, err)) {
+      return false;
+    }
+  }
+  return !have_hot || StreamLines(fd.get(), take, err);
+}
 
-  if (removed) {
-    *removed = removed_count;
+bool SummarizeHistory(std::string* summary, std::string* err) {
+  AggregateSources sources;
+  SeenTable table;
+  if (!AggregateHistory(kAllTypes, false, &sources, &table, err)) {
+    return false;
   }
+  std::vector<Seen>& entries = table.entries();
+  std::sort(entries.begin(), entries.end(), [](const Seen& a, const Seen& b) {
+    if (a.type != b.type) {
+      return a.type < b.type;
+    }
+    return a.b64 < b.b64;
+  });
+  *summary = FormatSummary(&entries);
   return true;
 }
 
+HistoryViews BuildHistoryViews(std::string_view records) {
+  SeenTable table;
+  AggregateRecords(records, kAllTypes, &table);
+  HistoryViews views;
+  BuildViews(&table, 0, true, true, &views, nullptr);
+  return views;
+}
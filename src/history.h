@@ -1,18 +1,114 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
+#include <functional>
 #include <string>
+#include <string_view>
+#include <unordered_set>
 #include <vector>
 
 struct HistoryEntry {
   std::string command;
   std::int64_t last_used = 0;
   int count = 0;
+  std::int64_t connect_ms = -1;
+  int connect_samples = 0;
+  // Approximate loads only: count may overstate the true count by up to
+  // count_error.
+  int count_error = 0;
 };
 
+// first_byte_ms is when the session first printed anything on its pty.
+// For a normal login that is the server's banner or shell prompt, but ssh's
+// own prompts (a host key confirmation, a password) count as well; it is
+// the first output, not the first byte from the server.
+struct ConnectTiming {
+  std::int64_t first_byte_ms = -1;
+  std::int64_t duration_ms = -1;
+};
+
+// Commands are pruned when they satisfy every enabled filter: last used
+// before older_than, used fewer than min_count times, and accepted by match.
+// drop_failed additionally removes every nonzero-exit record, and
+// drop_segments_before every frozen segment whose last record is older.
+struct PruneOptions {
+  std::int64_t older_than = 0;
+  int min_count = 0;
+  std::function<bool(const std::string& command)> match;
+  bool drop_failed = false;
+  std::int64_t drop_segments_before = 0;
+  bool dry_run = false;
+};
+
+struct PruneStats {
+  std::size_t lines = 0;
+  std::size_t bytes = 0;
+  std::size_t commands = 0;
+  std::size_t segments = 0;
+};
+
+// One record of the event log, as ScanHistory passes it on.
+struct HistoryEvent {
+  std::int64_t ts = 0;
+  int exit_code = 0;
+  // An ssh connection rather than another command.
+  bool ssh = false;
+  std::string command;
+  ConnectTiming timing;
+};
+
+// Both pickers' entries from one read of the event log: ssh holds ssh
+// connections, commands holds those plus every other recorded command.
+struct HistoryViews {
+  std::vector<HistoryEntry> ssh;
+  std::vector<HistoryEntry> commands;
+};
+
+double FrecencyScore(int count, std::int64_t last_used, std::int64_t now);
+
 bool AppendHistory(const std::string& command, int exit_code, std::string* err);
+bool AppendTimedHistory(const std::string& command,
+                        int exit_code,
+                        const ConnectTiming& timing,
+                        std::string* err);
 bool AppendCommandHistory(const std::string& command, int exit_code, std::string* err);
+bool AppendHistoryBatch(const std::vector<std::string>& commands,
+                        int exit_code,
+                        std::string* err);
+bool LoadHistoryViews(std::size_t limit, HistoryViews* out, std::string* err);
 std::vector<HistoryEntry> LoadRecentUnique(std::size_t limit, std::string* err);
 std::vector<HistoryEntry> LoadRecentUniqueCommands(std::size_t limit, std::string* err);
+// Approximate counterparts of the two loaders for logs with too many
+// distinct commands to aggregate exactly: the k most used entries, found in
+// memory bounded by k and listed like the exact loaders. connect_ms is the
+// latest sample instead of the median. Team layers merge in as in the
+// exact loaders. A k of 0 loads everything exactly.
+std::vector<HistoryEntry> LoadFrequentUnique(std::size_t k, std::string* err);
+std::vector<HistoryEntry> LoadFrequentUniqueCommands(std::size_t k, std::string* err);
 bool DeleteHistoryCommand(const std::string& command, int* removed, std::string* err);
 bool DeleteCommandHistory(const std::string& command, int* removed, std::string* err);
+bool DeleteHistoryCommands(const std::unordered_set<std::string>& commands,
+                           int* removed,
+                           std::string* err);
+bool DeleteCommandHistoryCommands(const std::unordered_set<std::string>& commands,
+                                  int* removed,
+                                  std::string* err);
+// Both views of records in the events.log format, unlimited, as
+// LoadHistoryViews builds them from the personal history.
+HistoryViews BuildHistoryViews(std::string_view records);
+// This machine's successful records of every type, aggregated like a frozen
+// segment's summary (one line per type and command) and sorted by type and
+// encoded command. Imported history is not included.
+bool SummarizeHistory(std::string* summary, std::string* err);
+// Calls fn with every recorded event at or after since, oldest segment
+// first and the hot log last. Archived segments decompress only the blocks
+// that reach since.
+bool ScanHistory(std::int64_t since, const std::function<void(const HistoryEvent&)>& fn, std::string* err);
+bool PruneHistory(const PruneOptions& options, PruneStats* stats, std::string* err);
+bool PruneCommandHistory(const PruneOptions& options, PruneStats* stats, std::string* err);
+// Reconciles the stable entry IDs (see entry_ids.h) with the ssh history,
+// personal and imported: entries without an ID get one, most recent first,
+// and the IDs of entries that are gone are retired. Deletes, prunes and
+// imports call it; so does the first record once IDs are introduced.
+bool SyncEntryIds(std::string* err);
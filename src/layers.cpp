@@ -0,0 +1,328 @@
+#include "layers.h"
+
+#include "hash.h"
+#include "normalize.h"
+#include "snapshot.h"
+#include "util.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <queue>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+namespace {
+
+// A layer index, with fields as described at PutU32 in util.h:
+//   magic[8] path:str mtime_ns:i64 size:i64
+//   n_ssh:u32 n_commands:u32 commands_offset:i64
+//   n_ssh + n_commands x { key:str command:str last_used:i64 count:i64
+//                          connect_ms:i64 connect_samples:i64 }
+// path, mtime_ns and size identify the layer file it was built from. key is
+// the entry's SshCommandKey, so merging needs no normalizing; each view is
+// stored in load order.
+const char kMagic[8] = {'S', 'S', 'H', 'T', 'L', 'A', 'Y', '1'};
+const std::uint32_t kMaxCount = 1u << 24;
+
+void PutEntries(std::string* out, const std::vector<HistoryEntry>& entries) {
+  for (const auto& entry : entries) {
+    PutStr(out, SshCommandKey(entry.command));
+    PutStr(out, entry.command);
+    PutI64(out, entry.last_used);
+    PutI64(out, entry.count);
+    PutI64(out, entry.connect_ms);
+    PutI64(out, entry.connect_samples);
+  }
+}
+
+std::string Serialize(const SnapshotSource& source, const HistoryViews& views) {
+  std::string out(kMagic, sizeof(kMagic));
+  PutStr(&out, source.path);
+  PutI64(&out, source.mtime_ns);
+  PutI64(&out, source.size);
+  PutU32(&out, static_cast<std::uint32_t>(views.ssh.size()));
+  PutU32(&out, static_cast<std::uint32_t>(views.commands.size()));
+  const std::size_t offset_at = out.size();
+  PutI64(&out, 0);
+  PutEntries(&out, views.ssh);
+  const std::int64_t commands_offset = static_cast<std::int64_t>(out.size());
+  std::memcpy(&out[offset_at], &commands_offset, sizeof(commands_offset));
+  PutEntries(&out, views.commands);
+  return out;
+}
+
+std::string LayerIndexPath(const std::string& layer, std::string* err) {
+  std::string dir = GetDataDir(err);
+  if (dir.empty()) {
+    return std::string();
+  }
+  char name[32];
+  std::snprintf(name, sizeof(name), "%016llx.idx", static_cast<unsigned long long>(HashBytes(layer)));
+  return dir + "/layers/" + name;
+}
+
+// One view of one layer, read entry by entry from its index.
+class LayerCursor {
+ public:
+  LayerCursor() = default;
+  LayerCursor(const LayerCursor&) = delete;
+  LayerCursor& operator=(const LayerCursor&) = delete;
+  ~LayerCursor() {
+    if (map_) {
+      munmap(map_, map_size_);
+    }
+  }
+
+  // Positions the cursor on the ssh or command view of layer, building the
+  // index first when it is missing or stale. Fails when the layer cannot
+  // be read.
+  bool Open(const std::string& layer, bool ssh) {
+    SnapshotSource source = StatSnapshotSource(layer);
+    if (source.size < 0) {
+      return false;
+    }
+    std::string err;
+    std::string index_path = LayerIndexPath(layer, &err);
+    if (index_path.empty()) {
+      return false;
+    }
+    if (!MapIndex(index_path, source) && !BuildIndex(layer, index_path, source)) {
+      return false;
+    }
+    return Seek(ssh);
+  }
+
+  // Reads the next entry and its target key; false at the end of the view.
+  bool Next(HistoryEntry* entry, std::string* key) {
+    if (remaining_ == 0) {
+      return false;
+    }
+    --remaining_;
+    BinaryReader reader(data_, size_, pos_);
+    std::int64_t count = 0;
+    std::int64_t samples = 0;
+    *entry = HistoryEntry();
+    if (!reader.Str(key) || !reader.Str(&entry->command) || !reader.I64(&entry->last_used) ||
+        !reader.I64(&count) || !reader.I64(&entry->connect_ms) || !reader.I64(&samples)) {
+      remaining_ = 0;
+      return false;
+    }
+    entry->count = static_cast<int>(count);
+    entry->connect_samples = static_cast<int>(samples);
+    pos_ = reader.pos();
+    return true;
+  }
+
+ private:
+  bool MapIndex(const std::string& path, const SnapshotSource& source) {
+    ScopedFd fd(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    struct stat st;
+    if (fd.get() < 0 || fstat(fd.get(), &st) != 0 || st.st_size <= 0) {
+      return false;
+    }
+    void* map = mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd.get(), 0);
+    if (map == MAP_FAILED) {
+      return false;
+    }
+    map_ = map;
+    map_size_ = static_cast<std::size_t>(st.st_size);
+    data_ = static_cast<const char*>(map);
+    size_ = map_size_;
+    if (!CheckHeader(source)) {
+      munmap(map_, map_size_);
+      map_ = nullptr;
+      data_ = nullptr;
+      size_ = 0;
+      return false;
+    }
+    return true;
+  }
+
+  // Aggregates the layer and keeps the index in memory, saving it for later
+  // loads when the data directory is writable.
+  bool BuildIndex(const std::string& layer, const std::string& index_path, const SnapshotSource& source) {
+    ScopedFd fd(open(layer.c_str(), O_RDONLY | O_CLOEXEC));
+    std::string content;
+    std::string err;
+    if (fd.get() < 0 || !ReadAllFromFd(fd.get(), &content, &err)) {
+      return false;
+    }
+    owned_ = Serialize(source, BuildHistoryViews(content));
+    WriteFileAtomically(index_path, owned_, nullptr);
+    data_ = owned_.data();
+    size_ = owned_.size();
+    return CheckHeader(source);
+  }
+
+  bool CheckHeader(const SnapshotSource& source) {
+    BinaryReader reader(data_, size_);
+    char magic[sizeof(kMagic)];
+    std::string path;
+    std::int64_t mtime_ns = 0;
+    std::int64_t size = 0;
+    std::int64_t commands_offset = 0;
+    if (!reader.Raw(magic, sizeof(magic)) || std::memcmp(magic, kMagic, sizeof(kMagic)) != 0 ||
+        !reader.Str(&path) || !reader.I64(&mtime_ns) || !reader.I64(&size) || !reader.U32(&n_ssh_) ||
+        !reader.U32(&n_commands_) || !reader.I64(&commands_offset)) {
+      return false;
+    }
+    if (path != source.path || mtime_ns != source.mtime_ns || size != source.size || n_ssh_ > kMaxCount ||
+        n_commands_ > kMaxCount || commands_offset < 0 || static_cast<std::size_t>(commands_offset) > size_) {
+      return false;
+    }
+    ssh_offset_ = reader.pos();
+    commands_offset_ = static_cast<std::size_t>(commands_offset);
+    return true;
+  }
+
+  bool Seek(bool ssh) {
+    pos_ = ssh ? ssh_offset_ : commands_offset_;
+    remaining_ = ssh ? n_ssh_ : n_commands_;
+    return true;
+  }
+
+  void* map_ = nullptr;
+  std::size_t map_size_ = 0;
+  std::string owned_;
+  const char* data_ = nullptr;
+  std::size_t size_ = 0;
+  std::uint32_t n_ssh_ = 0;
+  std::uint32_t n_commands_ = 0;
+  std::size_t ssh_offset_ = 0;
+  std::size_t commands_offset_ = 0;
+  std::size_t pos_ = 0;
+  std::uint32_t remaining_ = 0;
+};
+
+}  // namespace
+
+std::vector<HistoryEntry> MergeHistoryLayers(const std::vector<std::string>& layers,
+                                             std::vector<HistoryEntry> personal,
+                                             const std::unordered_set<std::string>& personal_keys,
+                                             bool ssh,
+                                             std::size_t limit) {
+  // Source 0 is the personal view; layers follow in order. A layer that
+  // cannot be read is left out rather than failing the load.
+  std::vector<std::unique_ptr<LayerCursor>> cursors;
+  for (const auto& path : layers) {
+    auto cursor = std::make_unique<LayerCursor>();
+    if (cursor->Open(path, ssh)) {
+      cursors.push_back(std::move(cursor));
+    }
+  }
+  if (cursors.empty()) {
+    return personal;
+  }
+
+  struct Head {
+    HistoryEntry entry;
+    std::string key;
+    std::size_t source = 0;
+  };
+  // Heads are ordered as the loaders sort entries, the earlier source
+  // first on ties.
+  auto later = [](const Head& a, const Head& b) {
+    if (a.entry.last_used != b.entry.last_used) {
+      return a.entry.last_used < b.entry.last_used;
+    }
+    if (a.entry.count != b.entry.count) {
+      return a.entry.count < b.entry.count;
+    }
+    return a.source > b.source;
+  };
+  std::priority_queue<Head, std::vector<Head>, decltype(later)> heap(later);
+  std::size_t next_personal = 0;
+  auto advance = [&](std::size_t source) {
+    Head head;
+    head.source = source;
+    if (source == 0) {
+      if (next_personal < personal.size()) {
+        head.entry = std::move(personal[next_personal++]);
+        heap.push(std::move(head));
+      }
+    } else if (cursors[source - 1]->Next(&head.entry, &head.key)) {
+      heap.push(std::move(head));
+    }
+  };
+  for (std::size_t source = 0; source <= cursors.size(); ++source) {
+    advance(source);
+  }
+
+  std::vector<HistoryEntry> result;
+  std::unordered_set<std::string> taken;
+  while (!heap.empty() && (limit == 0 || result.size() < limit)) {
+    Head head = heap.top();
+    heap.pop();
+    advance(head.source);
+    if (head.source > 0 && (personal_keys.count(head.key) > 0 || !taken.insert(head.key).second)) {
+      continue;
+    }
+    result.push_back(std::move(head.entry));
+  }
+  return result;
+}
+
+void ForEachLayerEntry(const std::vector<std::string>& layers,
+                       bool ssh,
+                       const std::function<void(const HistoryEntry& entry, const std::string& key)>& fn) {
+  for (const auto& path : layers) {
+    LayerCursor cursor;
+    if (!cursor.Open(path, ssh)) {
+      continue;
+    }
+    HistoryEntry entry;
+    std::string key;
+    while (cursor.Next(&entry, &key)) {
+      fn(entry, key);
+    }
+  }
+}
+
+void LayerCandidates::Add(const std::string& key, const HistoryEntry& entry) {
+  if (entries_.emplace(key, entry).second && entries_.size() >= 2 * keep_) {
+    Trim();
+  }
+}
+
+std::vector<HistoryEntry> LayerCandidates::Take() {
+  if (entries_.size() > keep_) {
+    Trim();
+  }
+  std::vector<HistoryEntry> result;
+  result.reserve(entries_.size());
+  for (auto& kv : entries_) {
+    result.push_back(std::move(kv.second));
+  }
+  entries_.clear();
+  return result;
+}
+
+void LayerCandidates::Trim() {
+  std::vector<std::pair<std::string, HistoryEntry>> ranked;
+  ranked.reserve(entries_.size());
+  for (auto& kv : entries_) {
+    ranked.emplace_back(kv.first, std::move(kv.second));
+  }
+  entries_.clear();
+  std::nth_element(ranked.begin(), ranked.begin() + static_cast<std::ptrdiff_t>(keep_), ranked.end(),
+                   [](const std::pair<std::string, HistoryEntry>& a, const std::pair<std::string, HistoryEntry>& b) {
+                     if (a.second.count != b.second.count) {
+                       return a.second.count > b.second.count;
+                     }
+                     if (a.second.last_used != b.second.last_used) {
+                       return a.second.last_used > b.second.last_used;
+                     }
+                     return a.first < b.first;
+                   });
+  ranked.resize(keep_);
+  for (auto& kv : ranked) {
+    entries_.emplace(std::move(kv.first), std::move(kv.second));
+  }
+}
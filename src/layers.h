@@ -0,0 +1,60 @@
+#pragma once
+
+#include "hash.h"
+#include "history.h"
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Read-only history layers (see GetHistoryLayerPaths) merged with the
+// personal history when it loads. A layer is an event log in the
+// events.log format. Its two views are aggregated once into an index under
+// <data>/layers/, sorted as the loaders sort, and rebuilt when the layer's
+// mtime or size changes. A load then reads only as many entries of each
+// layer as it shows.
+
+// Merges the ssh or command view of each of layers into personal, a view
+// of the personal history as the loaders return it, in the loaders' order;
+// personal entries come first on ties. Layer entries whose target is in
+// personal_keys (SshCommandKey of every entry of the whole personal view)
+// are left out, so personal entries win. Between layers the first entry
+// for a target in that order wins. Returns at most limit entries (0: all).
+std::vector<HistoryEntry> MergeHistoryLayers(const std::vector<std::string>& layers,
+                                             std::vector<HistoryEntry> personal,
+                                             const std::unordered_set<std::string>& personal_keys,
+                                             bool ssh,
+                                             std::size_t limit);
+
+// Calls fn with every entry of the ssh or command view of each of layers,
+// layer by layer in the loaders' order, along with its target key. A layer
+// that cannot be read is skipped.
+void ForEachLayerEntry(const std::vector<std::string>& layers,
+                       bool ssh,
+                       const std::function<void(const HistoryEntry& entry, const std::string& key)>& fn);
+
+// The layer entries with the highest counts, for loaders whose memory is
+// bounded: at most 2 x keep are held, and the table is cut back to exactly
+// keep whenever it fills. Ties on count go to the later last_used and then
+// to the smaller key, so the keep highest entries always survive.
+class LayerCandidates {
+ public:
+  explicit LayerCandidates(std::size_t keep) : keep_(keep) {}
+
+  // Adds entry for its target key unless the key is already held.
+  void Add(const std::string& key, const HistoryEntry& entry);
+
+  // Moves out the keep highest entries, in no particular order.
+  std::vector<HistoryEntry> Take();
+
+  std::size_t size() const { return entries_.size(); }
+
+ private:
+  void Trim();
+
+  std::size_t keep_;
+  std::unordered_map<std::string, HistoryEntry, StringHash> entries_;
+};
@@ -0,0 +1,152 @@
+#include "lz.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+const std::size_t kMinMatch = 4;
+const std::size_t kMaxOffset = 65535;
+const int kHashBits = 14;
+
+inline std::uint32_t Read32(const unsigned char* p) {
+  std::uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline std::uint32_t HashSeq(std::uint32_t seq) {
+  return (seq * 2654435761u) >> (32 - kHashBits);
+}
+
+// Lengths of 15 or more spill into extension bytes: 255 while at least 255
+// remains, then the rest.
+void PutLength(std::string* out, std::size_t len) {
+  while (len >= 255) {
+    out->push_back(static_cast<char>(255));
+    len -= 255;
+  }
+  out->push_back(static_cast<char>(len));
+}
+
+void PutSequence(std::string* out, const unsigned char* literals, std::size_t lit_len, std::size_t offset,
+                 std::size_t match_len) {
+  const std::size_t match_code = match_len >= kMinMatch ? match_len - kMinMatch : 0;
+  unsigned char token = static_cast<unsigned char>(((lit_len < 15 ? lit_len : 15) << 4) |
+                                                   (match_code < 15 ? match_code : 15));
+  out->push_back(static_cast<char>(token));
+  if (lit_len >= 15) {
+    PutLength(out, lit_len - 15);
+  }
+  out->append(reinterpret_cast<const char*>(literals), lit_len);
+  if (match_len == 0) {
+    return;
+  }
+  out->push_back(static_cast<char>(offset & 0xFF));
+  out->push_back(static_cast<char>(offset >> 8));
+  if (match_code >= 15) {
+    PutLength(out, match_code - 15);
+  }
+}
+
+bool GetLength(const unsigned char** p, const unsigned char* end, std::size_t* len) {
+  for (;;) {
+    if (*p >= end) {
+      return false;
+    }
+    unsigned char b = *(*p)++;
+    *len += b;
+    if (b != 255) {
+      return true;
+    }
+  }
+}
+
+}  // namespace
+
+std::string LzCompress(std::string_view input) {
+  std::string out;
+  const std::size_t n = input.size();
+  out.reserve(n / 2 + 16);
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(input.data());
+  // Positions + 1 of the last 4-byte sequence with each hash; 0 is empty.
+  std::vector<std::uint32_t> table(std::size_t(1) << kHashBits, 0);
+  std::size_t anchor = 0;
+  std::size_t i = 0;
+  while (i + kMinMatch <= n) {
+    const std::uint32_t seq = Read32(p + i);
+    std::uint32_t& slot = table[HashSeq(seq)];
+    const std::size_t candidate = slot;
+    slot = static_cast<std::uint32_t>(i + 1);
+    if (candidate == 0 || i - (candidate - 1) > kMaxOffset || Read32(p + candidate - 1) != seq) {
+      ++i;
+      continue;
+    }
+    const std::size_t from = candidate - 1;
+    std::size_t len = kMinMatch;
+    while (i + len < n && p[from + len] == p[i + len]) {
+      ++len;
+    }
+    PutSequence(&out, p + anchor, i - anchor, i - from, len);
+    i += len;
+    anchor = i;
+  }
+  // The final sequence carries the remaining literals and no match.
+  PutSequence(&out, p + anchor, n - anchor, 0, 0);
+  return out;
+}
+
+bool LzDecompress(std::string_view block, std::size_t raw_size, std::string* out, std::string* err) {
+  auto fail = [&](const char* what) {
+    if (err) {
+      *err = std::string("corrupt compressed block: ") + what;
+    }
+    return false;
+  };
+  std::string buf;
+  buf.reserve(raw_size);
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(block.data());
+  const unsigned char* end = p + block.size();
+  while (p < end) {
+    const unsigned char token = *p++;
+    std::size_t lit_len = token >> 4;
+    if (lit_len == 15 && !GetLength(&p, end, &lit_len)) {
+      return fail("truncated literal length");
+    }
+    if (lit_len > static_cast<std::size_t>(end - p) || lit_len > raw_size - buf.size()) {
+      return fail("literals overrun");
+    }
+    buf.append(reinterpret_cast<const char*>(p), lit_len);
+    p += lit_len;
+    if (p == end) {
+      break;
+    }
+    if (end - p < 2) {
+      return fail("truncated offset");
+    }
+    const std::size_t offset = static_cast<std::size_t>(p[0]) | (static_cast<std::size_t>(p[1]) << 8);
+    p += 2;
+    std::size_t match_len = token & 0x0F;
+    if (match_len == 15 && !GetLength(&p, end, &match_len)) {
+      return fail("truncated match length");
+    }
+    match_len += kMinMatch;
+    if (offset == 0 || offset > buf.size()) {
+      return fail("offset out of range");
+    }
+    if (match_len > raw_size - buf.size()) {
+      return fail("match overrun");
+    }
+    // Byte by byte, since a match may overlap the bytes it produces.
+    std::size_t from = buf.size() - offset;
+    for (std::size_t k = 0; k < match_len; ++k) {
+      buf.push_back(buf[from + k]);
+    }
+  }
+  if (buf.size() != raw_size) {
+    return fail("size mismatch");
+  }
+  out->append(buf);
+  return true;
+}
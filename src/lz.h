@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// A small LZ77 codec in the style of LZ4: each block is a run of sequences,
+// a token byte with literal and match lengths in its nibbles, the literals,
+// then a 16-bit back-reference offset. Blocks are self-contained; the caller
+// keeps the uncompressed size.
+std::string LzCompress(std::string_view input);
+
+// Appends the raw_size bytes block decodes to to out. Fails, leaving out
+// unchanged, on any block that does not decode to exactly raw_size bytes.
+bool LzDecompress(std::string_view block, std::size_t raw_size, std::string* out, std::string* err);
@@ -1,21 +1,41 @@
 #include "alias.h"
+#include "cli.h"
+#include "control.h"
+#include "entry_ids.h"
+#include "fanout.h"
 #include "history.h"
 #include "normalize.h"
+#include "probe.h"
+#include "session.h"
+#include "shell_init.h"
+#include "ssh_config.h"
+#include "snapshot.h"
+#include "ssh_exec.h"
+#include "sync.h"
 #include "tokenize.h"
 #include "tui.h"
 #include "util.h"
 
+#include <algorithm>
 #include <cerrno>
 #include <charconv>
 #include <cctype>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <fnmatch.h>
 #include <iostream>
 #include <limits>
+#include <regex>
 #include <string>
 #include <system_error>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
+#include <sys/file.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 namespace
@@ -27,28 +47,58 @@ namespace
     std::string port;
     std::string jump;
     std::string identity;
+    std::string user;
+    std::string hostname;
+    std::string config_file;
   };
 
   void PrintUsage()
   {
     std::cerr << "Usage:\n"
-              << "  sshtab record --exit-code <int> --raw <raw_cmd>\n"
+              << "  sshtab record --exit-code <int> --raw <raw_cmd> [--prefetch <N>]\n"
               << "    Record a successful ssh command from hooks.\n"
-              << "  sshtab add <command...>\n"
+              << "  sshtab add [--prefetch <N>] <command...>\n"
               << "    Add a command to general history without executing.\n"
-              << "  sshtab list --limit <N> [--with-ids]\n"
-              << "    List recent ssh commands.\n"
+              << "    --prefetch rebuilds the picker snapshots for --limit N in the background.\n"
+              << "  sshtab list --limit <N> [--with-ids] [--latency] [--approx]\n"
+              << "    List recent ssh commands; --approx lists the N most used with count bounds\n"
+              << "    in memory bounded by N.\n"
               << "  sshtab pick --limit <N> [--non-interactive --select <idx>]\n"
               << "    Pick ssh args for completion.\n"
-              << "  sshtab pick-command --limit <N> [--non-interactive --select <idx>]\n"
+              << "  sshtab pick-command --limit <N> [--approx] [--non-interactive --select <idx>]\n"
               << "    Pick full command lines for sshtab completion.\n"
-              << "  sshtab alias --name <alias> (--id <N> [--limit <N>] | --address <addr>)\n"
+              << "  sshtab init bash [--snippet <path>] [--capture auto|debug|history]\n"
+              << "    Print the bash integration with ssh path and builtin resolved ahead of time.\n"
+              << "  sshtab prefetch [--limit <N>]\n"
+              << "    Build the ready-to-render snapshots pick and pick-command load first.\n"
+              << "  sshtab alias --name <alias> (--id <N> | --address <addr>)\n"
               << "    Set or clear ssh alias display name.\n"
-              << "  sshtab delete --index <N> [--limit <N>]\n"
+              << "  sshtab delete --index <N>\n"
               << "  sshtab delete --pick [--limit <N>]\n"
               << "    Delete ssh history entries.\n"
-              << "  sshtab exec <args_string>\n"
-              << "    Execute ssh with safe tokenization.\n";
+              << "  sshtab prune [--older-than <dur>] [--min-count <N>] [--host <glob>]\n"
+              << "               [--host-regex <re>] [--failed] [--commands] [--dry-run]\n"
+              << "               [--drop-segments <dur>]\n"
+              << "    Remove matching entries in one rewrite (dur: N[s|m|h|d|w], default d);\n"
+              << "    --drop-segments deletes frozen segments older than dur whole.\n"
+              << "  sshtab search [--since <dur>] [--commands] [--timing] <text>\n"
+              << "    Print every successful ssh command containing text, oldest first, from\n"
+              << "    the whole history including compressed segments; --timing adds the\n"
+              << "    connect latency and session length of timed runs.\n"
+              << "  sshtab export\n"
+              << "  sshtab import --merge <file|->...\n"
+              << "    Write this machine's history, with what it imported, to stdout as sorted\n"
+              << "    aggregates; merge exports from other machines. Merging is idempotent, so\n"
+              << "    machines syncing through a shared directory converge.\n"
+              << "  sshtab warm [--top <N>] [--jobs <N>] [--persist <time>] [--background]\n"
+              << "    Start ssh ControlMaster sockets for the most frecent targets.\n"
+              << "  sshtab fanout [--jobs <N>] [--limit <N>] (--pick | --host <glob> | --host-regex <re>) -- <cmd...>\n"
+              << "    Run a command on several history targets concurrently with prefixed output.\n"
+              << "  sshtab probe [--top <N>] [--timeout-ms <ms>] [--ttl <time>]\n"
+              << "    TCP-connect to the most frecent hosts at once and cache up/down and RTT.\n"
+              << "  sshtab exec [--timed [--raw <raw_cmd>]] (<args_string> | -- <ssh_args...>)\n"
+              << "    Execute ssh with safe tokenization; --timed waits for ssh and records\n"
+              << "    connect latency and duration with the --raw command.\n";
   }
 
   bool ParseIntArg(const char *arg, int *out)
@@ -93,6 +143,55 @@ namespace
     return true;
   }
 
+  bool ParseDurationArg(const char *arg, std::int64_t *out)
+  {
+    if (!arg || !out || arg[0] == '-')
+    {
+      return false;
+    }
+    const char *end = arg + std::strlen(arg);
+    std::int64_t unit = 86400;
+    if (end > arg)
+    {
+      switch (end[-1])
+      {
+      case 's':
+        unit = 1;
+        --end;
+        break;
+      case 'm':
+        unit = 60;
+        --end;
+        break;
+      case 'h':
+        unit = 3600;
+        --end;
+        break;
+      case 'd':
+        --end;
+        break;
+      case 'w':
+        unit = 604800;
+        --end;
+        break;
+      default:
+        break;
+      }
+    }
+    std::int64_t value = 0;
+    auto result = std::from_chars(arg, end, value, 10);
+    if (result.ec != std::errc() || result.ptr != end || end == arg)
+    {
+      return false;
+    }
+    if (value > std::numeric_limits<std::int64_t>::max() / unit)
+    {
+      return false;
+    }
+    *out = value * unit;
+    return true;
+  }
+
   bool HasControlChars(const std::string &s)
   {
     return ContainsControlChars(s);
@@ -156,7 +255,8 @@ namespace
     std::string command;
     for (const auto &token : tokens)
     {
-      if (ContainsControlChars(token))
+      TokenizeError bad = FindForbiddenChar(token, nullptr);
+      if (bad == TokenizeError::kControlChar)
       {
         if (err)
         {
@@ -164,7 +264,7 @@ namespace
         }
         return false;
       }
-      if (ContainsForbiddenMetachars(token))
+      if (bad == TokenizeError::kMetachar)
       {
         if (err)
         {
@@ -278,59 +378,480 @@ namespace
     return path.substr(slash + 1, end - slash - 1);
   }
 
+  // Compiled configs for this invocation, keyed by -F path ("" for the
+  // defaults). Cleared per RunCli call so a long-lived host process (the
+  // bash builtin) sees config edits.
+  std::unordered_map<std::string, SshConfig> g_ssh_configs;
+
+  const SshConfig &SshConfigFor(const std::string &config_file)
+  {
+    auto it = g_ssh_configs.find(config_file);
+    if (it != g_ssh_configs.end())
+    {
+      return it->second;
+    }
+    SshConfig config;
+    std::string err;
+    if (config_file.empty())
+    {
+      std::string cache_path = GetSshConfigCachePath(&err);
+      LoadSshConfigCached(DefaultSshConfigRoots(), cache_path, &config, &err);
+    }
+    else
+    {
+      // -F replaces both the user and the system file, as in ssh.
+      CompileSshConfig({config_file}, &config, &err);
+    }
+    return g_ssh_configs.emplace(config_file, std::move(config)).first->second;
+  }
+
+  // Applies one ssh option that takes an argument.
+  void ApplySshOption(char opt, const std::string &value, SshMeta *meta)
+  {
+    switch (opt)
+    {
+    case 'p':
+      meta->port = value;
+      break;
+    case 'J':
+      meta->jump = value;
+      break;
+    case 'i':
+      meta->identity = BasenamePath(value);
+      break;
+    case 'l':
+      meta->user = value;
+      break;
+    case 'F':
+      meta->config_file = value;
+      break;
+    case 'o':
+    {
+      size_t split = value.find_first_of("= \t");
+      if (split == std::string::npos)
+      {
+        break;
+      }
+      std::string key = value.substr(0, split);
+      std::string option_value = TrimSpace(value.substr(split + 1));
+      if (!option_value.empty() && option_value[0] == '=')
+      {
+        option_value = TrimSpace(option_value.substr(1));
+      }
+      std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c)
+                     { return static_cast<char>(std::tolower(c)); });
+      if (key == "port")
+      {
+        meta->port = option_value;
+      }
+      else if (key == "proxyjump")
+      {
+        meta->jump = option_value;
+      }
+      else if (key == "hostname")
+      {
+        meta->hostname = option_value;
+      }
+      else if (key == "user")
+      {
+        meta->user = option_value;
+      }
+      else if (key == "identityfile")
+      {
+        meta->identity = BasenamePath(option_value);
+      }
+      break;
+    }
+    default:
+      break;
+    }
+  }
+
   SshMeta ExtractSshMeta(const std::string &args)
   {
     SshMeta meta;
-    std::vector<std::string> tokens = SplitArgsSimple(args);
-    for (size_t i = 0; i < tokens.size(); ++i)
+    std::vector<std::string> tokens;
+    std::string tok_err;
+    if (!TokenizeArgs(args, &tokens, &tok_err))
+    {
+      tokens = SplitArgsSimple(args);
+    }
+    // A partial parse still names the host when only a trailing option
+    // lacks its value.
+    SshTarget target;
+    ParseSshArgs(tokens, &target, &tok_err);
+    meta.host = target.host;
+    meta.user = target.user;
+    meta.port = target.port;
+    for (const auto &option : target.options)
+    {
+      ApplySshOption(option.first, option.second, &meta);
+    }
+
+    if (meta.host.empty())
     {
-      const std::string &tok = tokens[i];
-      if (tok == "-p")
+      return meta;
+    }
+    SshHostConfig resolved = ResolveSshHost(SshConfigFor(meta.config_file), meta.host, meta.user);
+    if (meta.hostname.empty())
+    {
+      meta.hostname = resolved.hostname;
+    }
+    if (meta.port.empty())
+    {
+      meta.port = resolved.port;
+    }
+    if (meta.jump.empty())
+    {
+      meta.jump = resolved.proxy_jump;
+    }
+    else if (meta.jump == "none")
+    {
+      meta.jump.clear();
+    }
+    if (meta.user.empty())
+    {
+      meta.user = resolved.user;
+    }
+    if (meta.identity.empty() && !resolved.identity_file.empty())
+    {
+      meta.identity = BasenamePath(resolved.identity_file);
+    }
+    return meta;
+  }
+
+  // The endpoint that decides reachability: the effective hostname, or the
+  // first hop of the jump chain resolved through ssh_config.
+  bool ResolveProbeTarget(const std::string &host, const std::string &hostname, const std::string &port,
+                          const std::string &jump, ProbeTarget *out, int depth = 0)
+  {
+    if (!jump.empty() && depth < 8)
+    {
+      std::string hop = jump.substr(0, jump.find(','));
+      if (hop.rfind("ssh://", 0) != 0)
       {
-        if (i + 1 < tokens.size())
-        {
-          meta.port = tokens[++i];
-        }
-        continue;
+        hop = "ssh://" + hop;
       }
-      if (tok.size() > 2 && tok.rfind("-p", 0) == 0)
+      SshMeta hop_meta = ExtractSshMeta(hop);
+      return ResolveProbeTarget(hop_meta.host, hop_meta.hostname, hop_meta.port, hop_meta.jump, out, depth + 1);
+    }
+    return ProbeTargetForSsh(hostname.empty() ? host : hostname, port, "", out);
+  }
+
+  PickItem MakeSshPickItem(const HistoryEntry &entry, const std::string &args,
+                           const AliasMap &aliases)
+  {
+    SshMeta meta = ExtractSshMeta(args);
+    PickItem item;
+    item.display = entry.command;
+    auto alias_it = aliases.find(SshTargetKey(args));
+    if (alias_it != aliases.end() && !HasControlChars(alias_it->second))
+    {
+      item.alias = alias_it->second;
+    }
+    item.args = args;
+    item.last_used = entry.last_used;
+    item.count = entry.count;
+    item.connect_ms = entry.connect_ms;
+    item.host = meta.host;
+    item.port = meta.port;
+    item.jump = meta.jump;
+    item.identity = meta.identity;
+    item.hostname = meta.hostname;
+    return item;
+  }
+
+  // Fills the picker status column from cached probe results; nothing is
+  // probed here, so an empty or expired cache leaves the column blank. When
+  // valid_until is given it receives the earliest expiry among the results
+  // used, or is left alone if none were.
+  void ApplyProbeStatus(std::vector<PickItem> *items, std::int64_t *valid_until = nullptr)
+  {
+    std::unordered_map<std::string, ProbeResult> cache;
+    std::string err;
+    std::int64_t now = static_cast<std::int64_t>(std::time(nullptr));
+    if (!LoadProbeCache(now, &cache, &err) || cache.empty())
+    {
+      return;
+    }
+    for (auto &item : *items)
+    {
+      ProbeTarget target;
+      if (item.host.empty() || !ResolveProbeTarget(item.host, item.hostname, item.port, item.jump, &target))
       {
-        meta.port = tok.substr(2);
         continue;
       }
-      if (tok == "-J")
+      auto it = cache.find(ProbeKey(target.host, target.port));
+      if (it != cache.end())
       {
-        if (i + 1 < tokens.size())
+        item.status = FormatProbeStatus(it->second);
+        if (valid_until && (*valid_until == 0 || it->second.expires_at < *valid_until))
         {
-          meta.jump = tokens[++i];
+          *valid_until = it->second.expires_at;
         }
+      }
+    }
+  }
+
+  void SortByFrecency(std::vector<HistoryEntry> *entries)
+  {
+    std::int64_t now = static_cast<std::int64_t>(std::time(nullptr));
+    std::stable_sort(entries->begin(), entries->end(), [now](const HistoryEntry &a, const HistoryEntry &b)
+                     { return FrecencyScore(a.count, a.last_used, now) > FrecencyScore(b.count, b.last_used, now); });
+  }
+
+  std::vector<PickItem> BuildSshPickItems(const std::vector<HistoryEntry> &entries)
+  {
+    AliasMap aliases;
+    std::string alias_err;
+    LoadAliases(&aliases, &alias_err);
+    std::vector<PickItem> items;
+    items.reserve(entries.size());
+    for (const auto &entry : entries)
+    {
+      if (HasControlChars(entry.command))
+      {
         continue;
       }
-      if (tok.size() > 2 && tok.rfind("-J", 0) == 0)
+      std::string args = ExtractArgsFromCommand(entry.command);
+      if (args.empty() || HasControlChars(args))
+      {
+        continue;
+      }
+      items.push_back(MakeSshPickItem(entry, args, aliases));
+    }
+    return items;
+  }
+
+  // The command view already holds every ssh connection, grouped with the
+  // other spellings of its target.
+  std::vector<PickItem> BuildCommandPickItems(const std::vector<HistoryEntry> &entries)
+  {
+    AliasMap command_aliases;
+    std::string alias_err;
+    LoadCommandAliases(&command_aliases, &alias_err);
+
+    AliasMap ssh_aliases;
+    std::string ssh_alias_err;
+    LoadAliases(&ssh_aliases, &ssh_alias_err);
+
+    std::vector<PickItem> items;
+    items.reserve(entries.size());
+    for (const auto &entry : entries)
+    {
+      if (HasControlChars(entry.command) || ContainsForbiddenMetachars(entry.command))
       {
-        meta.jump = tok.substr(2);
         continue;
       }
-      if (tok == "-i")
+      PickItem item;
+      item.display = entry.command;
+      item.args = entry.command;
+      auto alias_it = command_aliases.find(SshCommandKey(entry.command));
+      if (alias_it != command_aliases.end() && !HasControlChars(alias_it->second))
+      {
+        item.alias = alias_it->second;
+      }
+      if (item.alias.empty())
       {
-        if (i + 1 < tokens.size())
+        std::string args = ExtractArgsFromCommand(entry.command);
+        if (!args.empty())
         {
-          meta.identity = BasenamePath(tokens[++i]);
+          auto ssh_alias_it = ssh_aliases.find(SshTargetKey(args));
+          if (ssh_alias_it != ssh_aliases.end() && !HasControlChars(ssh_alias_it->second))
+          {
+            item.alias = ssh_alias_it->second;
+          }
         }
-        continue;
       }
-      if (tok.size() > 2 && tok.rfind("-i", 0) == 0)
+      std::string args = ExtractArgsFromCommand(entry.command);
+      if (!args.empty())
       {
-        meta.identity = BasenamePath(tok.substr(2));
-        continue;
+        SshMeta meta = ExtractSshMeta(args);
+        item.host = meta.host;
+        item.port = meta.port;
+        item.jump = meta.jump;
+        item.identity = meta.identity;
+        item.hostname = meta.hostname;
       }
-      if (!tok.empty() && tok[0] == '-')
+      item.last_used = entry.last_used;
+      item.count = entry.count;
+      item.connect_ms = entry.connect_ms;
+      items.push_back(item);
+    }
+
+    return items;
+  }
+
+  std::vector<PickItem> BuildSshPickItems(std::size_t limit)
+  {
+    std::string err;
+    return BuildSshPickItems(LoadRecentUnique(limit, &err));
+  }
+
+  std::vector<PickItem> BuildCommandPickItems(std::size_t limit)
+  {
+    std::string err;
+    std::vector<HistoryEntry> entries = LoadRecentUniqueCommands(limit, &err);
+    if (!err.empty() && entries.empty())
+    {
+      std::cerr << "pick-command warning: " << err << "\n";
+    }
+    return BuildCommandPickItems(entries);
+  }
+
+  // Every file a picker list is derived from besides ssh_config, which the
+  // compiled configs track themselves. Frozen segments are covered by their
+  // directory, whose mtime changes whenever one is added, rewritten or
+  // dropped.
+  std::vector<std::string> PickSnapshotInputs()
+  {
+    std::string err;
+    std::vector<std::string> inputs = {GetEventLogPath(&err), GetSegmentDir(&err), GetRemoteHistoryPath(&err),
+                                       GetAliasPath(&err), GetCommandAliasPath(&err), GetProbeCachePath(&err)};
+    for (const auto &layer : GetHistoryLayerPaths())
+    {
+      inputs.push_back(layer);
+      inputs.push_back(GetLayerAliasPath(layer));
+    }
+    return inputs;
+  }
+
+  std::vector<SnapshotSource> StatPickSnapshotInputs()
+  {
+    std::vector<SnapshotSource> sources;
+    for (const auto &input : PickSnapshotInputs())
+    {
+      if (!input.empty())
       {
-        continue;
+        sources.push_back(StatSnapshotSource(input));
       }
-      meta.host = tok;
     }
-    return meta;
+    return sources;
+  }
+
+  bool PrefetchPickSnapshot(const std::string &name, std::size_t limit, const std::vector<SnapshotSource> &sources,
+                            std::vector<PickItem> items, std::string *err)
+  {
+    std::string path = GetPickSnapshotPath(name, err);
+    if (path.empty())
+    {
+      return false;
+    }
+    PickSnapshot snapshot;
+    snapshot.limit = limit;
+    snapshot.sources = sources;
+    snapshot.items = std::move(items);
+    ApplyProbeStatus(&snapshot.items, &snapshot.valid_until);
+    for (const auto &kv : g_ssh_configs)
+    {
+      for (const auto &source : kv.second.sources)
+      {
+        SnapshotSource dep;
+        dep.path = source.path;
+        dep.mtime_ns = source.mtime_ns;
+        dep.size = source.size;
+        snapshot.sources.push_back(dep);
+      }
+    }
+    return WritePickSnapshot(path, snapshot, err);
+  }
+
+  // Rebuilds both picker snapshots. A prefetch that finds another one
+  // running gives up, since the running one re-reads every input anyway and
+  // the picker re-validates whatever it finds.
+  bool RunPrefetch(std::size_t limit, std::string *err)
+  {
+    std::string dir = GetDataDir(err);
+    if (dir.empty() || !EnsureDir(dir, err))
+    {
+      return false;
+    }
+    std::string lock_path = dir + "/prefetch.lock";
+    ScopedFd lock_fd(open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600));
+    if (lock_fd.get() < 0)
+    {
+      if (err)
+      {
+        *err = std::string("open lock failed: ") + std::strerror(errno);
+      }
+      return false;
+    }
+    if (flock(lock_fd.get(), LOCK_EX | LOCK_NB) != 0)
+    {
+      return errno == EWOULDBLOCK;
+    }
+    // Inputs are stat'ed before they are read so a write that races with
+    // the build leaves the snapshot stale rather than silently outdated.
+    // Both pickers' entries come from one read of the event log.
+    std::vector<SnapshotSource> sources = StatPickSnapshotInputs();
+    HistoryViews views;
+    std::string load_err;
+    LoadHistoryViews(limit, &views, &load_err);
+    return PrefetchPickSnapshot("pick", limit, sources, BuildSshPickItems(views.ssh), err) &&
+           PrefetchPickSnapshot("pick-command", limit, sources, BuildCommandPickItems(views.commands), err);
+  }
+
+  // Runs RunPrefetch in a detached, low-priority grandchild and returns as
+  // soon as the intermediate child has exited, so the caller (and the
+  // prompt waiting on it) never waits for the rebuild. Both children end in
+  // _exit.
+  void SpawnPrefetch(std::size_t limit)
+  {
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+      return;
+    }
+    if (pid == 0)
+    {
+      if (fork() != 0)
+      {
+        _exit(0);
+      }
+      setsid();
+      RedirectStdioToNull();
+      setpriority(PRIO_PROCESS, 0, 10);
+      // Inside the bash builtin the child is a copy of the shell, so it must
+      // end here even when the rebuild throws, never return to the caller.
+      int rc = 1;
+      try
+      {
+        std::string err;
+        rc = RunPrefetch(limit, &err) ? 0 : 1;
+      }
+      catch (...)
+      {
+      }
+      _exit(rc);
+    }
+    // Inside the bash builtin the shell may reap the child first; ECHILD
+    // then just ends the wait.
+    while (waitpid(pid, nullptr, 0) < 0 && errno == EINTR)
+    {
+    }
+  }
+
+  // Loads the prefetched list for a picker. A snapshot that exists but no
+  // longer matches its inputs is rebuilt in the background for next time.
+  bool LoadPrefetchedItems(const std::string &name, std::size_t limit, std::vector<PickItem> *items)
+  {
+    std::string err;
+    std::string path = GetPickSnapshotPath(name, &err);
+    if (path.empty())
+    {
+      return false;
+    }
+    std::int64_t now = static_cast<std::int64_t>(std::time(nullptr));
+    if (LoadPickSnapshot(path, limit, now, items, &err))
+    {
+      return true;
+    }
+    if (access(path.c_str(), F_OK) == 0)
+    {
+      SpawnPrefetch(limit);
+    }
+    return false;
   }
 
   bool NormalizeArgsInput(const std::string &input, std::string *out, std::string *err)
@@ -405,10 +926,45 @@ namespace
     return true;
   }
 
+  // Resolves a stable entry ID. History recorded before IDs existed gets
+  // its IDs here if nothing has been recorded since.
+  bool ResolveEntryId(std::int64_t id, std::string *command, std::string *err)
+  {
+    if (!HaveEntryIdIndex() && !SyncEntryIds(err))
+    {
+      return false;
+    }
+    return LookupEntryId(id, command, err);
+  }
+
+  // Returns the item indices a picker deletion applies to: the marked rows,
+  // or the selected row when nothing is marked. Sorted ascending.
+  std::vector<std::size_t> DeletionTargets(std::size_t selected, const std::vector<std::size_t> &marked)
+  {
+    if (!marked.empty())
+    {
+      return marked;
+    }
+    return std::vector<std::size_t>{selected};
+  }
+
+  void EraseItems(std::vector<PickItem> *items, const std::vector<std::size_t> &targets)
+  {
+    for (auto it = targets.rbegin(); it != targets.rend(); ++it)
+    {
+      if (*it < items->size())
+      {
+        items->erase(items->begin() + static_cast<std::ptrdiff_t>(*it));
+      }
+    }
+  }
+
   int CommandRecord(int argc, char **argv)
   {
     int exit_code = -1;
     std::string raw;
+    bool prefetch = false;
+    std::size_t prefetch_limit = 0;
 
     for (int i = 2; i < argc; ++i)
     {
@@ -431,7 +987,17 @@ namespace
         }
         raw = argv[++i];
       }
-      else
+      else if (arg == "--prefetch")
+      {
+        if (i + 1 >= argc || !ParseSizeArg(argv[i + 1], &prefetch_limit))
+        {
+          std::cerr << "Invalid --prefetch value\n";
+          return 1;
+        }
+        prefetch = true;
+        ++i;
+      }
+      else
       {
         std::cerr << "Unknown argument: " << arg << "\n";
         return 1;
@@ -471,18 +1037,29 @@ namespace
       std::cerr << "record failed: " << err << "\n";
       return 1;
     }
-    err.clear();
-    if (!AppendCommandHistory(normalized, exit_code, &err))
+    if (prefetch)
     {
-      std::cerr << "record failed: " << err << "\n";
-      return 1;
+      SpawnPrefetch(prefetch_limit);
     }
     return 0;
   }
 
   int CommandAdd(int argc, char **argv)
   {
-    if (argc < 3)
+    int first = 2;
+    bool prefetch = false;
+    std::size_t prefetch_limit = 0;
+    if (argc > 2 && std::string(argv[2]) == "--prefetch")
+    {
+      if (argc < 4 || !ParseSizeArg(argv[3], &prefetch_limit))
+      {
+        std::cerr << "Invalid --prefetch value\n";
+        return 1;
+      }
+      prefetch = true;
+      first = 4;
+    }
+    if (argc <= first)
     {
       std::cerr << "add requires a command" << "\n";
       return 1;
@@ -490,9 +1067,9 @@ namespace
 
     std::string command;
     std::string err;
-    if (argc == 3)
+    if (argc == first + 1)
     {
-      if (!NormalizeCommandRaw(argv[2], &command, &err))
+      if (!NormalizeCommandRaw(argv[first], &command, &err))
       {
         std::cerr << "add failed: " << err << "\n";
         return 1;
@@ -501,8 +1078,8 @@ namespace
     else
     {
       std::vector<std::string> tokens;
-      tokens.reserve(static_cast<std::size_t>(argc - 2));
-      for (int i = 2; i < argc; ++i)
+      tokens.reserve(static_cast<std::size_t>(argc - first));
+      for (int i = first; i < argc; ++i)
       {
         tokens.emplace_back(argv[i]);
       }
@@ -530,6 +1107,10 @@ namespace
       std::cerr << "add failed: " << err << "\n";
       return 1;
     }
+    if (prefetch)
+    {
+      SpawnPrefetch(prefetch_limit);
+    }
     return 0;
   }
 
@@ -537,6 +1118,8 @@ namespace
   {
     std::size_t limit = 50;
     bool with_ids = false;
+    bool with_latency = false;
+    bool approx = false;
     for (int i = 2; i < argc; ++i)
     {
       std::string arg = argv[i];
@@ -553,6 +1136,14 @@ namespace
       {
         with_ids = true;
       }
+      else if (arg == "--latency")
+      {
+        with_latency = true;
+      }
+      else if (arg == "--approx")
+      {
+        approx = true;
+      }
       else
       {
         std::cerr << "Unknown argument: " << arg << "\n";
@@ -561,22 +1152,61 @@ namespace
     }
 
     std::string err;
-    std::vector<HistoryEntry> entries = LoadRecentUnique(limit, &err);
+    std::vector<HistoryEntry> entries = approx ? LoadFrequentUnique(limit, &err) : LoadRecentUnique(limit, &err);
     if (!err.empty() && entries.empty())
     {
       std::cerr << "list warning: " << err << "\n";
     }
 
+    std::vector<std::int64_t> ids;
+    if (with_ids)
+    {
+      std::vector<std::string> commands;
+      commands.reserve(entries.size());
+      for (const auto &entry : entries)
+      {
+        commands.push_back(entry.command);
+      }
+      if (!FindEntryIds(commands, &ids, &err))
+      {
+        std::cerr << "list failed: " << err << "\n";
+        return 1;
+      }
+    }
+
     for (std::size_t i = 0; i < entries.size(); ++i)
     {
       if (with_ids)
       {
-        std::cout << i << '\t' << entries[i].command << "\n";
+        // Layer entries, and history not yet given IDs, have none.
+        if (ids[i] >= 0)
+        {
+          std::cout << ids[i];
+        }
+        else
+        {
+          std::cout << '-';
+        }
+        std::cout << '\t';
       }
-      else
+      if (with_latency)
+      {
+        if (entries[i].connect_ms >= 0)
+        {
+          std::cout << entries[i].connect_ms << "ms";
+        }
+        else
+        {
+          std::cout << '-';
+        }
+        std::cout << '\t';
+      }
+      if (approx)
       {
-        std::cout << entries[i].command << "\n";
+        // The true count lies within this range.
+        std::cout << entries[i].count - entries[i].count_error << ".." << entries[i].count << '\t';
       }
+      std::cout << entries[i].command << "\n";
     }
     return 0;
   }
@@ -620,39 +1250,11 @@ namespace
     }
 
     std::string err;
-    std::vector<HistoryEntry> entries = LoadRecentUnique(limit, &err);
-    std::unordered_map<std::string, std::string> aliases;
-    std::string alias_err;
-    LoadAliases(&aliases, &alias_err);
     std::vector<PickItem> items;
-    items.reserve(entries.size());
-    for (const auto &entry : entries)
+    bool prefetched = LoadPrefetchedItems("pick", limit, &items);
+    if (!prefetched)
     {
-      if (HasControlChars(entry.command))
-      {
-        continue;
-      }
-      std::string args = ExtractArgsFromCommand(entry.command);
-      if (args.empty() || HasControlChars(args))
-      {
-        continue;
-      }
-      SshMeta meta = ExtractSshMeta(args);
-      PickItem item;
-      item.display = entry.command;
-      auto alias_it = aliases.find(args);
-      if (alias_it != aliases.end() && !HasControlChars(alias_it->second))
-      {
-        item.alias = alias_it->second;
-      }
-      item.args = args;
-      item.last_used = entry.last_used;
-      item.count = entry.count;
-      item.host = meta.host;
-      item.port = meta.port;
-      item.jump = meta.jump;
-      item.identity = meta.identity;
-      items.push_back(item);
+      items = BuildSshPickItems(limit);
     }
 
     if (items.empty())
@@ -680,10 +1282,15 @@ namespace
       return 0;
     }
 
+    if (!prefetched)
+    {
+      ApplyProbeStatus(&items);
+    }
     PickUiConfig config;
     config.allow_alias_edit = true;
     config.allow_display_toggle = true;
     config.allow_delete = true;
+    config.allow_mark = true;
     config.show_alias = true;
 
     AliasUpdateFn alias_update = [&](const PickItem &item, const std::string &alias_input,
@@ -710,10 +1317,12 @@ namespace
       return SetAliasForArgs(item.args, alias, out_err);
     };
 
-    while (true) {
+    while (true)
+    {
       std::size_t selected = 0;
+      std::vector<std::size_t> marked;
       PickResult result = RunPickTui(items, "sshtab pick (Enter select, d delete, Esc cancel)", &selected,
-                                     config, alias_update, &err);
+                                     &marked, config, alias_update, &err);
       if (result == PickResult::kSelected)
       {
         if (selected >= items.size())
@@ -734,11 +1343,16 @@ namespace
         {
           return 1;
         }
-        std::string command = "ssh " + items[selected].args;
+        std::vector<std::size_t> targets = DeletionTargets(selected, marked);
+        std::unordered_set<std::string> commands;
+        for (std::size_t idx : targets)
+        {
+          commands.insert("ssh " + items[idx].args);
+        }
         int removed = 0;
         std::string del_err;
-        DeleteHistoryCommand(command, &removed, &del_err);
-        items.erase(items.begin() + static_cast<std::ptrdiff_t>(selected));
+        DeleteHistoryCommands(commands, &removed, &del_err);
+        EraseItems(&items, targets);
         if (items.empty())
         {
           return 1;
@@ -757,6 +1371,7 @@ namespace
   {
     std::size_t limit = 50;
     bool non_interactive = false;
+    bool approx = false;
     int select_idx = -1;
 
     for (int i = 2; i < argc; ++i)
@@ -771,6 +1386,10 @@ namespace
         }
         ++i;
       }
+      else if (arg == "--approx")
+      {
+        approx = true;
+      }
       else if (arg == "--non-interactive")
       {
         non_interactive = true;
@@ -791,106 +1410,17 @@ namespace
       }
     }
 
-    std::string command_err;
-    std::vector<HistoryEntry> command_entries = LoadRecentUniqueCommands(limit, &command_err);
-    if (!command_err.empty() && command_entries.empty())
-    {
-      std::cerr << "pick-command warning: " << command_err << "\n";
-    }
-
-    std::string ssh_err;
-    std::vector<HistoryEntry> ssh_entries = LoadRecentUnique(limit, &ssh_err);
-    if (!ssh_err.empty() && ssh_entries.empty())
-    {
-      std::cerr << "pick-command warning: " << ssh_err << "\n";
-    }
-
-    std::unordered_map<std::string, HistoryEntry> merged;
-    for (const auto &entry : command_entries)
-    {
-      merged.emplace(entry.command, entry);
-    }
-    for (const auto &entry : ssh_entries)
-    {
-      if (merged.find(entry.command) == merged.end())
-      {
-        merged.emplace(entry.command, entry);
-      }
-    }
-
-    std::vector<HistoryEntry> entries;
-    entries.reserve(merged.size());
-    for (const auto &kv : merged)
-    {
-      entries.push_back(kv.second);
-    }
-
-    std::sort(entries.begin(), entries.end(), [](const HistoryEntry &a, const HistoryEntry &b)
-              {
-                if (a.last_used != b.last_used)
-                {
-                  return a.last_used > b.last_used;
-                }
-                if (a.count != b.count)
-                {
-                  return a.count > b.count;
-                }
-                return a.command < b.command;
-              });
-
-    if (limit > 0 && entries.size() > limit)
+    // Snapshots hold the exact view, so --approx always reads the log.
+    std::vector<PickItem> items;
+    bool prefetched = !approx && LoadPrefetchedItems("pick-command", limit, &items);
+    if (approx)
     {
-      entries.resize(limit);
+      std::string err;
+      items = BuildCommandPickItems(LoadFrequentUniqueCommands(limit, &err));
     }
-
-    std::unordered_map<std::string, std::string> command_aliases;
-    std::string alias_err;
-    LoadCommandAliases(&command_aliases, &alias_err);
-
-    std::unordered_map<std::string, std::string> ssh_aliases;
-    std::string ssh_alias_err;
-    LoadAliases(&ssh_aliases, &ssh_alias_err);
-
-    std::vector<PickItem> items;
-    items.reserve(entries.size());
-    for (const auto &entry : entries)
+    else if (!prefetched)
     {
-      if (HasControlChars(entry.command) || ContainsForbiddenMetachars(entry.command))
-      {
-        continue;
-      }
-      PickItem item;
-      item.display = entry.command;
-      item.args = entry.command;
-      auto alias_it = command_aliases.find(entry.command);
-      if (alias_it != command_aliases.end() && !HasControlChars(alias_it->second))
-      {
-        item.alias = alias_it->second;
-      }
-      if (item.alias.empty())
-      {
-        std::string args = ExtractArgsFromCommand(entry.command);
-        if (!args.empty())
-        {
-          auto ssh_alias_it = ssh_aliases.find(args);
-          if (ssh_alias_it != ssh_aliases.end() && !HasControlChars(ssh_alias_it->second))
-          {
-            item.alias = ssh_alias_it->second;
-          }
-        }
-      }
-      std::string args = ExtractArgsFromCommand(entry.command);
-      if (!args.empty())
-      {
-        SshMeta meta = ExtractSshMeta(args);
-        item.host = meta.host;
-        item.port = meta.port;
-        item.jump = meta.jump;
-        item.identity = meta.identity;
-      }
-      item.last_used = entry.last_used;
-      item.count = entry.count;
-      items.push_back(item);
+      items = BuildCommandPickItems(limit);
     }
 
     if (items.empty())
@@ -918,10 +1448,15 @@ namespace
       return 0;
     }
 
+    if (!prefetched)
+    {
+      ApplyProbeStatus(&items);
+    }
     PickUiConfig config;
     config.allow_alias_edit = true;
     config.allow_display_toggle = true;
     config.allow_delete = true;
+    config.allow_mark = true;
     config.show_alias = true;
 
     AliasUpdateFn alias_update = [&](const PickItem &item, const std::string &alias_input,
@@ -948,11 +1483,13 @@ namespace
       return SetAliasForCommand(item.args, alias, out_err);
     };
 
-    while (true) {
+    while (true)
+    {
       std::string err;
       std::size_t selected = 0;
+      std::vector<std::size_t> marked;
       PickResult result = RunPickTui(items, "sshtab pick-command (Enter select, d delete, Esc cancel)",
-                                     &selected, config, alias_update, &err);
+                                     &selected, &marked, config, alias_update, &err);
       if (result == PickResult::kSelected)
       {
         if (selected >= items.size())
@@ -973,12 +1510,18 @@ namespace
         {
           return 1;
         }
-        std::string command = items[selected].args;
+        std::vector<std::size_t> targets = DeletionTargets(selected, marked);
+        std::unordered_set<std::string> commands;
+        for (std::size_t idx : targets)
+        {
+          commands.insert(items[idx].args);
+        }
         int removed = 0;
         std::string del_err;
-        DeleteCommandHistory(command, &removed, &del_err);
-        DeleteHistoryCommand(command, &removed, &del_err);
-        items.erase(items.begin() + static_cast<std::ptrdiff_t>(selected));
+        // Every record type lives in the one log, so this removes the ssh
+        // records of these commands too.
+        DeleteCommandHistoryCommands(commands, &removed, &del_err);
+        EraseItems(&items, targets);
         if (items.empty())
         {
           return 1;
@@ -1034,6 +1577,7 @@ namespace
       }
       else if (arg == "--limit")
       {
+        // Still accepted from older scripts; IDs no longer depend on it.
         if (i + 1 >= argc || !ParseSizeArg(argv[i + 1], &limit))
         {
           std::cerr << "Invalid --limit value\n";
@@ -1077,18 +1621,13 @@ namespace
     if (id >= 0)
     {
       std::string err;
-      std::vector<HistoryEntry> entries = LoadRecentUnique(limit, &err);
-      if (entries.empty())
-      {
-        std::cerr << "alias failed: history is empty\n";
-        return 1;
-      }
-      if (static_cast<std::size_t>(id) >= entries.size())
+      std::string command;
+      if (!ResolveEntryId(id, &command, &err))
       {
-        std::cerr << "alias failed: id out of range\n";
+        std::cerr << "alias failed: " << err << "\n";
         return 1;
       }
-      args = ExtractArgsFromCommand(entries[static_cast<std::size_t>(id)].command);
+      args = ExtractArgsFromCommand(command);
       if (args.empty())
       {
         std::cerr << "alias failed: empty args\n";
@@ -1169,6 +1708,19 @@ namespace
     }
 
     std::string err;
+    if (!use_pick)
+    {
+      // A stable ID resolves without loading or sorting the history.
+      std::string command;
+      int removed = 0;
+      if (!ResolveEntryId(index, &command, &err) || !DeleteHistoryCommand(command, &removed, &err))
+      {
+        std::cerr << "delete failed: " << err << "\n";
+        return 1;
+      }
+      return 0;
+    }
+
     std::vector<HistoryEntry> entries = LoadRecentUnique(limit, &err);
     if (entries.empty())
     {
@@ -1176,124 +1728,1054 @@ namespace
       return 1;
     }
 
-    std::unordered_map<std::string, std::string> aliases;
+    AliasMap aliases;
     std::string alias_err;
     LoadAliases(&aliases, &alias_err);
 
-    std::string command;
-    if (use_pick)
+    std::unordered_set<std::string> commands_to_delete;
+    std::vector<PickItem> items;
+    std::vector<std::string> commands;
+    items.reserve(entries.size());
+    commands.reserve(entries.size());
+    for (const auto &entry : entries)
     {
-      std::vector<PickItem> items;
-      std::vector<std::string> commands;
-      items.reserve(entries.size());
-      commands.reserve(entries.size());
-      for (const auto &entry : entries)
+      if (HasControlChars(entry.command))
+      {
+        continue;
+      }
+      std::string args = ExtractArgsFromCommand(entry.command);
+      items.push_back(MakeSshPickItem(entry, args, aliases));
+      commands.push_back(entry.command);
+    }
+    if (items.empty())
+    {
+      std::cerr << "delete failed: no deletable entries\n";
+      return 1;
+    }
+    ApplyProbeStatus(&items);
+    PickUiConfig config;
+    config.allow_alias_edit = false;
+    config.allow_display_toggle = true;
+    config.allow_mark = true;
+    config.show_alias = true;
+    std::size_t selected = 0;
+    std::vector<std::size_t> marked;
+    PickResult result = RunPickTui(items, "sshtab delete (Space mark, Enter delete, Esc/Ctrl+C cancel)",
+                                   &selected, &marked, config, AliasUpdateFn(), &err);
+    if (result != PickResult::kSelected)
+    {
+      return 1;
+    }
+    if (selected >= commands.size())
+    {
+      return 1;
+    }
+    for (std::size_t idx : DeletionTargets(selected, marked))
+    {
+      commands_to_delete.insert(commands[idx]);
+    }
+
+    int removed = 0;
+    if (!DeleteHistoryCommands(commands_to_delete, &removed, &err))
+    {
+      std::cerr << "delete failed: " << err << "\n";
+      return 1;
+    }
+    return 0;
+  }
+
+  int CommandPrune(int argc, char **argv)
+  {
+    PruneOptions options;
+    std::int64_t older_than = 0;
+    bool have_older_than = false;
+    std::int64_t segment_age = 0;
+    bool have_segment_age = false;
+    std::string host_glob;
+    std::string host_regex;
+    bool use_commands = false;
+
+    for (int i = 2; i < argc; ++i)
+    {
+      std::string arg = argv[i];
+      if (arg == "--older-than")
       {
-        if (HasControlChars(entry.command))
+        if (i + 1 >= argc || !ParseDurationArg(argv[i + 1], &older_than))
         {
-          continue;
+          std::cerr << "Invalid --older-than value\n";
+          return 1;
         }
-        std::string args = ExtractArgsFromCommand(entry.command);
-        SshMeta meta = ExtractSshMeta(args);
-        PickItem item;
-        item.display = entry.command;
-        auto alias_it = aliases.find(args);
-        if (alias_it != aliases.end() && !HasControlChars(alias_it->second))
+        have_older_than = true;
+        ++i;
+      }
+      else if (arg == "--drop-segments")
+      {
+        if (i + 1 >= argc || !ParseDurationArg(argv[i + 1], &segment_age))
         {
-          item.alias = alias_it->second;
+          std::cerr << "Invalid --drop-segments value\n";
+          return 1;
         }
-        item.args = args;
-        item.last_used = entry.last_used;
-        item.count = entry.count;
-        item.host = meta.host;
-        item.port = meta.port;
-        item.jump = meta.jump;
-        item.identity = meta.identity;
-        items.push_back(item);
-        commands.push_back(entry.command);
+        have_segment_age = true;
+        ++i;
       }
-      if (items.empty())
+      else if (arg == "--min-count")
       {
-        std::cerr << "delete failed: no deletable entries\n";
-        return 1;
+        if (i + 1 >= argc || !ParseIntArg(argv[i + 1], &options.min_count) || options.min_count <= 0)
+        {
+          std::cerr << "Invalid --min-count value\n";
+          return 1;
+        }
+        ++i;
       }
-      PickUiConfig config;
-      config.allow_alias_edit = false;
-      config.allow_display_toggle = true;
-      config.show_alias = true;
-      std::size_t selected = 0;
-      PickResult result = RunPickTui(items, "sshtab delete (Enter delete, Esc/Ctrl+C cancel)",
-                                     &selected, config, AliasUpdateFn(), &err);
-      if (result != PickResult::kSelected)
+      else if (arg == "--host")
       {
-        return 1;
+        if (i + 1 >= argc)
+        {
+          std::cerr << "Missing --host value\n";
+          return 1;
+        }
+        host_glob = argv[++i];
       }
-      if (selected >= commands.size())
+      else if (arg == "--host-regex")
       {
-        return 1;
+        if (i + 1 >= argc)
+        {
+          std::cerr << "Missing --host-regex value\n";
+          return 1;
+        }
+        host_regex = argv[++i];
       }
-      command = commands[selected];
-    }
-    else
-    {
-      if (index < 0)
+      else if (arg == "--failed")
       {
-        std::cerr << "Invalid --index value\n";
-        return 1;
+        options.drop_failed = true;
+      }
+      else if (arg == "--commands")
+      {
+        use_commands = true;
+      }
+      else if (arg == "--dry-run")
+      {
+        options.dry_run = true;
       }
-      if (static_cast<std::size_t>(index) >= entries.size())
+      else
       {
-        std::cerr << "delete failed: index out of range\n";
+        std::cerr << "Unknown argument: " << arg << "\n";
         return 1;
       }
-      command = entries[static_cast<std::size_t>(index)].command;
-    }
-
-    int removed = 0;
-    if (!DeleteHistoryCommand(command, &removed, &err))
-    {
-      std::cerr << "delete failed: " << err << "\n";
-      return 1;
     }
-    return 0;
-  }
 
-  int CommandExec(int argc, char **argv)
-  {
-    if (argc != 3)
+    if (!have_older_than && options.min_count == 0 && host_glob.empty() && host_regex.empty() &&
+        !options.drop_failed && !have_segment_age)
     {
-      std::cerr << "exec requires exactly one args_string\n";
+      std::cerr << "prune requires at least one filter\n";
       return 1;
     }
 
-    std::string args_string = argv[2];
-    if (ContainsControlChars(args_string))
+    if (have_older_than)
     {
-      std::cerr << "exec rejected control characters\n";
-      return 1;
+      options.older_than = static_cast<std::int64_t>(std::time(nullptr)) - older_than;
+      if (options.older_than <= 0)
+      {
+        options.older_than = 1;
+      }
     }
-    if (ContainsForbiddenMetachars(args_string))
+    if (have_segment_age)
     {
-      std::cerr << "exec rejected shell metacharacters\n";
-      return 1;
+      options.drop_segments_before = static_cast<std::int64_t>(std::time(nullptr)) - segment_age;
+      if (options.drop_segments_before <= 0)
+      {
+        options.drop_segments_before = 1;
+      }
     }
 
-    std::vector<std::string> tokens;
-    std::string tok_err;
-    if (!TokenizeArgs(args_string, &tokens, &tok_err))
+    std::regex re;
+    if (!host_regex.empty())
     {
-      std::cerr << "exec tokenize failed: " << tok_err << "\n";
-      return 1;
+      try
+      {
+        re = std::regex(host_regex, std::regex::ECMAScript);
+      }
+      catch (const std::regex_error &e)
+      {
+        std::cerr << "Invalid --host-regex value: " << e.what() << "\n";
+        return 1;
+      }
+    }
+    if (!host_glob.empty() || !host_regex.empty())
+    {
+      options.match = [&](const std::string &command) -> bool
+      {
+        std::string args = ExtractArgsFromCommand(command);
+        if (args.empty())
+        {
+          return false;
+        }
+        std::string host = ExtractSshMeta(args).host;
+        if (host.empty())
+        {
+          return false;
+        }
+        if (!host_glob.empty() && fnmatch(host_glob.c_str(), host.c_str(), 0) != 0)
+        {
+          return false;
+        }
+        if (!host_regex.empty() && !std::regex_search(host, re))
+        {
+          return false;
+        }
+        return true;
+      };
+    }
+
+    PruneStats stats;
+    std::string err;
+    bool ok = use_commands ? PruneCommandHistory(options, &stats, &err) : PruneHistory(options, &stats, &err);
+    if (!ok)
+    {
+      std::cerr << "prune failed: " << err << "\n";
+      return 1;
+    }
+    std::cout << (options.dry_run ? "would prune " : "pruned ") << stats.lines << " lines ("
+              << stats.bytes << " bytes)";
+    if (stats.commands > 0)
+    {
+      std::cout << " across " << stats.commands << " commands";
+    }
+    if (stats.segments > 0)
+    {
+      std::cout << " including " << stats.segments << " whole segments";
+    }
+    std::cout << "\n";
+    return 0;
+  }
+
+  // A recorded time for display; "-" when the run was not timed.
+  std::string FormatTimingMs(std::int64_t ms)
+  {
+    if (ms < 0)
+    {
+      return "-";
+    }
+    char buf[32];
+    if (ms < 1000)
+    {
+      std::snprintf(buf, sizeof(buf), "%lldms", static_cast<long long>(ms));
+    }
+    else if (ms < 60000)
+    {
+      std::snprintf(buf, sizeof(buf), "%.1fs", static_cast<double>(ms) / 1000.0);
+    }
+    else if (ms < 3600000)
+    {
+      std::snprintf(buf, sizeof(buf), "%lldm%02llds", static_cast<long long>(ms / 60000),
+                    static_cast<long long>(ms / 1000 % 60));
+    }
+    else
+    {
+      std::snprintf(buf, sizeof(buf), "%lldh%02lldm", static_cast<long long>(ms / 3600000),
+                    static_cast<long long>(ms / 60000 % 60));
+    }
+    return buf;
+  }
+
+  int CommandSearch(int argc, char **argv)
+  {
+    std::int64_t since_age = 0;
+    bool use_commands = false;
+    bool with_timing = false;
+    std::string text;
+    for (int i = 2; i < argc; ++i)
+    {
+      std::string arg = argv[i];
+      if (arg == "--since")
+      {
+        if (i + 1 >= argc || !ParseDurationArg(argv[i + 1], &since_age))
+        {
+          std::cerr << "Invalid --since value\n";
+          return 1;
+        }
+        ++i;
+      }
+      else if (arg == "--commands")
+      {
+        use_commands = true;
+      }
+      else if (arg == "--timing")
+      {
+        with_timing = true;
+      }
+      else if (text.empty() && !arg.empty() && arg[0] != '-')
+      {
+        text = arg;
+      }
+      else
+      {
+        std::cerr << "Unknown argument: " << arg << "\n";
+        return 1;
+      }
+    }
+    if (text.empty())
+    {
+      std::cerr << "Missing search text\n";
+      return 1;
+    }
+
+    // Without --since the scan covers the whole history; with it, archived
+    // segments older than the cutoff are not decompressed at all.
+    std::int64_t since = 0;
+    if (since_age > 0)
+    {
+      since = static_cast<std::int64_t>(std::time(nullptr)) - since_age;
+    }
+    std::string err;
+    bool ok = ScanHistory(
+        since,
+        [&](const HistoryEvent &event)
+        {
+          if (event.exit_code != 0 || (!use_commands && !event.ssh) ||
+              event.command.find(text) == std::string::npos)
+          {
+            return;
+          }
+          std::time_t ts = static_cast<std::time_t>(event.ts);
+          struct tm tm;
+          char when[32] = "?";
+          if (localtime_r(&ts, &tm))
+          {
+            std::strftime(when, sizeof(when), "%Y-%m-%d %H:%M", &tm);
+          }
+          std::cout << when << "\t";
+          if (with_timing)
+          {
+            std::cout << FormatTimingMs(event.timing.first_byte_ms) << "\t"
+                      << FormatTimingMs(event.timing.duration_ms) << "\t";
+          }
+          std::cout << event.command << "\n";
+        },
+        &err);
+    if (!ok)
+    {
+      std::cerr << "search failed: " << err << "\n";
+      return 1;
+    }
+    return 0;
+  }
+
+  int CommandExport(int argc, char **argv)
+  {
+    if (argc > 2)
+    {
+      std::cerr << "Unknown argument: " << argv[2] << "\n";
+      return 1;
+    }
+    std::string err;
+    if (!ExportHistory(STDOUT_FILENO, &err))
+    {
+      std::cerr << "export failed: " << err << "\n";
+      return 1;
+    }
+    return 0;
+  }
+
+  int CommandImport(int argc, char **argv)
+  {
+    bool merge = false;
+    std::vector<std::string> paths;
+    for (int i = 2; i < argc; ++i)
+    {
+      std::string arg = argv[i];
+      if (arg == "--merge")
+      {
+        merge = true;
+      }
+      else if (arg == "-" || (!arg.empty() && arg[0] != '-'))
+      {
+        paths.push_back(arg);
+      }
+      else
+      {
+        std::cerr << "Unknown argument: " << arg << "\n";
+        return 1;
+      }
+    }
+    // Replacing local history with an import is not offered; --merge keeps
+    // the intent explicit.
+    if (!merge || paths.empty())
+    {
+      std::cerr << "Usage: sshtab import --merge <file|->...\n";
+      return 1;
+    }
+    ImportStats stats;
+    std::string err;
+    if (!ImportHistory(paths, &stats, &err))
+    {
+      std::cerr << "import failed: " << err << "\n";
+      return 1;
+    }
+    std::cout << "merged " << stats.records << " records from " << paths.size() << " exports, " << stats.changed
+              << " new or updated\n";
+    return 0;
+  }
+
+  int CommandWarm(int argc, char **argv)
+  {
+    std::size_t top = 5;
+    WarmOptions options;
+    bool background = false;
+
+    for (int i = 2; i < argc; ++i)
+    {
+      std::string arg = argv[i];
+      if (arg == "--top")
+      {
+        if (i + 1 >= argc || !ParseSizeArg(argv[i + 1], &top) || top == 0)
+        {
+          std::cerr << "Invalid --top value\n";
+          return 1;
+        }
+        ++i;
+      }
+      else if (arg == "--jobs")
+      {
+        if (i + 1 >= argc || !ParseSizeArg(argv[i + 1], &options.jobs) || options.jobs == 0)
+        {
+          std::cerr << "Invalid --jobs value\n";
+          return 1;
+        }
+        ++i;
+      }
+      else if (arg == "--persist")
+      {
+        if (i + 1 >= argc || argv[i + 1][0] == '\0' || HasControlChars(argv[i + 1]))
+        {
+          std::cerr << "Invalid --persist value\n";
+          return 1;
+        }
+        options.persist = argv[++i];
+      }
+      else if (arg == "--background")
+      {
+        background = true;
+      }
+      else
+      {
+        std::cerr << "Unknown argument: " << arg << "\n";
+        return 1;
+      }
+    }
+
+    std::string err;
+    std::vector<HistoryEntry> entries = LoadRecentUnique(0, &err);
+    if (entries.empty())
+    {
+      if (!err.empty())
+      {
+        std::cerr << "warm failed: " << err << "\n";
+        return 1;
+      }
+      return 0;
+    }
+    SortByFrecency(&entries);
+    std::vector<std::string> targets;
+    for (const auto &entry : entries)
+    {
+      if (targets.size() >= top)
+      {
+        break;
+      }
+      std::string args = ExtractArgsFromCommand(entry.command);
+      if (!args.empty())
+      {
+        targets.push_back(args);
+      }
+    }
+
+    if (background)
+    {
+      std::cout.flush();
+      pid_t pid = fork();
+      if (pid < 0)
+      {
+        std::cerr << "warm failed: fork: " << std::strerror(errno) << "\n";
+        return 1;
+      }
+      if (pid > 0)
+      {
+        return 0;
+      }
+      // Nothing may hold the caller's terminal or pipes: ssh errors would
+      // surface at random later, and $(sshtab warm --background) would wait
+      // for every master.
+      setsid();
+      RedirectStdioToNull();
+    }
+
+    WarmStats stats;
+    if (!WarmControlMasters(targets, options, &stats, &err))
+    {
+      if (!background)
+      {
+        std::cerr << "warm failed: " << err << "\n";
+      }
+      return 1;
+    }
+    if (!background)
+    {
+      std::cout << "warm: " << stats.started << " started, " << stats.alive << " alive, " << stats.failed
+                << " failed\n";
+    }
+    return stats.failed == 0 ? 0 : 1;
+  }
+
+  int CommandFanout(int argc, char **argv)
+  {
+    FanoutOptions options;
+    std::size_t limit = 0;
+    bool use_pick = false;
+    std::string host_glob;
+    std::string host_regex;
+    std::string command;
+
+    for (int i = 2; i < argc; ++i)
+    {
+      std::string arg = argv[i];
+      if (arg == "--jobs")
+      {
+        if (i + 1 >= argc || !ParseSizeArg(argv[i + 1], &options.jobs) || options.jobs == 0)
+        {
+          std::cerr << "Invalid --jobs value\n";
+          return 1;
+        }
+        ++i;
+      }
+      else if (arg == "--limit")
+      {
+        if (i + 1 >= argc || !ParseSizeArg(argv[i + 1], &limit))
+        {
+          std::cerr << "Invalid --limit value\n";
+          return 1;
+        }
+        ++i;
+      }
+      else if (arg == "--pick")
+      {
+        use_pick = true;
+      }
+      else if (arg == "--host")
+      {
+        if (i + 1 >= argc || argv[i + 1][0] == '\0')
+        {
+          std::cerr << "Invalid --host value\n";
+          return 1;
+        }
+        host_glob = argv[++i];
+      }
+      else if (arg == "--host-regex")
+      {
+        if (i + 1 >= argc || argv[i + 1][0] == '\0')
+        {
+          std::cerr << "Invalid --host-regex value\n";
+          return 1;
+        }
+        host_regex = argv[++i];
+      }
+      else if (arg == "--")
+      {
+        for (++i; i < argc; ++i)
+        {
+          if (!command.empty())
+          {
+            command += ' ';
+          }
+          command += argv[i];
+        }
+      }
+      else
+      {
+        std::cerr << "Unknown argument: " << arg << "\n";
+        return 1;
+      }
+    }
+
+    if (TrimSpace(command).empty())
+    {
+      std::cerr << "fanout requires a command after --\n";
+      return 1;
+    }
+    if (!use_pick && host_glob.empty() && host_regex.empty())
+    {
+      std::cerr << "fanout requires --pick, --host or --host-regex\n";
+      return 1;
+    }
+    std::regex re;
+    if (!host_regex.empty())
+    {
+      try
+      {
+        re = std::regex(host_regex, std::regex::ECMAScript);
+      }
+      catch (const std::regex_error &e)
+      {
+        std::cerr << "Invalid --host-regex value: " << e.what() << "\n";
+        return 1;
+      }
+    }
+
+    std::string err;
+    std::vector<HistoryEntry> entries = LoadRecentUnique(limit, &err);
+    AliasMap aliases;
+    std::string alias_err;
+    LoadAliases(&aliases, &alias_err);
+    std::vector<PickItem> items;
+    items.reserve(entries.size());
+    for (const auto &entry : entries)
+    {
+      if (HasControlChars(entry.command))
+      {
+        continue;
+      }
+      std::string args = ExtractArgsFromCommand(entry.command);
+      if (args.empty() || HasControlChars(args))
+      {
+        continue;
+      }
+      PickItem item = MakeSshPickItem(entry, args, aliases);
+      if (!host_glob.empty() && fnmatch(host_glob.c_str(), item.host.c_str(), 0) != 0)
+      {
+        continue;
+      }
+      if (!host_regex.empty() && !std::regex_search(item.host, re))
+      {
+        continue;
+      }
+      items.push_back(item);
+    }
+    if (items.empty())
+    {
+      std::cerr << "fanout: no matching targets\n";
+      return 1;
+    }
+
+    std::vector<std::size_t> chosen;
+    if (use_pick)
+    {
+      ApplyProbeStatus(&items);
+      PickUiConfig config;
+      config.allow_display_toggle = true;
+      config.allow_mark = true;
+      config.show_alias = true;
+      std::size_t selected = 0;
+      std::vector<std::size_t> marked;
+      PickResult result = RunPickTui(items, "sshtab fanout (Space mark, Enter run, Esc cancel)", &selected,
+                                     &marked, config, AliasUpdateFn(), &err);
+      if (result != PickResult::kSelected || selected >= items.size())
+      {
+        return 1;
+      }
+      chosen = DeletionTargets(selected, marked);
+    }
+    else
+    {
+      for (std::size_t i = 0; i < items.size(); ++i)
+      {
+        chosen.push_back(i);
+      }
+    }
+
+    std::vector<FanoutTarget> targets;
+    targets.reserve(chosen.size());
+    for (std::size_t idx : chosen)
+    {
+      const PickItem &item = items[idx];
+      FanoutTarget target;
+      target.args = item.args;
+      target.label = !item.alias.empty() ? item.alias : (!item.host.empty() ? item.host : item.args);
+      targets.push_back(target);
+    }
+
+    std::vector<int> exit_codes;
+    if (!RunFanout(targets, command, options, STDOUT_FILENO, STDERR_FILENO, &exit_codes, &err))
+    {
+      std::cerr << "fanout failed: " << err << "\n";
+      return 1;
+    }
+
+    std::vector<std::string> succeeded;
+    std::string failures;
+    int worst = 0;
+    for (std::size_t i = 0; i < targets.size(); ++i)
+    {
+      if (exit_codes[i] == 0)
+      {
+        succeeded.push_back(items[chosen[i]].display);
+        continue;
+      }
+      worst = std::max(worst, exit_codes[i]);
+      failures += " " + targets[i].label + "=" + std::to_string(exit_codes[i]);
+    }
+    std::cerr << "fanout: " << succeeded.size() << " ok, " << targets.size() - succeeded.size() << " failed"
+              << failures << "\n";
+
+    std::string record_err;
+    if (!AppendHistoryBatch(succeeded, 0, &record_err))
+    {
+      std::cerr << "record failed: " << record_err << "\n";
+    }
+    return worst;
+  }
+
+  int CommandProbe(int argc, char **argv)
+  {
+    std::size_t top = 20;
+    ProbeOptions options;
+    for (int i = 2; i < argc; ++i)
+    {
+      std::string arg = argv[i];
+      if (arg == "--top")
+      {
+        if (i + 1 >= argc || !ParseSizeArg(argv[i + 1], &top) || top == 0)
+        {
+          std::cerr << "Invalid --top value\n";
+          return 1;
+        }
+        ++i;
+      }
+      else if (arg == "--timeout-ms")
+      {
+        if (i + 1 >= argc || !ParseIntArg(argv[i + 1], &options.timeout_ms) || options.timeout_ms <= 0)
+        {
+          std::cerr << "Invalid --timeout-ms value\n";
+          return 1;
+        }
+        ++i;
+      }
+      else if (arg == "--ttl")
+      {
+        if (i + 1 >= argc || !ParseDurationArg(argv[i + 1], &options.ttl_seconds) || options.ttl_seconds <= 0)
+        {
+          std::cerr << "Invalid --ttl value\n";
+          return 1;
+        }
+        ++i;
+      }
+      else
+      {
+        std::cerr << "Unknown argument: " << arg << "\n";
+        return 1;
+      }
+    }
+
+    std::string err;
+    std::vector<HistoryEntry> entries = LoadRecentUnique(0, &err);
+    if (entries.empty())
+    {
+      if (!err.empty())
+      {
+        std::cerr << "probe failed: " << err << "\n";
+        return 1;
+      }
+      return 0;
+    }
+    SortByFrecency(&entries);
+    std::vector<ProbeTarget> targets;
+    std::unordered_set<std::string> seen;
+    for (const auto &entry : entries)
+    {
+      if (targets.size() >= top)
+      {
+        break;
+      }
+      std::string args = ExtractArgsFromCommand(entry.command);
+      if (args.empty() || HasControlChars(args))
+      {
+        continue;
+      }
+      SshMeta meta = ExtractSshMeta(args);
+      ProbeTarget target;
+      if (meta.host.empty() || !ResolveProbeTarget(meta.host, meta.hostname, meta.port, meta.jump, &target) ||
+          !seen.insert(ProbeKey(target.host, target.port)).second)
+      {
+        continue;
+      }
+      targets.push_back(target);
+    }
+
+    std::vector<ProbeResult> results;
+    if (!ProbeHosts(targets, options, &results, &err))
+    {
+      std::cerr << "probe failed: " << err << "\n";
+      return 1;
+    }
+    if (!SaveProbeResults(results, &err))
+    {
+      std::cerr << "probe cache write failed: " << err << "\n";
+    }
+    for (const auto &result : results)
+    {
+      std::cout << ProbeKey(result.host, result.port) << '\t' << FormatProbeStatus(result);
+      if (!result.error.empty())
+      {
+        std::cout << " (" << result.error << ")";
+      }
+      std::cout << "\n";
+    }
+    return 0;
+  }
+
+  // Directory holding the running sshtab binary, or "" if unknown.
+  std::string ExecutableDir()
+  {
+    char buf[4096];
+    ssize_t n = readlink("/proc/self/exe", buf, sizeof(buf) - 1);
+    if (n <= 0)
+    {
+      return std::string();
+    }
+    return DirnameFromPath(std::string(buf, static_cast<std::size_t>(n)));
+  }
+
+  bool FileExists(const std::string &path)
+  {
+    return !path.empty() && access(path.c_str(), F_OK) == 0;
+  }
+
+  int CommandInit(int argc, char **argv)
+  {
+    if (argc < 3 || std::string(argv[2]) != "bash")
+    {
+      std::cerr << "init supports only: bash\n";
+      return 1;
+    }
+    std::string snippet_path;
+    BashInitOptions options;
+    for (int i = 3; i < argc; ++i)
+    {
+      std::string arg = argv[i];
+      if (arg == "--snippet")
+      {
+        if (i + 1 >= argc)
+        {
+          std::cerr << "Missing --snippet value\n";
+          return 1;
+        }
+        snippet_path = argv[++i];
+      }
+      else if (arg == "--capture")
+      {
+        if (i + 1 >= argc)
+        {
+          std::cerr << "Missing --capture value\n";
+          return 1;
+        }
+        options.capture_mode = argv[++i];
+        if (options.capture_mode != "auto" && options.capture_mode != "debug" &&
+            options.capture_mode != "history")
+        {
+          std::cerr << "Invalid --capture value\n";
+          return 1;
+        }
+      }
+      else
+      {
+        std::cerr << "Unknown argument: " << arg << "\n";
+        return 1;
+      }
+    }
+
+    // The installed snippet first, then the source tree next to a locally
+    // built binary.
+    std::string err;
+    std::string data_dir = GetDataDir(&err);
+    std::string exe_dir = ExecutableDir();
+    if (snippet_path.empty())
+    {
+      if (!data_dir.empty() && FileExists(data_dir + "/sshtab.bash"))
+      {
+        snippet_path = data_dir + "/sshtab.bash";
+      }
+      else if (!exe_dir.empty() && FileExists(exe_dir + "/bash/sshtab.bash"))
+      {
+        snippet_path = exe_dir + "/bash/sshtab.bash";
+      }
+      else
+      {
+        std::cerr << "init failed: sshtab.bash not found; pass --snippet\n";
+        return 1;
+      }
+    }
+    int fd = open(snippet_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+      std::cerr << "init failed: cannot open " << snippet_path << ": " << std::strerror(errno) << "\n";
+      return 1;
+    }
+    ScopedFd fd_guard(fd);
+    std::string snippet;
+    if (!ReadAllFromFd(fd, &snippet, &err))
+    {
+      std::cerr << "init failed: " << err << "\n";
+      return 1;
+    }
+
+    std::string ssh_path = ResolveSshBinary();
+    if (!ssh_path.empty() && ssh_path[0] == '/')
+    {
+      options.ssh_path = ssh_path;
+    }
+    if (!data_dir.empty() && FileExists(data_dir + "/sshtab.so"))
+    {
+      options.builtin_path = data_dir + "/sshtab.so";
+    }
+    else if (!exe_dir.empty() && FileExists(exe_dir + "/sshtab.so"))
+    {
+      options.builtin_path = exe_dir + "/sshtab.so";
+    }
+    std::cout << RenderBashInit(snippet, options);
+    return 0;
+  }
+
+  int CommandPrefetch(int argc, char **argv)
+  {
+    std::size_t limit = 50;
+    for (int i = 2; i < argc; ++i)
+    {
+      std::string arg = argv[i];
+      if (arg == "--limit")
+      {
+        if (i + 1 >= argc || !ParseSizeArg(argv[i + 1], &limit))
+        {
+          std::cerr << "Invalid --limit value\n";
+          return 1;
+        }
+        ++i;
+      }
+      else
+      {
+        std::cerr << "Unknown argument: " << arg << "\n";
+        return 1;
+      }
+    }
+
+    std::string err;
+    if (!RunPrefetch(limit, &err))
+    {
+      std::cerr << "prefetch failed: " << err << "\n";
+      return 1;
+    }
+    return 0;
+  }
+
+  int CommandExec(int argc, char **argv)
+  {
+    bool timed = false;
+    std::string raw;
+    int i = 2;
+    for (; i < argc; ++i)
+    {
+      std::string arg = argv[i];
+      if (arg == "--timed")
+      {
+        timed = true;
+      }
+      else if (arg == "--raw")
+      {
+        if (i + 1 >= argc)
+        {
+          std::cerr << "Missing --raw value\n";
+          return 1;
+        }
+        raw = argv[++i];
+      }
+      else
+      {
+        break;
+      }
+    }
+
+    std::vector<std::string> tokens;
+    std::string args_string;
+    if (i < argc && std::string(argv[i]) == "--")
+    {
+      // Plain argv from the ssh() wrapper: passed through untouched.
+      for (++i; i < argc; ++i)
+      {
+        tokens.emplace_back(argv[i]);
+      }
+    }
+    else
+    {
+      if (argc - i != 1)
+      {
+        std::cerr << "exec requires exactly one args_string\n";
+        return 1;
+      }
+
+      args_string = argv[i];
+      // Validates and splits in one pass over the string.
+      ArgTokens parsed;
+      std::string tok_err;
+      if (!TokenizeArgsInto(args_string, true, &parsed, &tok_err))
+      {
+        if (parsed.error == TokenizeError::kControlChar)
+        {
+          std::cerr << "exec rejected control characters: " << tok_err << "\n";
+        }
+        else if (parsed.error == TokenizeError::kMetachar)
+        {
+          std::cerr << "exec rejected shell metacharacters: " << tok_err << "\n";
+        }
+        else
+        {
+          std::cerr << "exec tokenize failed: " << tok_err << "\n";
+        }
+        return 1;
+      }
+      tokens = parsed.ToStrings();
     }
 
+    // Both forms, timed or not, reuse a master warmed for the same target.
     std::vector<std::string> argv_storage;
-    argv_storage.reserve(tokens.size() + 1);
+    argv_storage.reserve(tokens.size() + 3);
     argv_storage.emplace_back("ssh");
+    std::string control_err;
+    std::string control_path = ControlPathForTokens(tokens, &control_err);
+    if (HasControlSocket(control_path))
+    {
+      argv_storage.emplace_back("-o");
+      argv_storage.push_back("ControlPath=" + control_path);
+    }
     for (const auto &t : tokens)
     {
       argv_storage.push_back(t);
     }
 
+    std::string binary = ResolveSshBinary();
+    if (timed)
+    {
+      if (!binary.empty())
+      {
+        argv_storage[0] = binary;
+      }
+      ConnectTiming timing;
+      std::string err;
+      int rc = RunTimedSession(argv_storage, &timing, &err);
+      if (!err.empty())
+      {
+        std::cerr << "exec failed: " << err << "\n";
+        return rc;
+      }
+      std::string normalized;
+      if (rc == 0 && !raw.empty() && !ContainsControlChars(raw) && NormalizeSshCommand(raw, &normalized))
+      {
+        std::string record_err;
+        if (!AppendTimedHistory(normalized, rc, timing, &record_err))
+        {
+          std::cerr << "record failed: " << record_err << "\n";
+        }
+      }
+      return rc;
+    }
+
     std::vector<char *> argv_exec;
     argv_exec.reserve(argv_storage.size() + 1);
     for (auto &arg : argv_storage)
@@ -1302,15 +2784,16 @@ namespace
     }
     argv_exec.push_back(nullptr);
 
-    execvp(argv_exec[0], argv_exec.data());
+    ExecSshBinary(binary, argv_exec.data());
     std::cerr << "exec failed: " << std::strerror(errno) << "\n";
     return 1;
   }
 
 } // namespace
 
-int main(int argc, char **argv)
+int RunCli(int argc, char **argv)
 {
+  g_ssh_configs.clear();
   if (argc < 2)
   {
     PrintUsage();
@@ -1346,6 +2829,42 @@ int main(int argc, char **argv)
   {
     return CommandDelete(argc, argv);
   }
+  if (cmd == "prune")
+  {
+    return CommandPrune(argc, argv);
+  }
+  if (cmd == "search")
+  {
+    return CommandSearch(argc, argv);
+  }
+  if (cmd == "export")
+  {
+    return CommandExport(argc, argv);
+  }
+  if (cmd == "import")
+  {
+    return CommandImport(argc, argv);
+  }
+  if (cmd == "warm")
+  {
+    return CommandWarm(argc, argv);
+  }
+  if (cmd == "fanout")
+  {
+    return CommandFanout(argc, argv);
+  }
+  if (cmd == "probe")
+  {
+    return CommandProbe(argc, argv);
+  }
+  if (cmd == "init")
+  {
+    return CommandInit(argc, argv);
+  }
+  if (cmd == "prefetch")
+  {
+    return CommandPrefetch(argc, argv);
+  }
   if (cmd == "exec")
   {
     return CommandExec(argc, argv);
@@ -1354,3 +2873,10 @@ int main(int argc, char **argv)
   PrintUsage();
   return 1;
 }
+
+#ifndef SSHTAB_BUILTIN
+int main(int argc, char **argv)
+{
+  return RunCli(argc, argv);
+}
+#endif
@@ -1,7 +1,12 @@
 #include "normalize.h"
 
+#include "tokenize.h"
 #include "util.h"
 
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
 namespace {
 
 bool StartsWithSshToken(const std::string& s) {
@@ -67,3 +72,212 @@ std::string ExtractArgsFromCommand(const std::string& command) {
   }
   return std::string();
 }
+
+namespace {
+
+// Options that consume an argument, from ssh's getopt string.
+const char kSshArgOptions[] = "BbcDEeFIiJLlmOoPpQRSWw";
+
+bool NeedsQuote(const std::string& token) {
+  if (token.empty()) {
+    return true;
+  }
+  for (unsigned char c : token) {
+    if (std::isspace(c) || c == '\'' || c == '"' || c == '\\') {
+      return true;
+    }
+  }
+  return false;
+}
+
+void AppendToken(const std::string& token, std::string* out) {
+  if (!out->empty()) {
+    out->push_back(' ');
+  }
+  if (!NeedsQuote(token)) {
+    *out += token;
+    return;
+  }
+  out->push_back('\'');
+  for (char c : token) {
+    if (c == '\'') {
+      *out += "'\\''";
+    } else {
+      out->push_back(c);
+    }
+  }
+  out->push_back('\'');
+}
+
+void ApplyDestination(const std::string& destination, SshTarget* target) {
+  std::string rest = destination;
+  bool uri = rest.rfind("ssh://", 0) == 0;
+  if (uri) {
+    rest = rest.substr(6);
+  }
+  size_t at = rest.rfind('@');
+  if (at != std::string::npos) {
+    if (target->user.empty()) {
+      target->user = rest.substr(0, at);
+    }
+    rest = rest.substr(at + 1);
+  }
+  if (uri) {
+    size_t colon = rest.rfind(':');
+    if (colon != std::string::npos && rest.find(']') == std::string::npos) {
+      if (target->port.empty()) {
+        target->port = rest.substr(colon + 1);
+      }
+      rest = rest.substr(0, colon);
+    }
+  }
+  target->host = rest;
+}
+
+// "Key=Value", "Key Value" and "Key = Value" all become "key=Value".
+std::string CanonicalConfigOption(const std::string& value) {
+  size_t split = value.find_first_of("= \t");
+  if (split == std::string::npos) {
+    return value;
+  }
+  std::string key = value.substr(0, split);
+  std::string option_value = TrimSpace(value.substr(split + 1));
+  if (!option_value.empty() && option_value[0] == '=') {
+    option_value = TrimSpace(option_value.substr(1));
+  }
+  for (auto& c : key) {
+    c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+  }
+  return key + "=" + option_value;
+}
+
+}  // namespace
+
+bool ParseSshArgs(const std::vector<std::string>& tokens, SshTarget* out, std::string* err) {
+  if (!out) {
+    if (err) {
+      *err = "target pointer is null";
+    }
+    return false;
+  }
+  *out = SshTarget();
+  bool have_destination = false;
+  for (size_t i = 0; i < tokens.size(); ++i) {
+    const std::string& tok = tokens[i];
+    if (tok == "--") {
+      // Ends option parsing: what follows is the destination, unless one
+      // was already seen, and then the remote command.
+      ++i;
+      if (!have_destination && i < tokens.size()) {
+        ApplyDestination(tokens[i++], out);
+        have_destination = true;
+      }
+      out->command.assign(tokens.begin() + static_cast<std::ptrdiff_t>(std::min(i, tokens.size())),
+                          tokens.end());
+      break;
+    }
+    if (tok.size() > 1 && tok[0] == '-') {
+      // Flags may be bundled ("-vA"); the first option taking an argument
+      // ends the bundle and uses the rest of the token or the next one.
+      for (size_t j = 1; j < tok.size(); ++j) {
+        char opt = tok[j];
+        if (std::strchr(kSshArgOptions, opt) == nullptr) {
+          out->options.emplace_back(opt, std::string());
+          continue;
+        }
+        std::string value;
+        if (j + 1 < tok.size()) {
+          value = tok.substr(j + 1);
+        } else if (i + 1 < tokens.size()) {
+          value = tokens[++i];
+        } else {
+          if (err) {
+            *err = std::string("option -") + opt + " requires an argument";
+          }
+          return false;
+        }
+        if (opt == 'l') {
+          if (out->user.empty()) {
+            out->user = value;
+          }
+        } else if (opt == 'p') {
+          if (out->port.empty()) {
+            out->port = value;
+          }
+        } else {
+          out->options.emplace_back(opt, opt == 'o' ? CanonicalConfigOption(value) : value);
+        }
+        break;
+      }
+      continue;
+    }
+    if (have_destination) {
+      // ssh stops at the first non-option after the destination; the rest
+      // is the remote command.
+      out->command.assign(tokens.begin() + static_cast<std::ptrdiff_t>(i), tokens.end());
+      break;
+    }
+    ApplyDestination(tok, out);
+    have_destination = true;
+  }
+  if (!have_destination || out->host.empty()) {
+    if (err) {
+      *err = "missing destination";
+    }
+    return false;
+  }
+  return true;
+}
+
+bool ParseSshArgs(const std::string& args, SshTarget* out, std::string* err) {
+  std::vector<std::string> tokens;
+  if (!TokenizeArgs(args, &tokens, err)) {
+    return false;
+  }
+  return ParseSshArgs(tokens, out, err);
+}
+
+std::string CanonicalSshArgs(const SshTarget& target) {
+  std::vector<std::pair<char, std::string>> options = target.options;
+  if (!target.port.empty()) {
+    options.emplace_back('p', target.port);
+  }
+  std::stable_sort(options.begin(), options.end(),
+                   [](const auto& a, const auto& b) { return a.first < b.first; });
+  std::string out;
+  for (const auto& option : options) {
+    AppendToken(std::string("-") + option.first, &out);
+    if (std::strchr(kSshArgOptions, option.first) != nullptr) {
+      AppendToken(option.second, &out);
+    }
+  }
+  AppendToken(target.user.empty() ? target.host : target.user + "@" + target.host, &out);
+  if (!target.command.empty()) {
+    // A command that starts with "-" would otherwise read as an option.
+    if (target.command[0].size() > 1 && target.command[0][0] == '-') {
+      AppendToken("--", &out);
+    }
+    for (const auto& token : target.command) {
+      AppendToken(token, &out);
+    }
+  }
+  return out;
+}
+
+std::string SshTargetKey(const std::string& args) {
+  SshTarget target;
+  std::string err;
+  if (!ParseSshArgs(args, &target, &err)) {
+    return CollapseSpaces(TrimSpace(args));
+  }
+  return CanonicalSshArgs(target);
+}
+
+std::string SshCommandKey(const std::string& command) {
+  std::string trimmed = TrimSpace(command);
+  if (trimmed.size() > 3 && trimmed.compare(0, 4, "ssh ") == 0) {
+    std::string key = SshTargetKey(trimmed.substr(4));
+    return key.empty() ? std::string("ssh") : "ssh " + key;
+  }
+  return command;
+}
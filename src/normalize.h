@@ -1,6 +1,40 @@
 #pragma once
 
 #include <string>
+#include <utility>
+#include <vector>
 
 bool NormalizeSshCommand(const std::string& raw, std::string* out);
 std::string ExtractArgsFromCommand(const std::string& command);
+
+// An ssh command line split the way ssh's own option parser sees it.
+struct SshTarget {
+  // From -l or the destination, whichever came first, as in ssh.
+  std::string user;
+  std::string host;
+  // From -p or an ssh:// destination, whichever came first.
+  std::string port;
+  // Every other option in command-line order; value is empty for flags.
+  std::vector<std::pair<char, std::string>> options;
+  std::vector<std::string> command;
+};
+
+// Parses ssh arguments (without the leading "ssh"). Fails on a quoting
+// error, an option missing its value or a missing destination; out then
+// holds what was parsed before the error.
+bool ParseSshArgs(const std::vector<std::string>& tokens, SshTarget* out, std::string* err);
+bool ParseSshArgs(const std::string& args, SshTarget* out, std::string* err);
+
+// Renders target as runnable args in a canonical spelling: options sorted
+// by letter (values of the same option keep their order), -l and ssh://
+// folded into user@host and -p, -o keys lowercased as key=value, then the
+// destination and the remote command.
+std::string CanonicalSshArgs(const SshTarget& target);
+
+// The grouping key for an args string: its canonical spelling, or the args
+// with whitespace collapsed when they do not parse.
+std::string SshTargetKey(const std::string& args);
+
+// The grouping key for a recorded command: "ssh " plus SshTargetKey for ssh
+// commands, the command itself otherwise.
+std::string SshCommandKey(const std::string& command);
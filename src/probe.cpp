@@ -0,0 +1,584 @@
+#include "probe.h"
+
+#include "util.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const char* StatusName(ProbeStatus status) {
+  switch (status) {
+    case ProbeStatus::kUp:
+      return "up";
+    case ProbeStatus::kDown:
+      return "down";
+    case ProbeStatus::kUnresolved:
+      return "unresolved";
+  }
+  return "down";
+}
+
+bool ParseStatus(const std::string& text, ProbeStatus* out) {
+  if (text == "up") {
+    *out = ProbeStatus::kUp;
+  } else if (text == "down") {
+    *out = ProbeStatus::kDown;
+  } else if (text == "unresolved") {
+    *out = ProbeStatus::kUnresolved;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool IsValidPort(const std::string& port) {
+  std::int64_t value = 0;
+  return ParseInt64(port, &value) && value > 0 && value <= 65535;
+}
+
+bool IsPlainToken(const std::string& s) {
+  if (s.empty()) {
+    return false;
+  }
+  for (unsigned char c : s) {
+    if (c <= 0x20 || c == 0x7f) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Splits "host", "host:port" or "[v6]:port" into its parts.
+void SplitHostPort(const std::string& spec, std::string* host, std::string* port) {
+  if (!spec.empty() && spec[0] == '[') {
+    size_t close = spec.find(']');
+    if (close != std::string::npos) {
+      *host = spec.substr(1, close - 1);
+      if (close + 1 < spec.size() && spec[close + 1] == ':') {
+        *port = spec.substr(close + 2);
+      }
+      return;
+    }
+  }
+  size_t colon = spec.find(':');
+  if (colon != std::string::npos && spec.find(':', colon + 1) == std::string::npos) {
+    *host = spec.substr(0, colon);
+    *port = spec.substr(colon + 1);
+    return;
+  }
+  *host = spec;
+}
+
+std::string StripUser(const std::string& spec) {
+  size_t at = spec.rfind('@');
+  return at == std::string::npos ? spec : spec.substr(at + 1);
+}
+
+// Each entry is one line: host, port, status, rtt_ms, checked_at, expires_at.
+void ParseProbeContent(const std::string& content,
+                       std::int64_t now,
+                       std::unordered_map<std::string, ProbeResult>* out) {
+  size_t start = 0;
+  while (start < content.size()) {
+    size_t end = content.find('\n', start);
+    if (end == std::string::npos) {
+      end = content.size();
+    }
+    std::vector<std::string> fields;
+    size_t pos = start;
+    while (pos <= end) {
+      size_t tab = content.find('\t', pos);
+      if (tab == std::string::npos || tab > end) {
+        tab = end;
+      }
+      fields.push_back(content.substr(pos, tab - pos));
+      pos = tab + 1;
+    }
+    start = end + 1;
+
+    ProbeResult result;
+    if (fields.size() < 6 || fields[0].empty() || !ParseStatus(fields[2], &result.status) ||
+        !ParseInt64(fields[3], &result.rtt_ms) || !ParseInt64(fields[4], &result.checked_at) ||
+        !ParseInt64(fields[5], &result.expires_at)) {
+      continue;
+    }
+    if (result.expires_at <= now) {
+      continue;
+    }
+    result.host = fields[0];
+    result.port = fields[1];
+    std::string key = ProbeKey(result.host, result.port);
+    auto it = out->find(key);
+    if (it == out->end() || it->second.checked_at <= result.checked_at) {
+      (*out)[key] = result;
+    }
+  }
+}
+
+// Lifts the soft descriptor limit so every probe can be in flight at once.
+void EnsureFdHeadroom(size_t wanted) {
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+    return;
+  }
+  rlim_t need = static_cast<rlim_t>(wanted) + 64;
+  if (limit.rlim_cur == RLIM_INFINITY || limit.rlim_cur >= need) {
+    return;
+  }
+  limit.rlim_cur = (limit.rlim_max == RLIM_INFINITY || limit.rlim_max > need) ? need : limit.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &limit);
+}
+
+std::int64_t ElapsedMs(Clock::time_point start, Clock::time_point now) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(now - start).count();
+}
+
+struct AddrInfoFree {
+  void operator()(struct addrinfo* info) const { freeaddrinfo(info); }
+};
+using AddrInfoPtr = std::unique_ptr<struct addrinfo, AddrInfoFree>;
+
+struct ResolveAnswer {
+  size_t probe = 0;
+  int rc = 0;
+  AddrInfoPtr addrs;
+};
+
+// Name lookups for one ProbeHosts call, shared with the resolver threads.
+// Each answer bumps the eventfd the epoll loop waits on. At the deadline
+// the caller abandons lookups still running; their threads finish on
+// their own and drop what they find.
+struct ResolveQueue {
+  std::mutex mu;
+  std::vector<std::pair<size_t, ProbeTarget>> requests;
+  size_t next = 0;
+  std::vector<ResolveAnswer> answers;
+  bool abandoned = false;
+  ScopedFd event_fd;
+};
+
+const size_t kMaxResolverThreads = 16;
+
+struct addrinfo StreamHints(int flags) {
+  struct addrinfo hints;
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_NUMERICSERV | flags;
+  return hints;
+}
+
+void RunResolver(std::shared_ptr<ResolveQueue> queue) {
+  for (;;) {
+    std::pair<size_t, ProbeTarget> request;
+    {
+      std::lock_guard<std::mutex> lock(queue->mu);
+      if (queue->abandoned || queue->next == queue->requests.size()) {
+        return;
+      }
+      request = queue->requests[queue->next++];
+    }
+    struct addrinfo hints = StreamHints(0);
+    struct addrinfo* info = nullptr;
+    ResolveAnswer answer;
+    answer.probe = request.first;
+    answer.rc = getaddrinfo(request.second.host.c_str(), request.second.port.c_str(), &hints, &info);
+    answer.addrs.reset(info);
+    std::lock_guard<std::mutex> lock(queue->mu);
+    if (queue->abandoned) {
+      return;
+    }
+    queue->answers.push_back(std::move(answer));
+    std::uint64_t one = 1;
+    ssize_t n = write(queue->event_fd.get(), &one, sizeof(one));
+    (void)n;
+  }
+}
+
+// One endpoint being probed: its addresses, tried in order until one
+// accepts, and the connect in flight.
+struct Probe {
+  size_t result = 0;
+  AddrInfoPtr addrs;
+  const struct addrinfo* next = nullptr;
+  ScopedFd fd;
+  Clock::time_point start;
+  bool resolving = false;
+  bool done = false;
+};
+
+}  // namespace
+
+std::string GetProbeCachePath(std::string* err) {
+  std::string dir = GetDataDir(err);
+  if (dir.empty()) {
+    return std::string();
+  }
+  return dir + "/probe.log";
+}
+
+std::string ProbeKey(const std::string& host, const std::string& port) {
+  if (host.find(':') != std::string::npos) {
+    return "[" + host + "]:" + port;
+  }
+  return host + ":" + port;
+}
+
+bool ProbeTargetForSsh(const std::string& host,
+                       const std::string& port,
+                       const std::string& jump,
+                       ProbeTarget* out) {
+  if (!out) {
+    return false;
+  }
+  ProbeTarget target;
+  if (!jump.empty()) {
+    std::string hop = jump.substr(0, jump.find(','));
+    if (hop.rfind("ssh://", 0) == 0) {
+      hop = hop.substr(6);
+    }
+    SplitHostPort(StripUser(hop), &target.host, &target.port);
+  } else {
+    target.host = StripUser(host);
+    target.port = port;
+  }
+  if (target.port.empty()) {
+    target.port = "22";
+  }
+  if (!IsPlainToken(target.host) || !IsValidPort(target.port)) {
+    return false;
+  }
+  *out = target;
+  return true;
+}
+
+bool ProbeHosts(const std::vector<ProbeTarget>& targets,
+                const ProbeOptions& options,
+                std::vector<ProbeResult>* results,
+                std::string* err) {
+  if (!results) {
+    if (err) {
+      *err = "results pointer is null";
+    }
+    return false;
+  }
+  results->assign(targets.size(), ProbeResult());
+  if (targets.empty()) {
+    return true;
+  }
+
+  ScopedFd epoll_fd(epoll_create1(EPOLL_CLOEXEC));
+  if (epoll_fd.get() < 0) {
+    if (err) {
+      *err = std::string("epoll_create1 failed: ") + std::strerror(errno);
+    }
+    return false;
+  }
+  EnsureFdHeadroom(targets.size());
+
+  // Name lookups and connects all count against one deadline, so the batch
+  // never takes much longer than timeout_ms however many hosts are slow.
+  const Clock::time_point batch_start = Clock::now();
+  const Clock::time_point deadline =
+      batch_start + std::chrono::milliseconds(options.timeout_ms > 0 ? options.timeout_ms : 1);
+  const std::int64_t now = static_cast<std::int64_t>(std::time(nullptr));
+  const std::uint64_t kResolverEvent = UINT64_MAX;
+  std::unordered_map<std::string, size_t> first_of;
+  std::vector<size_t> same_as(targets.size(), targets.size());
+  std::vector<Probe> probes;
+  probes.reserve(targets.size());
+  auto queue = std::make_shared<ResolveQueue>();
+  size_t open = 0;
+
+  auto finish = [&](Probe* probe, const std::string& error) {
+    (*results)[probe->result].error = error;
+    probe->fd.reset();
+    probe->done = true;
+    --open;
+  };
+  // Starts connects down the address list until one is in flight; a
+  // refused address falls through to the next, so a host whose first
+  // record is unreachable IPv6 is still reached over IPv4.
+  auto connect_next = [&](size_t index) {
+    Probe& probe = probes[index];
+    ProbeResult& result = (*results)[probe.result];
+    std::string last_error = "no usable address";
+    while (probe.next) {
+      const struct addrinfo* info = probe.next;
+      probe.next = info->ai_next;
+      probe.fd.reset(socket(info->ai_family, info->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                            info->ai_protocol));
+      if (probe.fd.get() < 0) {
+        last_error = std::string("socket: ") + std::strerror(errno);
+        continue;
+      }
+      probe.start = Clock::now();
+      if (connect(probe.fd.get(), info->ai_addr, info->ai_addrlen) == 0) {
+        result.status = ProbeStatus::kUp;
+        result.rtt_ms = ElapsedMs(probe.start, Clock::now());
+        finish(&probe, std::string());
+        return;
+      }
+      if (errno != EINPROGRESS) {
+        last_error = std::strerror(errno);
+        continue;
+      }
+      struct epoll_event ev;
+      std::memset(&ev, 0, sizeof(ev));
+      ev.events = EPOLLOUT;
+      ev.data.u64 = index;
+      if (epoll_ctl(epoll_fd.get(), EPOLL_CTL_ADD, probe.fd.get(), &ev) != 0) {
+        last_error = std::string("epoll_ctl: ") + std::strerror(errno);
+        continue;
+      }
+      return;
+    }
+    finish(&probe, last_error);
+  };
+  auto resolved = [&](size_t index, int rc, AddrInfoPtr addrs) {
+    Probe& probe = probes[index];
+    probe.resolving = false;
+    if (rc != 0 || !addrs) {
+      (*results)[probe.result].status = ProbeStatus::kUnresolved;
+      finish(&probe, gai_strerror(rc));
+      return;
+    }
+    probe.addrs = std::move(addrs);
+    probe.next = probe.addrs.get();
+    connect_next(index);
+  };
+
+  // Literal addresses need no lookup; names go to the resolver threads.
+  for (size_t i = 0; i < targets.size(); ++i) {
+    ProbeResult& result = (*results)[i];
+    result.host = targets[i].host;
+    result.port = targets[i].port;
+    result.checked_at = now;
+    result.expires_at = now + options.ttl_seconds;
+    auto inserted = first_of.emplace(ProbeKey(result.host, result.port), i);
+    if (!inserted.second) {
+      same_as[i] = inserted.first->second;
+      continue;
+    }
+    probes.emplace_back();
+    probes.back().result = i;
+    ++open;
+    struct addrinfo hints = StreamHints(AI_NUMERICHOST);
+    struct addrinfo* info = nullptr;
+    int rc = getaddrinfo(result.host.c_str(), result.port.c_str(), &hints, &info);
+    if (rc == EAI_NONAME) {
+      probes.back().resolving = true;
+      queue->requests.emplace_back(probes.size() - 1, targets[i]);
+      continue;
+    }
+    resolved(probes.size() - 1, rc, AddrInfoPtr(info));
+  }
+
+  if (!queue->requests.empty()) {
+    queue->event_fd.reset(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+    struct epoll_event ev;
+    std::memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = kResolverEvent;
+    if (queue->event_fd.get() < 0 || epoll_ctl(epoll_fd.get(), EPOLL_CTL_ADD, queue->event_fd.get(), &ev) != 0) {
+      if (err) {
+        *err = std::string("eventfd failed: ") + std::strerror(errno);
+      }
+      return false;
+    }
+    size_t threads = std::min(queue->requests.size(), kMaxResolverThreads);
+    for (size_t t = 0; t < threads; ++t) {
+      std::thread(RunResolver, queue).detach();
+    }
+  }
+
+  std::vector<struct epoll_event> events(std::min<size_t>(probes.size() + 1, 256));
+  std::vector<ResolveAnswer> answers;
+  while (open > 0) {
+    Clock::time_point now_tp = Clock::now();
+    if (now_tp >= deadline) {
+      break;
+    }
+    std::int64_t wait = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now_tp).count() + 1;
+    int n = epoll_wait(epoll_fd.get(), events.data(), static_cast<int>(events.size()), static_cast<int>(wait));
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (err) {
+        *err = std::string("epoll_wait failed: ") + std::strerror(errno);
+      }
+      std::lock_guard<std::mutex> lock(queue->mu);
+      queue->abandoned = true;
+      return false;
+    }
+    now_tp = Clock::now();
+    for (int e = 0; e < n; ++e) {
+      if (events[e].data.u64 == kResolverEvent) {
+        std::uint64_t count = 0;
+        ssize_t got = read(queue->event_fd.get(), &count, sizeof(count));
+        (void)got;
+        {
+          std::lock_guard<std::mutex> lock(queue->mu);
+          answers.swap(queue->answers);
+        }
+        for (auto& answer : answers) {
+          resolved(answer.probe, answer.rc, std::move(answer.addrs));
+        }
+        answers.clear();
+        continue;
+      }
+      size_t index = static_cast<size_t>(events[e].data.u64);
+      Probe& probe = probes[index];
+      if (probe.done) {
+        continue;
+      }
+      int so_error = 0;
+      socklen_t len = sizeof(so_error);
+      if (getsockopt(probe.fd.get(), SOL_SOCKET, SO_ERROR, &so_error, &len) != 0) {
+        so_error = errno;
+      }
+      if (so_error == 0) {
+        (*results)[probe.result].status = ProbeStatus::kUp;
+        (*results)[probe.result].rtt_ms = ElapsedMs(probe.start, now_tp);
+        finish(&probe, std::string());
+      } else if (probe.next) {
+        connect_next(index);
+      } else {
+        finish(&probe, std::strerror(so_error));
+      }
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(queue->mu);
+    queue->abandoned = true;
+  }
+  for (auto& probe : probes) {
+    if (probe.done) {
+      continue;
+    }
+    if (probe.resolving) {
+      (*results)[probe.result].status = ProbeStatus::kUnresolved;
+    }
+    finish(&probe, "timeout");
+  }
+
+  for (size_t i = 0; i < targets.size(); ++i) {
+    if (same_as[i] < targets.size()) {
+      (*results)[i] = (*results)[same_as[i]];
+    }
+  }
+  return true;
+}
+
+bool LoadProbeCache(std::int64_t now,
+                    std::unordered_map<std::string, ProbeResult>* out,
+                    std::string* err) {
+  if (!out) {
+    if (err) {
+      *err = "probe cache pointer is null";
+    }
+    return false;
+  }
+  out->clear();
+  std::string path = GetProbeCachePath(err);
+  if (path.empty()) {
+    return false;
+  }
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    if (errno == ENOENT) {
+      return true;
+    }
+    if (err) {
+      *err = std::string("open failed: ") + std::strerror(errno);
+    }
+    return false;
+  }
+  ScopedFd fd_guard(fd);
+  FlockGuard lock(fd);
+  if (!lock.LockShared(err)) {
+    return false;
+  }
+  std::string content;
+  if (!ReadAllFromFd(fd, &content, err)) {
+    return false;
+  }
+  ParseProbeContent(content, now, out);
+  return true;
+}
+
+bool SaveProbeResults(const std::vector<ProbeResult>& results, std::string* err) {
+  std::string dir = GetDataDir(err);
+  if (dir.empty() || !EnsureDir(dir, err)) {
+    return false;
+  }
+  std::string path = GetProbeCachePath(err);
+  if (path.empty()) {
+    return false;
+  }
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    if (err) {
+      *err = std::string("open failed: ") + std::strerror(errno);
+    }
+    return false;
+  }
+  ScopedFd fd_guard(fd);
+  FlockGuard lock(fd);
+  if (!lock.LockExclusive(err)) {
+    return false;
+  }
+  std::string content;
+  if (!ReadAllFromFd(fd, &content, err)) {
+    return false;
+  }
+
+  std::unordered_map<std::string, ProbeResult> merged;
+  ParseProbeContent(content, static_cast<std::int64_t>(std::time(nullptr)), &merged);
+  for (const auto& result : results) {
+    if (!IsPlainToken(result.host) || !IsPlainToken(result.port)) {
+      continue;
+    }
+    merged[ProbeKey(result.host, result.port)] = result;
+  }
+
+  std::string out;
+  for (const auto& kv : merged) {
+    const ProbeResult& r = kv.second;
+    out += r.host + '\t' + r.port + '\t' + StatusName(r.status) + '\t' + std::to_string(r.rtt_ms) +
+           '\t' + std::to_string(r.checked_at) + '\t' + std::to_string(r.expires_at) + '\n';
+  }
+
+  return WriteFileAtomically(path, out, err);
+}
+
+std::string FormatProbeStatus(const ProbeResult& result) {
+  switch (result.status) {
+    case ProbeStatus::kUp:
+      return "up " + std::to_string(result.rtt_ms) + "ms";
+    case ProbeStatus::kDown:
+      return "down";
+    case ProbeStatus::kUnresolved:
+      return "no dns";
+  }
+  return std::string();
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct ProbeTarget {
+  std::string host;
+  std::string port;
+};
+
+enum class ProbeStatus {
+  kUp,
+  kDown,
+  kUnresolved,
+};
+
+struct ProbeResult {
+  std::string host;
+  std::string port;
+  ProbeStatus status = ProbeStatus::kDown;
+  std::int64_t rtt_ms = -1;
+  std::int64_t checked_at = 0;
+  std::int64_t expires_at = 0;
+  std::string error;
+};
+
+struct ProbeOptions {
+  int timeout_ms = 1000;
+  std::int64_t ttl_seconds = 600;
+};
+
+std::string GetProbeCachePath(std::string* err);
+std::string ProbeKey(const std::string& host, const std::string& port);
+
+// Picks the endpoint that decides reachability for an ssh target: the first
+// jump hop when -J is used, otherwise the host itself. Port defaults to 22.
+bool ProbeTargetForSsh(const std::string& host,
+                       const std::string& port,
+                       const std::string& jump,
+                       ProbeTarget* out);
+
+// Connects to every target at once from a single epoll loop, trying each
+// resolved address in turn. Names are looked up on resolver threads, and
+// lookups and connects share one deadline of options.timeout_ms. results is
+// aligned with targets; duplicate endpoints are connected only once.
+bool ProbeHosts(const std::vector<ProbeTarget>& targets,
+                const ProbeOptions& options,
+                std::vector<ProbeResult>* results,
+                std::string* err);
+
+// Loads cached results that have not expired at now, keyed by ProbeKey.
+bool LoadProbeCache(std::int64_t now,
+                    std::unordered_map<std::string, ProbeResult>* out,
+                    std::string* err);
+// Merges results into the cache, dropping expired entries.
+bool SaveProbeResults(const std::vector<ProbeResult>& results, std::string* err);
+
+// Short status text for the picker: "up 12ms", "down" or "no dns".
+std::string FormatProbeStatus(const ProbeResult& result);
@@ -0,0 +1,139 @@
+#include "segments.h"
+
+#include "util.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char kLogSuffix[] = ".log";
+const char kArchiveSuffix[] = ".lz";
+const char kSummarySuffix[] = ".sum";
+
+bool HasSuffix(const std::string& name, const char* suffix, std::size_t suffix_len) {
+  return name.size() > suffix_len && name.compare(name.size() - suffix_len, suffix_len, suffix) == 0;
+}
+
+// Parses <first_ts>-<last_ts>-<n> followed by a suffix of suffix_len bytes.
+bool ParseSegmentName(const std::string& name, std::size_t suffix_len, std::int64_t* first_ts,
+                      std::int64_t* last_ts) {
+  long long first = 0;
+  long long last = 0;
+  int n = 0;
+  int consumed = 0;
+  if (std::sscanf(name.c_str(), "%lld-%lld-%d%n", &first, &last, &n, &consumed) != 3 ||
+      static_cast<std::size_t>(consumed) != name.size() - suffix_len) {
+    return false;
+  }
+  *first_ts = first;
+  *last_ts = last;
+  return true;
+}
+
+SegmentFile MakeSegmentFile(const std::string& dir, const std::string& stem, std::int64_t first_ts,
+                            std::int64_t last_ts) {
+  SegmentFile file;
+  file.log_path = dir + "/" + stem + kLogSuffix;
+  file.archive_path = dir + "/" + stem + kArchiveSuffix;
+  file.summary_path = dir + "/" + stem + kSummarySuffix;
+  file.first_ts = first_ts;
+  file.last_ts = last_ts;
+  return file;
+}
+
+}  // namespace
+
+bool ListSegments(const std::string& dir, std::vector<SegmentFile>* out, std::string* err) {
+  if (!out) {
+    if (err) {
+      *err = "output pointer is null";
+    }
+    return false;
+  }
+  out->clear();
+  DIR* d = opendir(dir.c_str());
+  if (!d) {
+    if (errno == ENOENT) {
+      return true;
+    }
+    if (err) {
+      *err = std::string("opendir failed: ") + std::strerror(errno);
+    }
+    return false;
+  }
+  while (struct dirent* entry = readdir(d)) {
+    std::string name = entry->d_name;
+    std::size_t suffix_len = 0;
+    bool compressed = false;
+    if (HasSuffix(name, kLogSuffix, sizeof(kLogSuffix) - 1)) {
+      suffix_len = sizeof(kLogSuffix) - 1;
+    } else if (HasSuffix(name, kArchiveSuffix, sizeof(kArchiveSuffix) - 1)) {
+      suffix_len = sizeof(kArchiveSuffix) - 1;
+      compressed = true;
+    } else {
+      continue;
+    }
+    std::int64_t first_ts = 0;
+    std::int64_t last_ts = 0;
+    if (ParseSegmentName(name, suffix_len, &first_ts, &last_ts)) {
+      SegmentFile file = MakeSegmentFile(dir, name.substr(0, name.size() - suffix_len), first_ts, last_ts);
+      file.compressed = compressed;
+      out->push_back(std::move(file));
+    }
+  }
+  closedir(d);
+  std::sort(out->begin(), out->end(), [](const SegmentFile& a, const SegmentFile& b) {
+    if (a.first_ts != b.first_ts) {
+      return a.first_ts < b.first_ts;
+    }
+    if (a.log_path != b.log_path) {
+      return a.log_path < b.log_path;
+    }
+    return a.compressed > b.compressed;
+  });
+  // A stem with both files keeps one entry: the archive, with the .log
+  // marked stale.
+  std::vector<SegmentFile> merged;
+  for (auto& file : *out) {
+    if (!merged.empty() && merged.back().log_path == file.log_path) {
+      merged.back().stale_log = true;
+      continue;
+    }
+    merged.push_back(std::move(file));
+  }
+  out->swap(merged);
+  return true;
+}
+
+SegmentFile NewSegmentFile(const std::string& dir, std::int64_t first_ts, std::int64_t last_ts) {
+  for (int n = 0;; ++n) {
+    char stem[80];
+    std::snprintf(stem, sizeof(stem), "%010lld-%010lld-%d", static_cast<long long>(first_ts),
+                  static_cast<long long>(last_ts), n);
+    SegmentFile file = MakeSegmentFile(dir, stem, first_ts, last_ts);
+    struct stat st;
+    if (stat(file.log_path.c_str(), &st) != 0 && stat(file.archive_path.c_str(), &st) != 0) {
+      return file;
+    }
+  }
+}
+
+int OpenSegmentLock(std::string* err) {
+  std::string dir = GetDataDir(err);
+  if (dir.empty() || !EnsureDir(dir, err)) {
+    return -1;
+  }
+  std::string path = dir + "/segments.lock";
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0 && err) {
+    *err = std::string("open lock failed: ") + std::strerror(errno);
+  }
+  return fd;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Frozen segments of the event log. The hot log rolls into
+// <data>/segments/<first_ts>-<last_ts>-<n>.log, and each frozen log gets a
+// .sum summary beside it, so loads read the hot log plus the summaries
+// instead of every record ever written. Once summarized, the log is
+// compressed into a .lz archive (see archive.h) and the .log removed.
+struct SegmentFile {
+  std::string log_path;
+  std::string archive_path;
+  std::string summary_path;
+  std::int64_t first_ts = 0;
+  std::int64_t last_ts = 0;
+  // The records live in archive_path rather than log_path.
+  bool compressed = false;
+  // A .log left beside its archive by an interrupted compression.
+  bool stale_log = false;
+};
+
+// Segments in dir ordered by first_ts, one per name whether it has a .log,
+// a .lz or both. A missing dir has none.
+bool ListSegments(const std::string& dir, std::vector<SegmentFile>* out, std::string* err);
+
+// Picks a free name in dir for a segment covering [first_ts, last_ts].
+SegmentFile NewSegmentFile(const std::string& dir, std::int64_t first_ts, std::int64_t last_ts);
+
+// Opens <data>/segments.lock, which serializes every change to frozen
+// segments. Returns -1 on failure.
+int OpenSegmentLock(std::string* err);
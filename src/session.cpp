@@ -0,0 +1,263 @@
+#include "session.h"
+
+#include "util.h"
+
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+volatile sig_atomic_t g_winch = 0;
+
+void OnWinch(int) { g_winch = 1; }
+
+std::int64_t ElapsedMs(Clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count();
+}
+
+int ExitCodeFromStatus(int status) {
+  if (WIFEXITED(status)) {
+    return WEXITSTATUS(status);
+  }
+  if (WIFSIGNALED(status)) {
+    return 128 + WTERMSIG(status);
+  }
+  return 1;
+}
+
+bool WaitChild(pid_t pid, int* status) {
+  while (waitpid(pid, status, 0) < 0) {
+    if (errno != EINTR) {
+      return false;
+    }
+  }
+  return true;
+}
+
+[[noreturn]] void ExecArgv(const std::vector<std::string>& argv) {
+  std::vector<char*> argv_exec;
+  argv_exec.reserve(argv.size() + 1);
+  for (const auto& arg : argv) {
+    argv_exec.push_back(const_cast<char*>(arg.c_str()));
+  }
+  argv_exec.push_back(nullptr);
+  execvp(argv_exec[0], argv_exec.data());
+  _exit(127);
+}
+
+struct RawModeGuard {
+  int fd = -1;
+  termios orig{};
+  bool active = false;
+
+  ~RawModeGuard() {
+    if (active) {
+      tcsetattr(fd, TCSAFLUSH, &orig);
+    }
+  }
+};
+
+// Relays bytes between our terminal and the pty master until the child
+// exits and its output is drained. Records when the child first prints
+// anything. Returns false when the child could not be waited for.
+bool Relay(int master, pid_t pid, Clock::time_point start, ConnectTiming* timing, int* status) {
+  char buf[8192];
+  bool stdin_open = true;
+  bool exited = false;
+  std::string err;
+  // The slave can outlive the child when it leaves background processes
+  // behind, so exit is detected through the pidfd, not by EOF. Without one
+  // waitpid is polled every 100 ms instead.
+  ScopedFd pidfd(OpenPidFd(pid));
+  const int wait_ms = pidfd.get() < 0 ? 100 : -1;
+  while (true) {
+    if (g_winch) {
+      g_winch = 0;
+      struct winsize ws;
+      if (ioctl(STDIN_FILENO, TIOCGWINSZ, &ws) == 0) {
+        ioctl(master, TIOCSWINSZ, &ws);
+      }
+    }
+    struct pollfd fds[3];
+    fds[0] = {master, POLLIN, 0};
+    fds[1] = {STDIN_FILENO, static_cast<short>(stdin_open && !exited ? POLLIN : 0), 0};
+    fds[2] = {pidfd.get(), static_cast<short>(exited ? 0 : POLLIN), 0};
+    int rc = poll(fds, 3, exited ? 0 : wait_ms);
+    if (rc < 0 && errno != EINTR) {
+      break;
+    }
+    if (rc <= 0 && exited) {
+      return true;
+    }
+    if (rc <= 0 || (fds[2].revents & POLLIN)) {
+      pid_t done = waitpid(pid, status, WNOHANG);
+      if (done == pid) {
+        exited = true;
+      } else if (done < 0 && errno != EINTR) {
+        return false;
+      }
+      if (rc <= 0) {
+        continue;
+      }
+    }
+    if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+      ssize_t n = read(master, buf, sizeof(buf));
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        break;
+      }
+      if (timing->first_byte_ms < 0) {
+        timing->first_byte_ms = ElapsedMs(start);
+      }
+      if (!WriteAllToFd(STDOUT_FILENO, std::string(buf, static_cast<size_t>(n)), &err)) {
+        break;
+      }
+    }
+    if (stdin_open && !exited && (fds[1].revents & (POLLIN | POLLHUP | POLLERR))) {
+      ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        stdin_open = false;
+        continue;
+      }
+      if (!WriteAllToFd(master, std::string(buf, static_cast<size_t>(n)), &err)) {
+        break;
+      }
+    }
+  }
+  return exited || WaitChild(pid, status);
+}
+
+}  // namespace
+
+// Runs argv as a child and waits for it instead of exec'ing it. When stdin
+// is a terminal the child gets its own pty, so the first byte it prints can
+// be timed; otherwise it inherits our stdio and only the duration is known.
+int RunTimedSession(const std::vector<std::string>& argv, ConnectTiming* timing, std::string* err) {
+  ConnectTiming result;
+  if (timing) {
+    *timing = result;
+  }
+  if (argv.empty()) {
+    if (err) {
+      *err = "empty argv";
+    }
+    return 1;
+  }
+
+  const Clock::time_point start = Clock::now();
+  if (!isatty(STDIN_FILENO)) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      if (err) {
+        *err = std::string("fork failed: ") + std::strerror(errno);
+      }
+      return 1;
+    }
+    if (pid == 0) {
+      ExecArgv(argv);
+    }
+    int status = 0;
+    if (!WaitChild(pid, &status)) {
+      if (err) {
+        *err = std::string("waitpid failed: ") + std::strerror(errno);
+      }
+      return 1;
+    }
+    result.duration_ms = ElapsedMs(start);
+    if (timing) {
+      *timing = result;
+    }
+    return ExitCodeFromStatus(status);
+  }
+
+  RawModeGuard raw;
+  raw.fd = STDIN_FILENO;
+  if (tcgetattr(STDIN_FILENO, &raw.orig) != 0) {
+    if (err) {
+      *err = std::string("tcgetattr failed: ") + std::strerror(errno);
+    }
+    return 1;
+  }
+  struct winsize ws{};
+  ioctl(STDIN_FILENO, TIOCGWINSZ, &ws);
+
+  int master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+  if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+    if (err) {
+      *err = std::string("pty setup failed: ") + std::strerror(errno);
+    }
+    if (master >= 0) {
+      close(master);
+    }
+    return 1;
+  }
+  ScopedFd master_guard(master);
+  std::string slave_name = ptsname(master);
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    if (err) {
+      *err = std::string("fork failed: ") + std::strerror(errno);
+    }
+    return 1;
+  }
+  if (pid == 0) {
+    setsid();
+    int slave = open(slave_name.c_str(), O_RDWR);
+    if (slave < 0) {
+      _exit(127);
+    }
+    ioctl(slave, TIOCSCTTY, 0);
+    tcsetattr(slave, TCSANOW, &raw.orig);
+    ioctl(slave, TIOCSWINSZ, &ws);
+    dup2(slave, STDIN_FILENO);
+    dup2(slave, STDOUT_FILENO);
+    dup2(slave, STDERR_FILENO);
+    if (slave > STDERR_FILENO) {
+      close(slave);
+    }
+    ExecArgv(argv);
+  }
+
+  termios term = raw.orig;
+  cfmakeraw(&term);
+  if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &term) == 0) {
+    raw.active = true;
+  }
+  struct sigaction sa{};
+  struct sigaction old_sa{};
+  sa.sa_handler = OnWinch;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGWINCH, &sa, &old_sa);
+
+  int status = 0;
+  bool waited = Relay(master, pid, start, &result, &status);
+  sigaction(SIGWINCH, &old_sa, nullptr);
+  result.duration_ms = ElapsedMs(start);
+  if (timing) {
+    *timing = result;
+  }
+  if (!waited) {
+    if (err) {
+      *err = std::string("waitpid failed: ") + std::strerror(errno);
+    }
+    return 1;
+  }
+  return ExitCodeFromStatus(status);
+}
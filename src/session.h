@@ -0,0 +1,8 @@
+#pragma once
+
+#include "history.h"
+
+#include <string>
+#include <vector>
+
+int RunTimedSession(const std::vector<std::string>& argv, ConnectTiming* timing, std::string* err);
@@ -0,0 +1,40 @@
+#include "shell_init.h"
+
+std::string QuoteBashWord(const std::string& s) {
+  std::string out = "'";
+  for (char c : s) {
+    if (c == '\'') {
+      out += "'\\''";
+    } else {
+      out += c;
+    }
+  }
+  out += "'";
+  return out;
+}
+
+std::string RenderBashInit(const std::string& snippet, const BashInitOptions& options) {
+  std::string out;
+  out += "# Generated by `sshtab init bash`; rerun it after moving ssh or sshtab.\n";
+  out += "__sshtab_init_ssh=" + QuoteBashWord(options.ssh_path) + "\n";
+  out += "__sshtab_init_builtin_so=" + QuoteBashWord(options.builtin_path) + "\n";
+  if (!options.capture_mode.empty()) {
+    out += "SSHTAB_CAPTURE_MODE=${SSHTAB_CAPTURE_MODE:-" + options.capture_mode + "}\n";
+  }
+
+  std::size_t start = 0;
+  while (start < snippet.size()) {
+    std::size_t end = snippet.find('\n', start);
+    if (end == std::string::npos) {
+      end = snippet.size();
+    }
+    std::size_t first = snippet.find_first_not_of(" \t", start);
+    bool skip = first == std::string::npos || first >= end || snippet[first] == '#';
+    if (!skip) {
+      out.append(snippet, start, end - start);
+      out += '\n';
+    }
+    start = end + 1;
+  }
+  return out;
+}
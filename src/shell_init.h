@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+
+// Values `sshtab init bash` resolves once so the shell does not have to at
+// every startup. Empty strings are baked in as empty.
+struct BashInitOptions {
+  std::string ssh_path;
+  std::string builtin_path;
+  // auto, debug or history; empty leaves SSHTAB_CAPTURE_MODE to the user.
+  std::string capture_mode;
+};
+
+// Specializes the bash integration snippet: prepends the resolved values and
+// drops blank and comment-only lines, which the shell would otherwise parse
+// on every startup.
+std::string RenderBashInit(const std::string& snippet, const BashInitOptions& options);
+
+// Quotes s for bash as a single-quoted word.
+std::string QuoteBashWord(const std::string& s);
@@ -0,0 +1,175 @@
+#include "snapshot.h"
+
+#include "util.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+// A snapshot file, with fields as described at PutU32 in util.h:
+//   magic[8] limit:i64 valid_until:i64
+//   n_sources:u32 { path:str mtime_ns:i64 size:i64 }
+//   n_items:u32   { display alias args host hostname port jump identity
+//                   status:str last_used:i64 count:i64 connect_ms:i64 }
+// The sources are the files the items were built from.
+const char kMagic[8] = {'S', 'S', 'H', 'T', 'S', 'N', 'P', '1'};
+const std::uint32_t kMaxCount = 1u << 20;
+
+std::string Serialize(const PickSnapshot& snapshot) {
+  std::string out(kMagic, sizeof(kMagic));
+  PutI64(&out, static_cast<std::int64_t>(snapshot.limit));
+  PutI64(&out, snapshot.valid_until);
+  PutU32(&out, static_cast<std::uint32_t>(snapshot.sources.size()));
+  for (const auto& source : snapshot.sources) {
+    PutStr(&out, source.path);
+    PutI64(&out, source.mtime_ns);
+    PutI64(&out, source.size);
+  }
+  PutU32(&out, static_cast<std::uint32_t>(snapshot.items.size()));
+  for (const auto& item : snapshot.items) {
+    PutStr(&out, item.display);
+    PutStr(&out, item.alias);
+    PutStr(&out, item.args);
+    PutStr(&out, item.host);
+    PutStr(&out, item.hostname);
+    PutStr(&out, item.port);
+    PutStr(&out, item.jump);
+    PutStr(&out, item.identity);
+    PutStr(&out, item.status);
+    PutI64(&out, item.last_used);
+    PutI64(&out, item.count);
+    PutI64(&out, item.connect_ms);
+  }
+  return out;
+}
+
+bool Deserialize(const char* data, std::size_t size, PickSnapshot* out) {
+  BinaryReader reader(data, size);
+  char magic[sizeof(kMagic)];
+  if (!reader.Raw(magic, sizeof(magic)) || std::memcmp(magic, kMagic, sizeof(kMagic)) != 0) {
+    return false;
+  }
+  std::int64_t limit = 0;
+  std::uint32_t n = 0;
+  if (!reader.I64(&limit) || limit < 0 || !reader.I64(&out->valid_until) || !reader.U32(&n) ||
+      n > kMaxCount) {
+    return false;
+  }
+  out->limit = static_cast<std::size_t>(limit);
+  out->sources.resize(n);
+  for (auto& source : out->sources) {
+    if (!reader.Str(&source.path) || !reader.I64(&source.mtime_ns) || !reader.I64(&source.size)) {
+      return false;
+    }
+  }
+  if (!reader.U32(&n) || n > kMaxCount) {
+    return false;
+  }
+  out->items.resize(n);
+  for (auto& item : out->items) {
+    std::int64_t count = 0;
+    if (!reader.Str(&item.display) || !reader.Str(&item.alias) || !reader.Str(&item.args) ||
+        !reader.Str(&item.host) || !reader.Str(&item.hostname) || !reader.Str(&item.port) ||
+        !reader.Str(&item.jump) || !reader.Str(&item.identity) || !reader.Str(&item.status) ||
+        !reader.I64(&item.last_used) || !reader.I64(&count) || !reader.I64(&item.connect_ms)) {
+      return false;
+    }
+    item.count = static_cast<int>(count);
+  }
+  return reader.AtEnd();
+}
+
+}  // namespace
+
+std::string GetPickSnapshotPath(const std::string& name, std::string* err) {
+  std::string dir = GetDataDir(err);
+  if (dir.empty()) {
+    return std::string();
+  }
+  return dir + "/" + name + ".snapshot";
+}
+
+SnapshotSource StatSnapshotSource(const std::string& path) {
+  SnapshotSource source;
+  source.path = path;
+  struct stat st;
+  if (stat(path.c_str(), &st) == 0) {
+    source.mtime_ns = static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1000000000LL + st.st_mtim.tv_nsec;
+    source.size = static_cast<std::int64_t>(st.st_size);
+  }
+  return source;
+}
+
+bool WritePickSnapshot(const std::string& path, const PickSnapshot& snapshot, std::string* err) {
+  return WriteFileAtomically(path, Serialize(snapshot), err);
+}
+
+bool LoadPickSnapshot(const std::string& path,
+                      std::size_t limit,
+                      std::int64_t now,
+                      std::vector<PickItem>* items,
+                      std::string* err) {
+  if (!items) {
+    if (err) {
+      *err = "items pointer is null";
+    }
+    return false;
+  }
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    if (err) {
+      *err = std::string("open failed: ") + std::strerror(errno);
+    }
+    return false;
+  }
+  ScopedFd fd_guard(fd);
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    if (err) {
+      *err = "snapshot is empty";
+    }
+    return false;
+  }
+  std::size_t size = static_cast<std::size_t>(st.st_size);
+  void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) {
+    if (err) {
+      *err = std::string("mmap failed: ") + std::strerror(errno);
+    }
+    return false;
+  }
+  PickSnapshot snapshot;
+  bool ok = Deserialize(static_cast<const char*>(map), size, &snapshot);
+  munmap(map, size);
+  if (!ok) {
+    if (err) {
+      *err = "snapshot is malformed";
+    }
+    return false;
+  }
+  if (snapshot.limit != limit || (snapshot.valid_until > 0 && now >= snapshot.valid_until)) {
+    if (err) {
+      *err = "snapshot is stale";
+    }
+    return false;
+  }
+  for (const auto& source : snapshot.sources) {
+    SnapshotSource current = StatSnapshotSource(source.path);
+    if (current.mtime_ns != source.mtime_ns || current.size != source.size) {
+      if (err) {
+        *err = "snapshot is stale";
+      }
+      return false;
+    }
+  }
+  *items = std::move(snapshot.items);
+  return true;
+}
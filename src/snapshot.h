@@ -0,0 +1,41 @@
+#pragma once
+
+#include "tui.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A file the snapshot was built from. size is -1 when it did not exist.
+struct SnapshotSource {
+  std::string path;
+  std::int64_t mtime_ns = 0;
+  std::int64_t size = -1;
+};
+
+// A picker list prepared ahead of time, in the order the picker shows it
+// and with the status column already filled in.
+struct PickSnapshot {
+  std::size_t limit = 0;
+  // Unix time after which a status in items may be out of date; 0 if none.
+  std::int64_t valid_until = 0;
+  std::vector<SnapshotSource> sources;
+  std::vector<PickItem> items;
+};
+
+// <data>/<name>.snapshot, e.g. pick.snapshot.
+std::string GetPickSnapshotPath(const std::string& name, std::string* err);
+
+SnapshotSource StatSnapshotSource(const std::string& path);
+
+// Writes snapshot to path atomically.
+bool WritePickSnapshot(const std::string& path, const PickSnapshot& snapshot, std::string* err);
+
+// Maps path and returns its items only when it was built for limit, has not
+// expired at now and every source still has the recorded mtime and size.
+bool LoadPickSnapshot(const std::string& path,
+                      std::size_t limit,
+                      std::int64_t now,
+                      std::vector<PickItem>* items,
+                      std::string* err);
@@ -0,0 +1,524 @@
+#include "ssh_config.h"
+
+#include "util.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <glob.h>
+#include <pwd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char kCacheMagic[] = "sshtab-sshconfig 1";
+const int kMaxIncludeDepth = 16;
+
+std::string HomeDir() {
+  const char* home = std::getenv("HOME");
+  if (home && *home) {
+    return home;
+  }
+  struct passwd* pw = getpwuid(getuid());
+  return pw && pw->pw_dir ? pw->pw_dir : std::string();
+}
+
+std::string LocalUser() {
+  struct passwd* pw = getpwuid(getuid());
+  if (pw && pw->pw_name) {
+    return pw->pw_name;
+  }
+  const char* user = std::getenv("USER");
+  return user ? user : std::string();
+}
+
+std::string ExpandTilde(const std::string& path) {
+  if (path == "~" || path.rfind("~/", 0) == 0) {
+    return HomeDir() + path.substr(1);
+  }
+  return path;
+}
+
+SshConfigSource StatSource(const std::string& path) {
+  SshConfigSource source;
+  source.path = path;
+  struct stat st;
+  if (stat(path.c_str(), &st) == 0) {
+    source.mtime_ns = static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1000000000LL + st.st_mtim.tv_nsec;
+    source.size = static_cast<std::int64_t>(st.st_size);
+  }
+  return source;
+}
+
+// Splits directive arguments on whitespace, honouring double quotes.
+std::vector<std::string> SplitConfigArgs(const std::string& text) {
+  std::vector<std::string> out;
+  std::string current;
+  bool in_token = false;
+  bool quoted = false;
+  for (char c : text) {
+    if (quoted) {
+      if (c == '"') {
+        quoted = false;
+      } else {
+        current.push_back(c);
+      }
+      continue;
+    }
+    if (c == '"') {
+      quoted = true;
+      in_token = true;
+      continue;
+    }
+    if (c == ' ' || c == '\t') {
+      if (in_token) {
+        out.push_back(current);
+        current.clear();
+        in_token = false;
+      }
+      continue;
+    }
+    current.push_back(c);
+    in_token = true;
+  }
+  if (in_token) {
+    out.push_back(current);
+  }
+  return out;
+}
+
+std::string JoinArgs(const std::vector<std::string>& args, size_t from) {
+  std::string out;
+  for (size_t i = from; i < args.size(); ++i) {
+    if (!out.empty()) {
+      out.push_back(' ');
+    }
+    out += args[i];
+  }
+  return out;
+}
+
+struct Compiler {
+  SshConfig* config;
+  std::string include_base;
+
+  void StartBlock(SshConfigBlock::Kind kind, const std::vector<std::string>& criteria) {
+    SshConfigBlock block;
+    block.kind = kind;
+    block.criteria = criteria;
+    config->blocks.push_back(block);
+  }
+
+  // Parses one file whose leading directives belong to the condition of the
+  // enclosing block, as with an Include inside a Host section.
+  void ParseFile(const std::string& path, int depth) {
+    config->sources.push_back(StatSource(path));
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      return;
+    }
+    ScopedFd fd_guard(fd);
+    std::string content;
+    std::string read_err;
+    if (!ReadAllFromFd(fd, &content, &read_err)) {
+      return;
+    }
+
+    size_t start = 0;
+    while (start < content.size()) {
+      size_t end = content.find('\n', start);
+      if (end == std::string::npos) {
+        end = content.size();
+      }
+      std::string line = TrimSpace(content.substr(start, end - start));
+      start = end + 1;
+      if (!line.empty() && line.back() == '\r') {
+        line.pop_back();
+      }
+      if (line.empty() || line[0] == '#') {
+        continue;
+      }
+
+      size_t key_end = line.find_first_of(" \t=");
+      std::string keyword = LowerAscii(line.substr(0, key_end));
+      std::string rest;
+      if (key_end != std::string::npos) {
+        size_t value_start = line.find_first_not_of(" \t", key_end);
+        if (value_start != std::string::npos && line[value_start] == '=') {
+          value_start = line.find_first_not_of(" \t", value_start + 1);
+        }
+        if (value_start != std::string::npos) {
+          rest = line.substr(value_start);
+        }
+      }
+      std::vector<std::string> args = SplitConfigArgs(rest);
+      if (args.empty()) {
+        continue;
+      }
+
+      if (keyword == "host") {
+        StartBlock(SshConfigBlock::Kind::kHost, args);
+      } else if (keyword == "match") {
+        StartBlock(SshConfigBlock::Kind::kMatch, args);
+      } else if (keyword == "include") {
+        if (depth >= kMaxIncludeDepth) {
+          continue;
+        }
+        SshConfigBlock enclosing = config->blocks.back();
+        enclosing.directives.clear();
+        for (const auto& arg : args) {
+          std::string pattern = ExpandTilde(arg);
+          if (pattern.empty() || pattern[0] != '/') {
+            pattern = include_base + "/" + pattern;
+          }
+          // The directory is tracked so a file added under a glob
+          // invalidates the cached index.
+          config->sources.push_back(StatSource(DirnameFromPath(pattern)));
+          glob_t matches;
+          std::memset(&matches, 0, sizeof(matches));
+          if (glob(pattern.c_str(), 0, nullptr, &matches) == 0) {
+            for (size_t i = 0; i < matches.gl_pathc; ++i) {
+              config->blocks.push_back(enclosing);
+              ParseFile(matches.gl_pathv[i], depth + 1);
+            }
+          }
+          globfree(&matches);
+        }
+        config->blocks.push_back(enclosing);
+      } else {
+        config->blocks.back().directives.emplace_back(keyword, JoinArgs(args, 0));
+      }
+    }
+  }
+};
+
+bool MatchPatternList(const std::string& value, const std::string& list) {
+  std::string lowered = LowerAscii(value);
+  bool matched = false;
+  size_t start = 0;
+  while (start <= list.size()) {
+    size_t comma = list.find(',', start);
+    if (comma == std::string::npos) {
+      comma = list.size();
+    }
+    std::string pattern = LowerAscii(list.substr(start, comma - start));
+    start = comma + 1;
+    bool negated = !pattern.empty() && pattern[0] == '!';
+    if (negated) {
+      pattern.erase(0, 1);
+    }
+    if (pattern.empty() || fnmatch(pattern.c_str(), lowered.c_str(), FNM_NOESCAPE) != 0) {
+      continue;
+    }
+    if (negated) {
+      return false;
+    }
+    matched = true;
+  }
+  return matched;
+}
+
+bool HostBlockMatches(const std::vector<std::string>& patterns, const std::string& host) {
+  std::string list;
+  for (const auto& pattern : patterns) {
+    if (!list.empty()) {
+      list.push_back(',');
+    }
+    list += pattern;
+  }
+  return MatchPatternList(host, list);
+}
+
+struct MatchContext {
+  std::string original_host;
+  std::string host;
+  std::string user;
+  std::string local_user;
+};
+
+bool MatchBlockMatches(const std::vector<std::string>& criteria, const MatchContext& ctx) {
+  for (size_t i = 0; i < criteria.size(); ++i) {
+    std::string criterion = LowerAscii(criteria[i]);
+    bool negated = !criterion.empty() && criterion[0] == '!';
+    if (negated) {
+      criterion.erase(0, 1);
+    }
+    bool result = false;
+    if (criterion == "all") {
+      result = true;
+    } else if (criterion == "final") {
+      // sshtab evaluates once, which is the final pass.
+      result = true;
+    } else if (criterion == "canonical") {
+      result = false;
+    } else {
+      if (i + 1 >= criteria.size()) {
+        return false;
+      }
+      const std::string& arg = criteria[++i];
+      if (criterion == "host") {
+        result = MatchPatternList(ctx.host, arg);
+      } else if (criterion == "originalhost") {
+        result = MatchPatternList(ctx.original_host, arg);
+      } else if (criterion == "user") {
+        result = MatchPatternList(ctx.user, arg);
+      } else if (criterion == "localuser") {
+        result = MatchPatternList(ctx.local_user, arg);
+      } else {
+        // exec, localnetwork, tagged and friends cannot be decided here.
+        result = false;
+      }
+    }
+    if (result == negated) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::string ExpandHostTokens(const std::string& value, const std::string& host) {
+  std::string out;
+  for (size_t i = 0; i < value.size(); ++i) {
+    if (value[i] == '%' && i + 1 < value.size()) {
+      char t = value[++i];
+      if (t == 'h') {
+        out += host;
+      } else if (t == '%') {
+        out.push_back('%');
+      } else {
+        out.push_back('%');
+        out.push_back(t);
+      }
+      continue;
+    }
+    out.push_back(value[i]);
+  }
+  return out;
+}
+
+std::vector<std::string> SplitTabs(const std::string& line) {
+  std::vector<std::string> fields;
+  size_t start = 0;
+  while (true) {
+    size_t tab = line.find('\t', start);
+    fields.push_back(line.substr(start, tab == std::string::npos ? std::string::npos : tab - start));
+    if (tab == std::string::npos) {
+      break;
+    }
+    start = tab + 1;
+  }
+  return fields;
+}
+
+std::string DecodeField(const std::string& field, bool* ok) {
+  std::string out;
+  std::string err;
+  if (!Base64Decode(field, &out, &err)) {
+    *ok = false;
+  }
+  return out;
+}
+
+// Cache layout, one record per line with base64 for free text:
+//   R <root>                 roots, in order
+//   S <path> <mtime_ns> <size>
+//   B <kind> <criteria...>   starts a block
+//   D <keyword> <value>      directive of the last block
+std::string SerializeConfig(const SshConfig& config) {
+  std::string out = std::string(kCacheMagic) + "\n";
+  for (const auto& root : config.roots) {
+    out += "R\t" + Base64Encode(root) + "\n";
+  }
+  for (const auto& source : config.sources) {
+    out += "S\t" + Base64Encode(source.path) + "\t" + std::to_string(source.mtime_ns) + "\t" +
+           std::to_string(source.size) + "\n";
+  }
+  for (const auto& block : config.blocks) {
+    out += "B\t" + std::to_string(static_cast<int>(block.kind));
+    for (const auto& c : block.criteria) {
+      out += "\t" + Base64Encode(c);
+    }
+    out += "\n";
+    for (const auto& d : block.directives) {
+      out += "D\t" + d.first + "\t" + Base64Encode(d.second) + "\n";
+    }
+  }
+  return out;
+}
+
+bool DeserializeConfig(const std::string& content, SshConfig* out) {
+  size_t start = 0;
+  bool first = true;
+  bool ok = true;
+  while (start < content.size() && ok) {
+    size_t end = content.find('\n', start);
+    if (end == std::string::npos) {
+      end = content.size();
+    }
+    std::string line = content.substr(start, end - start);
+    start = end + 1;
+    if (first) {
+      if (line != kCacheMagic) {
+        return false;
+      }
+      first = false;
+      continue;
+    }
+    std::vector<std::string> f = SplitTabs(line);
+    if (f[0] == "R" && f.size() == 2) {
+      out->roots.push_back(DecodeField(f[1], &ok));
+    } else if (f[0] == "S" && f.size() == 4) {
+      SshConfigSource source;
+      source.path = DecodeField(f[1], &ok);
+      ok = ok && ParseInt64(f[2], &source.mtime_ns) && ParseInt64(f[3], &source.size);
+      out->sources.push_back(source);
+    } else if (f[0] == "B" && f.size() >= 2) {
+      std::int64_t kind = 0;
+      ok = ParseInt64(f[1], &kind) && kind >= 0 && kind <= 2;
+      SshConfigBlock block;
+      block.kind = static_cast<SshConfigBlock::Kind>(kind);
+      for (size_t i = 2; i < f.size(); ++i) {
+        block.criteria.push_back(DecodeField(f[i], &ok));
+      }
+      out->blocks.push_back(block);
+    } else if (f[0] == "D" && f.size() == 3 && !out->blocks.empty()) {
+      out->blocks.back().directives.emplace_back(f[1], DecodeField(f[2], &ok));
+    } else {
+      ok = false;
+    }
+  }
+  return ok && !first;
+}
+
+bool SourcesUnchanged(const SshConfig& config) {
+  for (const auto& source : config.sources) {
+    SshConfigSource now = StatSource(source.path);
+    if (now.mtime_ns != source.mtime_ns || now.size != source.size) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void WriteCache(const std::string& cache_path, const SshConfig& config) {
+  WriteFileAtomically(cache_path, SerializeConfig(config), nullptr);
+}
+
+}  // namespace
+
+std::vector<std::string> DefaultSshConfigRoots() {
+  std::vector<std::string> roots;
+  std::string home = HomeDir();
+  if (!home.empty()) {
+    roots.push_back(home + "/.ssh/config");
+  }
+  roots.push_back("/etc/ssh/ssh_config");
+  return roots;
+}
+
+bool CompileSshConfig(const std::vector<std::string>& roots, SshConfig* out, std::string* err) {
+  if (!out) {
+    if (err) {
+      *err = "config pointer is null";
+    }
+    return false;
+  }
+  *out = SshConfig();
+  out->roots = roots;
+  std::string home = HomeDir();
+  for (const auto& root : roots) {
+    Compiler compiler;
+    compiler.config = out;
+    // Relative Include paths resolve against ~/.ssh for user files and
+    // /etc/ssh for the system file.
+    compiler.include_base = root.rfind("/etc/ssh/", 0) == 0 ? "/etc/ssh" : home + "/.ssh";
+    compiler.StartBlock(SshConfigBlock::Kind::kAll, {});
+    compiler.ParseFile(root, 0);
+  }
+  return true;
+}
+
+std::string GetSshConfigCachePath(std::string* err) {
+  std::string dir = GetDataDir(err);
+  if (dir.empty()) {
+    return std::string();
+  }
+  return dir + "/ssh_config.cache";
+}
+
+bool LoadSshConfigCached(const std::vector<std::string>& roots,
+                         const std::string& cache_path,
+                         SshConfig* out,
+                         std::string* err) {
+  if (!out) {
+    if (err) {
+      *err = "config pointer is null";
+    }
+    return false;
+  }
+  if (!cache_path.empty()) {
+    int fd = open(cache_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+      ScopedFd fd_guard(fd);
+      std::string content;
+      std::string read_err;
+      SshConfig cached;
+      if (ReadAllFromFd(fd, &content, &read_err) && DeserializeConfig(content, &cached) &&
+          cached.roots == roots && SourcesUnchanged(cached)) {
+        *out = std::move(cached);
+        return true;
+      }
+    }
+  }
+  if (!CompileSshConfig(roots, out, err)) {
+    return false;
+  }
+  if (!cache_path.empty()) {
+    WriteCache(cache_path, *out);
+  }
+  return true;
+}
+
+SshHostConfig ResolveSshHost(const SshConfig& config, const std::string& host, const std::string& user) {
+  SshHostConfig result;
+  MatchContext ctx;
+  ctx.original_host = host;
+  ctx.host = host;
+  ctx.local_user = LocalUser();
+  ctx.user = user.empty() ? ctx.local_user : user;
+  for (const auto& block : config.blocks) {
+    bool applies = block.kind == SshConfigBlock::Kind::kAll ||
+                   (block.kind == SshConfigBlock::Kind::kHost && HostBlockMatches(block.criteria, host)) ||
+                   (block.kind == SshConfigBlock::Kind::kMatch && MatchBlockMatches(block.criteria, ctx));
+    if (!applies) {
+      continue;
+    }
+    for (const auto& directive : block.directives) {
+      const std::string& key = directive.first;
+      const std::string& value = directive.second;
+      if (key == "hostname" && result.hostname.empty()) {
+        result.hostname = ExpandHostTokens(value, host);
+        ctx.host = result.hostname;
+      } else if (key == "port" && result.port.empty()) {
+        result.port = value;
+      } else if (key == "user" && result.user.empty()) {
+        result.user = value;
+        if (user.empty()) {
+          ctx.user = value;
+        }
+      } else if (key == "proxyjump" && result.proxy_jump.empty()) {
+        result.proxy_jump = value;
+      } else if (key == "identityfile" && result.identity_file.empty()) {
+        result.identity_file = value;
+      }
+    }
+  }
+  // "ProxyJump none" wins like any other value but means no jump host.
+  if (LowerAscii(result.proxy_jump) == "none") {
+    result.proxy_jump.clear();
+  }
+  return result;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// One Host or Match section (or the implicit leading section) with the
+// directives that apply when its condition matches, in file order.
+struct SshConfigBlock {
+  enum class Kind { kAll, kHost, kMatch };
+  Kind kind = Kind::kAll;
+  std::vector<std::string> criteria;
+  std::vector<std::pair<std::string, std::string>> directives;
+};
+
+// A file or Include directory the compiled config depends on. size is -1
+// when the path did not exist at compile time.
+struct SshConfigSource {
+  std::string path;
+  std::int64_t mtime_ns = 0;
+  std::int64_t size = -1;
+};
+
+struct SshConfig {
+  std::vector<std::string> roots;
+  std::vector<SshConfigBlock> blocks;
+  std::vector<SshConfigSource> sources;
+};
+
+struct SshHostConfig {
+  std::string hostname;
+  std::string port;
+  std::string user;
+  std::string proxy_jump;
+  std::string identity_file;
+};
+
+// ~/.ssh/config followed by /etc/ssh/ssh_config, the order ssh reads them.
+std::vector<std::string> DefaultSshConfigRoots();
+
+// Parses roots in order, following Include (with globs, relative to ~/.ssh
+// or /etc/ssh) up to 16 levels deep. Missing roots are not an error.
+bool CompileSshConfig(const std::vector<std::string>& roots, SshConfig* out, std::string* err);
+
+// Reuses the compiled index stored at cache_path while every recorded source
+// still has the same mtime and size; otherwise recompiles and rewrites it.
+bool LoadSshConfigCached(const std::vector<std::string>& roots,
+                         const std::string& cache_path,
+                         SshConfig* out,
+                         std::string* err);
+std::string GetSshConfigCachePath(std::string* err);
+
+// Evaluates Host and Match sections for host with ssh's first-value-wins
+// rule. user is the login given on the command line, if any. Match exec is
+// never run and counts as not matching.
+SshHostConfig ResolveSshHost(const SshConfig& config, const std::string& host, const std::string& user);
@@ -0,0 +1,131 @@
+#include "ssh_exec.h"
+
+#include "util.h"
+
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+bool IsExecutableFile(const std::string& path, struct stat* st) {
+  return !path.empty() && path[0] == '/' && stat(path.c_str(), st) == 0 && S_ISREG(st->st_mode) &&
+         access(path.c_str(), X_OK) == 0;
+}
+
+std::string GetSshPathCachePath() {
+  std::string err;
+  std::string dir = GetDataDir(&err);
+  if (dir.empty()) {
+    return std::string();
+  }
+  return dir + "/ssh_path";
+}
+
+bool ParseUint64(const std::string& text, std::uint64_t* out) {
+  auto result = std::from_chars(text.data(), text.data() + text.size(), *out, 10);
+  return !text.empty() && result.ec == std::errc() && result.ptr == text.data() + text.size();
+}
+
+// Cache line: path, st_dev, st_ino and the PATH it was resolved under.
+std::string ReadCachedPath(const std::string& cache_path, const std::string& env_path) {
+  int fd = open(cache_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return std::string();
+  }
+  ScopedFd fd_guard(fd);
+  std::string content;
+  std::string err;
+  if (!ReadAllFromFd(fd, &content, &err)) {
+    return std::string();
+  }
+  if (!content.empty() && content.back() == '\n') {
+    content.pop_back();
+  }
+  std::vector<std::string> fields;
+  size_t start = 0;
+  for (int i = 0; i < 3; ++i) {
+    size_t tab = content.find('\t', start);
+    if (tab == std::string::npos) {
+      return std::string();
+    }
+    fields.push_back(content.substr(start, tab - start));
+    start = tab + 1;
+  }
+  std::uint64_t dev = 0;
+  std::uint64_t ino = 0;
+  if (content.compare(start, std::string::npos, env_path) != 0 || !ParseUint64(fields[1], &dev) ||
+      !ParseUint64(fields[2], &ino)) {
+    return std::string();
+  }
+  struct stat st;
+  if (!IsExecutableFile(fields[0], &st) || static_cast<std::uint64_t>(st.st_dev) != dev ||
+      static_cast<std::uint64_t>(st.st_ino) != ino) {
+    return std::string();
+  }
+  return fields[0];
+}
+
+void WriteCachedPath(const std::string& cache_path,
+                     const std::string& binary,
+                     const struct stat& st,
+                     const std::string& env_path) {
+  std::string line = binary + '\t' + std::to_string(static_cast<std::uint64_t>(st.st_dev)) + '\t' +
+                     std::to_string(static_cast<std::uint64_t>(st.st_ino)) + '\t' + env_path + '\n';
+  WriteFileAtomically(cache_path, line, nullptr);
+}
+
+}  // namespace
+
+std::string ResolveSshBinary() {
+  struct stat st;
+  const char* passed = std::getenv("SSHTAB_SSH");
+  if (passed && IsExecutableFile(passed, &st)) {
+    return passed;
+  }
+
+  const char* env_path_c = std::getenv("PATH");
+  std::string env_path = env_path_c ? env_path_c : "";
+  std::string cache_path = GetSshPathCachePath();
+  if (!cache_path.empty()) {
+    std::string cached = ReadCachedPath(cache_path, env_path);
+    if (!cached.empty()) {
+      return cached;
+    }
+  }
+
+  size_t start = 0;
+  while (start <= env_path.size()) {
+    size_t colon = env_path.find(':', start);
+    if (colon == std::string::npos) {
+      colon = env_path.size();
+    }
+    std::string dir = env_path.substr(start, colon - start);
+    start = colon + 1;
+    if (dir.empty() || dir[0] != '/') {
+      // Relative entries depend on the cwd; leave those to execvp.
+      return std::string();
+    }
+    std::string candidate = dir + "/ssh";
+    if (IsExecutableFile(candidate, &st)) {
+      if (!cache_path.empty()) {
+        WriteCachedPath(cache_path, candidate, st, env_path);
+      }
+      return candidate;
+    }
+  }
+  return std::string();
+}
+
+int ExecSshBinary(const std::string& binary, char* const argv[]) {
+  if (binary.empty()) {
+    return execvp(argv[0], argv);
+  }
+  return execv(binary.c_str(), argv);
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <string>
+
+// Absolute path of the ssh binary to run, or "" to fall back to execvp.
+// Checked in order: $SSHTAB_SSH (exported by the bash integration), the
+// path cached in the data dir (revalidated with one stat against its
+// device/inode and the PATH it was resolved under), then a PATH search
+// whose result refreshes the cache.
+std::string ResolveSshBinary();
+
+// execv()s binary when it is set, otherwise execvp()s argv[0]. Returns only
+// on failure.
+int ExecSshBinary(const std::string& binary, char* const argv[]);
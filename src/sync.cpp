@@ -0,0 +1,571 @@
+#include "sync.h"
+
+#include "history.h"
+#include "util.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <queue>
+#include <tuple>
+#include <unistd.h>
+#include <utility>
+
+namespace {
+
+// First line of every export, so an arbitrary file is not merged. Exports
+// of the first version have no generations.
+const char kExportHeader[] = "sshtab-export 2";
+const char kExportHeaderV1[] = "sshtab-export 1";
+const std::size_t kOriginBytes = 8;
+// The type of the record that carries an origin's generation; it sorts
+// before the record types and no load counts it.
+const char kTypeMarker = '#';
+
+// Pulls lines from a file through a fixed-size read buffer, or from a string
+// already in memory.
+class LineReader {
+ public:
+  explicit LineReader(int fd) : fd_(fd) {}
+  explicit LineReader(std::string content) : buf_(std::move(content)), eof_(true) {}
+
+  // Sets *line to the next line, valid until the next call. Returns false at
+  // the end, or on a read error, which sets *err.
+  bool Next(std::string_view* line, std::string* err) {
+    for (;;) {
+      std::size_t nl = buf_.find('\n', scan_);
+      if (nl != std::string::npos) {
+        *line = std::string_view(buf_).substr(pos_, nl - pos_);
+        pos_ = scan_ = nl + 1;
+        return true;
+      }
+      if (eof_) {
+        if (pos_ >= buf_.size()) {
+          return false;
+        }
+        *line = std::string_view(buf_).substr(pos_);
+        pos_ = scan_ = buf_.size();
+        return true;
+      }
+      buf_.erase(0, pos_);
+      pos_ = 0;
+      scan_ = buf_.size();
+      const std::size_t chunk = 64 * 1024;
+      buf_.resize(scan_ + chunk);
+      ssize_t n;
+      do {
+        n = read(fd_, &buf_[scan_], chunk);
+      } while (n < 0 && errno == EINTR);
+      if (n < 0) {
+        buf_.resize(scan_);
+        if (err) {
+          *err = std::string("read failed: ") + std::strerror(errno);
+        }
+        failed_ = true;
+        return false;
+      }
+      buf_.resize(scan_ + static_cast<std::size_t>(n));
+      eof_ = n == 0;
+    }
+  }
+
+  bool failed() const { return failed_; }
+
+ private:
+  int fd_ = -1;
+  std::string buf_;
+  // Start of the next line, and how far buf_ is known to hold no newline.
+  std::size_t pos_ = 0;
+  std::size_t scan_ = 0;
+  bool eof_ = false;
+  bool failed_ = false;
+};
+
+// Splits line into its origin, its generation (0 when the line has none)
+// and the segment-summary line that follows.
+bool SplitOrigin(std::string_view line,
+                 std::string_view* origin,
+                 std::int64_t* generation,
+                 std::string_view* summary) {
+  std::size_t tab = line.find('\t');
+  if (tab == 0 || tab == std::string_view::npos) {
+    return false;
+  }
+  *origin = line.substr(0, tab);
+  *summary = line.substr(tab + 1);
+  *generation = 0;
+  // A type never parses as a number.
+  std::size_t next = summary->find('\t');
+  if (next != std::string_view::npos && ParseInt64(summary->substr(0, next), generation)) {
+    *summary = summary->substr(next + 1);
+  }
+  return true;
+}
+
+// One export line. The line's key is origin with key.
+struct Record {
+  std::string_view origin;
+  std::int64_t generation = 0;
+  // type \t base64(command)
+  std::string_view key;
+  // The line from the type on, in the segment-summary layout.
+  std::string_view summary;
+  std::int64_t count = 0;
+  std::int64_t last_used = 0;
+  std::int64_t connect_samples = 0;
+  std::int64_t connect_ms = -1;
+};
+
+bool ParseRecord(std::string_view line, Record* out) {
+  if (!SplitOrigin(line, &out->origin, &out->generation, &out->summary)) {
+    return false;
+  }
+  std::string_view fields[6];
+  std::string_view rest = out->summary;
+  for (int i = 0; i < 6; ++i) {
+    std::size_t tab = rest.find('\t');
+    if ((tab == std::string_view::npos) != (i == 5)) {
+      return false;
+    }
+    fields[i] = rest.substr(0, tab);
+    rest = tab == std::string_view::npos ? std::string_view() : rest.substr(tab + 1);
+  }
+  if (fields[0].size() != 1 || fields[1].empty()) {
+    return false;
+  }
+  out->key = out->summary.substr(0, fields[1].data() + fields[1].size() - out->summary.data());
+  return ParseInt64(fields[2], &out->count) && ParseInt64(fields[3], &out->last_used) &&
+         ParseInt64(fields[4], &out->connect_samples) && ParseInt64(fields[5], &out->connect_ms);
+}
+
+bool KeyLess(const Record& a, const Record& b) {
+  return std::tie(a.origin, a.key) < std::tie(b.origin, b.key);
+}
+
+bool IsMarker(const Record& record) {
+  return record.key[0] == kTypeMarker;
+}
+
+void AppendRecord(std::string* out, std::string_view origin, std::int64_t generation, std::string_view summary) {
+  out->append(origin).push_back('\t');
+  out->append(std::to_string(generation)).push_back('\t');
+  out->append(summary).push_back('\n');
+}
+
+// Whether a is the larger of two records with the same key. The order is
+// total, so the merge result does not depend on which input came first.
+bool Supersedes(const Record& a, const Record& b) {
+  return std::tie(a.count, a.last_used, a.connect_samples, a.connect_ms) >
+         std::tie(b.count, b.last_used, b.connect_samples, b.connect_ms);
+}
+
+// One sorted input of a merge and its current record.
+struct MergeInput {
+  std::string name;
+  ScopedFd fd;
+  LineReader reader;
+  std::string_view line;
+  Record record;
+  std::string last_origin;
+  std::string last_key;
+  bool done = false;
+
+  MergeInput(std::string n, int input_fd) : name(std::move(n)), fd(input_fd), reader(input_fd) {}
+  MergeInput(std::string n, std::string content) : name(std::move(n)), reader(std::move(content)) {}
+
+  // Moves to the next record, checking that keys strictly increase.
+  bool Advance(std::string* err) {
+    if (!reader.Next(&line, err)) {
+      done = true;
+      return !reader.failed();
+    }
+    if (!ParseRecord(line, &record)) {
+      if (err) {
+        *err = "malformed record in " + name;
+      }
+      return false;
+    }
+    if (!last_origin.empty() &&
+        std::tie(record.origin, record.key) <= std::tie(last_origin, last_key)) {
+      if (err) {
+        *err = name + " is not sorted";
+      }
+      return false;
+    }
+    last_origin.assign(record.origin);
+    last_key.assign(record.key);
+    return true;
+  }
+};
+
+const std::size_t kNoRecord = static_cast<std::size_t>(-1);
+
+// Merges inputs by key, calling fn once per key with the index of the input
+// whose record the merge keeps and the indexes of every input holding the
+// key. The kept record is the largest among those of the newest generation
+// any input has for the key's origin, or kNoRecord when every input
+// holding the key has an older one.
+template <typename Fn>
+bool MergeInputs(std::vector<MergeInput>* inputs, Fn fn, std::string* err) {
+  auto later = [&](std::size_t a, std::size_t b) { return KeyLess((*inputs)[b].record, (*inputs)[a].record); };
+  std::priority_queue<std::size_t, std::vector<std::size_t>, decltype(later)> heap(later);
+  for (std::size_t i = 0; i < inputs->size(); ++i) {
+    if (!(*inputs)[i].Advance(err)) {
+      return false;
+    }
+    if (!(*inputs)[i].done) {
+      heap.push(i);
+    }
+  }
+  std::vector<std::size_t> present;
+  std::string origin;
+  std::int64_t newest = 0;
+  while (!heap.empty()) {
+    present.clear();
+    present.push_back(heap.top());
+    heap.pop();
+    while (!heap.empty() && !KeyLess((*inputs)[present[0]].record, (*inputs)[heap.top()].record)) {
+      present.push_back(heap.top());
+      heap.pop();
+    }
+    const Record& first = (*inputs)[present[0]].record;
+    if (origin.empty() || first.origin != origin) {
+      // Inputs are sorted by origin, so each one that holds this origin
+      // sits on its first record of it.
+      origin.assign(first.origin);
+      newest = first.generation;
+      for (const auto& input : *inputs) {
+        if (!input.done && input.record.origin == origin) {
+          newest = std::max(newest, input.record.generation);
+        }
+      }
+    }
+    std::size_t best = kNoRecord;
+    for (std::size_t i : present) {
+      const Record& record = (*inputs)[i].record;
+      if (record.generation == newest && (best == kNoRecord || Supersedes(record, (*inputs)[best].record))) {
+        best = i;
+      }
+    }
+    fn(best, present);
+    for (std::size_t i : present) {
+      if (!(*inputs)[i].Advance(err)) {
+        return false;
+      }
+      if (!(*inputs)[i].done) {
+        heap.push(i);
+      }
+    }
+  }
+  return true;
+}
+
+bool OpenInput(const std::string& path, std::vector<MergeInput>* inputs, std::string* err) {
+  int fd = path == "-" ? dup(STDIN_FILENO) : open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    if (err) {
+      *err = "open " + path + " failed: " + std::strerror(errno);
+    }
+    return false;
+  }
+  inputs->emplace_back(path == "-" ? "stdin" : path, fd);
+  std::string_view header;
+  if (!inputs->back().reader.Next(&header, err) || (header != kExportHeader && header != kExportHeaderV1)) {
+    if (err && !inputs->back().reader.failed()) {
+      *err = inputs->back().name + " is not an sshtab export";
+    }
+    return false;
+  }
+  return true;
+}
+
+// Opens remote.sum as a merge input; a missing file is empty.
+bool OpenRemote(const std::string& path, std::vector<MergeInput>* inputs, std::string* err) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    if (errno != ENOENT) {
+      if (err) {
+        *err = std::string("open failed: ") + std::strerror(errno);
+      }
+      return false;
+    }
+    inputs->emplace_back(path, std::string());
+    return true;
+  }
+  inputs->emplace_back(path, fd);
+  return true;
+}
+
+bool LockRemote(ScopedFd* lock_fd, FlockGuard* lock, bool exclusive, std::string* err) {
+  lock_fd->reset(OpenRemoteLock(err));
+  if (lock_fd->get() < 0) {
+    return false;
+  }
+  lock->reset(lock_fd->get());
+  return exclusive ? lock->LockExclusive(err) : lock->LockShared(err);
+}
+
+std::string NewOriginId() {
+  unsigned char bytes[kOriginBytes] = {};
+  ScopedFd fd(open("/dev/urandom", O_RDONLY | O_CLOEXEC));
+  if (fd.get() < 0 || read(fd.get(), bytes, sizeof(bytes)) != static_cast<ssize_t>(sizeof(bytes))) {
+    std::uint64_t mix = static_cast<std::uint64_t>(std::time(nullptr)) * 6364136223846793005ull ^
+                        static_cast<std::uint64_t>(getpid()) * 1442695040888963407ull;
+    std::memcpy(bytes, &mix, sizeof(bytes));
+  }
+  std::string id;
+  char hex[3];
+  for (unsigned char b : bytes) {
+    std::snprintf(hex, sizeof(hex), "%02x", b);
+    id += hex;
+  }
+  return id;
+}
+
+std::string GetGenerationPath(std::string* err) {
+  std::string path = GetOriginPath(err);
+  return path.empty() ? path : path + ".gen";
+}
+
+// Reads this machine's export generation; 0 until the first bump.
+bool ReadOriginGeneration(std::int64_t* generation, std::string* err) {
+  *generation = 0;
+  std::string path = GetGenerationPath(err);
+  if (path.empty()) {
+    return false;
+  }
+  ScopedFd fd(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+  if (fd.get() < 0) {
+    if (errno == ENOENT) {
+      return true;
+    }
+    if (err) {
+      *err = std::string("open failed: ") + std::strerror(errno);
+    }
+    return false;
+  }
+  std::string content;
+  if (!ReadAllFromFd(fd.get(), &content, err)) {
+    return false;
+  }
+  if (!ParseInt64(TrimSpace(content), generation) || *generation < 0) {
+    if (err) {
+      *err = path + " is malformed";
+    }
+    return false;
+  }
+  return true;
+}
+
+bool ReadOriginId(const std::string& path, std::string* id) {
+  ScopedFd fd(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+  std::string content;
+  std::string read_err;
+  if (fd.get() < 0 || !ReadAllFromFd(fd.get(), &content, &read_err)) {
+    return false;
+  }
+  while (!content.empty() && (content.back() == '\n' || content.back() == ' ')) {
+    content.pop_back();
+  }
+  if (content.size() != kOriginBytes * 2 || content.find_first_not_of("0123456789abcdef") != std::string::npos) {
+    return false;
+  }
+  *id = content;
+  return true;
+}
+
+}  // namespace
+
+std::string GetOriginId(std::string* err) {
+  std::string path = GetOriginPath(err);
+  if (path.empty()) {
+    return std::string();
+  }
+  std::string id;
+  if (ReadOriginId(path, &id)) {
+    return id;
+  }
+  // Processes racing to create the id all end up with the one that won.
+  bool created = false;
+  if (!CreateFileAtomically(path, NewOriginId() + "\n", &created, err)) {
+    return std::string();
+  }
+  if (!ReadOriginId(path, &id)) {
+    if (err) {
+      *err = "cannot create origin id in " + path;
+    }
+    return std::string();
+  }
+  return id;
+}
+
+bool BumpOriginGeneration(std::string* err) {
+  std::string path = GetGenerationPath(err);
+  if (path.empty()) {
+    return false;
+  }
+  ScopedFd lock_fd;
+  FlockGuard lock;
+  std::int64_t generation = 0;
+  return LockRemote(&lock_fd, &lock, true, err) && ReadOriginGeneration(&generation, err) &&
+         WriteFileAtomically(path, std::to_string(generation + 1) + "\n", err);
+}
+
+int OpenRemoteLock(std::string* err) {
+  std::string dir = GetDataDir(err);
+  if (dir.empty() || !EnsureDir(dir, err)) {
+    return -1;
+  }
+  std::string path = dir + "/remote.lock";
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0 && err) {
+    *err = std::string("open lock failed: ") + std::strerror(errno);
+  }
+  return fd;
+}
+
+bool SplitRemoteLine(std::string_view line, std::string_view* origin, std::string_view* summary) {
+  std::int64_t generation = 0;
+  return SplitOrigin(line, origin, &generation, summary);
+}
+
+bool ExportHistory(int fd, std::string* err) {
+  std::string origin = GetOriginId(err);
+  std::string remote_path = GetRemoteHistoryPath(err);
+  if (origin.empty() || remote_path.empty()) {
+    return false;
+  }
+  // The generation is read before the history: a delete bumps it only
+  // after removing the records, so the history read here is never older
+  // than its generation.
+  std::int64_t generation = 0;
+  std::string summary;
+  if (!ReadOriginGeneration(&generation, err) || !SummarizeHistory(&summary, err)) {
+    return false;
+  }
+  std::string local;
+  local.reserve(summary.size() + summary.size() / 4);
+  AppendRecord(&local, origin, generation, std::string(1, kTypeMarker) + "\t-\t0\t0\t0\t-1");
+  ForEachLine(summary, [&](std::string_view line) { AppendRecord(&local, origin, generation, line); });
+
+  ScopedFd lock_fd;
+  FlockGuard lock;
+  if (!LockRemote(&lock_fd, &lock, false, err)) {
+    return false;
+  }
+  std::vector<MergeInput> inputs;
+  inputs.reserve(2);
+  inputs.emplace_back("local history", std::move(local));
+  if (!OpenRemote(remote_path, &inputs, err)) {
+    return false;
+  }
+
+  std::string out = std::string(kExportHeader) + "\n";
+  bool write_ok = true;
+  bool merged = MergeInputs(
+      &inputs,
+      [&](std::size_t best, const std::vector<std::size_t>& present) {
+        // This machine's records come from its event log. remote.sum never
+        // holds any, unless copied from another data directory.
+        if (std::find(present.begin(), present.end(), 0) != present.end()) {
+          best = 0;
+        } else if (best == kNoRecord || inputs[best].record.origin == origin) {
+          return;
+        }
+        const Record& record = inputs[best].record;
+        AppendRecord(&out, record.origin, record.generation, record.summary);
+        if (write_ok && out.size() >= 256 * 1024) {
+          write_ok = WriteAllToFd(fd, out, err);
+          out.clear();
+        }
+      },
+      err);
+  return merged && write_ok && WriteAllToFd(fd, out, err);
+}
+
+bool ImportHistory(const std::vector<std::string>& paths, ImportStats* stats, std::string* err) {
+  std::string origin = GetOriginId(err);
+  std::string remote_path = GetRemoteHistoryPath(err);
+  if (origin.empty() || remote_path.empty()) {
+    return false;
+  }
+  ScopedFd lock_fd;
+  FlockGuard lock;
+  if (!LockRemote(&lock_fd, &lock, true, err)) {
+    return false;
+  }
+  // Input 0 is remote.sum as it stands; the exports follow.
+  std::vector<MergeInput> inputs;
+  inputs.reserve(paths.size() + 1);
+  if (!OpenRemote(remote_path, &inputs, err)) {
+    return false;
+  }
+  for (const auto& path : paths) {
+    if (!OpenInput(path, &inputs, err)) {
+      return false;
+    }
+  }
+
+  // The merge streams into a replacement that is kept only if something
+  // changed.
+  AtomicFileWriter writer(remote_path);
+  if (!writer.Open(err)) {
+    return false;
+  }
+  ImportStats local;
+  std::string out;
+  bool write_ok = true;
+  bool merged = MergeInputs(
+      &inputs,
+      [&](std::size_t best, const std::vector<std::size_t>& present) {
+        bool had = std::find(present.begin(), present.end(), 0) != present.end();
+        // Markers are kept but not counted.
+        const Record& first = inputs[present[0]].record;
+        const bool counted = !IsMarker(first);
+        if (counted) {
+          local.records += present.size() - (had ? 1 : 0);
+        }
+        if (first.origin == origin) {
+          return;
+        }
+        if (best == kNoRecord) {
+          // The origin has moved on to a generation without this key.
+          if (had && counted) {
+            ++local.changed;
+          }
+          return;
+        }
+        // Unchanged unless remote.sum lacked the key, held it from an
+        // older generation, or an export beat it.
+        const Record& record = inputs[best].record;
+        if (counted && (!had || inputs[0].record.generation != record.generation ||
+                        (best != 0 && Supersedes(record, inputs[0].record)))) {
+          ++local.changed;
+        }
+        AppendRecord(&out, record.origin, record.generation, record.summary);
+        if (write_ok && out.size() >= 256 * 1024) {
+          write_ok = writer.Write(out, err);
+          out.clear();
+        }
+      },
+      err);
+  if (!merged || !write_ok) {
+    return false;
+  }
+  if (stats) {
+    *stats = local;
+  }
+  if (local.changed == 0) {
+    return true;
+  }
+  if (!writer.Write(out, err) || !writer.Commit(err)) {
+    return false;
+  }
+  // Imported entries get IDs like recorded ones; the sync reads remote.sum.
+  lock.Unlock();
+  return SyncEntryIds(err);
+}
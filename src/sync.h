@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// History shared between machines. `sshtab export` writes one aggregate per
+// command, keyed by the machine that recorded it:
+//   origin \t generation \t type \t base64(command) \t count \t last_used \t connect_samples \t connect_ms
+// sorted by (origin, type, command): this machine's history under its own
+// origin, then what it imported from others. `sshtab import --merge` k-way
+// merges exports into <data>/remote.sum, which holds the same lines.
+//
+// Within one generation an origin's aggregates only grow, so for a key
+// seen twice the merge keeps the larger record instead of adding them up.
+// A delete or prune shrinks them, so it starts a new generation, and for
+// each origin only the records of its newest generation survive a merge;
+// every origin also exports a marker record of type '#' that carries its
+// generation when it has nothing else. That makes merging commutative and
+// idempotent: machines syncing through a shared directory converge however
+// often and in whatever order they import, and what an origin removed
+// stays removed. Loads add the origins together. Lines written before
+// generations existed lack that field and belong to generation 0.
+
+struct ImportStats {
+  // Records read from the inputs, this machine's own included.
+  std::size_t records = 0;
+  // Keys added to, raised in or dropped from remote.sum.
+  std::size_t changed = 0;
+};
+
+// This machine's origin id, created on first use.
+std::string GetOriginId(std::string* err);
+
+// Starts a new generation of this machine's exports, after records were
+// removed from its history.
+bool BumpOriginGeneration(std::string* err);
+
+// Writes the export to fd.
+bool ExportHistory(int fd, std::string* err);
+
+// Merges the exports at paths ("-" is stdin) into remote.sum. Records of
+// this machine's own origin are skipped: its event log already has them.
+bool ImportHistory(const std::vector<std::string>& paths, ImportStats* stats, std::string* err);
+
+// Opens <data>/remote.lock, which serializes changes to remote.sum. Returns
+// -1 on failure.
+int OpenRemoteLock(std::string* err);
+
+// Splits a remote.sum line into its origin and the segment-summary line
+// that follows its generation.
+bool SplitRemoteLine(std::string_view line, std::string_view* origin, std::string_view* summary);
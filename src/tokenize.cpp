@@ -1,44 +1,107 @@
 #include "tokenize.h"
 
-#include <cctype>
+#include <array>
+#include <cstdio>
 
-bool ContainsControlChars(const std::string& input) {
-  for (unsigned char c : input) {
-    if (c < 0x20 || c == 0x7F) {
-      return true;
-    }
+namespace {
+
+enum CharClass : std::uint8_t {
+  kPlain = 0,
+  kSpace = 1 << 0,
+  kControl = 1 << 1,
+  kMeta = 1 << 2,
+  kSingleQuote = 1 << 3,
+  kDoubleQuote = 1 << 4,
+  kBackslash = 1 << 5,
+};
+
+constexpr std::array<std::uint8_t, 256> BuildCharClasses() {
+  std::array<std::uint8_t, 256> table{};
+  for (int c = 0; c < 0x20; ++c) {
+    table[c] |= kControl;
   }
-  return false;
+  table[0x7F] |= kControl;
+  // The std::isspace set in the "C" locale.
+  for (char c : {' ', '\t', '\n', '\v', '\f', '\r'}) {
+    table[static_cast<unsigned char>(c)] |= kSpace;
+  }
+  for (char c : {';', '|', '&', '`', '$', '(', ')', '<', '>'}) {
+    table[static_cast<unsigned char>(c)] |= kMeta;
+  }
+  table['\''] |= kSingleQuote;
+  table['"'] |= kDoubleQuote;
+  table['\\'] |= kBackslash;
+  return table;
 }
 
-bool ContainsForbiddenMetachars(const std::string& input) {
-  for (char c : input) {
-    switch (c) {
-      case ';':
-      case '|':
-      case '&':
-      case '`':
-      case '$':
-      case '(':
-      case ')':
-      case '<':
-      case '>':
-        return true;
-      default:
-        break;
+constexpr std::array<std::uint8_t, 256> kCharClasses = BuildCharClasses();
+
+inline std::uint8_t ClassOf(char c) {
+  return kCharClasses[static_cast<unsigned char>(c)];
+}
+
+std::string DescribeForbidden(std::string_view input, std::size_t pos) {
+  char buf[64];
+  unsigned char c = static_cast<unsigned char>(input[pos]);
+  if (kCharClasses[c] & kControl) {
+    std::snprintf(buf, sizeof(buf), "control character 0x%02x at offset %zu", c, pos);
+  } else {
+    std::snprintf(buf, sizeof(buf), "shell metacharacter '%c' at offset %zu", c, pos);
+  }
+  return buf;
+}
+
+}  // namespace
+
+std::vector<std::string> ArgTokens::ToStrings() const {
+  std::vector<std::string> out;
+  out.reserve(spans.size());
+  for (std::size_t i = 0; i < spans.size(); ++i) {
+    out.emplace_back((*this)[i]);
+  }
+  return out;
+}
+
+TokenizeError FindForbiddenChar(std::string_view input, std::size_t* pos) {
+  for (std::size_t i = 0; i < input.size(); ++i) {
+    std::uint8_t cls = ClassOf(input[i]);
+    if (cls & (kControl | kMeta)) {
+      if (pos) {
+        *pos = i;
+      }
+      return (cls & kControl) ? TokenizeError::kControlChar : TokenizeError::kMetachar;
     }
   }
-  return false;
+  return TokenizeError::kNone;
 }
 
-bool TokenizeArgs(const std::string& input, std::vector<std::string>* out, std::string* err) {
+bool TokenizeArgsInto(std::string_view input, bool validate, ArgTokens* out, std::string* err) {
   if (!out) {
     if (err) {
       *err = "output pointer is null";
     }
     return false;
   }
-  out->clear();
+  out->buffer.clear();
+  out->spans.clear();
+  out->error = TokenizeError::kNone;
+  out->error_pos = 0;
+  if (input.size() > UINT32_MAX) {
+    if (err) {
+      *err = "input is too long";
+    }
+    return false;
+  }
+  if (out->buffer.capacity() < input.size()) {
+    out->buffer.reserve(input.size());
+  }
+
+  // Characters that end a run of literal bytes in each quoting state. In
+  // validate mode control characters and metacharacters stop every run.
+  const std::uint8_t forbidden = validate ? (kControl | kMeta) : 0;
+  const std::uint8_t stop_normal = kSpace | kSingleQuote | kDoubleQuote | kBackslash | forbidden;
+  const std::uint8_t stop_single = kSingleQuote | forbidden;
+  const std::uint8_t stop_double = kDoubleQuote | kBackslash | forbidden;
 
   enum class State {
     kNormal,
@@ -47,72 +110,132 @@ bool TokenizeArgs(const std::string& input, std::vector<std::string>* out, std::
   };
 
   State state = State::kNormal;
-  std::string cur;
+  bool in_token = false;
+  std::size_t token_start = 0;
+  std::size_t quote_pos = 0;
+  const std::size_t n = input.size();
+  std::size_t i = 0;
 
-  for (size_t i = 0; i < input.size(); ++i) {
-    char c = input[i];
-    if (state == State::kNormal) {
-      if (c == '\\') {
-        if (i + 1 < input.size()) {
-          cur.push_back(input[++i]);
-        } else {
-          cur.push_back('\\');
-        }
-        continue;
-      }
-      if (c == '\'') {
-        state = State::kSingle;
-        continue;
-      }
-      if (c == '"') {
-        state = State::kDouble;
-        continue;
-      }
-      if (std::isspace(static_cast<unsigned char>(c))) {
-        if (!cur.empty()) {
-          out->push_back(cur);
-          cur.clear();
-        }
-        continue;
+  auto fail = [&](TokenizeError error, std::size_t pos) {
+    out->error = error;
+    out->error_pos = pos;
+    if (err) {
+      *err = error == TokenizeError::kUnterminatedQuote ? "unterminated quote" : DescribeForbidden(input, pos);
+    }
+    return false;
+  };
+  auto begin_token = [&]() {
+    if (!in_token) {
+      in_token = true;
+      token_start = out->buffer.size();
+    }
+  };
+  // Copies the escaped byte after a backslash, or the backslash itself when it
+  // is the last byte of input.
+  auto take_escape = [&]() {
+    if (i + 1 < n) {
+      ++i;
+      if (ClassOf(input[i]) & forbidden) {
+        return false;
       }
-      cur.push_back(c);
-      continue;
     }
+    out->buffer.push_back(input[i]);
+    ++i;
+    return true;
+  };
 
-    if (state == State::kSingle) {
-      if (c == '\'') {
-        state = State::kNormal;
-      } else {
-        cur.push_back(c);
+  while (i < n) {
+    const std::uint8_t stop = state == State::kNormal   ? stop_normal
+                              : state == State::kSingle ? stop_single
+                                                        : stop_double;
+    std::size_t run = i;
+    while (run < n && (ClassOf(input[run]) & stop) == 0) {
+      ++run;
+    }
+    if (run > i) {
+      begin_token();
+      out->buffer.append(input.data() + i, run - i);
+      i = run;
+      if (i == n) {
+        break;
       }
-      continue;
     }
 
-    if (state == State::kDouble) {
-      if (c == '"') {
-        state = State::kNormal;
-      } else if (c == '\\') {
-        if (i + 1 < input.size()) {
-          cur.push_back(input[++i]);
-        } else {
-          cur.push_back('\\');
+    const std::uint8_t cls = ClassOf(input[i]);
+    if (cls & forbidden) {
+      return fail(cls & kControl ? TokenizeError::kControlChar : TokenizeError::kMetachar, i);
+    }
+    if (state == State::kNormal) {
+      if (cls & kSpace) {
+        if (in_token && out->buffer.size() > token_start) {
+          out->spans.push_back({static_cast<std::uint32_t>(token_start),
+                                static_cast<std::uint32_t>(out->buffer.size() - token_start)});
+        }
+        in_token = false;
+        ++i;
+      } else if (cls & kBackslash) {
+        begin_token();
+        if (!take_escape()) {
+          return fail(ClassOf(input[i]) & kControl ? TokenizeError::kControlChar : TokenizeError::kMetachar, i);
         }
       } else {
-        cur.push_back(c);
+        // A token made only of empty quotes is still dropped below.
+        begin_token();
+        quote_pos = i;
+        state = (cls & kSingleQuote) ? State::kSingle : State::kDouble;
+        ++i;
       }
-      continue;
+    } else if (state == State::kSingle) {
+      state = State::kNormal;
+      ++i;
+    } else if (cls & kDoubleQuote) {
+      state = State::kNormal;
+      ++i;
+    } else if (!take_escape()) {
+      return fail(ClassOf(input[i]) & kControl ? TokenizeError::kControlChar : TokenizeError::kMetachar, i);
     }
   }
 
   if (state != State::kNormal) {
+    return fail(TokenizeError::kUnterminatedQuote, quote_pos);
+  }
+  if (in_token && out->buffer.size() > token_start) {
+    out->spans.push_back({static_cast<std::uint32_t>(token_start),
+                          static_cast<std::uint32_t>(out->buffer.size() - token_start)});
+  }
+  return true;
+}
+
+bool ContainsControlChars(const std::string& input) {
+  for (char c : input) {
+    if (ClassOf(c) & kControl) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ContainsForbiddenMetachars(const std::string& input) {
+  for (char c : input) {
+    if (ClassOf(c) & kMeta) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool TokenizeArgs(const std::string& input, std::vector<std::string>* out, std::string* err) {
+  if (!out) {
     if (err) {
-      *err = "unterminated quote";
+      *err = "output pointer is null";
     }
     return false;
   }
-
-  if (!cur.empty()) {
-    out->push_back(cur);
+  out->clear();
+  ArgTokens tokens;
+  if (!TokenizeArgsInto(input, false, &tokens, err)) {
+    return false;
   }
+  *out = tokens.ToStrings();
   return true;
 }
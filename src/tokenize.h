@@ -1,8 +1,51 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 
+enum class TokenizeError {
+  kNone,
+  kControlChar,
+  kMetachar,
+  kUnterminatedQuote,
+};
+
+// Tokens of one args string. The unquoted, unescaped bytes of every token sit
+// back to back in buffer and spans index into it, so reusing one instance
+// across calls does not allocate once both have grown.
+struct ArgTokens {
+  struct Span {
+    std::uint32_t offset = 0;
+    std::uint32_t length = 0;
+  };
+
+  std::string buffer;
+  std::vector<Span> spans;
+  TokenizeError error = TokenizeError::kNone;
+  // Byte offset into the input of the offending character, or of the opening
+  // quote for kUnterminatedQuote.
+  std::size_t error_pos = 0;
+
+  std::size_t size() const { return spans.size(); }
+  bool empty() const { return spans.empty(); }
+  std::string_view operator[](std::size_t i) const {
+    return std::string_view(buffer.data() + spans[i].offset, spans[i].length);
+  }
+  std::vector<std::string> ToStrings() const;
+};
+
+// Splits input the way TokenizeArgs does in a single pass. With validate set
+// it also rejects control characters and shell metacharacters anywhere in
+// input, quoted or not, and stops at the first one.
+bool TokenizeArgsInto(std::string_view input, bool validate, ArgTokens* out, std::string* err);
+
+// Returns the first control character or shell metacharacter in input, or
+// kNone; *pos receives its offset.
+TokenizeError FindForbiddenChar(std::string_view input, std::size_t* pos);
+
 bool TokenizeArgs(const std::string& input, std::vector<std::string>* out, std::string* err);
 bool ContainsControlChars(const std::string& input);
 bool ContainsForbiddenMetachars(const std::string& input);
@@ -0,0 +1,108 @@
+#include "topk.h"
+
+#include <algorithm>
+
+SpaceSaving::SpaceSaving(std::size_t capacity) : capacity_(std::max<std::size_t>(capacity, 1)) {
+  counters_.reserve(capacity_);
+  heap_.reserve(capacity_);
+  heap_pos_.reserve(capacity_);
+  index_.reserve(capacity_);
+}
+
+SpaceSaving::Counter& SpaceSaving::Add(std::string_view key, std::int64_t ts, std::int64_t weight) {
+  // The lookup key is copied into a reused buffer, so counting a key that is
+  // already monitored does not allocate.
+  lookup_.assign(key.data(), key.size());
+  auto it = index_.find(lookup_);
+  if (it != index_.end()) {
+    Counter& counter = counters_[it->second];
+    counter.count += weight;
+    counter.last_used = std::max(counter.last_used, ts);
+    SiftDown(heap_pos_[it->second]);
+    return counter;
+  }
+
+  if (counters_.size() < capacity_) {
+    std::uint32_t at = static_cast<std::uint32_t>(counters_.size());
+    counters_.emplace_back();
+    Counter& counter = counters_.back();
+    counter.key = lookup_;
+    counter.count = weight;
+    counter.last_used = ts;
+    index_.emplace(lookup_, at);
+    heap_.push_back(at);
+    heap_pos_.push_back(static_cast<std::uint32_t>(heap_.size() - 1));
+    SiftUp(heap_.size() - 1);
+    return counter;
+  }
+
+  // Evict the smallest counter; its count becomes the newcomer's error.
+  std::uint32_t at = heap_[0];
+  Counter& counter = counters_[at];
+  index_.erase(counter.key);
+  counter.key = lookup_;
+  counter.error = counter.count;
+  counter.count += weight;
+  counter.last_used = ts;
+  counter.sample = -1;
+  index_.emplace(lookup_, at);
+  SiftDown(0);
+  return counter;
+}
+
+std::vector<SpaceSaving::Counter> SpaceSaving::Top(std::size_t k) const {
+  std::vector<Counter> out(counters_);
+  auto higher = [](const Counter& a, const Counter& b) {
+    if (a.count != b.count) {
+      return a.count > b.count;
+    }
+    if (a.last_used != b.last_used) {
+      return a.last_used > b.last_used;
+    }
+    return a.key < b.key;
+  };
+  if (k > 0 && k < out.size()) {
+    std::partial_sort(out.begin(), out.begin() + static_cast<std::ptrdiff_t>(k), out.end(), higher);
+    out.resize(k);
+  } else {
+    std::sort(out.begin(), out.end(), higher);
+  }
+  return out;
+}
+
+void SpaceSaving::SwapHeap(std::size_t a, std::size_t b) {
+  std::swap(heap_[a], heap_[b]);
+  heap_pos_[heap_[a]] = static_cast<std::uint32_t>(a);
+  heap_pos_[heap_[b]] = static_cast<std::uint32_t>(b);
+}
+
+void SpaceSaving::SiftUp(std::size_t pos) {
+  while (pos > 0) {
+    std::size_t parent = (pos - 1) / 2;
+    if (counters_[heap_[parent]].count <= counters_[heap_[pos]].count) {
+      break;
+    }
+    SwapHeap(parent, pos);
+    pos = parent;
+  }
+}
+
+void SpaceSaving::SiftDown(std::size_t pos) {
+  const std::size_t n = heap_.size();
+  for (;;) {
+    std::size_t smallest = pos;
+    std::size_t left = 2 * pos + 1;
+    std::size_t right = left + 1;
+    if (left < n && counters_[heap_[left]].count < counters_[heap_[smallest]].count) {
+      smallest = left;
+    }
+    if (right < n && counters_[heap_[right]].count < counters_[heap_[smallest]].count) {
+      smallest = right;
+    }
+    if (smallest == pos) {
+      return;
+    }
+    SwapHeap(pos, smallest);
+    pos = smallest;
+  }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "hash.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Space-Saving heavy hitters: approximate occurrence counts of the most
+// frequent keys of a stream in at most capacity counters. A key that is not
+// monitored takes over the counter with the smallest count, so every key
+// whose true count exceeds stream length / capacity is always monitored.
+class SpaceSaving {
+ public:
+  struct Counter {
+    std::string key;
+    std::int64_t count = 0;
+    // count overstates the key's true count by at most error.
+    std::int64_t error = 0;
+    std::int64_t last_used = 0;
+    // Free for the caller; reset when the counter changes keys.
+    std::int64_t sample = -1;
+  };
+
+  explicit SpaceSaving(std::size_t capacity);
+
+  // Counts weight occurrences of key, the latest seen at ts, and returns its
+  // counter, valid until the next Add.
+  Counter& Add(std::string_view key, std::int64_t ts, std::int64_t weight = 1);
+
+  // The monitored keys, highest count first.
+  std::vector<Counter> Top(std::size_t k) const;
+
+  std::size_t size() const { return counters_.size(); }
+  std::size_t capacity() const { return capacity_; }
+
+ private:
+  void SiftUp(std::size_t pos);
+  void SiftDown(std::size_t pos);
+  void SwapHeap(std::size_t a, std::size_t b);
+
+  std::size_t capacity_;
+  std::vector<Counter> counters_;
+  // Counter positions ordered as a min-heap on count, and each counter's
+  // place in it.
+  std::vector<std::uint32_t> heap_;
+  std::vector<std::uint32_t> heap_pos_;
+  std::unordered_map<std::string, std::uint32_t, StringHash> index_;
+  std::string lookup_;
+};
@@ -1,7 +1,9 @@
 #include "tui.h"
 
+#include "history.h"
 #include "util.h"
 
+#include <algorithm>
 #include <cerrno>
 #include <cstring>
 #include <ctime>
@@ -159,19 +161,6 @@ size_t GetPadding(size_t width) {
   return 0;
 }
 
-std::string TruncateLine(const std::string& text, size_t width) {
-  if (width == 0) {
-    return std::string();
-  }
-  if (text.size() <= width) {
-    return text;
-  }
-  if (width <= 3) {
-    return text.substr(0, width);
-  }
-  return text.substr(0, width - 3) + "...";
-}
-
 std::string FormatRelativeTime(std::int64_t last_used, std::time_t now) {
   if (last_used <= 0 || now <= 0) {
     return "?";
@@ -220,6 +209,9 @@ std::string BuildMetaLine(const PickItem& item) {
   std::string out;
   if (!item.host.empty()) {
     out += "host: " + item.host;
+    if (!item.hostname.empty() && item.hostname != item.host) {
+      out += " (" + item.hostname + ")";
+    }
   }
   if (!item.port.empty()) {
     if (!out.empty()) {
@@ -239,6 +231,12 @@ std::string BuildMetaLine(const PickItem& item) {
     }
     out += "i:" + item.identity;
   }
+  if (item.connect_ms >= 0) {
+    if (!out.empty()) {
+      out += "  ";
+    }
+    out += "conn:" + std::to_string(item.connect_ms) + "ms";
+  }
   return out;
 }
 
@@ -249,7 +247,49 @@ std::string PickItemLabel(const PickItem& item, bool show_alias) {
   return item.display;
 }
 
-std::string BuildHintText(const PickUiConfig& config, bool show_alias, size_t /*selected*/, size_t /*total*/) {
+const char* PickOrderName(PickOrder order) {
+  switch (order) {
+    case PickOrder::kRecent:
+      return "recent";
+    case PickOrder::kCount:
+      return "count";
+    case PickOrder::kFrecency:
+      return "frecency";
+    case PickOrder::kName:
+      return "name";
+    case PickOrder::kJump:
+      return "jump";
+    case PickOrder::kFast:
+      return "fast";
+  }
+  return "recent";
+}
+
+PickOrder NextPickOrder(PickOrder order) {
+  switch (order) {
+    case PickOrder::kRecent:
+      return PickOrder::kCount;
+    case PickOrder::kCount:
+      return PickOrder::kFrecency;
+    case PickOrder::kFrecency:
+      return PickOrder::kName;
+    case PickOrder::kName:
+      return PickOrder::kJump;
+    case PickOrder::kJump:
+      return PickOrder::kFast;
+    case PickOrder::kFast:
+      return PickOrder::kRecent;
+  }
+  return PickOrder::kRecent;
+}
+
+const size_t kPickOrderCount = 6;
+
+std::string BuildHintText(const PickUiConfig& config,
+                          bool show_alias,
+                          PickOrder order,
+                          size_t /*selected*/,
+                          size_t /*total*/) {
   std::vector<std::string> parts;
   parts.push_back("Up/Down: move");
   parts.push_back("Enter: select");
@@ -257,12 +297,16 @@ std::string BuildHintText(const PickUiConfig& config, bool show_alias, size_t /*
   if (config.allow_alias_edit) {
     parts.push_back("n: alias");
   }
+  if (config.allow_mark) {
+    parts.push_back("Space: mark");
+  }
   if (config.allow_delete) {
     parts.push_back("d: delete");
   }
   if (config.allow_display_toggle) {
     parts.push_back(show_alias ? "S/<Shift+Tab>: addr" : "S/<Shift+Tab>: alias");
   }
+  parts.push_back(std::string("o: order(") + PickOrderName(order) + ")");
   std::string hint;
   for (size_t i = 0; i < parts.size(); ++i) {
     if (i > 0) {
@@ -273,135 +317,256 @@ std::string BuildHintText(const PickUiConfig& config, bool show_alias, size_t /*
   return hint;
 }
 
-void AppendStyledLine(std::string* out,
-                      const std::string& text,
-                      size_t width,
-                      size_t padding,
-                      const std::string& style) {
-  if (!out) {
-    return;
-  }
-  size_t inner_width = width > padding * 2 ? width - padding * 2 : 0;
-  std::string line = TruncateLine(text, inner_width);
-  out->append("\r\x1b[2K");
-  out->append(style);
-  out->append(padding, ' ');
-  out->append(line);
-  if (line.size() < inner_width) {
-    out->append(inner_width - line.size(), ' ');
-  }
-  out->append(padding, ' ');
-  out->append("\x1b[0m");
-  out->append("\n");
+// Lays out left/right text into exactly inner_width display columns; the
+// right text is dropped when it does not fit.
+std::string RenderListBody(const std::string& left, const std::string& right, size_t inner_width) {
+  size_t right_len = DisplayWidth(right);
+  size_t gap = right.empty() ? 0 : 2;
+  bool show_right = !right.empty() && right_len + gap <= inner_width;
+  size_t left_max = show_right ? inner_width - right_len - gap : inner_width;
+
+  size_t left_len = 0;
+  std::string body = TruncateDisplay(left, left_max, &left_len);
+  if (left_len < left_max) {
+    body.append(left_max - left_len, ' ');
+  }
+  if (show_right) {
+    body.append(gap, ' ');
+    body.append(right);
+  }
+  return body;
 }
 
-void AppendListLine(std::string* out,
-                    const std::string& left,
-                    const std::string& right,
-                    size_t width,
-                    size_t padding,
-                    const std::string& style) {
-  if (!out) {
-    return;
-  }
-  size_t inner_width = width > padding * 2 ? width - padding * 2 : 0;
-  std::string right_text = right;
-  size_t right_len = right_text.size();
-  size_t gap = right_text.empty() ? 0 : 2;
-  size_t left_max = inner_width;
-  if (right_len + gap <= inner_width) {
-    left_max = inner_width - right_len - gap;
-  } else {
-    right_text.clear();
-    right_len = 0;
-    gap = 0;
-    left_max = inner_width;
-  }
-  std::string left_text = TruncateLine(left, left_max);
-  out->append("\r\x1b[2K");
-  out->append(style);
-  out->append(padding, ' ');
-  out->append(left_text);
-  if (left_text.size() < left_max) {
-    out->append(left_max - left_text.size(), ' ');
-  }
-  if (!right_text.empty()) {
-    out->append(gap, ' ');
-    out->append(right_text);
-  }
-  out->append(padding, ' ');
-  out->append("\x1b[0m");
-  out->append("\n");
+std::string ComposeLine(const std::string& body, size_t padding, const std::string& style) {
+  std::string line;
+  line.reserve(style.size() + padding * 2 + body.size() + 4);
+  line.append(style);
+  line.append(padding, ' ');
+  line.append(body);
+  line.append(padding, ' ');
+  line.append("\x1b[0m");
+  return line;
 }
 
-bool Draw(int fd,
-          const std::vector<PickItem>& items,
-          const std::string& title,
-          size_t selected,
-          size_t offset,
-          bool show_alias,
-          const std::string& header_hint,
-          const std::string& footer_left) {
-  const TerminalSize size = GetTerminalSize(fd);
-  const size_t width = size.cols;
-  const size_t rows = size.rows;
-  const size_t padding = GetPadding(width);
-  const size_t visible = GetVisibleCount(items.size(), rows);
-  const std::string header_bg = "\x1b[48;5;235m";
-  const std::string panel_bg = "\x1b[48;5;236m";
-  const std::string select_bg = "\x1b[48;5;24m";
-  const std::string text = "\x1b[38;5;250m";
-  const std::string muted = "\x1b[38;5;245m";
-  const std::string accent = "\x1b[38;5;75m";
-  const std::string bright = "\x1b[38;5;231m";
-  const std::string bold = "\x1b[1m";
-  std::string out;
-  out += "\x1b[2J\x1b[H";
-  std::string title_base = TrimTitle(title);
-  if (title_base.empty()) {
-    title_base = "sshtab";
-  }
-  std::string header_text = title_base + "  [" + std::to_string(items.size()) + "]";
-  AppendListLine(&out, header_text, header_hint, width, padding, header_bg + accent + bold);
-
-  std::time_t now = std::time(nullptr);
-  size_t inner_width = width > padding * 2 ? width - padding * 2 : 0;
-  for (size_t i = 0; i < visible; ++i) {
-    size_t idx = offset + i;
-    if (idx >= items.size()) {
-      AppendStyledLine(&out, "", width, padding, panel_bg + muted);
-      continue;
+const char kHeaderBg[] = "\x1b[48;5;235m";
+const char kPanelBg[] = "\x1b[48;5;236m";
+const char kSelectBg[] = "\x1b[48;5;24m";
+const char kText[] = "\x1b[38;5;250m";
+const char kMuted[] = "\x1b[38;5;245m";
+const char kAccent[] = "\x1b[38;5;75m";
+const char kBright[] = "\x1b[38;5;231m";
+const char kBold[] = "\x1b[1m";
+
+// Pre-rendered list rows, one entry per item. Lines are indexed by
+// selected | marked << 1 and built on first use.
+struct RowCell {
+  bool valid = false;
+  std::string label;
+  std::string right;
+  std::string line[4];
+};
+
+class PickRenderer {
+ public:
+  PickRenderer(int fd, const std::string& title) : fd_(fd), title_base_(TrimTitle(title)) {
+    if (title_base_.empty()) {
+      title_base_ = "sshtab";
     }
-    const PickItem& item = items[idx];
-    std::string prefix = idx == selected ? "> " : "  ";
-    std::string line = prefix + PickItemLabel(item, show_alias);
-    std::string time_text = FormatRelativeTime(item.last_used, now);
-    std::string right_text = time_text + "  " + std::to_string(item.count) + "x";
-    size_t gap = 2;
-    if (right_text.size() + gap > inner_width) {
-      right_text = time_text;
+  }
+
+  void InvalidateItem(size_t idx) {
+    if (idx < cells_.size()) {
+      cells_[idx].valid = false;
     }
-    if (!right_text.empty() && right_text.size() + gap > inner_width) {
-      right_text.clear();
+  }
+
+  bool Draw(const std::vector<PickItem>& items,
+            const std::vector<size_t>& view,
+            const std::vector<bool>& marks,
+            size_t selected,
+            size_t offset,
+            bool show_alias,
+            const std::string& header_hint,
+            const std::string& footer_left) {
+    const TerminalSize size = GetTerminalSize(fd_);
+    const std::time_t now = std::time(nullptr);
+    const std::int64_t minute = static_cast<std::int64_t>(now) / 60;
+    const bool resized = size.cols != width_ || size.rows != rows_;
+    if (resized || show_alias != show_alias_ || minute != minute_ || cells_.size() != items.size()) {
+      cells_.assign(items.size(), RowCell());
+      width_ = size.cols;
+      rows_ = size.rows;
+      show_alias_ = show_alias;
+      minute_ = minute;
     }
-    if (idx == selected) {
-      AppendListLine(&out, line, right_text, width, padding, select_bg + bright + bold);
-    } else {
-      AppendListLine(&out, line, right_text, width, padding, panel_bg + text);
+
+    const size_t padding = GetPadding(width_);
+    const size_t inner_width = width_ > padding * 2 ? width_ - padding * 2 : 0;
+    const size_t visible = GetVisibleCount(items.size(), rows_);
+
+    std::string header_text = title_base_ + "  [" + std::to_string(items.size()) + "]";
+    std::string header_style = std::string(kHeaderBg) + kAccent + kBold;
+    std::string muted_style = std::string(kHeaderBg) + kMuted;
+
+    const size_t line_count = visible + 3;
+    const bool full = resized || frame_.size() != line_count;
+    if (full) {
+      frame_.assign(line_count, std::string());
     }
-  }
 
-  std::string rule(width > padding * 2 ? width - padding * 2 : 0, '-');
-  AppendStyledLine(&out, rule, width, padding, header_bg + muted);
-  AppendListLine(&out, footer_left, "", width, padding, header_bg + muted);
-  return WriteAll(fd, out);
-}
+    std::string out;
+    if (full) {
+      out += "\x1b[2J\x1b[H";
+    }
+    auto emit = [&](size_t row, const std::string& line) {
+      if (!full && frame_[row] == line) {
+        return;
+      }
+      if (full) {
+        out += "\r\x1b[2K";
+        out += line;
+        out += "\n";
+      } else {
+        out += "\x1b[";
+        out += std::to_string(row + 1);
+        out += ";1H\x1b[2K";
+        out += line;
+      }
+      frame_[row] = line;
+    };
+
+    emit(0, ComposeLine(RenderListBody(header_text, header_hint, inner_width), padding, header_style));
+    for (size_t i = 0; i < visible; ++i) {
+      size_t pos = offset + i;
+      if (pos >= view.size()) {
+        emit(i + 1, ComposeLine(RenderListBody("", "", inner_width), padding,
+                                std::string(kPanelBg) + kMuted));
+        continue;
+      }
+      size_t idx = view[pos];
+      emit(i + 1, RowLine(items[idx], idx, pos == selected, marks[idx], now, padding, inner_width));
+    }
+    std::string rule(inner_width, '-');
+    emit(visible + 1, ComposeLine(RenderListBody(rule, "", inner_width), padding, muted_style));
+    emit(visible + 2, ComposeLine(RenderListBody(footer_left, "", inner_width), padding, muted_style));
+
+    if (out.empty()) {
+      return true;
+    }
+    return WriteAll(fd_, out);
+  }
+
+ private:
+  const std::string& RowLine(const PickItem& item,
+                             size_t idx,
+                             bool is_selected,
+                             bool is_marked,
+                             std::time_t now,
+                             size_t padding,
+                             size_t inner_width) {
+    RowCell& cell = cells_[idx];
+    if (!cell.valid) {
+      cell.label = PickItemLabel(item, show_alias_);
+      std::string time_text = FormatRelativeTime(item.last_used, now);
+      std::string count_text = time_text + "  " + std::to_string(item.count) + "x";
+      cell.right = item.status.empty() ? count_text : item.status + "  " + count_text;
+      // Drop the status column first, then the count, when the row is narrow.
+      const size_t gap = 2;
+      if (cell.right.size() + gap > inner_width / 2) {
+        cell.right = count_text;
+      }
+      if (cell.right.size() + gap > inner_width) {
+        cell.right = time_text;
+      }
+      for (auto& line : cell.line) {
+        line.clear();
+      }
+      cell.valid = true;
+    }
+    std::string& line = cell.line[(is_selected ? 1 : 0) | (is_marked ? 2 : 0)];
+    if (line.empty()) {
+      std::string prefix;
+      prefix += is_selected ? '>' : ' ';
+      prefix += is_marked ? '*' : ' ';
+      std::string style = is_selected ? std::string(kSelectBg) + kBright + kBold
+                                      : std::string(kPanelBg) + (is_marked ? kAccent : kText);
+      line = ComposeLine(RenderListBody(prefix + cell.label, cell.right, inner_width), padding, style);
+    }
+    return line;
+  }
+
+  int fd_;
+  std::string title_base_;
+  size_t width_ = 0;
+  size_t rows_ = 0;
+  bool show_alias_ = false;
+  std::int64_t minute_ = -1;
+  std::vector<RowCell> cells_;
+  std::vector<std::string> frame_;
+};
 
 }  // namespace
 
+std::vector<std::size_t> BuildPickOrder(const std::vector<PickItem>& items,
+                                        PickOrder order,
+                                        std::int64_t now) {
+  std::vector<std::size_t> perm(items.size());
+  for (std::size_t i = 0; i < perm.size(); ++i) {
+    perm[i] = i;
+  }
+  switch (order) {
+    case PickOrder::kRecent:
+      break;
+    case PickOrder::kCount:
+      std::stable_sort(perm.begin(), perm.end(), [&](std::size_t a, std::size_t b) {
+        return items[a].count > items[b].count;
+      });
+      break;
+    case PickOrder::kFrecency: {
+      std::vector<double> scores(items.size());
+      for (std::size_t i = 0; i < items.size(); ++i) {
+        scores[i] = FrecencyScore(items[i].count, items[i].last_used, now);
+      }
+      std::stable_sort(perm.begin(), perm.end(),
+                       [&](std::size_t a, std::size_t b) { return scores[a] > scores[b]; });
+      break;
+    }
+    case PickOrder::kName: {
+      std::vector<std::string> keys(items.size());
+      for (std::size_t i = 0; i < items.size(); ++i) {
+        const PickItem& item = items[i];
+        keys[i] = LowerAscii(!item.alias.empty() ? item.alias
+                                                 : (!item.host.empty() ? item.host : item.display));
+      }
+      std::stable_sort(perm.begin(), perm.end(),
+                       [&](std::size_t a, std::size_t b) { return keys[a] < keys[b]; });
+      break;
+    }
+    case PickOrder::kJump:
+      // Direct connections first, then one block per jump host.
+      std::stable_sort(perm.begin(), perm.end(), [&](std::size_t a, std::size_t b) {
+        return items[a].jump < items[b].jump;
+      });
+      break;
+    case PickOrder::kFast:
+      // Median connect latency ascending; targets never timed go last.
+      std::stable_sort(perm.begin(), perm.end(), [&](std::size_t a, std::size_t b) {
+        std::int64_t la = items[a].connect_ms;
+        std::int64_t lb = items[b].connect_ms;
+        if ((la < 0) != (lb < 0)) {
+          return lb < 0;
+        }
+        return la < lb;
+      });
+      break;
+  }
+  return perm;
+}
+
 PickResult RunPickTui(std::vector<PickItem>& items,
                       const std::string& title,
                       std::size_t* index,
+                      std::vector<std::size_t>* marked,
                       const PickUiConfig& config,
                       const AliasUpdateFn& alias_update,
                       std::string* err) {
@@ -435,8 +600,18 @@ PickResult RunPickTui(std::vector<PickItem>& items,
     return PickResult::kError;
   }
 
+  PickRenderer renderer(fd, title);
+  // Orders are item permutations built on first use, so switching only
+  // costs a redraw. selected and offset are positions within the view.
+  std::vector<size_t> orders[kPickOrderCount];
+  PickOrder order = PickOrder::kRecent;
+  orders[static_cast<size_t>(order)] = BuildPickOrder(items, order, std::time(nullptr));
+  const std::vector<size_t>* view = &orders[static_cast<size_t>(order)];
   size_t selected = 0;
   size_t offset = 0;
+  std::vector<bool> marks(items.size(), false);
+  size_t mark_count = 0;
+  const bool allow_mark = config.allow_mark && marked;
   bool show_alias = config.show_alias;
   bool prompt_active = false;
   bool delete_confirm = false;
@@ -444,6 +619,28 @@ PickResult RunPickTui(std::vector<PickItem>& items,
   std::string status;
   bool clear_status_on_next_input = false;
 
+  auto scroll_to_selected = [&]() {
+    size_t visible = GetVisibleCount(items.size(), GetTerminalSize(fd).rows);
+    if (selected < offset) {
+      offset = selected;
+    } else if (selected >= offset + visible) {
+      offset = selected - visible + 1;
+    }
+  };
+
+  auto finish = [&](PickResult result) -> PickResult {
+    *index = (*view)[selected];
+    if (marked) {
+      marked->clear();
+      for (size_t i = 0; i < marks.size(); ++i) {
+        if (marks[i]) {
+          marked->push_back(i);
+        }
+      }
+    }
+    return result;
+  };
+
   auto draw = [&]() -> bool {
     std::string footer_left;
     std::string header_hint;
@@ -451,17 +648,21 @@ PickResult RunPickTui(std::vector<PickItem>& items,
       footer_left = "alias: " + prompt_input;
       header_hint = "Alias edit: Enter save | Esc cancel";
     } else if (delete_confirm) {
-      footer_left = "Delete: " + PickItemLabel(items[selected], show_alias);
+      if (mark_count > 0) {
+        footer_left = "Delete " + std::to_string(mark_count) + " marked entries";
+      } else {
+        footer_left = "Delete: " + PickItemLabel(items[(*view)[selected]], show_alias);
+      }
       header_hint = "Press Enter to delete, Esc to cancel";
     } else {
       if (!status.empty()) {
         footer_left = status;
       } else {
-        footer_left = BuildMetaLine(items[selected]);
+        footer_left = BuildMetaLine(items[(*view)[selected]]);
       }
-      header_hint = BuildHintText(config, show_alias, selected, items.size());
+      header_hint = BuildHintText(config, show_alias, order, selected, items.size());
     }
-    return Draw(fd, items, title, selected, offset, show_alias, header_hint, footer_left);
+    return renderer.Draw(items, *view, marks, selected, offset, show_alias, header_hint, footer_left);
   };
 
   if (!draw()) {
@@ -488,8 +689,19 @@ PickResult RunPickTui(std::vector<PickItem>& items,
           status = "alias update unavailable";
         } else if (HasControlChars(alias)) {
           status = "alias rejected: control characters";
-        } else if (alias_update(items[selected], alias, &update_err)) {
-          items[selected].alias = alias;
+        } else if (alias_update(items[(*view)[selected]], alias, &update_err)) {
+          size_t idx = (*view)[selected];
+          items[idx].alias = alias;
+          renderer.InvalidateItem(idx);
+          std::vector<size_t>& by_name = orders[static_cast<size_t>(PickOrder::kName)];
+          if (order == PickOrder::kName) {
+            by_name = BuildPickOrder(items, PickOrder::kName, std::time(nullptr));
+            selected = static_cast<size_t>(std::find(by_name.begin(), by_name.end(), idx) -
+                                           by_name.begin());
+            scroll_to_selected();
+          } else {
+            by_name.clear();
+          }
           status = alias.empty() ? "alias cleared" : "alias saved";
         } else {
           status = update_err.empty() ? "alias failed" : update_err;
@@ -551,8 +763,7 @@ PickResult RunPickTui(std::vector<PickItem>& items,
         continue;
       }
       if (c == '\r' || c == '\n') {
-        *index = selected;
-        return PickResult::kDeleted;
+        return finish(PickResult::kDeleted);
       }
       if (c == 0x1b) {
         char next = 0;
@@ -582,13 +793,21 @@ PickResult RunPickTui(std::vector<PickItem>& items,
     }
 
     if (c == '\r' || c == '\n') {
-      *index = selected;
-      return PickResult::kSelected;
+      return finish(PickResult::kSelected);
+    }
+
+    if (c == ' ' && allow_mark) {
+      size_t idx = (*view)[selected];
+      marks[idx] = !marks[idx];
+      mark_count = marks[idx] ? mark_count + 1 : mark_count - 1;
+      if (selected + 1 < items.size()) {
+        ++selected;
+      }
     }
 
     if ((c == 'n' || c == 'N') && config.allow_alias_edit && alias_update) {
       prompt_active = true;
-      prompt_input = items[selected].alias;
+      prompt_input = items[(*view)[selected]].alias;
       draw();
       continue;
     }
@@ -599,6 +818,17 @@ PickResult RunPickTui(std::vector<PickItem>& items,
       continue;
     }
 
+    if (c == 'o' || c == 'O') {
+      size_t current = (*view)[selected];
+      order = NextPickOrder(order);
+      std::vector<size_t>& next = orders[static_cast<size_t>(order)];
+      if (next.empty()) {
+        next = BuildPickOrder(items, order, std::time(nullptr));
+      }
+      view = &next;
+      selected = static_cast<size_t>(std::find(view->begin(), view->end(), current) - view->begin());
+    }
+
     if ((c == 'd' || c == 'D') && config.allow_delete) {
       delete_confirm = true;
       draw();
@@ -632,13 +862,7 @@ PickResult RunPickTui(std::vector<PickItem>& items,
       }
     }
 
-    size_t visible = GetVisibleCount(items.size(), GetTerminalSize(fd).rows);
-    if (selected < offset) {
-      offset = selected;
-    } else if (selected >= offset + visible) {
-      offset = selected - visible + 1;
-    }
-
+    scroll_to_selected();
     draw();
   }
 }
@@ -13,18 +13,31 @@ struct PickItem {
   std::int64_t last_used = 0;
   int count = 0;
   std::string host;
+  std::string hostname;
   std::string port;
   std::string jump;
   std::string identity;
+  std::int64_t connect_ms = -1;
+  std::string status;
 };
 
 struct PickUiConfig {
   bool allow_alias_edit = false;
   bool allow_display_toggle = true;
   bool allow_delete = false;
+  bool allow_mark = false;
   bool show_alias = false;
 };
 
+enum class PickOrder {
+  kRecent,
+  kCount,
+  kFrecency,
+  kName,
+  kJump,
+  kFast,
+};
+
 enum class PickResult {
   kSelected,
   kCanceled,
@@ -35,9 +48,14 @@ enum class PickResult {
 using AliasUpdateFn =
     std::function<bool(const PickItem& item, const std::string& alias, std::string* err)>;
 
+std::vector<std::size_t> BuildPickOrder(const std::vector<PickItem>& items,
+                                        PickOrder order,
+                                        std::int64_t now);
+
 PickResult RunPickTui(std::vector<PickItem>& items,
                       const std::string& title,
                       std::size_t* index,
+                      std::vector<std::size_t>* marked,
                       const PickUiConfig& config,
                       const AliasUpdateFn& alias_update,
                       std::string* err);
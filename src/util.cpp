@@ -1,14 +1,17 @@
 #include "util.h"
 
 #include <cerrno>
+#include <charconv>
 #include <climits>
 #include <cstdlib>
 #include <cstring>
 #include <fcntl.h>
 #include <sys/file.h>
+#include <sys/syscall.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <utility>
+#include <vector>
 
 namespace {
 
@@ -38,6 +41,95 @@ bool MkdirIfMissing(const std::string& path, std::string* err) {
   return false;
 }
 
+struct CodepointRange {
+  char32_t first;
+  char32_t last;
+};
+
+// Zero-width combining marks and joiners.
+const CodepointRange kZeroWidth[] = {
+    {0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x0610, 0x061A},
+    {0x064B, 0x065F}, {0x200B, 0x200F}, {0x202A, 0x202E}, {0x2060, 0x2064},
+    {0x20D0, 0x20FF}, {0xFE00, 0xFE0F}, {0xFE20, 0xFE2F}, {0xFEFF, 0xFEFF},
+};
+
+// East Asian Wide and Fullwidth blocks, rendered in two terminal columns.
+const CodepointRange kWide[] = {
+    {0x1100, 0x115F},   {0x2E80, 0x303E},   {0x3041, 0x33FF},   {0x3400, 0x4DBF},
+    {0x4E00, 0x9FFF},   {0xA000, 0xA4CF},   {0xA960, 0xA97F},   {0xAC00, 0xD7A3},
+    {0xF900, 0xFAFF},   {0xFE10, 0xFE19},   {0xFE30, 0xFE6F},   {0xFF00, 0xFF60},
+    {0xFFE0, 0xFFE6},   {0x1F300, 0x1F64F}, {0x1F900, 0x1F9FF}, {0x20000, 0x2FFFD},
+    {0x30000, 0x3FFFD},
+};
+
+template <std::size_t N>
+bool InRanges(const CodepointRange (&ranges)[N], char32_t cp) {
+  if (cp < ranges[0].first || cp > ranges[N - 1].last) {
+    return false;
+  }
+  for (const auto& r : ranges) {
+    if (cp < r.first) {
+      return false;
+    }
+    if (cp <= r.last) {
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t CodepointWidth(char32_t cp) {
+  if (cp < 0x300) {
+    return 1;
+  }
+  if (InRanges(kZeroWidth, cp)) {
+    return 0;
+  }
+  if (InRanges(kWide, cp)) {
+    return 2;
+  }
+  return 1;
+}
+
+// Decodes one UTF-8 sequence at s[*i] and advances *i. Malformed bytes are
+// consumed one at a time and reported as U+FFFD so they still take a column.
+char32_t DecodeUtf8(const std::string& s, size_t* i) {
+  unsigned char c = static_cast<unsigned char>(s[*i]);
+  size_t len = 0;
+  char32_t cp = 0;
+  if (c < 0x80) {
+    ++*i;
+    return c;
+  }
+  if ((c & 0xE0) == 0xC0) {
+    len = 2;
+    cp = c & 0x1F;
+  } else if ((c & 0xF0) == 0xE0) {
+    len = 3;
+    cp = c & 0x0F;
+  } else if ((c & 0xF8) == 0xF0) {
+    len = 4;
+    cp = c & 0x07;
+  } else {
+    ++*i;
+    return 0xFFFD;
+  }
+  if (*i + len > s.size()) {
+    ++*i;
+    return 0xFFFD;
+  }
+  for (size_t k = 1; k < len; ++k) {
+    unsigned char cc = static_cast<unsigned char>(s[*i + k]);
+    if ((cc & 0xC0) != 0x80) {
+      ++*i;
+      return 0xFFFD;
+    }
+    cp = (cp << 6) | (cc & 0x3F);
+  }
+  *i += len;
+  return cp;
+}
+
 }  // namespace
 
 std::string GetDataDir(std::string* err) {
@@ -55,6 +147,68 @@ std::string GetDataDir(std::string* err) {
   return std::string();
 }
 
+std::string GetEventLogPath(std::string* err) {
+  std::string dir = GetDataDir(err);
+  if (dir.empty()) {
+    return std::string();
+  }
+  return dir + "/events.log";
+}
+
+std::string GetSegmentDir(std::string* err) {
+  std::string dir = GetDataDir(err);
+  if (dir.empty()) {
+    return std::string();
+  }
+  return dir + "/segments";
+}
+
+std::string GetRemoteHistoryPath(std::string* err) {
+  std::string dir = GetDataDir(err);
+  if (dir.empty()) {
+    return std::string();
+  }
+  return dir + "/remote.sum";
+}
+
+std::string GetOriginPath(std::string* err) {
+  std::string dir = GetDataDir(err);
+  if (dir.empty()) {
+    return std::string();
+  }
+  return dir + "/origin";
+}
+
+std::vector<std::string> GetHistoryLayerPaths() {
+  std::vector<std::string> paths;
+  const char* env = std::getenv("SSHTAB_LAYERS");
+  if (!env) {
+    const char* shared = "/etc/sshtab/shared.log";
+    struct stat st;
+    if (stat(shared, &st) == 0) {
+      paths.emplace_back(shared);
+    }
+    return paths;
+  }
+  std::string list = env;
+  std::size_t pos = 0;
+  while (pos <= list.size()) {
+    std::size_t colon = list.find(':', pos);
+    if (colon == std::string::npos) {
+      colon = list.size();
+    }
+    if (colon > pos) {
+      paths.push_back(list.substr(pos, colon - pos));
+    }
+    pos = colon + 1;
+  }
+  return paths;
+}
+
+std::string GetLayerAliasPath(const std::string& layer) {
+  return layer + ".aliases";
+}
+
 std::string GetHistoryPath(std::string* err) {
   std::string dir = GetDataDir(err);
   if (dir.empty()) {
@@ -155,6 +309,61 @@ std::string CollapseSpaces(const std::string& s) {
   return TrimSpace(out);
 }
 
+std::string LowerAscii(std::string s) {
+  for (char& c : s) {
+    if (c >= 'A' && c <= 'Z') {
+      c = static_cast<char>(c - 'A' + 'a');
+    }
+  }
+  return s;
+}
+
+bool ParseInt64(std::string_view text, std::int64_t* out) {
+  auto result = std::from_chars(text.data(), text.data() + text.size(), *out, 10);
+  return !text.empty() && result.ec == std::errc() && result.ptr == text.data() + text.size();
+}
+
+size_t DisplayWidth(const std::string& s) {
+  size_t width = 0;
+  size_t i = 0;
+  while (i < s.size()) {
+    width += CodepointWidth(DecodeUtf8(s, &i));
+  }
+  return width;
+}
+
+std::string TruncateDisplay(const std::string& s, size_t width, size_t* out_width) {
+  size_t total = DisplayWidth(s);
+  if (total <= width) {
+    if (out_width) {
+      *out_width = total;
+    }
+    return s;
+  }
+  const size_t ellipsis = width > 3 ? 3 : 0;
+  const size_t budget = width - ellipsis;
+  size_t used = 0;
+  size_t i = 0;
+  while (i < s.size()) {
+    size_t next = i;
+    size_t w = CodepointWidth(DecodeUtf8(s, &next));
+    if (used + w > budget) {
+      break;
+    }
+    used += w;
+    i = next;
+  }
+  std::string out = s.substr(0, i);
+  if (ellipsis > 0) {
+    out += "...";
+    used += ellipsis;
+  }
+  if (out_width) {
+    *out_width = used;
+  }
+  return out;
+}
+
 std::string Base64Encode(const std::string& input) {
   static const char kTable[] =
       "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
@@ -262,6 +471,42 @@ bool Base64Decode(const std::string& input, std::string* output, std::string* er
   return true;
 }
 
+void PutU32(std::string* out, std::uint32_t v) {
+  out->append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+void PutU64(std::string* out, std::uint64_t v) {
+  out->append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+void PutI64(std::string* out, std::int64_t v) {
+  out->append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+void PutStr(std::string* out, std::string_view s) {
+  PutU32(out, static_cast<std::uint32_t>(s.size()));
+  out->append(s);
+}
+
+bool BinaryReader::Str(std::string* s) {
+  std::uint32_t len = 0;
+  if (!U32(&len) || len > size_ - pos_) {
+    return false;
+  }
+  s->assign(data_ + pos_, len);
+  pos_ += len;
+  return true;
+}
+
+bool BinaryReader::Raw(void* out, std::size_t n) {
+  if (n > size_ - pos_) {
+    return false;
+  }
+  std::memcpy(out, data_ + pos_, n);
+  pos_ += n;
+  return true;
+}
+
 ScopedFd::~ScopedFd() { reset(); }
 
 ScopedFd::ScopedFd(ScopedFd&& other) noexcept : fd_(other.fd_) { other.fd_ = -1; }
@@ -416,6 +661,29 @@ std::string DirnameFromPath(const std::string& path) {
   return path.substr(0, slash);
 }
 
+void RedirectStdioToNull() {
+  int null_fd = open("/dev/null", O_RDWR);
+  if (null_fd < 0) {
+    return;
+  }
+  dup2(null_fd, 0);
+  dup2(null_fd, 1);
+  dup2(null_fd, 2);
+  if (null_fd > 2) {
+    close(null_fd);
+  }
+}
+
+int OpenPidFd(pid_t pid) {
+#ifdef SYS_pidfd_open
+  return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#else
+  (void)pid;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
 bool FsyncDir(const std::string& dir, std::string* err) {
   int flags = O_RDONLY;
 #ifdef O_DIRECTORY
@@ -440,3 +708,112 @@ bool FsyncDir(const std::string& dir, std::string* err) {
   }
   return true;
 }
+
+namespace {
+
+// Creates a temporary file next to path, setting *tmp_path to its name.
+// Returns its fd, or -1 on failure.
+int OpenTempFile(const std::string& path, std::string* tmp_path, std::string* err) {
+  std::string dir = DirnameFromPath(path);
+  if (dir.empty() || !EnsureDir(dir, err)) {
+    return -1;
+  }
+  std::string tmpl = path + ".tmp.XXXXXX";
+  std::vector<char> tmp_buf(tmpl.begin(), tmpl.end());
+  tmp_buf.push_back('\0');
+  int tmp_fd = mkstemp(tmp_buf.data());
+  if (tmp_fd < 0) {
+    if (err) {
+      *err = std::string("mkstemp failed: ") + std::strerror(errno);
+    }
+    return -1;
+  }
+  *tmp_path = tmp_buf.data();
+  return tmp_fd;
+}
+
+bool SyncFd(int fd, std::string* err) {
+  if (fsync(fd) != 0) {
+    if (err) {
+      *err = std::string("fsync failed: ") + std::strerror(errno);
+    }
+    return false;
+  }
+  return true;
+}
+
+// Writes data to a synced temporary file next to path and returns its name,
+// or an empty string on failure.
+std::string WriteTempFile(const std::string& path, const std::string& data, std::string* err) {
+  std::string tmp_path;
+  ScopedFd tmp_fd(OpenTempFile(path, &tmp_path, err));
+  if (tmp_fd.get() < 0) {
+    return std::string();
+  }
+  if (!WriteAllToFd(tmp_fd.get(), data, err) || !SyncFd(tmp_fd.get(), err)) {
+    unlink(tmp_path.c_str());
+    return std::string();
+  }
+  return tmp_path;
+}
+
+}  // namespace
+
+AtomicFileWriter::~AtomicFileWriter() {
+  if (!tmp_path_.empty()) {
+    unlink(tmp_path_.c_str());
+  }
+}
+
+bool AtomicFileWriter::Open(std::string* err) {
+  fd_.reset(OpenTempFile(path_, &tmp_path_, err));
+  return fd_.get() >= 0;
+}
+
+bool AtomicFileWriter::Write(const std::string& data, std::string* err) {
+  return WriteAllToFd(fd_.get(), data, err);
+}
+
+bool AtomicFileWriter::Commit(std::string* err) {
+  if (!SyncFd(fd_.get(), err)) {
+    return false;
+  }
+  fd_.reset();
+  if (rename(tmp_path_.c_str(), path_.c_str()) != 0) {
+    if (err) {
+      *err = std::string("rename failed: ") + std::strerror(errno);
+    }
+    return false;
+  }
+  tmp_path_.clear();
+  return FsyncDir(DirnameFromPath(path_), err);
+}
+
+bool WriteFileAtomically(const std::string& path, const std::string& data, std::string* err) {
+  AtomicFileWriter writer(path);
+  return writer.Open(err) && writer.Write(data, err) && writer.Commit(err);
+}
+
+bool CreateFileAtomically(const std::string& path, const std::string& data, bool* created, std::string* err) {
+  *created = false;
+  std::string tmp_path = WriteTempFile(path, data, err);
+  if (tmp_path.empty()) {
+    return false;
+  }
+  // link() rather than rename() so a file another process created
+  // meanwhile is never replaced.
+  int rc = link(tmp_path.c_str(), path.c_str());
+  int link_errno = errno;
+  unlink(tmp_path.c_str());
+  if (rc != 0) {
+    if (link_errno == EEXIST) {
+      return true;
+    }
+    if (err) {
+      *err = std::string("link failed: ") + std::strerror(link_errno);
+    }
+    return false;
+  }
+  *created = true;
+  return FsyncDir(DirnameFromPath(path), err);
+}
@@ -1,9 +1,27 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <utility>
+#include <vector>
 
 std::string GetDataDir(std::string* err);
+std::string GetEventLogPath(std::string* err);
+std::string GetSegmentDir(std::string* err);
+// Aggregates imported from other machines; see sync.h.
+std::string GetRemoteHistoryPath(std::string* err);
+std::string GetOriginPath(std::string* err);
+// Read-only team history layers: the event logs listed in SSHTAB_LAYERS,
+// colon-separated, or else /etc/sshtab/shared.log if it exists. An empty
+// SSHTAB_LAYERS turns layers off.
+std::vector<std::string> GetHistoryLayerPaths();
+// <layer>.aliases: a layer's ssh aliases, in the aliases.log format.
+std::string GetLayerAliasPath(const std::string& layer);
+// Logs older versions write instead of events.log; only read to fold them
+// into it.
 std::string GetHistoryPath(std::string* err);
 std::string GetCommandHistoryPath(std::string* err);
 std::string GetAliasPath(std::string* err);
@@ -12,10 +30,59 @@ bool EnsureDir(const std::string& path, std::string* err);
 
 std::string TrimSpace(const std::string& s);
 std::string CollapseSpaces(const std::string& s);
+std::string LowerAscii(std::string s);
+// Parses a whole decimal string; fails on empty input, junk or overflow.
+bool ParseInt64(std::string_view text, std::int64_t* out);
+
+// Calls fn with each line of content, without its newline.
+template <typename Fn>
+void ForEachLine(std::string_view content, Fn fn) {
+  std::size_t pos = 0;
+  while (pos < content.size()) {
+    std::size_t nl = content.find('\n', pos);
+    std::size_t end = nl == std::string_view::npos ? content.size() : nl;
+    fn(content.substr(pos, end - pos));
+    pos = end + 1;
+  }
+}
+
+std::size_t DisplayWidth(const std::string& s);
+std::string TruncateDisplay(const std::string& s, std::size_t width, std::size_t* out_width);
 
 std::string Base64Encode(const std::string& input);
 bool Base64Decode(const std::string& input, std::string* output, std::string* err);
 
+// Fields of the binary files sshtab keeps under its data directory:
+// snapshots, archives, layer indexes and the entry ID index. Integers are
+// fixed-width in host byte order, since those files are only read on the
+// machine that wrote them; a str is a u32 byte length followed by the
+// bytes.
+void PutU32(std::string* out, std::uint32_t v);
+void PutU64(std::string* out, std::uint64_t v);
+void PutI64(std::string* out, std::int64_t v);
+void PutStr(std::string* out, std::string_view s);
+
+// Reads fields written by the Put functions from a buffer it does not own.
+// Every read fails once the buffer runs out.
+class BinaryReader {
+ public:
+  BinaryReader(const char* data, std::size_t size, std::size_t pos = 0) : data_(data), size_(size), pos_(pos) {}
+
+  bool U32(std::uint32_t* v) { return Raw(v, sizeof(*v)); }
+  bool U64(std::uint64_t* v) { return Raw(v, sizeof(*v)); }
+  bool I64(std::int64_t* v) { return Raw(v, sizeof(*v)); }
+  bool Str(std::string* s);
+  bool Raw(void* out, std::size_t n);
+
+  std::size_t pos() const { return pos_; }
+  bool AtEnd() const { return pos_ == size_; }
+
+ private:
+  const char* data_;
+  std::size_t size_;
+  std::size_t pos_;
+};
+
 class ScopedFd {
  public:
   explicit ScopedFd(int fd = -1) : fd_(fd) {}
@@ -53,4 +120,33 @@ class FlockGuard {
 bool ReadAllFromFd(int fd, std::string* out, std::string* err);
 bool WriteAllToFd(int fd, const std::string& data, std::string* err);
 std::string DirnameFromPath(const std::string& path);
+// Points fds 0, 1 and 2 at /dev/null, for a child that runs detached from
+// the terminal.
+void RedirectStdioToNull();
+// Opens a pidfd for child pid, which polls readable once the child exits.
+// Returns -1 where the kernel has no pidfd_open (before Linux 5.3).
+int OpenPidFd(pid_t pid);
 bool FsyncDir(const std::string& dir, std::string* err);
+// Replaces path with data through a synced temporary file.
+bool WriteFileAtomically(const std::string& path, const std::string& data, std::string* err);
+// Replaces path like WriteFileAtomically, with the data written in pieces;
+// a writer destroyed before Commit leaves path alone.
+class AtomicFileWriter {
+ public:
+  explicit AtomicFileWriter(std::string path) : path_(std::move(path)) {}
+  ~AtomicFileWriter();
+  AtomicFileWriter(const AtomicFileWriter&) = delete;
+  AtomicFileWriter& operator=(const AtomicFileWriter&) = delete;
+
+  bool Open(std::string* err);
+  bool Write(const std::string& data, std::string* err);
+  bool Commit(std::string* err);
+
+ private:
+  std::string path_;
+  std::string tmp_path_;
+  ScopedFd fd_;
+};
+// Like WriteFileAtomically, but leaves a path that already exists alone;
+// *created tells whether this call created it.
+bool CreateFileAtomically(const std::string& path, const std::string& data, bool* created, std::string* err);
@@ -1,17 +1,41 @@
 #include "alias.h"
+#include "archive.h"
+#include "control.h"
+#include "entry_ids.h"
+#include "fanout.h"
+#include "hash.h"
 #include "history.h"
+#include "layers.h"
+#include "lz.h"
 #include "normalize.h"
+#include "probe.h"
+#include "session.h"
+#include "shell_init.h"
+#include "snapshot.h"
+#include "ssh_config.h"
+#include "ssh_exec.h"
+#include "sync.h"
 #include "tokenize.h"
+#include "topk.h"
+#include "tui.h"
 #include "util.h"
 
+#include <algorithm>
 #include <cerrno>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <ftw.h>
 #include <iostream>
+#include <netinet/in.h>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <vector>
 
@@ -49,21 +73,17 @@ std::string MakeTempDir() {
   return std::string(dir);
 }
 
+int RemoveTreeEntry(const char* path, const struct stat*, int, struct FTW*) {
+  remove(path);
+  return 0;
+}
+
+// Removes dir and everything the test left in it.
 void CleanupDir(const std::string& dir) {
   if (dir.empty()) {
     return;
   }
-  std::string data_dir = dir + "/sshtab";
-  std::string history = data_dir + "/history.log";
-  std::string commands = data_dir + "/commands.log";
-  std::string aliases = data_dir + "/aliases.log";
-  std::string command_aliases = data_dir + "/aliases_cmd.log";
-  unlink(history.c_str());
-  unlink(commands.c_str());
-  unlink(aliases.c_str());
-  unlink(command_aliases.c_str());
-  rmdir(data_dir.c_str());
-  rmdir(dir.c_str());
+  nftw(dir.c_str(), RemoveTreeEntry, 16, FTW_DEPTH | FTW_PHYS);
 }
 
 void TestBase64() {
@@ -78,6 +98,151 @@ void TestBase64() {
   EXPECT_FALSE(Base64Decode("!!!!", &out, &err));
 }
 
+void TestFlatHashIndex() {
+  EXPECT_TRUE(HashBytes("ssh host") == HashBytes(std::string("ssh host")));
+  EXPECT_TRUE(HashBytes("ssh host1") != HashBytes("ssh host2"));
+  EXPECT_TRUE(HashBytes("") != HashBytes(std::string(1, '\0')));
+
+  // Every key shares one hash, so lookups must fall back to full compares.
+  std::vector<std::string> keys;
+  FlatHashIndex index;
+  for (int i = 0; i < 100; ++i) {
+    std::string key = "k" + std::to_string(i);
+    bool inserted = false;
+    std::uint32_t at = index.FindOrInsert(
+        42, static_cast<std::uint32_t>(keys.size()), [&](std::uint32_t j) { return keys[j] == key; }, &inserted);
+    EXPECT_TRUE(inserted);
+    EXPECT_EQ(at, static_cast<std::uint32_t>(i));
+    keys.push_back(key);
+  }
+  EXPECT_EQ(index.size(), static_cast<size_t>(100));
+  bool inserted = true;
+  EXPECT_EQ(index.FindOrInsert(42, 100, [&](std::uint32_t j) { return keys[j] == "k57"; }, &inserted),
+            static_cast<std::uint32_t>(57));
+  EXPECT_FALSE(inserted);
+  EXPECT_EQ(index.Find(42, [&](std::uint32_t j) { return keys[j] == "k99"; }), static_cast<std::uint32_t>(99));
+  EXPECT_EQ(index.Find(42, [&](std::uint32_t j) { return keys[j] == "nope"; }), FlatHashIndex::kNone);
+  EXPECT_EQ(index.Find(7, [](std::uint32_t) { return true; }), FlatHashIndex::kNone);
+}
+
+void TestLzCodec() {
+  std::string random;
+  std::uint32_t seed = 12345;
+  for (int i = 0; i < 5000; ++i) {
+    seed = seed * 1103515245u + 12345u;
+    random.push_back(static_cast<char>(seed >> 24));
+  }
+  std::string lines;
+  for (int i = 0; i < 2000; ++i) {
+    lines += std::to_string(1580000000 + i) + "\t0\ts\tc3NoIGhvc3Q=\n";
+  }
+  std::vector<std::string> inputs = {"", "x", "abcd", std::string(100000, 'a'), random, lines};
+  for (const auto& input : inputs) {
+    std::string block = LzCompress(input);
+    std::string out;
+    std::string err;
+    EXPECT_TRUE(LzDecompress(block, input.size(), &out, &err));
+    EXPECT_EQ(out, input);
+  }
+  EXPECT_TRUE(LzCompress(lines).size() < lines.size() / 4);
+
+  std::string block = LzCompress(lines);
+  std::string out;
+  std::string err;
+  EXPECT_FALSE(LzDecompress(block.substr(0, block.size() / 2), lines.size(), &out, &err));
+  EXPECT_FALSE(LzDecompress(block, lines.size() + 1, &out, &err));
+  EXPECT_TRUE(out.empty());
+  // A back-reference before the start of the output.
+  EXPECT_FALSE(LzDecompress(std::string("\x10" "a" "\x05\x00", 4), 5, &out, &err));
+}
+
+void TestArchive() {
+  std::string temp = MakeTempDir();
+  EXPECT_FALSE(temp.empty());
+  if (temp.empty()) {
+    return;
+  }
+  std::string path = temp + "/segment.lz";
+  std::string content;
+  for (int i = 0; i < 20000; ++i) {
+    content += std::to_string(1580000000 + i) + "\t0\ts\t" + Base64Encode("ssh host" + std::to_string(i % 37)) +
+               "\n";
+  }
+  std::string err;
+  EXPECT_TRUE(WriteArchive(path, content, &err));
+  std::string read;
+  EXPECT_TRUE(ReadArchive(path, &read, &err));
+  EXPECT_EQ(read, content);
+
+  // A narrow range decompresses only the blocks around it, far fewer lines
+  // than the archive holds, and still every line inside it.
+  std::size_t lines = 0;
+  std::size_t in_range = 0;
+  EXPECT_TRUE(StreamArchiveLines(path, 1580019990, 1580019999, [&](std::string_view line) {
+    ++lines;
+    if (line.compare(0, 10, "1580019990") >= 0) {
+      ++in_range;
+    }
+  }, &err));
+  EXPECT_EQ(in_range, static_cast<size_t>(10));
+  EXPECT_TRUE(lines < 10000);
+  lines = 0;
+  EXPECT_TRUE(StreamArchiveLines(path, 0, 1000, [&](std::string_view) { ++lines; }, &err));
+  EXPECT_EQ(lines, static_cast<size_t>(0));
+
+  EXPECT_TRUE(WriteArchive(path, "", &err));
+  EXPECT_TRUE(ReadArchive(path, &read, &err));
+  EXPECT_TRUE(read.empty());
+  // Not an archive.
+  FILE* f = std::fopen(path.c_str(), "w");
+  if (f) {
+    std::fputs("1580000000\t0\ts\tc3No\n", f);
+    std::fclose(f);
+  }
+  EXPECT_FALSE(ReadArchive(path, &read, &err));
+  unlink(path.c_str());
+  rmdir(temp.c_str());
+}
+
+void TestSpaceSaving() {
+  SpaceSaving sketch(3);
+  for (int i = 0; i < 10; ++i) {
+    sketch.Add("heavy", i);
+  }
+  sketch.Add("a", 20);
+  sketch.Add("b", 21);
+  // "c" evicts the smallest counter and inherits its count as error.
+  SpaceSaving::Counter& c = sketch.Add("c", 22);
+  EXPECT_EQ(c.count, 2);
+  EXPECT_EQ(c.error, 1);
+  EXPECT_EQ(sketch.size(), static_cast<size_t>(3));
+  auto top = sketch.Top(1);
+  EXPECT_EQ(top.size(), static_cast<size_t>(1));
+  if (!top.empty()) {
+    EXPECT_EQ(top[0].key, "heavy");
+    EXPECT_EQ(top[0].count, 10);
+    EXPECT_EQ(top[0].error, 0);
+    EXPECT_EQ(top[0].last_used, 9);
+  }
+
+  // A key above n / capacity is always monitored and never undercounted.
+  SpaceSaving stream(8);
+  int heavy = 0;
+  for (int i = 0; i < 1000; ++i) {
+    if (i % 4 == 0) {
+      stream.Add("hot", i);
+      ++heavy;
+    } else {
+      stream.Add("cold" + std::to_string(i), i);
+    }
+  }
+  top = stream.Top(1);
+  if (!top.empty()) {
+    EXPECT_EQ(top[0].key, "hot");
+    EXPECT_TRUE(top[0].count >= heavy && top[0].count - top[0].error <= heavy);
+  }
+}
+
 void TestNormalize() {
   std::string out;
   EXPECT_TRUE(NormalizeSshCommand("ssh user@host", &out));
@@ -87,6 +252,27 @@ void TestNormalize() {
   EXPECT_FALSE(NormalizeSshCommand("scp host", &out));
   EXPECT_EQ(ExtractArgsFromCommand("ssh user@host"), "user@host");
   EXPECT_EQ(ExtractArgsFromCommand("ssh"), "");
+
+  EXPECT_EQ(SshTargetKey("-p 2222 u@h"), "-p 2222 u@h");
+  EXPECT_EQ(SshTargetKey("u@h -p 2222"), "-p 2222 u@h");
+  EXPECT_EQ(SshTargetKey("-p2222 -l u h"), "-p 2222 u@h");
+  EXPECT_EQ(SshTargetKey("ssh://u@h:2222"), "-p 2222 u@h");
+  EXPECT_EQ(SshTargetKey("-vA -o 'Port = 1' h"), "-A -o port=1 -v h");
+  EXPECT_EQ(SshTargetKey("-L 1:a:1 h -L 2:b:2 uptime -l"), "-L 1:a:1 -L 2:b:2 h uptime -l");
+  EXPECT_EQ(SshTargetKey("-i 'id file' h -- -x"), "-i 'id file' h -- -x");
+  EXPECT_EQ(SshTargetKey("b@h -l a"), "b@h");
+  EXPECT_EQ(SshTargetKey("h  -p"), "h -p");
+  EXPECT_EQ(SshCommandKey("ssh u@h -p 22"), "ssh -p 22 u@h");
+  EXPECT_EQ(SshCommandKey("ls -la"), "ls -la");
+
+  SshTarget target;
+  EXPECT_TRUE(ParseSshArgs("-J jump -p 22 -- u@h ls -l", &target, &out));
+  EXPECT_EQ(target.user, "u");
+  EXPECT_EQ(target.host, "h");
+  EXPECT_EQ(target.port, "22");
+  EXPECT_EQ(target.options.size(), static_cast<size_t>(1));
+  EXPECT_EQ(target.command.size(), static_cast<size_t>(2));
+  EXPECT_FALSE(ParseSshArgs("-p 22", &target, &out));
 }
 
 void TestTokenize() {
@@ -109,6 +295,78 @@ void TestTokenize() {
 
   EXPECT_TRUE(ContainsControlChars(std::string("a\nb")));
   EXPECT_TRUE(ContainsForbiddenMetachars("a|b"));
+
+  ArgTokens tokens;
+  EXPECT_TRUE(TokenizeArgsInto("-i 'id file' a\\ b \"x\\\"y\" '' z", true, &tokens, &err));
+  EXPECT_EQ(tokens.size(), static_cast<size_t>(5));
+  EXPECT_EQ(tokens[0], "-i");
+  EXPECT_EQ(tokens[1], "id file");
+  EXPECT_EQ(tokens[2], "a b");
+  EXPECT_EQ(tokens[3], "x\"y");
+  EXPECT_EQ(tokens[4], "z");
+  EXPECT_TRUE(TokenizeArgs("-i 'id file' a\\ b \"x\\\"y\" '' z", &out, &err));
+  EXPECT_TRUE(out == tokens.ToStrings());
+
+  EXPECT_FALSE(TokenizeArgsInto("host 'a;b'", true, &tokens, &err));
+  EXPECT_TRUE(tokens.error == TokenizeError::kMetachar);
+  EXPECT_EQ(tokens.error_pos, static_cast<size_t>(7));
+  EXPECT_FALSE(TokenizeArgsInto(std::string("host\tx"), true, &tokens, &err));
+  EXPECT_TRUE(tokens.error == TokenizeError::kControlChar);
+  EXPECT_EQ(tokens.error_pos, static_cast<size_t>(4));
+  EXPECT_FALSE(TokenizeArgsInto("host \\$", true, &tokens, &err));
+  EXPECT_EQ(tokens.error_pos, static_cast<size_t>(6));
+  EXPECT_FALSE(TokenizeArgsInto("a \"b c", true, &tokens, &err));
+  EXPECT_TRUE(tokens.error == TokenizeError::kUnterminatedQuote);
+  EXPECT_EQ(tokens.error_pos, static_cast<size_t>(2));
+  EXPECT_TRUE(TokenizeArgsInto("a;b", false, &tokens, &err));
+  EXPECT_EQ(tokens.size(), static_cast<size_t>(1));
+
+  size_t pos = 0;
+  EXPECT_TRUE(FindForbiddenChar("echo hi > x", &pos) == TokenizeError::kMetachar);
+  EXPECT_EQ(pos, static_cast<size_t>(8));
+  EXPECT_TRUE(FindForbiddenChar("echo hi", &pos) == TokenizeError::kNone);
+}
+
+void TestDisplayWidth() {
+  std::size_t width = 0;
+  EXPECT_EQ(DisplayWidth("ssh host"), static_cast<size_t>(8));
+  EXPECT_EQ(DisplayWidth("\xe6\x9c\x8d\xe5\x8a\xa1\xe5\x99\xa8"), static_cast<size_t>(6));
+  EXPECT_EQ(DisplayWidth("e\xcc\x81"), static_cast<size_t>(1));
+  EXPECT_EQ(TruncateDisplay("abcdefgh", 6, &width), "abc...");
+  EXPECT_EQ(width, static_cast<size_t>(6));
+  EXPECT_EQ(TruncateDisplay("\xe6\x9c\x8d\xe5\x8a\xa1\xe5\x99\xa8x", 6, &width),
+            "\xe6\x9c\x8d...");
+  EXPECT_EQ(width, static_cast<size_t>(5));
+  EXPECT_EQ(TruncateDisplay("\xe6\x9c\x8d\xe5\x8a\xa1", 3, &width), "\xe6\x9c\x8d");
+  EXPECT_EQ(width, static_cast<size_t>(2));
+  EXPECT_EQ(TruncateDisplay("short", 10, &width), "short");
+}
+
+void TestPickOrder() {
+  const std::int64_t now = 10000000;
+  std::vector<PickItem> items(3);
+  items[0].display = "ssh zeta";
+  items[0].host = "zeta";
+  items[0].last_used = now - 10;
+  items[0].count = 1;
+  items[1].display = "ssh alpha";
+  items[1].host = "alpha";
+  items[1].jump = "bastion";
+  items[1].last_used = now - 7200;
+  items[1].count = 5;
+  items[2].display = "ssh mid";
+  items[2].alias = "Beta";
+  items[2].last_used = now - 30 * 86400;
+  items[2].count = 3;
+
+  EXPECT_EQ(BuildPickOrder(items, PickOrder::kRecent, now), (std::vector<size_t>{0, 1, 2}));
+  EXPECT_EQ(BuildPickOrder(items, PickOrder::kCount, now), (std::vector<size_t>{1, 2, 0}));
+  EXPECT_EQ(BuildPickOrder(items, PickOrder::kFrecency, now), (std::vector<size_t>{1, 0, 2}));
+  EXPECT_EQ(BuildPickOrder(items, PickOrder::kName, now), (std::vector<size_t>{1, 2, 0}));
+  EXPECT_EQ(BuildPickOrder(items, PickOrder::kJump, now), (std::vector<size_t>{0, 2, 1}));
+  items[0].connect_ms = 80;
+  items[2].connect_ms = 12;
+  EXPECT_EQ(BuildPickOrder(items, PickOrder::kFast, now), (std::vector<size_t>{2, 0, 1}));
 }
 
 void TestHistoryAndAlias() {
@@ -145,7 +403,111 @@ void TestHistoryAndAlias() {
     EXPECT_EQ(entries[0].command, "ssh host1");
   }
 
-  std::unordered_map<std::string, std::string> aliases;
+  EXPECT_TRUE(AppendHistory("ssh host3", 0, &err));
+  EXPECT_TRUE(AppendHistory("ssh host4", 0, &err));
+  EXPECT_TRUE(AppendHistory("ssh host3", 0, &err));
+  EXPECT_TRUE(DeleteHistoryCommands({"ssh host3", "ssh host4", "ssh missing"}, &removed, &err));
+  EXPECT_EQ(removed, 3);
+  EXPECT_FALSE(DeleteHistoryCommands({"ssh missing"}, &removed, &err));
+  entries = LoadRecentUnique(10, &err);
+  EXPECT_EQ(entries.size(), static_cast<size_t>(1));
+
+  EXPECT_TRUE(AppendHistory("ssh old.example", 0, &err));
+  EXPECT_TRUE(AppendHistory("ssh old.example", 255, &err));
+  PruneOptions prune;
+  prune.match = [](const std::string& command) { return command == "ssh old.example"; };
+  prune.dry_run = true;
+  PruneStats prune_stats;
+  EXPECT_TRUE(PruneHistory(prune, &prune_stats, &err));
+  EXPECT_EQ(prune_stats.lines, static_cast<size_t>(2));
+  EXPECT_EQ(prune_stats.commands, static_cast<size_t>(1));
+  EXPECT_EQ(LoadRecentUnique(10, &err).size(), static_cast<size_t>(2));
+  prune.dry_run = false;
+  prune.min_count = 1;
+  EXPECT_TRUE(PruneHistory(prune, &prune_stats, &err));
+  EXPECT_EQ(prune_stats.lines, static_cast<size_t>(0));
+  prune.min_count = 2;
+  EXPECT_TRUE(PruneHistory(prune, &prune_stats, &err));
+  EXPECT_EQ(prune_stats.lines, static_cast<size_t>(2));
+  EXPECT_EQ(LoadRecentUnique(10, &err).size(), static_cast<size_t>(1));
+
+  ConnectTiming timing;
+  timing.duration_ms = 1000;
+  for (int ms : {40, 10, 900}) {
+    timing.first_byte_ms = ms;
+    EXPECT_TRUE(AppendTimedHistory("ssh timed", 0, timing, &err));
+  }
+  EXPECT_TRUE(AppendHistory("ssh timed", 0, &err));
+  entries = LoadRecentUnique(10, &err);
+  bool found_timed = false;
+  for (const auto& e : entries) {
+    if (e.command == "ssh timed") {
+      found_timed = true;
+      EXPECT_EQ(e.count, 4);
+      EXPECT_EQ(e.connect_samples, 3);
+      EXPECT_EQ(e.connect_ms, 40);
+    } else {
+      EXPECT_EQ(e.connect_ms, -1);
+    }
+  }
+  EXPECT_TRUE(found_timed);
+
+  auto frequent = LoadFrequentUnique(1, &err);
+  EXPECT_EQ(frequent.size(), static_cast<size_t>(1));
+  if (!frequent.empty()) {
+    EXPECT_EQ(frequent[0].command, "ssh timed");
+    EXPECT_EQ(frequent[0].count, 4);
+    EXPECT_EQ(frequent[0].count_error, 0);
+    EXPECT_EQ(frequent[0].connect_ms, 900);
+  }
+
+  // Spellings of one target share an entry, an alias and a deletion.
+  EXPECT_TRUE(AppendHistory("ssh -p 2222 u@dup", 0, &err));
+  EXPECT_TRUE(AppendHistory("ssh u@dup -p2222", 0, &err));
+  EXPECT_TRUE(AppendHistory("ssh -l u dup -p 2222", 0, &err));
+  int dup_count = 0;
+  for (const auto& e : LoadRecentUnique(10, &err)) {
+    if (SshCommandKey(e.command) == "ssh -p 2222 u@dup") {
+      dup_count += e.count;
+      EXPECT_EQ(e.count, 3);
+    }
+  }
+  EXPECT_EQ(dup_count, 3);
+  EXPECT_TRUE(SetAliasForArgs("u@dup -p 2222", "dup", &err));
+  AliasMap dup_aliases;
+  EXPECT_TRUE(LoadAliases(&dup_aliases, &err));
+  EXPECT_EQ(dup_aliases[SshTargetKey("-p2222 -l u dup")], "dup");
+
+  // Entries get IDs as they are recorded; new records and other spellings
+  // keep them.
+  std::vector<std::int64_t> ids;
+  EXPECT_TRUE(FindEntryIds({"ssh u@dup -p2222", "ssh timed"}, &ids, &err));
+  std::int64_t dup_id = ids[0];
+  std::int64_t timed_id = ids[1];
+  EXPECT_TRUE(dup_id >= 0 && timed_id >= 0 && dup_id != timed_id);
+  EXPECT_TRUE(AppendHistory("ssh newer", 0, &err));
+  EXPECT_TRUE(FindEntryIds({"ssh newer", "ssh timed", "ssh -l u -p 2222 dup", "ssh never"}, &ids, &err));
+  EXPECT_TRUE(ids[0] > dup_id);
+  EXPECT_EQ(ids[1], timed_id);
+  EXPECT_EQ(ids[2], dup_id);
+  EXPECT_EQ(ids[3], static_cast<std::int64_t>(-1));
+  std::string id_command;
+  EXPECT_TRUE(LookupEntryId(dup_id, &id_command, &err));
+  EXPECT_EQ(id_command, "ssh -p 2222 u@dup");
+  EXPECT_FALSE(LookupEntryId(99, &id_command, &err));
+
+  EXPECT_TRUE(DeleteHistoryCommand(id_command, &removed, &err));
+  EXPECT_EQ(removed, 3);
+  // A deleted entry's ID stops resolving until the target is back.
+  EXPECT_FALSE(LookupEntryId(dup_id, &id_command, &err));
+  EXPECT_TRUE(AppendHistory("ssh -p 2222 u@dup", 0, &err));
+  EXPECT_TRUE(LookupEntryId(dup_id, &id_command, &err));
+  EXPECT_TRUE(DeleteHistoryCommand(id_command, &removed, &err));
+  timing = ConnectTiming();
+  EXPECT_EQ(RunTimedSession({"sh", "-c", "exit 3"}, &timing, &err), 3);
+  EXPECT_TRUE(timing.duration_ms >= 0);
+
+  AliasMap aliases;
   EXPECT_TRUE(SetAliasForArgs("host1", "alias1", &err));
   EXPECT_TRUE(LoadAliases(&aliases, &err));
   EXPECT_EQ(aliases["host1"], "alias1");
@@ -173,7 +535,7 @@ void TestHistoryAndAlias() {
   EXPECT_TRUE(found_ssh);
   EXPECT_FALSE(found_bad);
 
-  std::unordered_map<std::string, std::string> command_aliases;
+  AliasMap command_aliases;
   EXPECT_TRUE(SetAliasForCommand("ls -la", "list", &err));
   EXPECT_TRUE(LoadCommandAliases(&command_aliases, &err));
   EXPECT_EQ(command_aliases["ls -la"], "list");
@@ -181,13 +543,939 @@ void TestHistoryAndAlias() {
   CleanupDir(temp);
 }
 
+void TestEntryIds() {
+  std::string temp = MakeTempDir();
+  EXPECT_FALSE(temp.empty());
+  if (temp.empty()) {
+    return;
+  }
+  setenv("XDG_DATA_HOME", temp.c_str(), 1);
+  std::string dir = temp + "/sshtab";
+  mkdir(dir.c_str(), 0700);
+  // History written before IDs existed.
+  FILE* f = std::fopen((dir + "/events.log").c_str(), "w");
+  if (f) {
+    std::fputs(("10\t0\ts\t" + Base64Encode("ssh a") + "\n20\t0\ts\t" + Base64Encode("ssh b") + "\n").c_str(), f);
+    std::fclose(f);
+  }
+
+  // Reading assigns nothing.
+  std::string err;
+  std::vector<std::int64_t> ids;
+  std::string command;
+  EXPECT_TRUE(FindEntryIds({"ssh a", "ssh b"}, &ids, &err));
+  EXPECT_EQ(ids[0], static_cast<std::int64_t>(-1));
+  EXPECT_FALSE(LookupEntryId(0, &command, &err));
+  EXPECT_FALSE(access((dir + "/ids.log").c_str(), F_OK) == 0);
+
+  // The first record gives the older history IDs too, most recent first.
+  EXPECT_TRUE(AppendHistory("ssh c", 0, &err));
+  EXPECT_TRUE(FindEntryIds({"ssh c", "ssh b", "ssh a"}, &ids, &err));
+  EXPECT_EQ(ids[0], static_cast<std::int64_t>(0));
+  EXPECT_EQ(ids[1], static_cast<std::int64_t>(1));
+  EXPECT_EQ(ids[2], static_cast<std::int64_t>(2));
+
+  // Enough new targets to grow the index.
+  std::vector<std::string> batch;
+  for (int i = 0; i < 100; ++i) {
+    batch.push_back("ssh host" + std::to_string(i));
+  }
+  EXPECT_TRUE(AppendHistoryBatch(batch, 0, &err));
+  EXPECT_TRUE(LookupEntryId(102, &command, &err));
+  EXPECT_EQ(command, "ssh host99");
+  EXPECT_TRUE(LookupEntryId(1, &command, &err));
+  EXPECT_EQ(command, "ssh b");
+  EXPECT_FALSE(LookupEntryId(103, &command, &err));
+
+  // Deleting retires the ID; recording the target again brings it back.
+  int removed = 0;
+  EXPECT_TRUE(DeleteHistoryCommand("ssh b", &removed, &err));
+  EXPECT_FALSE(LookupEntryId(1, &command, &err));
+  EXPECT_TRUE(FindEntryIds({"ssh b"}, &ids, &err));
+  EXPECT_EQ(ids[0], static_cast<std::int64_t>(-1));
+  EXPECT_TRUE(AppendHistory("ssh b", 0, &err));
+  EXPECT_TRUE(LookupEntryId(1, &command, &err));
+
+  // A lost index is rebuilt from ids.log with the same IDs.
+  unlink((dir + "/ids.idx").c_str());
+  EXPECT_TRUE(LookupEntryId(102, &command, &err));
+  EXPECT_TRUE(AppendHistory("ssh a", 0, &err));
+  EXPECT_TRUE(HaveEntryIdIndex());
+  EXPECT_TRUE(FindEntryIds({"ssh a", "ssh host0"}, &ids, &err));
+  EXPECT_EQ(ids[0], static_cast<std::int64_t>(2));
+  EXPECT_EQ(ids[1], static_cast<std::int64_t>(3));
+
+  // Pruning retires the IDs of what it removes.
+  PruneOptions options;
+  options.min_count = 2;
+  PruneStats stats;
+  EXPECT_TRUE(PruneHistory(options, &stats, &err));
+  EXPECT_FALSE(LookupEntryId(0, &command, &err));
+  EXPECT_TRUE(LookupEntryId(2, &command, &err));
+
+  CleanupDir(temp);
+}
+
+void TestMigrateLegacyHistory() {
+  std::string temp = MakeTempDir();
+  EXPECT_FALSE(temp.empty());
+  if (temp.empty()) {
+    return;
+  }
+  setenv("XDG_DATA_HOME", temp.c_str(), 1);
+  std::string dir = temp + "/sshtab";
+  mkdir(dir.c_str(), 0700);
+  auto write_file = [](const std::string& path, const std::string& content) {
+    FILE* f = std::fopen(path.c_str(), "w");
+    if (f) {
+      std::fputs(content.c_str(), f);
+      std::fclose(f);
+    }
+  };
+  // Older versions wrote each ssh connection to both logs.
+  std::string ssh_a = Base64Encode("ssh a");
+  write_file(dir + "/history.log", "10\t0\t" + ssh_a + "\t40\t900\n30\t0\t" + ssh_a + "\n");
+  write_file(dir + "/commands.log",
+             "10\t0\t" + ssh_a + "\n20\t0\t" + Base64Encode("ls") + "\n30\t0\t" + ssh_a + "\n");
+
+  std::string err;
+  HistoryViews views;
+  EXPECT_TRUE(LoadHistoryViews(0, &views, &err));
+  EXPECT_EQ(views.ssh.size(), static_cast<size_t>(1));
+  EXPECT_EQ(views.commands.size(), static_cast<size_t>(2));
+  if (!views.commands.empty()) {
+    EXPECT_EQ(views.commands[0].command, "ssh a");
+    EXPECT_EQ(views.commands[0].count, 2);
+    EXPECT_EQ(views.commands[0].connect_ms, 40);
+  }
+  struct stat st;
+  EXPECT_TRUE(stat((dir + "/history.log").c_str(), &st) == 0 && st.st_size == 0);
+  EXPECT_TRUE(stat((dir + "/commands.log.migrated").c_str(), &st) == 0);
+
+  // A shell still running an older version keeps writing the legacy logs;
+  // its records join on the next load.
+  write_file(dir + "/history.log", "40\t0\t" + ssh_a + "\n");
+  write_file(dir + "/commands.log", "40\t0\t" + ssh_a + "\n");
+  EXPECT_TRUE(LoadHistoryViews(0, &views, &err));
+  if (!views.ssh.empty()) {
+    EXPECT_EQ(views.ssh[0].count, 3);
+    EXPECT_EQ(views.ssh[0].last_used, static_cast<std::int64_t>(40));
+  }
+  EXPECT_EQ(views.commands.size(), static_cast<size_t>(2));
+  EXPECT_TRUE(stat((dir + "/commands.log").c_str(), &st) == 0 && st.st_size == 0);
+
+  int removed = 0;
+  EXPECT_TRUE(DeleteHistoryCommand("ssh a", &removed, &err));
+  EXPECT_EQ(removed, 3);
+  EXPECT_TRUE(LoadHistoryViews(0, &views, &err));
+  EXPECT_TRUE(views.ssh.empty());
+  EXPECT_EQ(views.commands.size(), static_cast<size_t>(1));
+
+  CleanupDir(temp);
+}
+
+std::vector<std::string> SegmentNames(const std::string& dir) {
+  std::vector<std::string> names;
+  if (DIR* d = opendir(dir.c_str())) {
+    while (struct dirent* entry = readdir(d)) {
+      if (entry->d_name[0] != '.') {
+        names.push_back(entry->d_name);
+      }
+    }
+    closedir(d);
+  }
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+void TestHistorySegments() {
+  std::string temp = MakeTempDir();
+  EXPECT_FALSE(temp.empty());
+  if (temp.empty()) {
+    return;
+  }
+  setenv("XDG_DATA_HOME", temp.c_str(), 1);
+  std::string dir = temp + "/sshtab";
+  mkdir(dir.c_str(), 0700);
+  // January 2020: the next append starts a new month and rolls the log.
+  std::string old_ssh = Base64Encode("ssh old");
+  FILE* f = std::fopen((dir + "/events.log").c_str(), "w");
+  if (f) {
+    std::fputs(("1580000000\t0\ts\t" + old_ssh + "\t30\t500\n1580000100\t0\ts\t" + old_ssh + "\n" +
+                "1580000200\t255\ts\t" + old_ssh + "\n1580000300\t0\tc\t" + Base64Encode("ls") + "\n")
+                   .c_str(),
+               f);
+    std::fclose(f);
+  }
+
+  std::string err;
+  EXPECT_TRUE(AppendHistory("ssh new", 0, &err));
+  auto names = SegmentNames(dir + "/segments");
+  EXPECT_EQ(names, (std::vector<std::string>{"1580000000-1580000300-0.lz", "1580000000-1580000300-0.sum"}));
+  std::string hot;
+  ScopedFd hot_fd(open((dir + "/events.log").c_str(), O_RDONLY));
+  EXPECT_TRUE(ReadAllFromFd(hot_fd.get(), &hot, &err));
+  EXPECT_EQ(static_cast<int>(std::count(hot.begin(), hot.end(), '\n')), 1);
+
+  // Frozen records are read through the summary.
+  auto entries = LoadRecentUnique(10, &err);
+  EXPECT_EQ(entries.size(), static_cast<size_t>(2));
+  if (entries.size() == 2) {
+    EXPECT_EQ(entries[0].command, "ssh new");
+    EXPECT_EQ(entries[1].command, "ssh old");
+    EXPECT_EQ(entries[1].count, 2);
+    EXPECT_EQ(entries[1].last_used, 1580000100);
+    EXPECT_EQ(entries[1].connect_ms, 30);
+  }
+  EXPECT_EQ(LoadRecentUniqueCommands(10, &err).size(), static_cast<size_t>(3));
+  auto frequent = LoadFrequentUnique(1, &err);
+  EXPECT_EQ(frequent.size(), static_cast<size_t>(1));
+  if (!frequent.empty()) {
+    EXPECT_EQ(frequent[0].command, "ssh old");
+    EXPECT_EQ(frequent[0].count, 2);
+  }
+
+  // Scans read the archived records, then the hot log.
+  std::vector<HistoryEvent> events;
+  EXPECT_TRUE(ScanHistory(0, [&](const HistoryEvent& event) { events.push_back(event); }, &err));
+  EXPECT_EQ(events.size(), static_cast<size_t>(5));
+  if (events.size() == 5) {
+    EXPECT_EQ(events[0].command, "ssh old");
+    EXPECT_TRUE(events[0].ssh);
+    EXPECT_EQ(events[0].timing.first_byte_ms, 30);
+    EXPECT_EQ(events[0].timing.duration_ms, 500);
+    EXPECT_EQ(events[2].exit_code, 255);
+    EXPECT_FALSE(events[3].ssh);
+    EXPECT_EQ(events[4].command, "ssh new");
+  }
+  events.clear();
+  EXPECT_TRUE(ScanHistory(1580000250, [&](const HistoryEvent& event) { events.push_back(event); }, &err));
+  EXPECT_EQ(events.size(), static_cast<size_t>(2));
+
+  PruneOptions prune;
+  prune.drop_failed = true;
+  prune.dry_run = true;
+  PruneStats stats;
+  EXPECT_TRUE(PruneHistory(prune, &stats, &err));
+  EXPECT_EQ(stats.lines, static_cast<size_t>(1));
+
+  int removed = 0;
+  EXPECT_TRUE(DeleteHistoryCommand("ssh old", &removed, &err));
+  EXPECT_EQ(removed, 3);
+  EXPECT_EQ(LoadRecentUnique(10, &err).size(), static_cast<size_t>(1));
+  EXPECT_EQ(LoadRecentUniqueCommands(10, &err).size(), static_cast<size_t>(2));
+
+  // Retention drops the segment whole; the hot log is untouched.
+  prune = PruneOptions();
+  prune.drop_segments_before = 1600000000;
+  EXPECT_TRUE(PruneCommandHistory(prune, &stats, &err));
+  EXPECT_EQ(stats.segments, static_cast<size_t>(1));
+  EXPECT_EQ(stats.lines, static_cast<size_t>(1));
+  EXPECT_TRUE(SegmentNames(dir + "/segments").empty());
+  entries = LoadRecentUniqueCommands(10, &err);
+  EXPECT_EQ(entries.size(), static_cast<size_t>(1));
+
+  CleanupDir(temp);
+}
+
+void ExportTo(const std::string& path) {
+  ScopedFd fd(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600));
+  std::string err;
+  EXPECT_TRUE(ExportHistory(fd.get(), &err));
+}
+
+void TestExportImport() {
+  std::string temp_a = MakeTempDir();
+  std::string temp_b = MakeTempDir();
+  EXPECT_FALSE(temp_a.empty() || temp_b.empty());
+  if (temp_a.empty() || temp_b.empty()) {
+    return;
+  }
+  std::string export_a = temp_a + "/a.export";
+  std::string export_b = temp_b + "/b.export";
+  std::string err;
+
+  setenv("XDG_DATA_HOME", temp_a.c_str(), 1);
+  EXPECT_TRUE(AppendHistory("ssh alpha", 0, &err));
+  EXPECT_TRUE(AppendHistory("ssh shared", 0, &err));
+  EXPECT_TRUE(AppendHistory("ssh shared", 0, &err));
+  EXPECT_TRUE(AppendHistory("ssh broken", 255, &err));
+  ExportTo(export_a);
+  std::string origin_a = GetOriginId(&err);
+  EXPECT_EQ(origin_a.size(), static_cast<size_t>(16));
+
+  setenv("XDG_DATA_HOME", temp_b.c_str(), 1);
+  EXPECT_TRUE(AppendHistory("ssh beta", 0, &err));
+  EXPECT_TRUE(AppendHistory("ssh shared", 0, &err));
+  EXPECT_TRUE(GetOriginId(&err) != origin_a);
+  ImportStats stats;
+  EXPECT_TRUE(ImportHistory({export_a}, &stats, &err));
+  EXPECT_EQ(stats.records, static_cast<size_t>(2));
+  EXPECT_EQ(stats.changed, static_cast<size_t>(2));
+  // Counts of different machines add up.
+  auto entries = LoadRecentUnique(10, &err);
+  EXPECT_EQ(entries.size(), static_cast<size_t>(3));
+  for (const auto& entry : entries) {
+    if (entry.command == "ssh shared") {
+      EXPECT_EQ(entry.count, 3);
+    }
+  }
+  // Merging again, or B's own export, changes nothing.
+  ExportTo(export_b);
+  EXPECT_TRUE(ImportHistory({export_a, export_b}, &stats, &err));
+  EXPECT_EQ(stats.changed, static_cast<size_t>(0));
+  EXPECT_EQ(LoadRecentUnique(10, &err).size(), static_cast<size_t>(3));
+
+  // A, syncing through both exports, ends up with the same entries.
+  setenv("XDG_DATA_HOME", temp_a.c_str(), 1);
+  EXPECT_TRUE(ImportHistory({export_b, export_a}, &stats, &err));
+  EXPECT_EQ(stats.changed, static_cast<size_t>(2));
+  entries = LoadRecentUnique(10, &err);
+  EXPECT_EQ(entries.size(), static_cast<size_t>(3));
+  for (const auto& entry : entries) {
+    if (entry.command == "ssh shared") {
+      EXPECT_EQ(entry.count, 3);
+    }
+  }
+
+  // A newer export from A raises its count in B instead of adding to it.
+  EXPECT_TRUE(AppendHistory("ssh alpha", 0, &err));
+  ExportTo(export_a);
+  setenv("XDG_DATA_HOME", temp_b.c_str(), 1);
+  EXPECT_TRUE(ImportHistory({export_a}, &stats, &err));
+  EXPECT_EQ(stats.changed, static_cast<size_t>(1));
+  for (const auto& entry : LoadRecentUnique(10, &err)) {
+    if (entry.command == "ssh alpha") {
+      EXPECT_EQ(entry.count, 2);
+    }
+  }
+
+  // Once A deletes an entry, its next export drops the entry from B, and
+  // exports from before the delete, in any order, do not bring it back.
+  std::string old_export_a = export_a + ".old";
+  EXPECT_TRUE(rename(export_a.c_str(), old_export_a.c_str()) == 0);
+  setenv("XDG_DATA_HOME", temp_a.c_str(), 1);
+  int removed = 0;
+  EXPECT_TRUE(DeleteHistoryCommand("ssh shared", &removed, &err));
+  ExportTo(export_a);
+  setenv("XDG_DATA_HOME", temp_b.c_str(), 1);
+  EXPECT_TRUE(ImportHistory({old_export_a, export_a}, &stats, &err));
+  EXPECT_EQ(stats.changed, static_cast<size_t>(2));
+  EXPECT_TRUE(ImportHistory({old_export_a}, &stats, &err));
+  EXPECT_EQ(stats.changed, static_cast<size_t>(0));
+  for (const auto& entry : LoadRecentUnique(10, &err)) {
+    if (entry.command == "ssh shared") {
+      EXPECT_EQ(entry.count, 1);
+    }
+  }
+  unlink(old_export_a.c_str());
+
+  // Deleting an imported entry drops its aggregate.
+  EXPECT_TRUE(DeleteHistoryCommand("ssh alpha", &removed, &err));
+  EXPECT_EQ(removed, 2);
+  EXPECT_EQ(LoadRecentUnique(10, &err).size(), static_cast<size_t>(2));
+
+  // Unsorted or foreign input is rejected without touching remote.sum.
+  FILE* f = std::fopen(export_b.c_str(), "w");
+  if (f) {
+    std::fputs(("sshtab-export 1\nffff\ts\t" + Base64Encode("ssh z") + "\t1\t1\t0\t-1\nffff\ts\t" +
+                Base64Encode("ssh a") + "\t1\t1\t0\t-1\n")
+                   .c_str(),
+               f);
+    std::fclose(f);
+  }
+  EXPECT_FALSE(ImportHistory({export_b}, &stats, &err));
+  EXPECT_EQ(LoadRecentUnique(10, &err).size(), static_cast<size_t>(2));
+  f = std::fopen(export_b.c_str(), "w");
+  if (f) {
+    std::fputs("1580000000\t0\ts\tc3No\n", f);
+    std::fclose(f);
+  }
+  EXPECT_FALSE(ImportHistory({export_b}, &stats, &err));
+
+  unlink(export_a.c_str());
+  unlink(export_b.c_str());
+  CleanupDir(temp_a);
+  CleanupDir(temp_b);
+}
+
+void WriteTextFile(const std::string& path, const std::string& text) {
+  FILE* f = std::fopen(path.c_str(), "w");
+  if (f) {
+    std::fputs(text.c_str(), f);
+    std::fclose(f);
+  }
+}
+
+void TestHistoryLayers() {
+  std::string temp = MakeTempDir();
+  EXPECT_FALSE(temp.empty());
+  if (temp.empty()) {
+    return;
+  }
+  setenv("XDG_DATA_HOME", temp.c_str(), 1);
+  std::string err;
+  EXPECT_TRUE(AppendHistory("ssh mine", 0, &err));
+  EXPECT_TRUE(AppendHistory("ssh shared", 0, &err));
+
+  std::string team = temp + "/team.log";
+  std::string ops = temp + "/ops.log";
+  std::string bastion = Base64Encode("ssh bastion");
+  WriteTextFile(team, "1700000000\t0\ts\t" + bastion + "\n1700000100\t0\ts\t" + bastion + "\t25\t900\n" +
+                          "1700000200\t0\ts\t" + Base64Encode("ssh shared") + "\n1700000300\t255\ts\t" +
+                          Base64Encode("ssh broken") + "\n1700000400\t0\tc\t" + Base64Encode("make deploy") +
+                          "\n");
+  WriteTextFile(ops, "1600000000\t0\ts\t" + bastion + "\n1650000000\t0\ts\t" + Base64Encode("ssh ops") + "\n");
+  setenv("SSHTAB_LAYERS", (team + ":" + ops + ":" + temp + "/missing.log").c_str(), 1);
+
+  // Personal entries first, then the layers by recency; a target in the
+  // personal history or an earlier match shows once.
+  auto entries = LoadRecentUnique(10, &err);
+  std::vector<std::string> commands;
+  for (const auto& entry : entries) {
+    commands.push_back(entry.command);
+  }
+  EXPECT_EQ(commands.size(), static_cast<size_t>(4));
+  if (commands.size() == 4) {
+    EXPECT_EQ(commands[2], "ssh bastion");
+    EXPECT_EQ(commands[3], "ssh ops");
+    EXPECT_EQ(entries[2].count, 2);
+    EXPECT_EQ(entries[2].connect_ms, 25);
+  }
+  for (const auto& entry : entries) {
+    if (entry.command == "ssh shared") {
+      EXPECT_EQ(entry.count, 1);
+    }
+  }
+  EXPECT_EQ(LoadRecentUnique(3, &err).size(), static_cast<size_t>(3));
+  EXPECT_EQ(LoadRecentUniqueCommands(10, &err).size(), static_cast<size_t>(5));
+  EXPECT_EQ(SegmentNames(temp + "/sshtab/layers").size(), static_cast<size_t>(2));
+
+  // A changed layer is indexed again.
+  WriteTextFile(ops, "1650000000\t0\ts\t" + Base64Encode("ssh ops") + "\n1660000000\t0\ts\t" +
+                         Base64Encode("ssh ops2") + "\n");
+  entries = LoadRecentUnique(10, &err);
+  EXPECT_EQ(entries.size(), static_cast<size_t>(5));
+  if (entries.size() == 5) {
+    EXPECT_EQ(entries[3].command, "ssh ops2");
+  }
+  // The approximate loader merges the layers the same way.
+  auto frequent = LoadFrequentUnique(1, &err);
+  EXPECT_EQ(frequent.size(), static_cast<size_t>(1));
+  if (!frequent.empty()) {
+    EXPECT_EQ(frequent[0].command, "ssh bastion");
+    EXPECT_EQ(frequent[0].count, 2);
+    EXPECT_EQ(frequent[0].count_error, 0);
+  }
+  EXPECT_EQ(LoadFrequentUnique(10, &err).size(), static_cast<size_t>(5));
+  EXPECT_EQ(LoadFrequentUniqueCommands(10, &err).size(), static_cast<size_t>(6));
+
+  // Candidates tied on count stay bounded and keep the most recent.
+  LayerCandidates candidates(4);
+  for (int i = 0; i < 100; ++i) {
+    HistoryEntry entry;
+    entry.command = "ssh tie" + std::to_string(i);
+    entry.count = 1;
+    entry.last_used = 1000 + i;
+    candidates.Add(SshCommandKey(entry.command), entry);
+    EXPECT_TRUE(candidates.size() < 8);
+  }
+  auto kept = candidates.Take();
+  EXPECT_EQ(kept.size(), static_cast<size_t>(4));
+  for (const auto& entry : kept) {
+    EXPECT_TRUE(entry.last_used >= 1096);
+  }
+  std::string ties;
+  for (int i = 0; i < 100; ++i) {
+    ties += std::to_string(1700001000 + i) + "\t0\ts\t" + Base64Encode("ssh tie" + std::to_string(i)) + "\n";
+  }
+  WriteTextFile(ops, ties);
+  frequent = LoadFrequentUnique(3, &err);
+  EXPECT_EQ(frequent.size(), static_cast<size_t>(3));
+  EXPECT_TRUE(std::any_of(frequent.begin(), frequent.end(),
+                          [](const HistoryEntry& entry) { return entry.command == "ssh bastion"; }));
+
+  // Shared aliases apply unless there is a personal one.
+  WriteTextFile(team + ".aliases", Base64Encode("bastion") + "\t" + Base64Encode("team-bastion") + "\n" +
+                                       Base64Encode("ops") + "\t" + Base64Encode("team-ops") + "\n");
+  AliasMap aliases;
+  EXPECT_TRUE(LoadAliases(&aliases, &err));
+  EXPECT_EQ(aliases[SshTargetKey("bastion")], "team-bastion");
+  EXPECT_TRUE(SetAliasForArgs("bastion", "my-bastion", &err));
+  EXPECT_TRUE(LoadAliases(&aliases, &err));
+  EXPECT_EQ(aliases[SshTargetKey("bastion")], "my-bastion");
+  EXPECT_EQ(aliases[SshTargetKey("ops")], "team-ops");
+
+  setenv("SSHTAB_LAYERS", "", 1);
+  EXPECT_EQ(LoadRecentUnique(10, &err).size(), static_cast<size_t>(2));
+  unlink(team.c_str());
+  unlink((team + ".aliases").c_str());
+  unlink(ops.c_str());
+  CleanupDir(temp);
+}
+
+void TestResolveSshBinary() {
+  std::string temp = MakeTempDir();
+  EXPECT_FALSE(temp.empty());
+  if (temp.empty()) {
+    return;
+  }
+  setenv("XDG_DATA_HOME", temp.c_str(), 1);
+  std::string first = temp + "/a";
+  std::string second = temp + "/b";
+  mkdir(first.c_str(), 0700);
+  mkdir(second.c_str(), 0700);
+  auto make_stub = [](const std::string& path) {
+    FILE* f = std::fopen(path.c_str(), "w");
+    if (f) {
+      std::fputs("#!/bin/sh\n", f);
+      std::fclose(f);
+    }
+    chmod(path.c_str(), 0755);
+  };
+  make_stub(first + "/ssh");
+  make_stub(second + "/ssh");
+
+  const char* old_path = std::getenv("PATH");
+  std::string saved_path = old_path ? old_path : "";
+  setenv("PATH", (first + ":" + second).c_str(), 1);
+  EXPECT_EQ(ResolveSshBinary(), first + "/ssh");
+  struct stat st;
+  EXPECT_EQ(stat((temp + "/sshtab/ssh_path").c_str(), &st), 0);
+  EXPECT_EQ(ResolveSshBinary(), first + "/ssh");
+  // A removed binary fails the inode check and PATH is searched again.
+  unlink((first + "/ssh").c_str());
+  EXPECT_EQ(ResolveSshBinary(), second + "/ssh");
+  make_stub(first + "/ssh");
+  setenv("PATH", (first + ":" + second + ":").c_str(), 1);
+  EXPECT_EQ(ResolveSshBinary(), first + "/ssh");
+  setenv("SSHTAB_SSH", (second + "/ssh").c_str(), 1);
+  EXPECT_EQ(ResolveSshBinary(), second + "/ssh");
+  setenv("PATH", "relative:/nonexistent", 1);
+  unsetenv("SSHTAB_SSH");
+  EXPECT_EQ(ResolveSshBinary(), "");
+
+  setenv("PATH", saved_path.c_str(), 1);
+  unlink((first + "/ssh").c_str());
+  unlink((second + "/ssh").c_str());
+  rmdir(first.c_str());
+  rmdir(second.c_str());
+  unlink((temp + "/sshtab/ssh_path").c_str());
+  CleanupDir(temp);
+}
+
+void TestWarmControlMasters() {
+  std::string temp = MakeTempDir();
+  EXPECT_FALSE(temp.empty());
+  if (temp.empty()) {
+    return;
+  }
+  setenv("XDG_DATA_HOME", temp.c_str(), 1);
+  std::string err;
+  EXPECT_EQ(ControlPathForArgs("u@h  -p 22", &err), ControlPathForArgs("u@h -p 22", &err));
+  EXPECT_TRUE(ControlPathForArgs("u@h", &err) != ControlPathForArgs("u@h -p 22", &err));
+  // exec -- hands over argv; it must find the master warmed from history.
+  EXPECT_EQ(ControlPathForTokens({"-l", "u", "-p", "22", "h"}, &err), ControlPathForArgs("u@h -p 22", &err));
+
+  std::string stub = temp + "/ssh";
+  std::string calls = temp + "/calls";
+  FILE* f = std::fopen(stub.c_str(), "w");
+  EXPECT_TRUE(f != nullptr);
+  if (!f) {
+    return;
+  }
+  std::fprintf(f, "#!/bin/sh\necho \"$@\" >> '%s'\n", calls.c_str());
+  std::fclose(f);
+  chmod(stub.c_str(), 0755);
+  const char* old_path = std::getenv("PATH");
+  std::string saved_path = old_path ? old_path : "";
+  setenv("PATH", (temp + ":" + saved_path).c_str(), 1);
+
+  WarmOptions options;
+  options.jobs = 2;
+  WarmStats stats;
+  EXPECT_TRUE(WarmControlMasters({"host1", "u@host2 -p 2222", "bad;host"}, options, &stats, &err));
+  EXPECT_EQ(stats.started, static_cast<size_t>(2));
+  EXPECT_EQ(stats.failed, static_cast<size_t>(1));
+  setenv("PATH", saved_path.c_str(), 1);
+
+  std::string content;
+  FILE* in = std::fopen(calls.c_str(), "r");
+  EXPECT_TRUE(in != nullptr);
+  if (in) {
+    char buf[4096];
+    size_t n = std::fread(buf, 1, sizeof(buf), in);
+    content.assign(buf, n);
+    std::fclose(in);
+  }
+  EXPECT_TRUE(content.find("ControlMaster=yes") != std::string::npos);
+  EXPECT_TRUE(content.find("-N u@host2 -p 2222") != std::string::npos);
+
+  unlink(stub.c_str());
+  unlink(calls.c_str());
+  rmdir((temp + "/sshtab/cm").c_str());
+  CleanupDir(temp);
+}
+
+void TestSshConfig() {
+  std::string temp = MakeTempDir();
+  EXPECT_FALSE(temp.empty());
+  if (temp.empty()) {
+    return;
+  }
+  auto write_file = [](const std::string& path, const std::string& content) {
+    FILE* f = std::fopen(path.c_str(), "w");
+    if (f) {
+      std::fputs(content.c_str(), f);
+      std::fclose(f);
+    }
+  };
+  std::string root = temp + "/config";
+  std::string extra = temp + "/extra.conf";
+  write_file(root,
+             "Include " + temp + "/extra*.conf\n"
+             "Host web* !web3\n  HostName %h.example.com\n  Port 2200\n"
+             "Match originalhost db user admin\n  ProxyJump bastion\n"
+             "Host *\n  User = fallback\n  Port 22\n");
+  write_file(extra, "Host db\n  HostName db.internal\n");
+
+  std::string cache = temp + "/ssh_config.cache";
+  SshConfig config;
+  std::string err;
+  EXPECT_TRUE(LoadSshConfigCached({root}, cache, &config, &err));
+  SshHostConfig web1 = ResolveSshHost(config, "web1", "");
+  EXPECT_EQ(web1.hostname, "web1.example.com");
+  EXPECT_EQ(web1.port, "2200");
+  EXPECT_EQ(web1.user, "fallback");
+  EXPECT_EQ(ResolveSshHost(config, "web3", "").port, "22");
+  SshHostConfig db = ResolveSshHost(config, "db", "admin");
+  EXPECT_EQ(db.hostname, "db.internal");
+  EXPECT_EQ(db.proxy_jump, "bastion");
+  EXPECT_EQ(ResolveSshHost(config, "db", "").proxy_jump, "");
+
+  // A cache hit returns the same index; touching an included file
+  // invalidates it.
+  SshConfig cached;
+  EXPECT_TRUE(LoadSshConfigCached({root}, cache, &cached, &err));
+  EXPECT_EQ(cached.blocks.size(), config.blocks.size());
+  write_file(extra, "Host db\n  HostName db2.internal\n  Port 2022\n");
+  EXPECT_TRUE(LoadSshConfigCached({root}, cache, &cached, &err));
+  EXPECT_EQ(ResolveSshHost(cached, "db", "").hostname, "db2.internal");
+
+  unlink(root.c_str());
+  unlink(extra.c_str());
+  unlink(cache.c_str());
+  CleanupDir(temp);
+}
+
+void TestRunFanout() {
+  std::string temp = MakeTempDir();
+  EXPECT_FALSE(temp.empty());
+  if (temp.empty()) {
+    return;
+  }
+  setenv("XDG_DATA_HOME", temp.c_str(), 1);
+
+  std::string stub = temp + "/ssh";
+  FILE* f = std::fopen(stub.c_str(), "w");
+  EXPECT_TRUE(f != nullptr);
+  if (!f) {
+    return;
+  }
+  // The stub echoes the last argument (the remote command) and fails for
+  // db. For bg it leaves a sleeper behind that keeps stdout open.
+  std::fprintf(f,
+               "#!/bin/sh\nfor last; do :; done\nprintf 'ran %%s' \"$last\"\n"
+               "echo warn >&2\ncase \"$*\" in *db*) exit 3;; *bg*) sleep 5 & ;; esac\n");
+  std::fclose(f);
+  chmod(stub.c_str(), 0755);
+  const char* old_path = std::getenv("PATH");
+  std::string saved_path = old_path ? old_path : "";
+  setenv("PATH", (temp + ":" + saved_path).c_str(), 1);
+
+  std::string out_path = temp + "/out";
+  std::string err_path = temp + "/err";
+  int out_fd = open(out_path.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0600);
+  int err_fd = open(err_path.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0600);
+  std::vector<FanoutTarget> targets = {
+      {"web1", "web1"}, {"u@db -p 22", "db"}, {"bad;x", "bad"}, {"bg", "bg"}};
+  FanoutOptions options;
+  options.jobs = 2;
+  std::vector<int> codes;
+  std::string err;
+  std::time_t started = std::time(nullptr);
+  EXPECT_TRUE(RunFanout(targets, "uptime", options, out_fd, err_fd, &codes, &err));
+  // Reaped on exit, not held up until the sleeper closes stdout.
+  EXPECT_TRUE(std::time(nullptr) - started < 4);
+  close(out_fd);
+  close(err_fd);
+  setenv("PATH", saved_path.c_str(), 1);
+  EXPECT_EQ(codes, (std::vector<int>{0, 3, 255, 0}));
+
+  auto read_file = [](const std::string& path) {
+    std::string content;
+    FILE* in = std::fopen(path.c_str(), "r");
+    if (in) {
+      char buf[4096];
+      size_t n = std::fread(buf, 1, sizeof(buf), in);
+      content.assign(buf, n);
+      std::fclose(in);
+    }
+    return content;
+  };
+  std::string out = read_file(out_path);
+  std::string errs = read_file(err_path);
+  EXPECT_TRUE(out.find("web1 | ran uptime\n") != std::string::npos);
+  EXPECT_TRUE(out.find("db   | ran uptime\n") != std::string::npos);
+  EXPECT_TRUE(errs.find("web1 | warn\n") != std::string::npos);
+  EXPECT_TRUE(errs.find("bad  | sshtab: invalid ssh args\n") != std::string::npos);
+  EXPECT_TRUE(out.find("bg   | ran uptime\n") != std::string::npos);
+
+  EXPECT_TRUE(AppendHistoryBatch({"ssh web1", "ssh web2"}, 0, &err));
+  EXPECT_EQ(LoadRecentUnique(10, &err).size(), static_cast<size_t>(2));
+
+  unlink(stub.c_str());
+  unlink(out_path.c_str());
+  unlink(err_path.c_str());
+  CleanupDir(temp);
+}
+
+void TestProbeHosts() {
+  std::string temp = MakeTempDir();
+  EXPECT_FALSE(temp.empty());
+  if (temp.empty()) {
+    return;
+  }
+  setenv("XDG_DATA_HOME", temp.c_str(), 1);
+
+  ProbeTarget target;
+  EXPECT_TRUE(ProbeTargetForSsh("user@db1", "", "", &target));
+  EXPECT_EQ(target.host, "db1");
+  EXPECT_EQ(target.port, "22");
+  EXPECT_TRUE(ProbeTargetForSsh("db1", "2222", "ops@bastion:2200,inner", &target));
+  EXPECT_EQ(target.host, "bastion");
+  EXPECT_EQ(target.port, "2200");
+  EXPECT_FALSE(ProbeTargetForSsh("db1", "99999", "", &target));
+
+  auto listen_on_loopback = [](int* port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len) != 0) {
+      return -1;
+    }
+    *port = ntohs(addr.sin_port);
+    return fd;
+  };
+  int open_port = 0;
+  int closed_port = 0;
+  int listener = listen_on_loopback(&open_port);
+  int unused = listen_on_loopback(&closed_port);
+  EXPECT_TRUE(listener >= 0 && unused >= 0);
+  EXPECT_EQ(listen(listener, 8), 0);
+  close(unused);
+
+  std::vector<ProbeTarget> targets = {{"127.0.0.1", std::to_string(open_port)},
+                                      {"127.0.0.1", std::to_string(closed_port)},
+                                      {"127.0.0.1", std::to_string(open_port)}};
+  ProbeOptions options;
+  options.timeout_ms = 500;
+  std::vector<ProbeResult> results;
+  std::string err;
+  EXPECT_TRUE(ProbeHosts(targets, options, &results, &err));
+  EXPECT_EQ(results.size(), static_cast<size_t>(3));
+  if (results.size() == 3) {
+    EXPECT_TRUE(results[0].status == ProbeStatus::kUp);
+    EXPECT_TRUE(results[0].rtt_ms >= 0);
+    EXPECT_TRUE(results[1].status == ProbeStatus::kDown);
+    EXPECT_TRUE(results[2].status == ProbeStatus::kUp);
+    EXPECT_EQ(FormatProbeStatus(results[1]), "down");
+  }
+  // A name goes through the resolver threads; every address it has is
+  // tried, so an unreachable ::1 ahead of 127.0.0.1 still counts as up.
+  std::vector<ProbeResult> named;
+  EXPECT_TRUE(ProbeHosts({{"localhost", std::to_string(open_port)}}, options, &named, &err));
+  EXPECT_TRUE(named.size() == 1 && named[0].status == ProbeStatus::kUp);
+  close(listener);
+
+  EXPECT_TRUE(SaveProbeResults(results, &err));
+  std::unordered_map<std::string, ProbeResult> cache;
+  EXPECT_TRUE(LoadProbeCache(results.empty() ? 0 : results[0].checked_at, &cache, &err));
+  EXPECT_EQ(cache.size(), static_cast<size_t>(2));
+  EXPECT_TRUE(cache.count("127.0.0.1:" + std::to_string(open_port)) == 1);
+  EXPECT_TRUE(LoadProbeCache(results.empty() ? 0 : results[0].expires_at, &cache, &err));
+  EXPECT_TRUE(cache.empty());
+
+  unlink((temp + "/sshtab/probe.log").c_str());
+  CleanupDir(temp);
+}
+
+void TestPickSnapshot() {
+  std::string temp = MakeTempDir();
+  EXPECT_FALSE(temp.empty());
+  if (temp.empty()) {
+    return;
+  }
+  std::string input = temp + "/history.log";
+  FILE* f = std::fopen(input.c_str(), "w");
+  if (f) {
+    std::fputs("1\t0\tc3NoIGE=\n", f);
+    std::fclose(f);
+  }
+
+  PickSnapshot snapshot;
+  snapshot.limit = 50;
+  snapshot.valid_until = 2000;
+  snapshot.sources.push_back(StatSnapshotSource(input));
+  snapshot.sources.push_back(StatSnapshotSource(temp + "/missing.log"));
+  PickItem item;
+  item.display = "ssh -p 2222 web";
+  item.alias = "web";
+  item.args = "-p 2222 web";
+  item.host = "web";
+  item.port = "2222";
+  item.last_used = 1700000000;
+  item.count = 3;
+  item.connect_ms = 42;
+  item.status = "up 5ms";
+  snapshot.items.push_back(item);
+  snapshot.items.push_back(PickItem());
+
+  std::string path = temp + "/pick.snapshot";
+  std::string err;
+  EXPECT_TRUE(WritePickSnapshot(path, snapshot, &err));
+  std::vector<PickItem> items;
+  EXPECT_TRUE(LoadPickSnapshot(path, 50, 1000, &items, &err));
+  EXPECT_EQ(items.size(), static_cast<size_t>(2));
+  if (items.size() == 2) {
+    EXPECT_EQ(items[0].display, item.display);
+    EXPECT_EQ(items[0].alias, "web");
+    EXPECT_EQ(items[0].port, "2222");
+    EXPECT_EQ(items[0].count, 3);
+    EXPECT_EQ(items[0].connect_ms, 42);
+    EXPECT_EQ(items[0].status, "up 5ms");
+    EXPECT_EQ(items[1].connect_ms, -1);
+  }
+
+  // Built for another limit, past its status expiry, or with a changed or
+  // newly created input: the picker must rebuild.
+  EXPECT_FALSE(LoadPickSnapshot(path, 20, 1000, &items, &err));
+  EXPECT_FALSE(LoadPickSnapshot(path, 50, 2000, &items, &err));
+  f = std::fopen(input.c_str(), "a");
+  if (f) {
+    std::fputs("2\t0\tc3NoIGI=\n", f);
+    std::fclose(f);
+  }
+  EXPECT_FALSE(LoadPickSnapshot(path, 50, 1000, &items, &err));
+  snapshot.sources[0] = StatSnapshotSource(input);
+  EXPECT_TRUE(WritePickSnapshot(path, snapshot, &err));
+  EXPECT_TRUE(LoadPickSnapshot(path, 50, 1000, &items, &err));
+  f = std::fopen((temp + "/missing.log").c_str(), "w");
+  if (f) {
+    std::fclose(f);
+  }
+  EXPECT_FALSE(LoadPickSnapshot(path, 50, 1000, &items, &err));
+
+  // A truncated file is rejected rather than half-read.
+  EXPECT_EQ(truncate(path.c_str(), 40), 0);
+  EXPECT_FALSE(LoadPickSnapshot(path, 50, 1000, &items, &err));
+
+  unlink(path.c_str());
+  unlink(input.c_str());
+  unlink((temp + "/missing.log").c_str());
+  CleanupDir(temp);
+}
+
+void TestRenderBashInit() {
+  BashInitOptions options;
+  options.ssh_path = "/opt/o'ssh/bin/ssh";
+  options.capture_mode = "history";
+  std::string out = RenderBashInit("# header\n\nfoo() {\n  # note\n  echo '#x'\n}\n", options);
+  EXPECT_EQ(out,
+            "# Generated by `sshtab init bash`; rerun it after moving ssh or sshtab.\n"
+            "__sshtab_init_ssh='/opt/o'\\''ssh/bin/ssh'\n"
+            "__sshtab_init_builtin_so=''\n"
+            "SSHTAB_CAPTURE_MODE=${SSHTAB_CAPTURE_MODE:-history}\n"
+            "foo() {\n  echo '#x'\n}\n");
+}
+
+// Runs subcommands through the sshtab() function of bash/sshtab.bash with a
+// stub sshtab on PATH, so each one must reach the binary rather than a
+// builtin or another program of the same name.
+void TestBashSubcommands() {
+  std::string temp = MakeTempDir();
+  EXPECT_FALSE(temp.empty());
+  if (temp.empty()) {
+    return;
+  }
+  std::string log = temp + "/calls";
+  for (const char* name : {"sshtab", "import"}) {
+    std::string stub = temp + "/" + name;
+    FILE* f = std::fopen(stub.c_str(), "w");
+    EXPECT_TRUE(f != nullptr);
+    if (!f) {
+      return;
+    }
+    std::fprintf(f, "#!/bin/sh\necho \"%s $*\" >>'%s'\n", name, log.c_str());
+    std::fclose(f);
+    chmod(stub.c_str(), 0755);
+  }
+  const char* old_path = std::getenv("PATH");
+  std::string saved_path = old_path ? old_path : "";
+  setenv("PATH", (temp + ":" + saved_path).c_str(), 1);
+  std::string script =
+      "SSHTAB_BUILTIN_SO=/nonexistent bash --norc --noprofile -c "
+      "'. bash/sshtab.bash 2>/dev/null; sshtab export >/dev/null && sshtab import --merge f && "
+      "sshtab search foo'";
+  EXPECT_EQ(std::system(script.c_str()), 0);
+  setenv("PATH", saved_path.c_str(), 1);
+
+  std::string calls;
+  FILE* in = std::fopen(log.c_str(), "r");
+  if (in) {
+    char buf[256];
+    calls.assign(buf, std::fread(buf, 1, sizeof(buf), in));
+    std::fclose(in);
+  }
+  EXPECT_EQ(calls, std::string("sshtab export\nsshtab import --merge f\nsshtab search foo\n"));
+  CleanupDir(temp);
+}
+
 }  // namespace
 
 int main() {
+  // Stub ssh scripts are found through PATH; an exported path from the bash
+  // integration would bypass them.
+  unsetenv("SSHTAB_SSH");
+  // A team layer installed on this machine would show up in every load.
+  setenv("SSHTAB_LAYERS", "", 1);
   TestBase64();
+  TestFlatHashIndex();
+  TestLzCodec();
+  TestArchive();
+  TestSpaceSaving();
   TestNormalize();
   TestTokenize();
+  TestDisplayWidth();
+  TestPickOrder();
   TestHistoryAndAlias();
+  TestEntryIds();
+  TestMigrateLegacyHistory();
+  TestHistorySegments();
+  TestExportImport();
+  TestHistoryLayers();
+  TestResolveSshBinary();
+  TestWarmControlMasters();
+  TestSshConfig();
+  TestRunFanout();
+  TestProbeHosts();
+  TestPickSnapshot();
+  TestRenderBashInit();
+  TestBashSubcommands();
   if (g_failures == 0) {
     std::cout << "OK\n";
   }